@@ -6,11 +6,21 @@
 #include "task.h"
 #include "timers.h"
 #include "workqueue.h"
+#include "clock.h"
+#include "timesync.h"
+#include "schedule.h"
 #include "rtc.h"
 #include "aht20.h"
 #include "esp_at.h"
 #include "weather.h"
+#include "weather_cache.h"
+#include "wifi.h"
+#include "tim_delay.h"
 #include "page.h"
+#include "ui.h"
+#include "clkscale.h"
+#include "log.h"
+#include "trace.h"
 #include "app.h"
   
 #define MILLISECONDS(x) (x)
@@ -19,11 +29,11 @@
 #define HOURS(x)        MINUTES((x) * 60)
 #define DAYS(x)          HOURS((x) * 24)
 
-#define TIME_SYNC_INTERVAL          HOURS(1)
-#define WIFI_UPDATE_INTERVAL        SECONDS(5)
-#define TIME_UPDATE_INTERVAL        SECONDS(1)
 #define INNER_UPDATE_INTERVAL       SECONDS(3)
 #define OUTDOOR_UPDATE_INTERVAL     MINUTES(1)
+// the network jobs wait this long for the connection manager to finish
+// its command, then skip their turn rather than hold up the workqueue
+#define AT_LOCK_WAIT                MILLISECONDS(500)
 
 #define MLOOP_EVT_TIME_SYNC         (1 << 0)
 #define MLOOP_EVT_WIFI_UPDATE       (1 << 1)
@@ -35,32 +45,51 @@
                                      MLOOP_EVT_OUTDOOR_UPDATE)
 
 static TimerHandle_t time_sync_timer;
-static TimerHandle_t wifi_update_timer;
-static TimerHandle_t time_update_timer;
 static TimerHandle_t inner_update_timer;
 static TimerHandle_t outdoor_update_timer;
 
+// last values shown on the main page, kept so app_redraw() can repaint it
+static esp_wifi_info_t last_info;
+static float last_temperature, last_humidity;
+static bool inner_valid;
+static weather_info_t last_weather;
+static bool app_started;
+// shown in place of the SSID while not connected
+static const char *wifi_status = "connecting";
+static app_boot_stats_t boot_stats;
+
 static void time_sync(void)
 {
-    uint32_t restart_sync_delay = TIME_SYNC_INTERVAL;
+    uint32_t restart_sync_delay;
     rtc_date_time_t rtc_date = { 0 };
+    
+    // the timer is one-shot: it stays off until wifi_event() is back online
+    if (!wifi_is_online())
+        return;
 
     esp_date_time_t esp_date = { 0 };
-    if (!esp_at_sntp_get_time(&esp_date))
+    if (!esp_at_lock(AT_LOCK_WAIT))
+    {
+        restart_sync_delay = SECONDS(1);
+        goto err;
+    }
+    bool synced = esp_at_sntp_get_time(&esp_date);
+    esp_at_unlock();
+    if (!synced)
     {
-        printf("[SNTP] get time failed\n");
+        LOG("[SNTP] get time failed\n");
         restart_sync_delay = SECONDS(1);
         goto err;
     }
     
     if (esp_date.year < 2000)
     {
-        printf("[SNTP] invalid date formate\n");
+        LOG("[SNTP] invalid date formate\n");
         restart_sync_delay = SECONDS(1);
         goto err;
     }
     
-    printf("[SNTP] sync time: %04u-%02u-%02u %02u:%02u:%02u (%d)\n",
+    LOG("[SNTP] sync time: %04u-%02u-%02u %02u:%02u:%02u (%d)\n",
         esp_date.year, esp_date.month, esp_date.day,
         esp_date.hour, esp_date.minute, esp_date.second, esp_date.weekday);
     
@@ -71,85 +100,47 @@ static void time_sync(void)
     rtc_date.minute = esp_date.minute;
     rtc_date.second = esp_date.second;
     rtc_date.weekday = esp_date.weekday;
-    rtc_set_time(&rtc_date);
+    restart_sync_delay = timesync_discipline(&rtc_date);
     
 err:
     xTimerChangePeriod(time_sync_timer, pdMS_TO_TICKS(restart_sync_delay), 0);
 }
 
-static void wifi_update(void)
+static void time_second_update(const rtc_date_time_t *date, uint32_t events)
 {
-    static esp_wifi_info_t last_info = { 0 };
-
-    esp_wifi_info_t info = { 0 };
-    if (!esp_at_get_wifi_info(&info))
-    {
-        printf("[AT] wifi info get failed\n");
+    // no blinking colon at night: one redraw less per second on the workqueue
+    if (ui_get_mode() != UI_MODE_DAY)
         return;
-    }
-    
-    if (memcmp(&info, &last_info, sizeof(esp_wifi_info_t)) == 0)
-    {
-        return;
-    }
-    
-    if (last_info.connected == info.connected)
-    {
-        return;
-    }
-    
-    if (info.connected)
-    {
-        printf("[WIFI] connected to %s\n", info.ssid);
-        printf("[WIFI] SSID: %s, BSSID: %s, Channel: %d, RSSI: %d\n",
-                info.ssid, info.bssid, info.channel, info.rssi);
-        main_page_redraw_wifi_ssid(info.ssid);
-    }
-    else
-    {
-        printf("[WIFI] disconnected from %s\n", last_info.ssid);
-        main_page_redraw_wifi_ssid("wifi lost");
-    }
-    
-    memcpy(&last_info, &info, sizeof(esp_wifi_info_t));
+    main_page_redraw_time_colon(date->second % 2 == 0);
 }
 
-static void time_update(void)
+static void time_minute_update(const rtc_date_time_t *date, uint32_t events)
 {
-    static rtc_date_time_t last_date = { 0 };
-    
-    rtc_date_time_t date;
-    rtc_get_time(&date);
-    
-    if (date.year < 2020)
-    {
-        return;
-    }
-    
-    if (memcmp(&date, &last_date, sizeof(rtc_date_time_t)) == 0)
-    {
-        return;
-    }
-    
-    memcpy(&last_date, &date, sizeof(rtc_date_time_t));
-    main_page_redraw_time(&date);
-    main_page_redraw_date(&date);
+    main_page_redraw_time_minute(date->minute);
+}
+
+static void time_hour_update(const rtc_date_time_t *date, uint32_t events)
+{
+    main_page_redraw_time_hour(date->hour);
+}
+
+static void date_update(const rtc_date_time_t *date, uint32_t events)
+{
+    main_page_redraw_date(date);
 }
 
 
 static void inner_update(void)
 {
-    static float last_temperature, last_humidity;
-    
     if (!aht20_start_measurement())
     {
-        printf("[AHT20] start measurement failed\n");
+        LOG("[AHT20] start measurement failed\n");
         return;
     }
     
     if (!aht20_wait_for_measurement())
     {
-        printf("[AHT20] wait for measurement failed\n");
+        LOG("[AHT20] wait for measurement failed\n");
         return;
     }
     
@@ -157,7 +148,7 @@ static void inner_update(void)
     
     if (!aht20_read_measurement(&temperature, &humidity))
     {
-        printf("[AHT20] read measurement failed\n");
+        LOG("[AHT20] read measurement failed\n");
         return;
     }
     
@@ -168,28 +159,42 @@ static void inner_update(void)
     
     last_temperature = temperature;
     last_humidity = humidity;
+    inner_valid = true;
     
-    printf("[AHT20] Temperature: %.1f, Humidity: %.1f\n", temperature, humidity);
+    LOG("[AHT20] Temperature: %.1f, Humidity: %.1f\n", temperature, humidity);
     main_page_redraw_inner_temperature(temperature);
     main_page_redraw_inner_humidity(humidity);
 }
  
 static void outdoor_update(void)
 {
-    static weather_info_t last_weather = { 0 };
+    if (!wifi_is_online())
+        return;
     
     weather_info_t weather = { 0 };
     const char *weather_url = "https://api.seniverse.com/v3/weather/now.json?key=SfRic8Wmp-Qh3OeFk&location=WTEMH46Z5N09&language=en&unit=c";
+    if (!esp_at_lock(AT_LOCK_WAIT))
+        return;
+    
+    trace_begin(TRACE_CH_WEATHER_HTTP);
     const char *weather_http_response = esp_at_http_get(weather_url);
+    trace_end(TRACE_CH_WEATHER_HTTP);
     if (weather_http_response == NULL)
     {
-        printf("[WEATHER] http error\n");
+        esp_at_unlock();
+        LOG("[WEATHER] http error\n");
         return;
     }
     
-    if (!parse_seniverse_response(weather_http_response, &weather))
+    trace_begin(TRACE_CH_WEATHER_PARSE);
+    clkscale_request(CLKSCALE_HIGH);
+    bool parsed = parse_seniverse_response(weather_http_response, &weather);
+    clkscale_release(CLKSCALE_HIGH);
+    trace_end(TRACE_CH_WEATHER_PARSE);
+    esp_at_unlock();
+    if (!parsed)
     {
-        printf("[WEATHER] parse failed\n");
+        LOG("[WEATHER] parse failed\n");
         return;
     }
     
@@ -199,12 +204,51 @@ static void outdoor_update(void)
     }
     
     memcpy(&last_weather, &weather, sizeof(weather_info_t));
-    printf("[WEATHER] %s, %s, %.1f\n", weather.city, weather.weather, weather.temperature);
+    LOG("[WEATHER] %s, %s, %.1f\n", weather.city, weather.weather, weather.temperature);
+    weather_cache_save(&weather);
     
     main_page_redraw_outdoor_temperature(weather.temperature);
     main_page_redraw_outdoor_weather_icon(weather.weather_code);
 }
 
+static void redraw_update(void)
+{
+    main_page_display();
+    
+    main_page_redraw_wifi_ssid(last_info.connected ? last_info.ssid : wifi_status);
+    
+    if (inner_valid)
+    {
+        main_page_redraw_inner_temperature(last_temperature);
+        main_page_redraw_inner_humidity(last_humidity);
+    }
+    
+    if (last_weather.city[0] != '\0')
+    {
+        main_page_redraw_outdoor_temperature(last_weather.temperature);
+        main_page_redraw_outdoor_weather_icon(last_weather.weather_code);
+    }
+    
+    // an RTC that lost its date keeps the placeholders, as the clock task does
+    rtc_date_time_t date;
+    rtc_get_time(&date);
+    if (date.year < 2020)
+        return;
+    date_update(&date, CLOCK_EVT_ALL);
+    time_hour_update(&date, CLOCK_EVT_ALL);
+    time_minute_update(&date, CLOCK_EVT_ALL);
+    time_second_update(&date, CLOCK_EVT_ALL);
+}
+
+// queued behind the first paint and the first AHT20 reading
+static void boot_screen_ready(void)
+{
+    ui_sync();
+    boot_stats.screen_ms = (uint32_t)tim_get_ms();
+    LOG("[BOOT] main page up after %lu ms%s\n", boot_stats.screen_ms,
+        boot_stats.cached_weather ? ", cached weather" : "");
+}
+
 typedef void (*app_job_t)(void);
 
 static void app_work(void *param)
@@ -219,30 +263,73 @@ static void work_timer_cb(TimerHandle_t timer)
     workqueue_run(app_work, job);
 }
 
-static void app_timer_cb(TimerHandle_t timer)
+// from the connection manager, on the workqueue: the page says what
+// happened and the network jobs catch up as soon as the link is back
+static void wifi_event(const esp_wifi_info_t *info)
 {
-    app_job_t job = (app_job_t)pvTimerGetTimerID(timer);
-    job();
+    if (info == NULL)
+    {
+        LOG("[WIFI] disconnected from %s\n", last_info.ssid);
+        last_info.connected = false;
+        wifi_status = "wifi lost";
+        main_page_redraw_wifi_ssid(wifi_status);
+        return;
+    }
+    
+    memcpy(&last_info, info, sizeof(esp_wifi_info_t));
+    main_page_redraw_wifi_ssid(info->ssid);
+    
+    if (boot_stats.network_ms == 0)
+    {
+        boot_stats.network_ms = (uint32_t)tim_get_ms();
+        LOG("[BOOT] network up after %lu ms\n", boot_stats.network_ms);
+        xTimerStart(outdoor_update_timer, 0);
+    }
+    
+    workqueue_run(app_work, time_sync);
+    workqueue_run(app_work, outdoor_update);
 }
 
+// Everything that needs no network: the page is painted from the RTC, the
+// AHT20 and the weather cache, then the connection manager brings the
+// ESP32 up behind it and wifi_event() starts the rest
 void app_init(void)
 {
-    time_update_timer = xTimerCreate("time update", pdMS_TO_TICKS(TIME_UPDATE_INTERVAL), pdTRUE, time_update, app_timer_cb);
     time_sync_timer = xTimerCreate("time sync", pdMS_TO_TICKS(200), pdFALSE, time_sync, work_timer_cb);
-    wifi_update_timer = xTimerCreate("wifi update", pdMS_TO_TICKS(WIFI_UPDATE_INTERVAL), pdTRUE, wifi_update, work_timer_cb);
     inner_update_timer = xTimerCreate("inner upadte", pdMS_TO_TICKS(INNER_UPDATE_INTERVAL), pdTRUE, inner_update, work_timer_cb);
     outdoor_update_timer = xTimerCreate("outdoor update", pdMS_TO_TICKS(OUTDOOR_UPDATE_INTERVAL), pdTRUE, outdoor_update, work_timer_cb);
 
-    workqueue_run(app_work, time_sync);
-    workqueue_run(app_work, wifi_update);
+    boot_stats.cached_weather = weather_cache_load(&last_weather);
+    
+    workqueue_run(app_work, redraw_update);
     workqueue_run(app_work, inner_update);
-    workqueue_run(app_work, outdoor_update);
+    workqueue_run(app_work, boot_screen_ready);
+    
+    clock_event_register(CLOCK_EVT_SECOND, time_second_update);
+    clock_event_register(CLOCK_EVT_MINUTE, time_minute_update);
+    clock_event_register(CLOCK_EVT_HOUR, time_hour_update);
+    clock_event_register(CLOCK_EVT_DAY, date_update);
+    schedule_init();
+    clock_init();
     
-    xTimerStart(time_update_timer, 0);
-    xTimerStart(time_sync_timer, 0);
-    xTimerStart(wifi_update_timer, 0);
     xTimerStart(inner_update_timer, 0);
-    xTimerStart(outdoor_update_timer, 0);
+    wifi_init(wifi_event);
+    
+    app_started = true;
+}
+
+void app_get_boot_stats(app_boot_stats_t *stats)
+{
+    memcpy(stats, &boot_stats, sizeof(app_boot_stats_t));
+}
+
+bool app_redraw(void)
+{
+    if (!app_started)
+        return false;
+    
+    workqueue_run(app_work, redraw_update);
+    return true;
 }
 
 
@@ -1,8 +1,20 @@
 #ifndef __APP_H__
 #define __APP_H__
 
+#include <stdbool.h>
+
 #define APP_VERSION "v1.0"
 
+typedef struct
+{
+    // ms since the timer started in board_init, 0 until it happened
+    uint32_t screen_ms;
+    uint32_t network_ms;
+    bool cached_weather;
+} app_boot_stats_t;
+
 void app_init(void);
+bool app_redraw(void);
+void app_get_boot_stats(app_boot_stats_t *stats);
 
 #endif /* __APP_H__ */
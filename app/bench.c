@@ -0,0 +1,207 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "st7789.h"
+#include "tim_delay.h"
+#include "rtc.h"
+#include "ui.h"
+#include "page.h"
+#include "wifi.h"
+#include "app.h"
+#include "shell.h"
+#include "bench.h"
+
+// Rendering benchmarks: each scenario draws a page (or the part of it that
+// changes every second) with fixed content, with every other task kept off
+// the panel, and is measured from the first message to the UI task until
+// the last pixel is out. SPI bytes and register transactions only depend on
+// what is drawn, so they are checked against the budgets below wherever the
+// firmware runs, the host build included (sim/, make bench). Cycles and
+// wall time depend on where it runs, so there are two cycle budgets:
+//  - board: checked by "bench cycles", with BENCH_CYCLE_SLACK_PCT for
+//    jitter; a budget of 0 has not been recorded on the board yet and is
+//    only reported
+//  - host: the simulator's DWT follows the host clock, so a run moves by
+//    a third either way with the machine's load; always checked in the
+//    host build, with BENCH_HOST_SLACK_PCT, which still catches a change
+//    that doubles the work
+//
+// A change that draws more must raise the budget here, in the same commit.
+#define BENCH_MAX_SCENARIOS     8
+#define BENCH_RUNS              3
+#define BENCH_CYCLE_SLACK_PCT   10
+#define BENCH_HOST_SLACK_PCT    60
+
+#ifndef HOST_BUILD
+#define HOST_BUILD              0
+#endif
+
+typedef struct
+{
+    const char *name;
+    void (*run)(void);
+    uint32_t spi_bytes;
+    uint32_t commands;
+    uint32_t cycles;
+    uint32_t host_cycles;
+} bench_scenario_t;
+
+static const rtc_date_time_t bench_date = { 2025, 7, 26, 16, 30, 0, 6 };
+
+static void bench_welcome(void)
+{
+    welcome_page_display();
+}
+
+static void bench_wifi(void)
+{
+    wifi_page_display();
+}
+
+// the page as it stands once everything has come in
+static void bench_main(void)
+{
+    main_page_display();
+    main_page_redraw_wifi_ssid(WIFI_SSID);
+    main_page_redraw_inner_temperature(24.0f);
+    main_page_redraw_inner_humidity(45.0f);
+    main_page_redraw_outdoor_temperature(32.0f);
+    main_page_redraw_outdoor_weather_icon(4);
+    main_page_redraw_date(&bench_date);
+    main_page_redraw_time_hour(bench_date.hour);
+    main_page_redraw_time_minute(bench_date.minute);
+    main_page_redraw_time_colon(true);
+}
+
+// what a second without news costs in day mode: the colon blinks
+static void bench_second(void)
+{
+    main_page_redraw_time_colon(false);
+}
+
+static const bench_scenario_t scenarios[] =
+{
+    { "welcome", bench_welcome, 242823, 63, 0, 1150000 },
+    { "wifi", bench_wifi, 224200, 72, 0, 1080000 },
+    { "main", bench_main, 403987, 285, 0, 2300000 },
+    { "second", bench_second, 5787, 3, 0, 38000 },
+};
+
+#define BENCH_SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static uint32_t bench_cycle_budget(const bench_scenario_t *scenario)
+{
+    return HOST_BUILD ? scenario->host_cycles : scenario->cycles;
+}
+
+static bool bench_cycles_over(const bench_scenario_t *scenario, uint32_t cycles, bool check_cycles)
+{
+    uint32_t budget = bench_cycle_budget(scenario);
+    uint32_t slack = HOST_BUILD ? BENCH_HOST_SLACK_PCT : BENCH_CYCLE_SLACK_PCT;
+    
+    if (budget == 0 || !(check_cycles || HOST_BUILD))
+        return false;
+    return (uint64_t)cycles * 100 > (uint64_t)budget * (100 + slack);
+}
+
+static void bench_measure(const bench_scenario_t *scenario, bench_result_t *result)
+{
+    st7789_stats_t before, after;
+    
+    ui_sync();
+    st7789_get_stats(&before);
+    uint64_t start_us = tim_get_us();
+    uint32_t start_cycles = tim_get_cycles();
+    
+    scenario->run();
+    ui_sync();
+    
+    result->cycles = tim_get_cycles() - start_cycles;
+    result->us = (uint32_t)(tim_get_us() - start_us);
+    st7789_get_stats(&after);
+    result->spi_bytes = after.bytes_written - before.bytes_written;
+    result->commands = after.commands - before.commands;
+}
+
+// the panel is in day mode throughout, night drops most of the drawing;
+// the previous mode and the main page are put back afterwards
+uint32_t bench_run(bench_result_t results[], uint32_t max, bool check_cycles)
+{
+    uint32_t count = BENCH_SCENARIOS < max ? BENCH_SCENARIOS : max;
+    
+    ui_lock();
+    ui_mode_t mode = ui_get_mode();
+    if (mode != UI_MODE_DAY)
+        ui_set_mode(UI_MODE_DAY, MAIN_PAGE_TIME_Y1, MAIN_PAGE_TIME_Y2);
+    
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const bench_scenario_t *scenario = &scenarios[i];
+        bench_result_t *result = &results[i];
+    
+        // fastest of a few runs; the byte counts are the same every time
+        for (uint32_t run = 0; run < BENCH_RUNS; run++)
+        {
+            bench_result_t sample;
+            bench_measure(scenario, &sample);
+            if (run == 0 || sample.cycles < result->cycles)
+                *result = sample;
+        }
+    
+        result->name = scenario->name;
+        result->over_budget = result->spi_bytes > scenario->spi_bytes ||
+                              result->commands > scenario->commands;
+        if (bench_cycles_over(scenario, result->cycles, check_cycles))
+            result->over_budget = true;
+    }
+    
+    if (mode != UI_MODE_DAY)
+        ui_set_mode(mode, MAIN_PAGE_TIME_Y1, MAIN_PAGE_TIME_Y2);
+    ui_unlock();
+    app_redraw();
+    
+    return count;
+}
+
+static void cmd_bench(int argc, char *argv[])
+{
+    static bench_result_t results[BENCH_MAX_SCENARIOS];
+    bool check_cycles = argc > 1 && strcmp(argv[1], "cycles") == 0;
+    uint32_t count = bench_run(results, BENCH_MAX_SCENARIOS, check_cycles);
+    uint32_t failed = 0;
+    
+    shell_printf("  %-8s %10s %6s %10s %8s  budget\n", "scenario", "spi bytes", "cmds", "cycles", "us");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const bench_scenario_t *scenario = &scenarios[i];
+        const bench_result_t *result = &results[i];
+        const char *verdict = "ok";
+    
+        if (result->over_budget)
+        {
+            verdict = "OVER";
+            failed++;
+        }
+        else if (result->spi_bytes < scenario->spi_bytes || result->commands < scenario->commands)
+        {
+            verdict = "under, lower it";
+        }
+    
+        shell_printf("  %-8s %10lu %6lu %10lu %8lu  %s\n", result->name, result->spi_bytes,
+                     result->commands, result->cycles, result->us, verdict);
+        shell_printf("  %-8s %10lu %6lu %10lu\n", HOST_BUILD ? "(host)" : "(budget)", scenario->spi_bytes,
+                     scenario->commands, bench_cycle_budget(scenario));
+    }
+    
+    if (failed > 0)
+        shell_printf("bench: FAIL, %lu over budget\n", failed);
+    else
+        shell_printf("bench: pass\n");
+}
+
+void bench_init(void)
+{
+    shell_register("bench", "rendering cost per page against the budgets [cycles]", cmd_bench);
+}
@@ -0,0 +1,20 @@
+#ifndef __APP_BENCH_H__
+#define __APP_BENCH_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+    const char *name;
+    uint32_t spi_bytes;
+    uint32_t commands;
+    uint32_t cycles;
+    uint32_t us;
+    bool over_budget;
+} bench_result_t;
+
+void bench_init(void);
+uint32_t bench_run(bench_result_t results[], uint32_t max, bool check_cycles);
+
+#endif /* __APP_BENCH_H__ */
@@ -6,7 +6,14 @@
 #include "tim_delay.h"
 #include "console.h"
 #include "rtc.h"
+#include "i2c_bus.h"
+#include "log.h"
+#include "trace.h"
+#include "heapmon.h"
+#include "lowpower.h"
+#include "clkscale.h"
 #include "aht20.h"
+#include "bl24c512.h"
  
 void board_lowlevel_init(void)
 {
@@ -16,10 +23,13 @@ void board_lowlevel_init(void)
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOD, ENABLE);
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_GPIOE, ENABLE);
     RCC_APB2PeriphClockCmd(RCC_APB2Periph_USART1, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_SYSCFG, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1, ENABLE);
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM9, ENABLE);
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_USART2, ENABLE);
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_I2C2, ENABLE);
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_SPI2, ENABLE);
-    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM6, ENABLE);
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM5, ENABLE);
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR, ENABLE);
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA1, ENABLE);
     RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
@@ -31,35 +41,53 @@ void board_lowlevel_init(void)
   
 void board_init(void)
 {
+    clkscale_init();
     tim_delay_init();
+    trace_init();
     console_init();
-    printf("[SYS] Build Date: %s %s\n", __DATE__, __TIME__);
+    LOG("[SYS] Build Date: %s %s\n", __DATE__, __TIME__);
     
     rtc_init();
+    lowpower_init();
+    i2c_bus_init();
     aht20_init();
+    if (!bl24c512_init())
+        LOG("[EEPROM] not responding\n");
 }
 
 int fputc(int ch, FILE *f)
 {
-    USART_SendData(USART1, (uint8_t)ch);
-    while (USART_GetFlagStatus(USART1, USART_FLAG_TXE) == RESET);
+    char c = (char)ch;
+    console_write_data(&c, 1);
     return ch;
 }
 
 void vAssertCalled(const char *file, int line)
 {
+    char str[128];
     portDISABLE_INTERRUPTS();
-    printf("Assert Called: %s(%d)\n", file, line);
+    snprintf(str, sizeof(str), "Assert Called: %s(%d)\n", file, line);
+    console_panic_write(str);
 }
 
 void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName)
 {
-    printf("Stack Overflowed: %s\n", pcTaskName);
+    char str[64];
+    snprintf(str, sizeof(str), "Stack Overflowed: %s\n", pcTaskName);
+    console_panic_write(str);
     configASSERT(0);
 }
 
 void vApplicationMallocFailedHook(void)
 {
-    printf("Malloc Failed\n");
+    char str[128];
+    heapmon_stats_t stats;
+    heapmon_get_stats(&stats);
+    
+    portDISABLE_INTERRUPTS();
+    snprintf(str, sizeof(str), "Malloc Failed: %u bytes from 0x%08x, free %u in %u blocks, largest %u\n",
+             stats.failed_size, (unsigned)stats.failed_caller, stats.total - stats.used,
+             stats.free_blocks, stats.largest_free);
+    console_panic_write(str);
     configASSERT(0);
 }
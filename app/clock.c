@@ -0,0 +1,102 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "rtc.h"
+#include "ccm.h"
+#include "clock.h"
+
+#define CLOCK_MAX_SUBSCRIBERS   8
+
+typedef struct
+{
+    uint32_t events;
+    clock_event_func_t func;
+} clock_subscriber_t;
+
+static TaskHandle_t clock_task;
+static clock_subscriber_t subscribers[CLOCK_MAX_SUBSCRIBERS];
+static uint32_t subscriber_count;
+
+static uint32_t clock_changed_events(const rtc_date_time_t *last, const rtc_date_time_t *now)
+{
+    uint32_t events = 0;
+    
+    if (last->second != now->second)
+        events |= CLOCK_EVT_SECOND;
+    if (last->minute != now->minute)
+        events |= CLOCK_EVT_MINUTE;
+    if (last->hour != now->hour)
+        events |= CLOCK_EVT_HOUR;
+    if (last->day != now->day || last->month != now->month ||
+        last->year != now->year || last->weekday != now->weekday)
+        events |= CLOCK_EVT_DAY;
+    
+    return events;
+}
+
+static void clock_publish(const rtc_date_time_t *date, uint32_t events)
+{
+    for (uint32_t i = 0; i < subscriber_count; i++)
+    {
+        uint32_t matched = subscribers[i].events & events;
+        if (matched)
+            subscribers[i].func(date, matched);
+    }
+}
+
+static void clock_second_isr(void)
+{
+    BaseType_t pxHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(clock_task, &pxHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(pxHigherPriorityTaskWoken);
+}
+
+static void clock_func(void *param)
+{
+    rtc_date_time_t last_date = { 0 };
+    
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        rtc_date_time_t date;
+        rtc_get_time(&date);
+        
+        if (date.year < 2020)
+            continue;
+        
+        uint32_t events = last_date.year == 0 ? CLOCK_EVT_ALL :
+                          clock_changed_events(&last_date, &date);
+        if (events == 0)
+            continue;
+        
+        memcpy(&last_date, &date, sizeof(rtc_date_time_t));
+        clock_publish(&date, events);
+    }
+}
+
+void clock_init(void)
+{
+    ccm_task_create(clock_func, "clock", 512, NULL, 6, &clock_task);
+    configASSERT(clock_task);
+    rtc_second_callback_register(clock_second_isr);
+}
+
+bool clock_event_register(uint32_t events, clock_event_func_t func)
+{
+    bool ret = false;
+    
+    taskENTER_CRITICAL();
+    if (subscriber_count < CLOCK_MAX_SUBSCRIBERS)
+    {
+        subscribers[subscriber_count].events = events;
+        subscribers[subscriber_count].func = func;
+        subscriber_count++;
+        ret = true;
+    }
+    taskEXIT_CRITICAL();
+    
+    return ret;
+}
@@ -0,0 +1,22 @@
+#ifndef __APP_CLOCK_H__
+#define __APP_CLOCK_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "rtc.h"
+
+#define CLOCK_EVT_SECOND    (1 << 0)
+#define CLOCK_EVT_MINUTE    (1 << 1)
+#define CLOCK_EVT_HOUR      (1 << 2)
+#define CLOCK_EVT_DAY       (1 << 3)
+#define CLOCK_EVT_ALL       (CLOCK_EVT_SECOND | \
+                             CLOCK_EVT_MINUTE | \
+                             CLOCK_EVT_HOUR | \
+                             CLOCK_EVT_DAY)
+
+typedef void (*clock_event_func_t)(const rtc_date_time_t *date, uint32_t events);
+
+void clock_init(void);
+bool clock_event_register(uint32_t events, clock_event_func_t func);
+
+#endif /* __APP_CLOCK_H__ */
@@ -3,26 +3,31 @@
 #include "workqueue.h"
 #include "app.h"
 #include "ui.h"
-#include "wifi.h"
-#include "page.h"
+#include "shell.h"
+#include "sysmon.h"
+#include "stackmon.h"
+#include "bench.h"
+#include "clkscale.h"
  
 extern void board_lowlevel_init(void);
 extern void board_init(void);
 
+// boot at full speed, the clock drops once the main page is queued. The
+// ESP32 restore and the association take seconds and run on the workqueue
+// behind it, see wifi.c.
 static void main_init(void *param)
 {
     board_init();
+    clkscale_request(CLKSCALE_HIGH);
+    shell_init();
+    sysmon_init();
+    stackmon_init();
+    bench_init();
     ui_init();
     
-    welcome_page_display(); 
-    
-    wifi_init();
-    wifi_page_display();
-    wifi_wait_connect();
-    
-    main_page_display();
     app_init();
     
+    clkscale_release(CLKSCALE_HIGH);
     vTaskDelete(NULL);
 }
   
@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdio.h>
@@ -7,6 +8,10 @@
 #include "app.h"
 #include "page.h"
 
+#define TIME_X              25
+#define TIME_Y              42
+#define TIME_CHAR_WIDTH     (font76_maple_extrabold.size / 2)
+
 static const uint16_t color_bg_time = mkcolor(248, 248, 248);
 static const uint16_t color_bg_inner = mkcolor(136, 217, 234);
 static const uint16_t color_bg_outdoor = mkcolor(254, 135, 75);
@@ -16,11 +21,11 @@ void main_page_display(void)
     ui_fill_color(0, 0, UI_WIDTH - 1, UI_HEIGHT - 1, mkcolor(0, 0, 0));
     
     do {
-        ui_fill_color(15, 15, 224, 154, color_bg_time);
+        ui_fill_color(15, MAIN_PAGE_TIME_Y1, 224, MAIN_PAGE_TIME_Y2, color_bg_time);
         // wifiͼ��
         ui_draw_image(23, 20, &icon_wifi);
         main_page_redraw_wifi_ssid(WIFI_SSID);
-        ui_write_string(25, 42, "--:--", mkcolor(0, 0, 0), color_bg_time, &font76_maple_extrabold);
+        ui_write_string(TIME_X, TIME_Y, "--:--", mkcolor(0, 0, 0), color_bg_time, &font76_maple_extrabold);
         ui_write_string(35, 121, "----/--/-- ������", mkcolor(143, 143, 143), color_bg_time, &font20_maple_bold);
     } while (0);
     
@@ -50,15 +55,34 @@ void main_page_redraw_wifi_ssid(const char *ssid)
     ui_write_string(50, 23, str, mkcolor(143, 143, 143), color_bg_time, &font16_maple);
 }
 
-void main_page_redraw_time(rtc_date_time_t *time)
+void main_page_redraw_time(const rtc_date_time_t *time)
 {
     char str[6];
     char comma = (time->second % 2 == 0) ? ':' : ' ';
     snprintf(str, sizeof(str), "%02u%c%02u", time->hour, comma, time->minute);
-    ui_write_string(25, 42, str, mkcolor(0, 0, 0), color_bg_time, &font76_maple_extrabold);
+    ui_write_string(TIME_X, TIME_Y, str, mkcolor(0, 0, 0), color_bg_time, &font76_maple_extrabold);
+}
+
+void main_page_redraw_time_hour(uint8_t hour)
+{
+    char str[3];
+    snprintf(str, sizeof(str), "%02u", hour);
+    ui_write_string(TIME_X, TIME_Y, str, mkcolor(0, 0, 0), color_bg_time, &font76_maple_extrabold);
+}
+
+void main_page_redraw_time_minute(uint8_t minute)
+{
+    char str[3];
+    snprintf(str, sizeof(str), "%02u", minute);
+    ui_write_string(TIME_X + TIME_CHAR_WIDTH * 3, TIME_Y, str, mkcolor(0, 0, 0), color_bg_time, &font76_maple_extrabold);
+}
+
+void main_page_redraw_time_colon(bool visible)
+{
+    ui_write_string(TIME_X + TIME_CHAR_WIDTH * 2, TIME_Y, visible ? ":" : " ", mkcolor(0, 0, 0), color_bg_time, &font76_maple_extrabold);
 }
 
-void main_page_redraw_date(rtc_date_time_t *date)
+void main_page_redraw_date(const rtc_date_time_t *date)
 {
     char str[18];
     snprintf(str, sizeof(str), "%04u/%02u/%02u ����%s", date->year, date->month, date->day,
@@ -1,15 +1,24 @@
 #ifndef __PAGE_H__
 #define __PAGE_H__
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "rtc.h"
 
+// rows of the time panel on the main page, the band kept at night
+#define MAIN_PAGE_TIME_Y1   15
+#define MAIN_PAGE_TIME_Y2   154
+
 void welcome_page_display(void);
 void error_page_display(const char *msg);
 void wifi_page_display(void);
 void main_page_display(void);
 void main_page_redraw_wifi_ssid(const char *ssid);
-void main_page_redraw_time(rtc_date_time_t *time);
-void main_page_redraw_date(rtc_date_time_t *date);
+void main_page_redraw_time(const rtc_date_time_t *time);
+void main_page_redraw_time_hour(uint8_t hour);
+void main_page_redraw_time_minute(uint8_t minute);
+void main_page_redraw_time_colon(bool visible);
+void main_page_redraw_date(const rtc_date_time_t *date);
 void main_page_redraw_inner_temperature(float temperature);
 void main_page_redraw_inner_humidity(float humidity);
 void main_page_redraw_outdoor_city(const char *city);
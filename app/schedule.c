@@ -0,0 +1,124 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "clock.h"
+#include "ui.h"
+#include "page.h"
+#include "app.h"
+#include "st7789.h"
+#include "log.h"
+#include "shell.h"
+#include "schedule.h"
+
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+
+// Backlight over the day: each entry holds from its start until the next
+// one, the last wraps past midnight, so keep them sorted by start time.
+// Checked every minute from the clock task, changes fade in slowly. Night
+// entries keep only the time panel lit, in the panel's partial and 8-colour
+// idle modes; UI_MODE_OFF puts the panel to sleep.
+#define SCHEDULE_FADE_MS    3000
+
+typedef struct
+{
+    uint8_t hour;
+    uint8_t minute;
+    uint8_t brightness;
+    ui_mode_t mode;
+} schedule_entry_t;
+
+static const schedule_entry_t schedule[] =
+{
+    { 0, 30, 5, UI_MODE_NIGHT },
+    { 6, 30, 40, UI_MODE_DAY },
+    { 8, 0, 100, UI_MODE_DAY },
+    { 19, 0, 60, UI_MODE_DAY },
+    { 22, 30, 20, UI_MODE_NIGHT },
+};
+
+static const char *const mode_names[] = { "day", "night", "off" };
+
+static int32_t active_index = -1;
+static bool manual;
+
+// waking the panel goes before the backlight, putting it to sleep after;
+// a mode change repaints the page, the night palette differs from the day
+static void schedule_apply(const schedule_entry_t *entry)
+{
+    bool mode_changed = entry->mode != ui_get_mode();
+    
+    if (entry->mode == UI_MODE_OFF)
+    {
+        ui_set_brightness(0, SCHEDULE_FADE_MS);
+        ui_set_mode(entry->mode, MAIN_PAGE_TIME_Y1, MAIN_PAGE_TIME_Y2);
+        return;
+    }
+    
+    if (mode_changed)
+    {
+        ui_set_mode(entry->mode, MAIN_PAGE_TIME_Y1, MAIN_PAGE_TIME_Y2);
+        app_redraw();
+    }
+    ui_set_brightness(entry->brightness, SCHEDULE_FADE_MS);
+}
+
+static uint32_t schedule_find(const rtc_date_time_t *date)
+{
+    uint32_t now = date->hour * 60 + date->minute;
+    uint32_t index = ARRAY_SIZE(schedule) - 1;
+    
+    for (uint32_t i = 0; i < ARRAY_SIZE(schedule); i++)
+    {
+        if (schedule[i].hour * 60 + schedule[i].minute <= now)
+            index = i;
+    }
+    
+    return index;
+}
+
+// a manual setting from the shell lasts until the next entry starts
+static void schedule_update(const rtc_date_time_t *date, uint32_t events)
+{
+    int32_t index = schedule_find(date);
+    if (index == active_index)
+        return;
+    
+    active_index = index;
+    manual = false;
+    LOG("[SCHED] %02u:%02u backlight %u%%, %s\n", schedule[index].hour,
+        schedule[index].minute, schedule[index].brightness, mode_names[schedule[index].mode]);
+    schedule_apply(&schedule[index]);
+}
+
+static void cmd_backlight(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        int percent = atoi(argv[1]);
+        if (percent < 0 || percent > 100)
+        {
+            shell_printf("0..100\n");
+            return;
+        }
+        manual = true;
+        ui_set_brightness(percent, SCHEDULE_FADE_MS / 3);
+    }
+    
+    shell_printf("  backlight %u%%%s, %s\n", st7789_get_brightness(), manual ? " (manual)" : "",
+                 mode_names[ui_get_mode()]);
+    for (uint32_t i = 0; i < ARRAY_SIZE(schedule); i++)
+    {
+        shell_printf("  %c %02u:%02u %3u%% %s\n", (int32_t)i == active_index ? '*' : ' ',
+                     schedule[i].hour, schedule[i].minute, schedule[i].brightness,
+                     mode_names[schedule[i].mode]);
+    }
+}
+
+// before clock_init, so the first publish already applies it
+void schedule_init(void)
+{
+    clock_event_register(CLOCK_EVT_MINUTE, schedule_update);
+    shell_register("backlight", "brightness and day schedule [percent]", cmd_backlight);
+}
@@ -0,0 +1,6 @@
+#ifndef __APP_SCHEDULE_H__
+#define __APP_SCHEDULE_H__
+
+void schedule_init(void);
+
+#endif /* __APP_SCHEDULE_H__ */
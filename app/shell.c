@@ -0,0 +1,527 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "console.h"
+#include "log.h"
+#include "tim_delay.h"
+#include "i2c_bus.h"
+#include "trace.h"
+#include "heapmon.h"
+#include "st7789.h"
+#include "esp_at.h"
+#include "lowpower.h"
+#include "clkscale.h"
+#include "ccm.h"
+#include "mempool.h"
+#include "workqueue.h"
+#include "ui.h"
+#include "app.h"
+#include "shell.h"
+
+#define SHELL_MAX_COMMANDS  24
+#define SHELL_LINE_MAX      80
+#define SHELL_ARGS_MAX      8
+#define SHELL_PROMPT        "> "
+
+typedef struct
+{
+    const char *name;
+    const char *help;
+    shell_cmd_func_t func;
+} shell_cmd_t;
+
+typedef enum
+{
+    SHELL_ESC_NONE,
+    SHELL_ESC_START,
+    SHELL_ESC_CSI,
+} shell_esc_t;
+
+static TaskHandle_t shell_task;
+static shell_cmd_t commands[SHELL_MAX_COMMANDS];
+static uint32_t command_count;
+static char line[SHELL_LINE_MAX];
+static char history[SHELL_LINE_MAX];
+static uint32_t line_len;
+static shell_esc_t esc_state;
+static char last_ch;
+
+void shell_printf(const char *fmt, ...)
+{
+    static char buf[160];
+    
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    
+    // long listings (trace dump) would overrun the console ring, so wait
+    // for the DMA to make room instead of dropping lines
+    uint32_t len = strlen(buf);
+    while (console_get_free() < len)
+        vTaskDelay(pdMS_TO_TICKS(2));
+    console_write_data(buf, len);
+}
+
+bool shell_register(const char *name, const char *help, shell_cmd_func_t func)
+{
+    if (command_count >= SHELL_MAX_COMMANDS)
+        return false;
+    
+    commands[command_count].name = name;
+    commands[command_count].help = help;
+    commands[command_count].func = func;
+    command_count++;
+    
+    return true;
+}
+
+static void cmd_help(int argc, char *argv[])
+{
+    for (uint32_t i = 0; i < command_count; i++)
+        shell_printf("  %-10s %s\n", commands[i].name, commands[i].help);
+}
+
+static char task_state_char(eTaskState state)
+{
+    switch (state)
+    {
+    case eRunning:   return 'X';
+    case eReady:     return 'R';
+    case eBlocked:   return 'B';
+    case eSuspended: return 'S';
+    case eDeleted:   return 'D';
+    default:         return '?';
+    }
+}
+
+static void cmd_tasks(int argc, char *argv[])
+{
+    UBaseType_t count = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *status = pvPortMalloc(count * sizeof(TaskStatus_t));
+    if (status == NULL)
+    {
+        shell_printf("out of memory\n");
+        return;
+    }
+    
+    count = uxTaskGetSystemState(status, count, NULL);
+    shell_printf("  %-16s %s %4s %6s\n", "name", "s", "prio", "free");
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        shell_printf("  %-16s %c %4lu %6lu\n", status[i].pcTaskName,
+                     task_state_char(status[i].eCurrentState),
+                     (unsigned long)status[i].uxCurrentPriority,
+                     (unsigned long)status[i].usStackHighWaterMark * sizeof(StackType_t));
+    }
+    
+    vPortFree(status);
+}
+
+static void cmd_heap(int argc, char *argv[])
+{
+    static heapmon_site_t sites[16];
+    heapmon_stats_t stats;
+    
+    if (argc > 1 && strcmp(argv[1], "mark") == 0)
+    {
+        heapmon_mark();
+        shell_printf("  marked, 'heap' now shows growth per site\n");
+        return;
+    }
+    
+    heapmon_get_stats(&stats);
+    shell_printf("  total %lu, used %lu, peak %lu\n", stats.total, stats.used, stats.peak_used);
+    shell_printf("  free blocks %lu, largest %lu, fragmentation %lu.%lu%%\n",
+                 stats.free_blocks, stats.largest_free,
+                 stats.fragmentation / 10, stats.fragmentation % 10);
+    shell_printf("  mallocs %lu, frees %lu, failed %lu, untracked %lu\n",
+                 stats.allocs, stats.frees, stats.failed, stats.untracked);
+    if (stats.failed)
+        shell_printf("  last failure %lu bytes from 0x%08lx\n", stats.failed_size, stats.failed_caller);
+    
+    uint32_t count = heapmon_get_sites(sites, 16);
+    shell_printf("  %-10s %8s %6s %8s %8s %8s\n", "site", "live", "blocks", "peak", "growth", "allocs");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        shell_printf("  0x%08lx %8lu %6lu %8lu %8ld %8lu\n", sites[i].caller,
+                     sites[i].live_bytes, sites[i].live_count, sites[i].peak_bytes,
+                     (int32_t)(sites[i].live_bytes - sites[i].mark_bytes), sites[i].allocs);
+    }
+}
+
+static void cmd_pools(int argc, char *argv[])
+{
+    static mempool_stats_t pools[MEMPOOL_MAX_POOLS];
+    uint32_t count = mempool_get_stats(pools, MEMPOOL_MAX_POOLS);
+    
+    shell_printf("  %-12s %5s %6s %5s %5s %8s %6s\n", "pool", "size", "blocks", "free", "min", "allocs", "failed");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        shell_printf("  %-12s %5u %6u %5u %5u %8lu %6lu\n", pools[i].name, pools[i].block_size,
+                     pools[i].block_count, pools[i].free, pools[i].free_min,
+                     pools[i].allocs, pools[i].failed);
+    }
+}
+
+static void cmd_queues(int argc, char *argv[])
+{
+    ui_stats_t ui;
+    workqueue_stats_t work;
+    ui_get_stats(&ui);
+    workqueue_get_stats(&work);
+    
+    shell_printf("  ui         %2lu/%lu, peak %lu\n", ui.pending, ui.length, ui.pending_peak);
+    shell_printf("  workqueue  %2lu/%lu, peak %lu\n", work.pending, work.length, work.pending_peak);
+}
+
+static void cmd_jobs(int argc, char *argv[])
+{
+    workqueue_stats_t work;
+    ui_stats_t ui;
+    workqueue_get_stats(&work);
+    ui_get_stats(&ui);
+    
+    uint32_t jobs = work.jobs ? work.jobs : 1;
+    shell_printf("  work jobs %lu\n", work.jobs);
+    shell_printf("  wait  avg %lu us, max %lu us\n",
+                 (uint32_t)(work.wait_total_us / jobs), work.wait_max_us);
+    shell_printf("  run   avg %lu us, max %lu us\n",
+                 (uint32_t)(work.run_total_us / jobs), work.run_max_us);
+    shell_printf("  ui actions %lu, busy %lu ms\n", ui.actions, (uint32_t)(ui.busy_us / 1000));
+    
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+        workqueue_reset_stats();
+}
+
+static void cmd_io(int argc, char *argv[])
+{
+    st7789_stats_t lcd;
+    esp_at_stats_t at;
+    console_stats_t con;
+    log_stats_t logs;
+    st7789_get_stats(&lcd);
+    esp_at_get_stats(&at);
+    console_get_stats(&con);
+    log_get_stats(&logs);
+    
+    shell_printf("  spi2   lcd: %lu bytes, %lu cmds, %lu dma, gram %lu ms\n",
+                 lcd.bytes_written, lcd.commands, lcd.dma_transfers, (uint32_t)(lcd.gram_us / 1000));
+    shell_printf("  usart2 esp: tx %lu, rx %lu, rx lost %lu\n",
+                 at.bytes_sent, at.bytes_received, at.bytes_dropped);
+    shell_printf("             %lu cmds, %lu errors, %lu timeouts, max %lu ms\n",
+                 at.commands, at.errors, at.timeouts, at.response_max_us / 1000);
+    shell_printf("  usart1 con: tx %lu, dropped %lu (%lu writes), peak %lu/%lu\n",
+                 con.bytes_written, con.bytes_dropped, con.writes_dropped, con.peak_used, con.size);
+    shell_printf("             rx %lu, rx lost %lu\n", con.bytes_received, con.bytes_lost);
+    shell_printf("  log    %lu frames, %lu dropped, %lu truncated\n",
+                 logs.frames, logs.dropped, logs.truncated);
+}
+
+static void cmd_i2c(int argc, char *argv[])
+{
+    i2c_bus_stats_t stats;
+    i2c_bus_get_stats(&stats);
+    
+    uint64_t elapsed = tim_get_us() - stats.since_us;
+    uint32_t load = elapsed ? (uint32_t)(stats.busy_us * 1000 / elapsed) : 0;
+    shell_printf("  batches %lu, transactions %lu, queue peak %lu\n",
+                 stats.batches, stats.transactions, stats.queue_peak);
+    shell_printf("  written %lu, read %lu, busy %lu.%lu%%\n",
+                 stats.bytes_written, stats.bytes_read, load / 10, load % 10);
+    shell_printf("  timeouts %lu, nacks %lu, bus errors %lu\n",
+                 stats.errors_timeout, stats.errors_nack, stats.errors_bus);
+    
+    if (argc > 1 && strcmp(argv[1], "reset") == 0)
+        i2c_bus_reset_stats();
+}
+
+// slowdown under DMA load in 0.1 % units
+static uint32_t ccm_slowdown(uint32_t idle, uint32_t busy)
+{
+    return idle && busy > idle ? (busy - idle) * 1000 / idle : 0;
+}
+
+static void cmd_ccm(int argc, char *argv[])
+{
+    ccm_stats_t stats;
+    ccm_get_stats(&stats);
+    
+    shell_printf("  pool %lu/%lu, %lu tasks, %lu fell back to the heap\n",
+                 stats.pool_used, stats.pool_size, stats.tasks, stats.fallbacks);
+    
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        ccm_contention_t result;
+        ccm_measure_contention(&result);
+        
+        uint32_t sram = ccm_slowdown(result.sram_idle, result.sram_busy);
+        uint32_t ccm = ccm_slowdown(result.ccm_idle, result.ccm_busy);
+        shell_printf("  %-5s %8s %8s %8s\n", "", "idle", "dma", "slower");
+        shell_printf("  %-5s %8lu %8lu %5lu.%lu%%\n", "sram", result.sram_idle, result.sram_busy,
+                     sram / 10, sram % 10);
+        shell_printf("  %-5s %8lu %8lu %5lu.%lu%%\n", "ccm", result.ccm_idle, result.ccm_busy,
+                     ccm / 10, ccm % 10);
+    }
+}
+
+static void cmd_redraw(int argc, char *argv[])
+{
+    if (!app_redraw())
+        shell_printf("main page not shown yet\n");
+}
+
+static void cmd_uptime(int argc, char *argv[])
+{
+    uint32_t s = (uint32_t)(tim_get_ms() / 1000);
+    shell_printf("  %lu d %02lu:%02lu:%02lu\n", s / 86400, s / 3600 % 24, s / 60 % 60, s % 60);
+}
+
+static void cmd_boot(int argc, char *argv[])
+{
+    app_boot_stats_t stats;
+    app_get_boot_stats(&stats);
+    
+    shell_printf("  main page %lu ms (%s weather)\n", stats.screen_ms,
+                 stats.cached_weather ? "cached" : "no");
+    if (stats.network_ms)
+        shell_printf("  network   %lu ms\n", stats.network_ms);
+    else
+        shell_printf("  network   not up\n");
+}
+
+static void cmd_power(int argc, char *argv[])
+{
+    const char *op = argc > 1 ? argv[1] : "";
+    
+    if (strcmp(op, "on") == 0)
+        lowpower_set_stop_enabled(true);
+    else if (strcmp(op, "off") == 0)
+        lowpower_set_stop_enabled(false);
+    else if (strcmp(op, "reset") == 0)
+        lowpower_reset_stats();
+    
+    lowpower_stats_t stats;
+    lowpower_get_stats(&stats);
+    
+    uint64_t total = stats.total_us ? stats.total_us : 1;
+    uint32_t stop = (uint32_t)(stats.stop_us * 1000 / total);
+    uint32_t sleep = (uint32_t)(stats.sleep_us * 1000 / total);
+    uint32_t run = stop + sleep < 1000 ? 1000 - stop - sleep : 0;
+    shell_printf("  stop mode %s, over %lu s\n", lowpower_get_stop_enabled() ? "on" : "off",
+                 (uint32_t)(stats.total_us / 1000000));
+    shell_printf("  run %lu.%lu%%, sleep %lu.%lu%%, stop %lu.%lu%%\n",
+                 run / 10, run % 10, sleep / 10, sleep % 10, stop / 10, stop % 10);
+    shell_printf("  %lu stops, %lu held off by locks, wake %lu us (max %lu)\n",
+                 stats.stops, stats.blocked, stats.wake_us, stats.wake_max_us);
+    shell_printf("  estimated mcu current %lu.%02lu mA\n",
+                 stats.average_ua / 1000, stats.average_ua % 1000 / 10);
+    
+    shell_printf("  locks held:");
+    for (uint32_t i = 0; i < LOWPOWER_LOCK_COUNT; i++)
+    {
+        if (stats.locks & (1u << i))
+            shell_printf(" %s", lowpower_lock_name((lowpower_lock_t)i));
+    }
+    shell_printf(stats.locks ? "\n" : " none\n");
+}
+
+static void cmd_speed(int argc, char *argv[])
+{
+    const char *op = argc > 1 ? argv[1] : "";
+    
+    for (uint32_t i = 0; i < CLKSCALE_LEVEL_COUNT; i++)
+    {
+        if (strcmp(op, clkscale_level_name((clkscale_level_t)i)) == 0)
+            clkscale_set_floor((clkscale_level_t)i);
+    }
+    
+    clkscale_clocks_t clocks;
+    clkscale_stats_t stats;
+    clkscale_get_clocks(&clocks);
+    clkscale_get_stats(&stats);
+    
+    shell_printf("  %s (floor %s), hclk %lu MHz, pclk1 %lu MHz, pclk2 %lu MHz\n",
+                 clkscale_level_name(clkscale_get_level()), clkscale_level_name(clkscale_get_floor()),
+                 clocks.hclk / 1000000, clocks.pclk1 / 1000000, clocks.pclk2 / 1000000);
+    shell_printf("  %lu changes, %lu put off\n", stats.changes, stats.deferred);
+    
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < CLKSCALE_LEVEL_COUNT; i++)
+        total += stats.level_us[i];
+    for (uint32_t i = 0; i < CLKSCALE_LEVEL_COUNT; i++)
+    {
+        uint32_t permille = total ? (uint32_t)(stats.level_us[i] * 1000 / total) : 0;
+        shell_printf("  %-4s %lu.%lu%%\n", clkscale_level_name((clkscale_level_t)i),
+                     permille / 10, permille % 10);
+    }
+}
+
+static void cmd_trace(int argc, char *argv[])
+{
+    const char *op = argc > 1 ? argv[1] : "";
+    
+    if (strcmp(op, "start") == 0)
+        trace_start();
+    else if (strcmp(op, "stop") == 0)
+        trace_stop();
+    else if (strcmp(op, "clear") == 0)
+        trace_clear();
+    else if (strcmp(op, "dump") == 0)
+        trace_dump(shell_printf);
+    else
+        shell_printf("  trace start|stop|clear|dump, %s\n", trace_is_running() ? "running" : "stopped");
+}
+
+static void shell_execute(char *str)
+{
+    char *argv[SHELL_ARGS_MAX];
+    int argc = 0;
+    
+    char *token = strtok(str, " ");
+    while (token != NULL && argc < SHELL_ARGS_MAX)
+    {
+        argv[argc++] = token;
+        token = strtok(NULL, " ");
+    }
+    if (argc == 0)
+        return;
+    
+    for (uint32_t i = 0; i < command_count; i++)
+    {
+        if (strcmp(argv[0], commands[i].name) == 0)
+        {
+            commands[i].func(argc, argv);
+            return;
+        }
+    }
+    
+    shell_printf("unknown command: %s, try 'help'\n", argv[0]);
+}
+
+static void shell_erase_line(void)
+{
+    while (line_len > 0)
+    {
+        console_write("\b \b");
+        line_len--;
+    }
+}
+
+static void shell_input(char ch)
+{
+    // treat CR LF as one line ending
+    bool crlf = ch == '\n' && last_ch == '\r';
+    last_ch = ch;
+    if (crlf)
+        return;
+    
+    // up arrow (ESC [ A) recalls the previous line, other sequences are eaten
+    if (esc_state == SHELL_ESC_START)
+    {
+        esc_state = ch == '[' ? SHELL_ESC_CSI : SHELL_ESC_NONE;
+        return;
+    }
+    if (esc_state == SHELL_ESC_CSI)
+    {
+        esc_state = SHELL_ESC_NONE;
+        if (ch == 'A' && history[0] != '\0')
+        {
+            shell_erase_line();
+            strcpy(line, history);
+            line_len = strlen(line);
+            console_write(line);
+        }
+        return;
+    }
+    
+    switch (ch)
+    {
+    case 0x1B:
+        esc_state = SHELL_ESC_START;
+        break;
+    case '\r':
+    case '\n':
+        console_write("\n");
+        line[line_len] = '\0';
+        if (line_len > 0)
+            strcpy(history, line);
+        shell_execute(line);
+        line_len = 0;
+        console_write(SHELL_PROMPT);
+        break;
+    case '\b':
+    case 0x7F:
+        if (line_len > 0)
+        {
+            line_len--;
+            console_write("\b \b");
+        }
+        break;
+    case 0x03: // ctrl-c
+        line_len = 0;
+        console_write("^C\n" SHELL_PROMPT);
+        break;
+    case 0x15: // ctrl-u
+        shell_erase_line();
+        break;
+    default:
+        if (ch >= ' ' && ch < 0x7F && line_len < SHELL_LINE_MAX - 1)
+        {
+            char echo[2] = { ch, '\0' };
+            line[line_len++] = ch;
+            console_write(echo);
+        }
+        break;
+    }
+}
+
+static void shell_received(uint8_t data)
+{
+    BaseType_t pxHigherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(shell_task, &pxHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(pxHigherPriorityTaskWoken);
+}
+
+static void shell_func(void *param)
+{
+    uint8_t buf[16];
+    
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    
+        uint32_t count;
+        while ((count = console_read(buf, sizeof(buf))) > 0)
+        {
+            for (uint32_t i = 0; i < count; i++)
+                shell_input(buf[i]);
+        }
+    }
+}
+
+void shell_init(void)
+{
+    shell_register("help", "list commands", cmd_help);
+    shell_register("tasks", "task states and free stack (bytes)", cmd_tasks);
+    shell_register("heap", "heap usage, fragmentation and call sites [mark]", cmd_heap);
+    shell_register("pools", "fixed block pools: free, low water, failures", cmd_pools);
+    shell_register("queues", "ui / workqueue depth", cmd_queues);
+    shell_register("jobs", "workqueue latency [reset]", cmd_jobs);
+    shell_register("io", "spi / uart byte counters", cmd_io);
+    shell_register("i2c", "i2c bus statistics [reset]", cmd_i2c);
+    shell_register("ccm", "core-coupled RAM use, contention with DMA [bench]", cmd_ccm);
+    shell_register("redraw", "repaint the main page", cmd_redraw);
+    shell_register("uptime", "time since boot", cmd_uptime);
+    shell_register("boot", "time to the main page and to the network", cmd_boot);
+    shell_register("trace", "scheduler trace start|stop|clear|dump", cmd_trace);
+    shell_register("power", "idle residency and wake latency [on|off|reset]", cmd_power);
+    shell_register("speed", "clock level and residency [low|mid|high floor]", cmd_speed);
+    
+    ccm_task_create(shell_func, "shell", 512, NULL, 4, &shell_task);
+    console_received_register(shell_received);
+}
@@ -0,0 +1,13 @@
+#ifndef __APP_SHELL_H__
+#define __APP_SHELL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*shell_cmd_func_t)(int argc, char *argv[]);
+
+void shell_init(void);
+bool shell_register(const char *name, const char *help, shell_cmd_func_t func);
+void shell_printf(const char *fmt, ...);
+
+#endif /* __APP_SHELL_H__ */
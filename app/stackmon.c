@@ -0,0 +1,167 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+#include "workqueue.h"
+#include "log.h"
+#include "shell.h"
+#include "stackmon.h"
+
+// Stack sizes are captured when each TCB is set up, so nothing has to be
+// declared twice. Every STACKMON_SAMPLE_MS the high watermarks are read on
+// the workqueue; the peak use is the lifetime watermark, so
+// recommendations only get better the longer the device runs through its
+// paths (boot, wifi loss, SNTP, weather).
+#define STACKMON_MAX_TASKS      16
+#define STACKMON_SAMPLE_MS      10000
+#define STACKMON_REPORT_SAMPLES 360
+// peak * 1.25 plus the FPU exception frame (26 words) and some headroom
+#define STACKMON_MARGIN_WORDS   64
+#define STACKMON_ROUND_WORDS    32
+#define STACKMON_WARN_WORDS     32
+
+typedef struct
+{
+    void *handle;
+    uint32_t stack_words;
+    uint32_t peak_words;
+    bool warned;
+} stackmon_entry_t;
+
+static stackmon_entry_t entries[STACKMON_MAX_TASKS];
+static TimerHandle_t stackmon_timer;
+
+void stackmon_task_create(void *handle, uint32_t stack_words)
+{
+    for (uint32_t i = 0; i < STACKMON_MAX_TASKS; i++)
+    {
+        if (entries[i].handle == NULL)
+        {
+            entries[i].handle = handle;
+            entries[i].stack_words = stack_words;
+            entries[i].peak_words = 0;
+            entries[i].warned = false;
+            return;
+        }
+    }
+}
+
+void stackmon_task_delete(void *handle)
+{
+    for (uint32_t i = 0; i < STACKMON_MAX_TASKS; i++)
+    {
+        if (entries[i].handle == handle)
+        {
+            entries[i].handle = NULL;
+            return;
+        }
+    }
+}
+
+static uint32_t stackmon_recommend(uint32_t peak_words)
+{
+    uint32_t words = peak_words + peak_words / 4 + STACKMON_MARGIN_WORDS;
+    words = (words + STACKMON_ROUND_WORDS - 1) / STACKMON_ROUND_WORDS * STACKMON_ROUND_WORDS;
+    return words < configMINIMAL_STACK_SIZE ? configMINIMAL_STACK_SIZE : words;
+}
+
+// the scheduler stays suspended so no task can be deleted under us
+uint32_t stackmon_get_tasks(stackmon_task_t tasks[], uint32_t max)
+{
+    uint32_t count = 0;
+    
+    vTaskSuspendAll();
+    for (uint32_t i = 0; i < STACKMON_MAX_TASKS && count < max; i++)
+    {
+        stackmon_entry_t *entry = &entries[i];
+        if (entry->handle == NULL)
+            continue;
+    
+        uint32_t free_words = uxTaskGetStackHighWaterMark2(entry->handle);
+        entry->peak_words = entry->stack_words - free_words;
+    
+        stackmon_task_t *task = &tasks[count++];
+        strncpy(task->name, pcTaskGetName(entry->handle), STACKMON_NAME_LEN - 1);
+        task->name[STACKMON_NAME_LEN - 1] = '\0';
+        task->stack_words = entry->stack_words;
+        task->peak_words = entry->peak_words;
+        task->recommended_words = stackmon_recommend(entry->peak_words);
+    }
+    (void)xTaskResumeAll();
+    
+    return count;
+}
+
+static void stackmon_report(const stackmon_task_t tasks[], uint32_t count)
+{
+    uint32_t reclaim = 0;
+    
+    for (uint32_t i = 0; i < count; i++)
+    {
+        LOG("[STACK] %-16s size %4u, peak %4u, recommend %4u words\n", tasks[i].name,
+            tasks[i].stack_words, tasks[i].peak_words, tasks[i].recommended_words);
+        if (tasks[i].recommended_words < tasks[i].stack_words)
+            reclaim += tasks[i].stack_words - tasks[i].recommended_words;
+    }
+    LOG("[STACK] %u bytes reclaimable\n", reclaim * sizeof(StackType_t));
+}
+
+static void stackmon_work(void *param)
+{
+    static stackmon_task_t tasks[STACKMON_MAX_TASKS];
+    static uint32_t samples;
+    
+    uint32_t count = stackmon_get_tasks(tasks, STACKMON_MAX_TASKS);
+    
+    for (uint32_t i = 0; i < STACKMON_MAX_TASKS; i++)
+    {
+        stackmon_entry_t *entry = &entries[i];
+        if (entry->handle != NULL && !entry->warned &&
+            entry->stack_words - entry->peak_words < STACKMON_WARN_WORDS)
+        {
+            entry->warned = true;
+            LOG("[STACK] %s has only %u words left\n", pcTaskGetName(entry->handle),
+                entry->stack_words - entry->peak_words);
+        }
+    }
+    
+    if (++samples >= STACKMON_REPORT_SAMPLES)
+    {
+        samples = 0;
+        stackmon_report(tasks, count);
+    }
+}
+
+static void stackmon_timer_cb(TimerHandle_t timer)
+{
+    workqueue_run(stackmon_work, NULL);
+}
+
+static void cmd_stacks(int argc, char *argv[])
+{
+    static stackmon_task_t tasks[STACKMON_MAX_TASKS];
+    uint32_t count = stackmon_get_tasks(tasks, STACKMON_MAX_TASKS);
+    uint32_t reclaim = 0;
+    
+    shell_printf("  %-16s %6s %6s %9s (words)\n", "task", "size", "peak", "recommend");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        shell_printf("  %-16s %6lu %6lu %9lu%s\n", tasks[i].name,
+                     tasks[i].stack_words, tasks[i].peak_words, tasks[i].recommended_words,
+                     tasks[i].recommended_words > tasks[i].stack_words ? "  grow" : "");
+        if (tasks[i].recommended_words < tasks[i].stack_words)
+            reclaim += tasks[i].stack_words - tasks[i].recommended_words;
+    }
+    shell_printf("  %lu bytes reclaimable\n", reclaim * sizeof(StackType_t));
+}
+
+void stackmon_init(void)
+{
+    shell_register("stacks", "stack peaks and recommended sizes", cmd_stacks);
+    
+    stackmon_timer = xTimerCreate("stackmon", pdMS_TO_TICKS(STACKMON_SAMPLE_MS), pdTRUE, NULL, stackmon_timer_cb);
+    configASSERT(stackmon_timer);
+    xTimerStart(stackmon_timer, 0);
+}
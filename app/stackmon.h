@@ -0,0 +1,31 @@
+#ifndef __APP_STACKMON_H__
+#define __APP_STACKMON_H__
+
+// Included at the end of FreeRTOSConfig.h for the TCB setup / clean up
+// hooks: keep it to plain C declarations.
+
+#include <stdint.h>
+
+#define STACKMON_NAME_LEN   16
+
+typedef struct
+{
+    char name[STACKMON_NAME_LEN];
+    uint32_t stack_words;
+    uint32_t peak_words;
+    uint32_t recommended_words;
+} stackmon_task_t;
+
+void stackmon_init(void);
+uint32_t stackmon_get_tasks(stackmon_task_t tasks[], uint32_t max);
+
+void stackmon_task_create(void *handle, uint32_t stack_words);
+void stackmon_task_delete(void *handle);
+
+// needs configRECORD_STACK_HIGH_ADDRESS for pxEndOfStack
+#define portSETUP_TCB(pxTCB) \
+    stackmon_task_create((pxTCB), (uint32_t)((pxTCB)->pxEndOfStack - (pxTCB)->pxStack) + 1)
+#define portCLEAN_UP_TCB(pxTCB) \
+    stackmon_task_delete(pxTCB)
+
+#endif /* __APP_STACKMON_H__ */
@@ -0,0 +1,261 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "log.h"
+#include "ccm.h"
+#include "shell.h"
+#include "sysmon.h"
+
+// The run time counter is TIM5 (1 us, see FreeRTOSConfig.h). Once a
+// second the per-task counters are sampled and the deltas go into a
+// 60 slot history, so every window is an exact sliding sum rather than a
+// decaying average. Slot deltas are kept in 100 us units to halve the
+// history size.
+#define SYSMON_MAX_TASKS        16
+#define SYSMON_HISTORY          60
+#define SYSMON_SAMPLE_MS        1000
+#define SYSMON_REPORT_INTERVAL  60
+#define SYSMON_SLOT_UNIT_US     100
+
+typedef struct
+{
+    bool used;
+    bool seen;
+    UBaseType_t number;
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t priority;
+    uint32_t runtime;
+    uint16_t history[SYSMON_HISTORY];
+} sysmon_entry_t;
+
+static const uint32_t window_slots[SYSMON_WINDOWS] = { 1, 10, 60 };
+
+static SemaphoreHandle_t sysmon_mutex;
+static TaskStatus_t task_status[SYSMON_MAX_TASKS];
+static sysmon_entry_t entries[SYSMON_MAX_TASKS];
+static uint32_t slot_elapsed[SYSMON_HISTORY];
+static uint32_t slot_index;
+static uint32_t slot_count;
+static uint32_t last_total;
+static UBaseType_t idle_number;
+static uint32_t report_interval = SYSMON_REPORT_INTERVAL;
+
+static sysmon_entry_t *sysmon_find_entry(UBaseType_t number)
+{
+    sysmon_entry_t *free_entry = NULL;
+    
+    for (uint32_t i = 0; i < SYSMON_MAX_TASKS; i++)
+    {
+        if (entries[i].used && entries[i].number == number)
+            return &entries[i];
+        if (!entries[i].used && free_entry == NULL)
+            free_entry = &entries[i];
+    }
+    
+    if (free_entry != NULL)
+    {
+        // a task created since the last sample: all of its run time is new
+        memset(free_entry, 0, sizeof(sysmon_entry_t));
+        free_entry->used = true;
+        free_entry->number = number;
+    }
+    
+    return free_entry;
+}
+
+static void sysmon_sample(void)
+{
+    uint32_t total;
+    UBaseType_t count = uxTaskGetSystemState(task_status, SYSMON_MAX_TASKS, &total);
+    if (count == 0)
+    {
+        LOG("[SYSMON] more than %u tasks, sampling skipped\n", SYSMON_MAX_TASKS);
+        return;
+    }
+    
+    xSemaphoreTake(sysmon_mutex, portMAX_DELAY);
+    
+    for (uint32_t i = 0; i < SYSMON_MAX_TASKS; i++)
+        entries[i].seen = false;
+    
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        const TaskStatus_t *status = &task_status[i];
+        sysmon_entry_t *entry = sysmon_find_entry(status->xTaskNumber);
+        if (entry == NULL)
+            continue;
+    
+        uint32_t delta = (status->ulRunTimeCounter - entry->runtime) / SYSMON_SLOT_UNIT_US;
+        entry->history[slot_index] = delta > UINT16_MAX ? UINT16_MAX : delta;
+        entry->runtime = status->ulRunTimeCounter;
+        entry->priority = status->uxCurrentPriority;
+        entry->seen = true;
+        strncpy(entry->name, status->pcTaskName, sizeof(entry->name) - 1);
+    
+        if (status->xHandle == xTaskGetIdleTaskHandle())
+            idle_number = status->xTaskNumber;
+    }
+    
+    // deleted tasks
+    for (uint32_t i = 0; i < SYSMON_MAX_TASKS; i++)
+    {
+        if (entries[i].used && !entries[i].seen)
+            entries[i].used = false;
+    }
+    
+    slot_elapsed[slot_index] = total - last_total;
+    last_total = total;
+    slot_index = (slot_index + 1) % SYSMON_HISTORY;
+    if (slot_count < SYSMON_HISTORY)
+        slot_count++;
+    
+    xSemaphoreGive(sysmon_mutex);
+}
+
+static uint16_t sysmon_share(const uint16_t history[], uint32_t window)
+{
+    uint32_t slots = window_slots[window] < slot_count ? window_slots[window] : slot_count;
+    uint64_t busy = 0, elapsed = 0;
+    
+    for (uint32_t i = 1; i <= slots; i++)
+    {
+        uint32_t slot = (slot_index + SYSMON_HISTORY - i) % SYSMON_HISTORY;
+        busy += history[slot];
+        elapsed += slot_elapsed[slot];
+    }
+    
+    if (elapsed == 0)
+        return 0;
+    
+    uint64_t share = busy * SYSMON_SLOT_UNIT_US * 1000 / elapsed;
+    return share > 1000 ? 1000 : (uint16_t)share;
+}
+
+uint32_t sysmon_get_tasks(sysmon_task_t tasks[], uint32_t max)
+{
+    uint32_t count = 0;
+    
+    xSemaphoreTake(sysmon_mutex, portMAX_DELAY);
+    for (uint32_t i = 0; i < SYSMON_MAX_TASKS && count < max; i++)
+    {
+        if (!entries[i].used)
+            continue;
+    
+        sysmon_task_t *task = &tasks[count++];
+        memcpy(task->name, entries[i].name, sizeof(task->name));
+        task->priority = entries[i].priority;
+        task->runtime_us = entries[i].runtime;
+        for (uint32_t w = 0; w < SYSMON_WINDOWS; w++)
+            task->cpu[w] = sysmon_share(entries[i].history, w);
+    }
+    xSemaphoreGive(sysmon_mutex);
+    
+    return count;
+}
+
+// 0.1 % units, 1000 minus what the idle task got
+uint16_t sysmon_get_load(uint32_t window)
+{
+    uint16_t load = 0;
+    
+    if (window >= SYSMON_WINDOWS)
+        return 0;
+    
+    xSemaphoreTake(sysmon_mutex, portMAX_DELAY);
+    for (uint32_t i = 0; i < SYSMON_MAX_TASKS; i++)
+    {
+        if (entries[i].used && entries[i].number == idle_number)
+        {
+            load = 1000 - sysmon_share(entries[i].history, window);
+            break;
+        }
+    }
+    xSemaphoreGive(sysmon_mutex);
+    
+    return load;
+}
+
+void sysmon_set_report_interval(uint32_t seconds)
+{
+    report_interval = seconds;
+}
+
+static void sysmon_report(void)
+{
+    static sysmon_task_t tasks[SYSMON_MAX_TASKS];
+    uint32_t count = sysmon_get_tasks(tasks, SYSMON_MAX_TASKS);
+    
+    uint16_t load_1s = sysmon_get_load(SYSMON_WINDOW_1S);
+    uint16_t load_10s = sysmon_get_load(SYSMON_WINDOW_10S);
+    uint16_t load_60s = sysmon_get_load(SYSMON_WINDOW_60S);
+    LOG("[SYSMON] load %u.%u%% %u.%u%% %u.%u%%\n",
+        load_1s / 10, load_1s % 10, load_10s / 10, load_10s % 10, load_60s / 10, load_60s % 10);
+    
+    for (uint32_t i = 0; i < count; i++)
+    {
+        LOG("[SYSMON] %-16s %3u.%u%% %3u.%u%% %3u.%u%%\n", tasks[i].name,
+            tasks[i].cpu[0] / 10, tasks[i].cpu[0] % 10,
+            tasks[i].cpu[1] / 10, tasks[i].cpu[1] % 10,
+            tasks[i].cpu[2] / 10, tasks[i].cpu[2] % 10);
+    }
+}
+
+static void cmd_top(int argc, char *argv[])
+{
+    static sysmon_task_t tasks[SYSMON_MAX_TASKS];
+    uint32_t count = sysmon_get_tasks(tasks, SYSMON_MAX_TASKS);
+    
+    if (argc > 1)
+    {
+        sysmon_set_report_interval(strtoul(argv[1], NULL, 10));
+        shell_printf("report every %lu s\n", report_interval);
+    }
+    
+    shell_printf("  load   %3u.%u%% %3u.%u%% %3u.%u%%\n",
+                 sysmon_get_load(0) / 10, sysmon_get_load(0) % 10,
+                 sysmon_get_load(1) / 10, sysmon_get_load(1) % 10,
+                 sysmon_get_load(2) / 10, sysmon_get_load(2) % 10);
+    shell_printf("  %-16s %4s %7s %7s %7s %10s\n", "task", "prio", "1s", "10s", "60s", "total ms");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        shell_printf("  %-16s %4lu %5u.%u%% %5u.%u%% %5u.%u%% %10lu\n",
+                     tasks[i].name, tasks[i].priority,
+                     tasks[i].cpu[0] / 10, tasks[i].cpu[0] % 10,
+                     tasks[i].cpu[1] / 10, tasks[i].cpu[1] % 10,
+                     tasks[i].cpu[2] / 10, tasks[i].cpu[2] % 10,
+                     tasks[i].runtime_us / 1000);
+    }
+}
+
+static void sysmon_func(void *param)
+{
+    TickType_t wake = xTaskGetTickCount();
+    uint32_t seconds = 0;
+    
+    while (1)
+    {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(SYSMON_SAMPLE_MS));
+        sysmon_sample();
+    
+        seconds++;
+        if (report_interval != 0 && seconds >= report_interval)
+        {
+            seconds = 0;
+            sysmon_report();
+        }
+    }
+}
+
+void sysmon_init(void)
+{
+    sysmon_mutex = xSemaphoreCreateMutex();
+    configASSERT(sysmon_mutex);
+    shell_register("top", "cpu usage per task [report interval s, 0 = off]", cmd_top);
+    
+    // high priority so a runaway lower priority task cannot hide itself
+    ccm_task_create(sysmon_func, "sysmon", 384, NULL, 8, NULL);
+}
@@ -0,0 +1,26 @@
+#ifndef __APP_SYSMON_H__
+#define __APP_SYSMON_H__
+
+#include <stdint.h>
+#include "FreeRTOS.h"
+
+// cpu shares are in 0.1 % units, over the last 1 s, 10 s and 60 s
+#define SYSMON_WINDOW_1S    0
+#define SYSMON_WINDOW_10S   1
+#define SYSMON_WINDOW_60S   2
+#define SYSMON_WINDOWS      3
+
+typedef struct
+{
+    char name[configMAX_TASK_NAME_LEN];
+    uint32_t priority;
+    uint32_t runtime_us;
+    uint16_t cpu[SYSMON_WINDOWS];
+} sysmon_task_t;
+
+void sysmon_init(void);
+uint32_t sysmon_get_tasks(sysmon_task_t tasks[], uint32_t max);
+uint16_t sysmon_get_load(uint32_t window);
+void sysmon_set_report_interval(uint32_t seconds);
+
+#endif /* __APP_SYSMON_H__ */
@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "rtc.h"
+#include "log.h"
+#include "timesync.h"
+
+#define TIMESYNC_MIN_BASELINE       (30.0f * 60)
+#define TIMESYNC_STEP_THRESHOLD     1.0f
+#define TIMESYNC_MAX_CALIBRATION    480.0f
+
+// SNTP reports whole seconds, so every sample is +-0.5 s around the middle
+#define TIMESYNC_SAMPLE_ERROR       0.5f
+
+static bool ref_valid;
+static uint32_t ref_ntp;
+static float ref_offset;
+static timesync_stats_t timesync_stats = { .interval_ms = TIMESYNC_MIN_INTERVAL };
+
+static void timesync_set_baseline(uint32_t ntp_seconds, float offset)
+{
+    ref_valid = true;
+    ref_ntp = ntp_seconds;
+    ref_offset = offset;
+}
+
+// the RTC starts the second at 0 ms, on average half a second after the
+// true time got there; later samples see that as the offset to start from
+static void timesync_step(const rtc_date_time_t *ntp)
+{
+    rtc_set_time(ntp);
+    timesync_stats.steps++;
+    timesync_set_baseline(rtc_to_seconds(ntp), -TIMESYNC_SAMPLE_ERROR);
+}
+
+uint32_t timesync_discipline(const rtc_date_time_t *ntp)
+{
+    rtc_date_time_t now;
+    uint16_t now_ms;
+    rtc_get_time_ms(&now, &now_ms);
+    
+    uint32_t ntp_seconds = rtc_to_seconds(ntp);
+    float offset = (float)((int32_t)(rtc_to_seconds(&now) - ntp_seconds)) +
+                   now_ms / 1000.0f - TIMESYNC_SAMPLE_ERROR;
+    
+    timesync_stats.samples++;
+    timesync_stats.last_offset = offset;
+    timesync_stats.calibration_ppm = rtc_get_calibration_ppm();
+    
+    if (!ref_valid || now.year < 2020)
+    {
+        timesync_step(ntp);
+        timesync_stats.interval_ms = TIMESYNC_MIN_INTERVAL;
+        return timesync_stats.interval_ms;
+    }
+    
+    float elapsed = (float)((int32_t)(ntp_seconds - ref_ntp));
+    if (elapsed >= TIMESYNC_MIN_BASELINE)
+    {
+        // the offset change since the baseline is what the LSE gained or lost
+        float drift_ppm = (offset - ref_offset) / elapsed * 1000000.0f;
+        float uncertainty_ppm = 2.0f * TIMESYNC_SAMPLE_ERROR / elapsed * 1000000.0f;
+        timesync_stats.drift_ppm = drift_ppm;
+        
+        if (drift_ppm > uncertainty_ppm || drift_ppm < -uncertainty_ppm)
+        {
+            float calibration = timesync_stats.calibration_ppm - drift_ppm;
+            if (calibration > TIMESYNC_MAX_CALIBRATION)
+                calibration = TIMESYNC_MAX_CALIBRATION;
+            if (calibration < -TIMESYNC_MAX_CALIBRATION)
+                calibration = -TIMESYNC_MAX_CALIBRATION;
+            
+            rtc_set_calibration_ppm(calibration);
+            timesync_stats.calibration_ppm = rtc_get_calibration_ppm();
+            timesync_stats.interval_ms = TIMESYNC_MIN_INTERVAL;
+            timesync_set_baseline(ntp_seconds, offset);
+        }
+        else if (timesync_stats.interval_ms < TIMESYNC_MAX_INTERVAL)
+        {
+            // drift is below what we can resolve: trust the calibration longer
+            timesync_stats.interval_ms *= 2;
+            if (timesync_stats.interval_ms > TIMESYNC_MAX_INTERVAL)
+                timesync_stats.interval_ms = TIMESYNC_MAX_INTERVAL;
+        }
+    }
+    
+    if (offset >= TIMESYNC_STEP_THRESHOLD || offset <= -TIMESYNC_STEP_THRESHOLD)
+        timesync_step(ntp);
+    
+    LOG("[SNTP] offset %.2f s, drift %.2f ppm, calibration %.2f ppm, next sync in %lu min\n",
+        offset, timesync_stats.drift_ppm, timesync_stats.calibration_ppm,
+        (unsigned long)(timesync_stats.interval_ms / 60000));
+    
+    return timesync_stats.interval_ms;
+}
+
+void timesync_get_stats(timesync_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &timesync_stats, sizeof(timesync_stats_t));
+    taskEXIT_CRITICAL();
+}
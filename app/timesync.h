@@ -0,0 +1,24 @@
+#ifndef __APP_TIMESYNC_H__
+#define __APP_TIMESYNC_H__
+
+#include <stdint.h>
+#include "rtc.h"
+
+// ms between syncs, doubled while the drift stays within the noise
+#define TIMESYNC_MIN_INTERVAL       (60ul * 60 * 1000)
+#define TIMESYNC_MAX_INTERVAL       (24ul * 60 * 60 * 1000)
+
+typedef struct
+{
+    uint32_t samples;
+    uint32_t steps;
+    float last_offset;
+    float drift_ppm;
+    float calibration_ppm;
+    uint32_t interval_ms;
+} timesync_stats_t;
+
+uint32_t timesync_discipline(const rtc_date_time_t *ntp);
+void timesync_get_stats(timesync_stats_t *stats);
+
+#endif /* __APP_TIMESYNC_H__ */
@@ -4,16 +4,26 @@
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
+#include "semphr.h"
 #include "st7789.h"
+#include "tim_delay.h"
 #include "ui.h"
 #include "font.h"
+#include "log.h"
+#include "trace.h"
 #include "image.h"
+#include "clkscale.h"
+#include "ccm.h"
+#include "mempool.h"
 
 typedef enum
 {
     UI_ACTION_FILL_COLOR,
     UI_ACTION_WRITE_STRING,
     UI_ACTION_DRAW_IMAGE,
+    UI_ACTION_SET_BRIGHTNESS,
+    UI_ACTION_SET_MODE,
+    UI_ACTION_SYNC,
 } ui_action_t;
 
 typedef struct
@@ -44,51 +54,245 @@ typedef struct
             uint16_t y;
             const image_t *image;
         } draw_image;
+        struct
+        {
+            uint8_t percent;
+            uint32_t fade_ms;
+        } set_brightness;
+        struct
+        {
+            ui_mode_t mode;
+            uint16_t y1;
+            uint16_t y2;
+        } set_mode;
     };
 } ui_message_t;
 
+#define UI_QUEUE_LENGTH 16
+// a line of the smallest font across the whole panel is 30 characters;
+// one block per queued message, one being drawn and a few in senders
+// waiting for the queue
+#define UI_STRING_SIZE      32
+#define UI_STRING_BLOCKS    (UI_QUEUE_LENGTH + 4)
+#define UI_NIGHT_STRIP_PIXELS   1024
+
 static QueueHandle_t ui_queue;
+static SemaphoreHandle_t ui_mutex;
+static SemaphoreHandle_t ui_sync_semaphore;
+static ui_stats_t ui_stats;
+static volatile ui_mode_t ui_mode;
+static uint16_t band_y1, band_y2;
+static mempool_t string_pool;
+static CCM_DATA MEMPOOL_STORAGE(string_storage, UI_STRING_SIZE, UI_STRING_BLOCKS);
+// night images go through the palette here, a strip of rows at a time
+static DMA_DATA uint16_t night_strip[UI_NIGHT_STRIP_PIXELS];
+
+// Night keeps only the rows y1..y2 on the panel (partial mode) in 8-colour
+// idle mode; anything drawn outside them is dropped instead of sent over
+// SPI, and the whole panel is dropped while it sleeps. Switching back
+// needs a full repaint. Images in the band are kept, but their pixels go
+// through the night palette like every other colour (ui_draw_night_image).
+static bool ui_visible(uint16_t y1, uint16_t y2)
+{
+    if (ui_mode == UI_MODE_OFF)
+        return false;
+    if (ui_mode == UI_MODE_NIGHT)
+        return y2 >= band_y1 && y1 <= band_y2;
+    return true;
+}
+
+// night palette: inverted, then each channel snapped fully on or off so it
+// survives the 8-colour mode; light backgrounds go black, dark and grey
+// text goes bright
+static uint16_t ui_color(uint16_t color)
+{
+    if (ui_mode != UI_MODE_NIGHT)
+        return color;
+    
+    uint16_t r = 31 - (color >> 11);
+    uint16_t g = 63 - ((color >> 5) & 0x3F);
+    uint16_t b = 31 - (color & 0x1F);
+    return (r >= 8 ? 0xF800 : 0) | (g >= 16 ? 0x07E0 : 0) | (b >= 8 ? 0x001F : 0);
+}
+
+// a strip at a time through night_strip, strips outside the band are
+// not sent at all
+static void ui_draw_night_image(uint16_t x, uint16_t y, const image_t *image)
+{
+    uint16_t rows = UI_NIGHT_STRIP_PIXELS / image->width;
+    if (rows == 0)
+        return;
+    
+    for (uint16_t row = 0; row < image->height; row += rows)
+    {
+        image_t strip = { image->width, image->height - row, (const uint8_t *)night_strip };
+        if (strip.height > rows)
+            strip.height = rows;
+        if (!ui_visible(y + row, y + row + strip.height - 1))
+            continue;
+        
+        const uint8_t *data = image->data + (uint32_t)row * image->width * 2;
+        for (uint32_t i = 0; i < (uint32_t)strip.width * strip.height; i++)
+            night_strip[i] = ui_color(data[2 * i] | (data[2 * i + 1] << 8));
+        st7789_draw_image(x, y + row, &strip);
+    }
+}
+
+static void ui_apply_mode(ui_mode_t mode, uint16_t y1, uint16_t y2)
+{
+    if (ui_mode == UI_MODE_OFF && mode != UI_MODE_OFF)
+        st7789_sleep(false);
+    
+    switch (mode)
+    {
+    case UI_MODE_DAY:
+        st7789_set_idle(false);
+        st7789_set_normal();
+        break;
+    case UI_MODE_NIGHT:
+        st7789_set_partial(y1, y2);
+        st7789_set_idle(true);
+        break;
+    case UI_MODE_OFF:
+        if (ui_mode != UI_MODE_OFF)
+            st7789_sleep(true);
+        break;
+    }
+    
+    band_y1 = y1;
+    band_y2 = y2;
+    ui_mode = mode;
+}
 
+// full speed while there is a burst of drawing queued, glyphs are
+// expanded by the CPU
 static void ui_func(void *param)
 {
     ui_message_t msg;
+    bool boosted = false;
     
     st7789_init();
     
     while (1)
     {
         xQueueReceive(ui_queue, &msg, portMAX_DELAY);
+        if (!boosted)
+        {
+            clkscale_request(CLKSCALE_HIGH);
+            boosted = true;
+        }
+        uint64_t start = tim_get_us();
+        trace_begin(TRACE_CH_UI_DRAW);
         // st7789_fill_color  st7789是lcd显示屏的驱动芯片
         switch (msg.action)
         {
         case UI_ACTION_FILL_COLOR:
+            if (!ui_visible(msg.fill_color.y, msg.fill_color.height))
+            {
+                ui_stats.dropped++;
+                break;
+            }
             st7789_fill_color(msg.fill_color.x, msg.fill_color.y,
                               msg.fill_color.width, msg.fill_color.height,
-                              msg.fill_color.color);
+                              ui_color(msg.fill_color.color));
             break;
         case UI_ACTION_WRITE_STRING:
-            st7789_write_string(msg.write_string.x, msg.write_string.y,
-                                msg.write_string.str,
-                                msg.write_string.color, msg.write_string.bg_color,
-                                msg.write_string.font);
-            vPortFree((void*)msg.write_string.str);
+            if (ui_visible(msg.write_string.y, msg.write_string.y + msg.write_string.font->size - 1))
+                st7789_write_string(msg.write_string.x, msg.write_string.y,
+                                    msg.write_string.str,
+                                    ui_color(msg.write_string.color), ui_color(msg.write_string.bg_color),
+                                    msg.write_string.font);
+            else
+                ui_stats.dropped++;
+            mempool_free(&string_pool, (void *)msg.write_string.str);
             break;
         case UI_ACTION_DRAW_IMAGE:
-            st7789_draw_image(msg.draw_image.x, msg.draw_image.y,
-                              msg.draw_image.image);
+            if (!ui_visible(msg.draw_image.y, msg.draw_image.y + msg.draw_image.image->height - 1))
+            {
+                ui_stats.dropped++;
+                break;
+            }
+            if (ui_mode == UI_MODE_NIGHT)
+                ui_draw_night_image(msg.draw_image.x, msg.draw_image.y, msg.draw_image.image);
+            else
+                st7789_draw_image(msg.draw_image.x, msg.draw_image.y,
+                                  msg.draw_image.image);
+            break;
+        case UI_ACTION_SET_BRIGHTNESS:
+            st7789_set_brightness(msg.set_brightness.percent, msg.set_brightness.fade_ms);
+            break;
+        case UI_ACTION_SET_MODE:
+            ui_apply_mode(msg.set_mode.mode, msg.set_mode.y1, msg.set_mode.y2);
+            break;
+        case UI_ACTION_SYNC:
+            xSemaphoreGive(ui_sync_semaphore);
             break;
         default:
-            printf("Unknown UI action: %d\n", msg.action);
+            LOG("Unknown UI action: %d\n", msg.action);
             break;
         }
+        
+        trace_end(TRACE_CH_UI_DRAW);
+        taskENTER_CRITICAL();
+        ui_stats.actions++;
+        ui_stats.busy_us += tim_get_us() - start;
+        taskEXIT_CRITICAL();
+        
+        // stay up while the next message is already waiting
+        if (uxQueueMessagesWaiting(ui_queue) == 0)
+        {
+            clkscale_release(CLKSCALE_HIGH);
+            boosted = false;
+        }
     }
 }
 
 void ui_init(void)
 {
-    ui_queue = xQueueCreate(16, sizeof(ui_message_t));
+    ui_queue = xQueueCreate(UI_QUEUE_LENGTH, sizeof(ui_message_t));
     configASSERT(ui_queue);
-    xTaskCreate(ui_func, "ui", 1024, NULL, 8, NULL);
+    ui_mutex = xSemaphoreCreateRecursiveMutex();
+    configASSERT(ui_mutex);
+    ui_sync_semaphore = xSemaphoreCreateBinary();
+    configASSERT(ui_sync_semaphore);
+    mempool_init(&string_pool, "ui string", string_storage, UI_STRING_SIZE, UI_STRING_BLOCKS);
+    vQueueAddToRegistry(ui_queue, "ui");
+    ccm_task_create(ui_func, "ui", 1024, NULL, 8, NULL);
+}
+
+static void ui_send(const ui_message_t *msg)
+{
+    xSemaphoreTakeRecursive(ui_mutex, portMAX_DELAY);
+    xQueueSend(ui_queue, msg, portMAX_DELAY);
+    
+    uint32_t depth = uxQueueMessagesWaiting(ui_queue);
+    if (depth > ui_stats.pending_peak)
+        ui_stats.pending_peak = depth;
+    xSemaphoreGiveRecursive(ui_mutex);
+}
+
+// while held, drawing from other tasks waits in ui_send, so what the
+// holder sends reaches the panel on its own (bench); nests
+void ui_lock(void)
+{
+    xSemaphoreTakeRecursive(ui_mutex, portMAX_DELAY);
+}
+
+void ui_unlock(void)
+{
+    xSemaphoreGiveRecursive(ui_mutex);
+}
+
+// returns once everything sent before it has been drawn
+void ui_sync(void)
+{
+    ui_message_t msg;
+    msg.action = UI_ACTION_SYNC;
+    
+    ui_lock();
+    ui_send(&msg);
+    xSemaphoreTake(ui_sync_semaphore, portMAX_DELAY);
+    ui_unlock();
 }
 
 void ui_fill_color(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t color)
@@ -101,18 +305,29 @@ void ui_fill_color(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint
     msg.fill_color.height = height;
     msg.fill_color.color = color;
     
-    xQueueSend(ui_queue, &msg, portMAX_DELAY);
+    ui_send(&msg);
 }
 
 void ui_write_string(uint16_t x, uint16_t y, const char *str, uint16_t color, uint16_t bg_color, const font_t *font)
 {
-    char *pstr = pvPortMalloc(strlen(str) + 1);
+    char *pstr = mempool_alloc(&string_pool);
     if (pstr == NULL)
     {
-        printf("ui write string malloc failed: %s", str);
+        LOG("ui write string: no block for %s\n", str);
         return;
     }
-    strcpy(pstr, str);
+    
+    // anything longer is off the panel; don't split a GBK pair
+    uint32_t len = 0;
+    while (str[len] != '\0' && len < UI_STRING_SIZE - 1)
+    {
+        uint32_t n = (uint8_t)str[len] >= 0x80 ? 2 : 1;
+        if (len + n > UI_STRING_SIZE - 1)
+            break;
+        len += n;
+    }
+    memcpy(pstr, str, len);
+    pstr[len] = '\0';
     
     ui_message_t msg;
     msg.action = UI_ACTION_WRITE_STRING;
@@ -123,7 +338,7 @@ void ui_write_string(uint16_t x, uint16_t y, const char *str, uint16_t color, ui
     msg.write_string.bg_color = bg_color;
     msg.write_string.font = font;
     
-    xQueueSend(ui_queue, &msg, portMAX_DELAY);
+    ui_send(&msg);
 }
 
 void ui_draw_image(uint16_t x, uint16_t y, const image_t *image)
@@ -134,5 +349,41 @@ void ui_draw_image(uint16_t x, uint16_t y, const image_t *image)
     msg.draw_image.y = y;
     msg.draw_image.image = image;
     
-    xQueueSend(ui_queue, &msg, portMAX_DELAY);
+    ui_send(&msg);
+}
+
+void ui_set_brightness(uint8_t percent, uint32_t fade_ms)
+{
+    ui_message_t msg;
+    msg.action = UI_ACTION_SET_BRIGHTNESS;
+    msg.set_brightness.percent = percent;
+    msg.set_brightness.fade_ms = fade_ms;
+    
+    ui_send(&msg);
+}
+
+// y1..y2 are the rows kept in UI_MODE_NIGHT
+void ui_set_mode(ui_mode_t mode, uint16_t y1, uint16_t y2)
+{
+    ui_message_t msg;
+    msg.action = UI_ACTION_SET_MODE;
+    msg.set_mode.mode = mode;
+    msg.set_mode.y1 = y1;
+    msg.set_mode.y2 = y2;
+    
+    ui_send(&msg);
+}
+
+ui_mode_t ui_get_mode(void)
+{
+    return ui_mode;
+}
+
+void ui_get_stats(ui_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &ui_stats, sizeof(ui_stats_t));
+    taskEXIT_CRITICAL();
+    stats->pending = uxQueueMessagesWaiting(ui_queue);
+    stats->length = UI_QUEUE_LENGTH;
 }
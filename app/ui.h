@@ -8,11 +8,35 @@
 #define UI_WIDTH    240
 #define UI_HEIGHT   320
 
+typedef struct
+{
+    uint32_t actions;
+    uint32_t pending;
+    uint32_t pending_peak;
+    uint32_t length;
+    uint64_t busy_us;
+    uint32_t dropped;
+} ui_stats_t;
+
+typedef enum
+{
+    UI_MODE_DAY,
+    UI_MODE_NIGHT,
+    UI_MODE_OFF,
+} ui_mode_t;
+
 #define mkcolor(r, g, b) (((r & 0xF8) << 8) | ((g & 0xFC) << 3) | (b >> 3))
 
 void ui_init(void);
 void ui_fill_color(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t color);
 void ui_write_string(uint16_t x, uint16_t y, const char *str, uint16_t color, uint16_t bg_color, const font_t *font);
 void ui_draw_image(uint16_t x, uint16_t y, const image_t *image);
+void ui_set_brightness(uint8_t percent, uint32_t fade_ms);
+void ui_set_mode(ui_mode_t mode, uint16_t y1, uint16_t y2);
+ui_mode_t ui_get_mode(void);
+void ui_get_stats(ui_stats_t *stats);
+void ui_lock(void);
+void ui_unlock(void);
+void ui_sync(void);
 
 #endif /* __APP_UI_H__ */
@@ -24,7 +24,7 @@ bool parse_seniverse_response(const char *response, weather_info_t *info)
 	const char *loaction_path_response = strstr(location_response, "\"path\":");
 	if (loaction_path_response)
 	{
-		sscanf(loaction_path_response, "\"path\": \"%128[^\"]\"", info->loaction);
+		sscanf(loaction_path_response, "\"path\": \"%127[^\"]\"", info->loaction);
 	}
 	
 	const char *now_response = strstr(response, "\"now\":");
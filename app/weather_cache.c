@@ -0,0 +1,112 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "rtc.h"
+#include "bl24c512.h"
+#include "log.h"
+#include "weather.h"
+#include "weather_cache.h"
+
+// The last weather report, kept in the EEPROM so the main page has an
+// outdoor reading at boot before the network is up. One record at the
+// start of the chip, written only when the report changes; a torn write
+// fails the CRC and is treated as no cache. Anything older than
+// WEATHER_CACHE_MAX_AGE is not shown, unless the RTC has lost the date or
+// runs behind the save: then nothing says how old it is.
+#define WEATHER_CACHE_ADDR      0x0000
+#define WEATHER_CACHE_MAGIC     0x57434331u
+#define WEATHER_CACHE_MAX_AGE   (12ul * 60 * 60)
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t saved;
+    char city[32];
+    char weather[16];
+    int32_t weather_code;
+    float temperature;
+    uint32_t crc;
+} weather_cache_record_t;
+
+static uint32_t weather_cache_crc(const void *data, uint32_t length)
+{
+    const uint8_t *p = data;
+    uint32_t crc = 0xFFFFFFFF;
+    
+    while (length--)
+    {
+        crc ^= *p++;
+        for (uint32_t bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    
+    return ~crc;
+}
+
+static bool weather_cache_now(uint32_t *seconds)
+{
+    rtc_date_time_t now;
+    rtc_get_time(&now);
+    if (now.year < 2020)
+        return false;
+    
+    *seconds = rtc_to_seconds(&now);
+    return true;
+}
+
+bool weather_cache_load(weather_info_t *info)
+{
+    weather_cache_record_t record;
+    
+    if (!bl24c512_read(WEATHER_CACHE_ADDR, &record, sizeof(record)))
+    {
+        LOG("[CACHE] eeprom read failed\n");
+        return false;
+    }
+    
+    if (record.magic != WEATHER_CACHE_MAGIC ||
+        record.crc != weather_cache_crc(&record, offsetof(weather_cache_record_t, crc)))
+        return false;
+    
+    uint32_t now;
+    if (weather_cache_now(&now) && record.saved != 0 && now > record.saved &&
+        now - record.saved > WEATHER_CACHE_MAX_AGE)
+    {
+        LOG("[CACHE] weather from %lu min ago, too old\n", (now - record.saved) / 60);
+        return false;
+    }
+    
+    memset(info, 0, sizeof(weather_info_t));
+    memcpy(info->city, record.city, sizeof(info->city));
+    memcpy(info->weather, record.weather, sizeof(info->weather));
+    info->city[sizeof(info->city) - 1] = '\0';
+    info->weather[sizeof(info->weather) - 1] = '\0';
+    info->weather_code = record.weather_code;
+    info->temperature = record.temperature;
+    
+    return true;
+}
+
+bool weather_cache_save(const weather_info_t *info)
+{
+    weather_cache_record_t record;
+    
+    memset(&record, 0, sizeof(record));
+    record.magic = WEATHER_CACHE_MAGIC;
+    if (!weather_cache_now(&record.saved))
+        record.saved = 0;
+    memcpy(record.city, info->city, sizeof(record.city));
+    memcpy(record.weather, info->weather, sizeof(record.weather));
+    record.weather_code = info->weather_code;
+    record.temperature = info->temperature;
+    record.crc = weather_cache_crc(&record, offsetof(weather_cache_record_t, crc));
+    
+    if (!bl24c512_write(WEATHER_CACHE_ADDR, &record, sizeof(record)))
+    {
+        LOG("[CACHE] eeprom write failed\n");
+        return false;
+    }
+    
+    return true;
+}
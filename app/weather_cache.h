@@ -0,0 +1,10 @@
+#ifndef __APP_WEATHER_CACHE_H__
+#define __APP_WEATHER_CACHE_H__
+
+#include <stdbool.h>
+#include "weather.h"
+
+bool weather_cache_load(weather_info_t *info);
+bool weather_cache_save(const weather_info_t *info);
+
+#endif /* __APP_WEATHER_CACHE_H__ */
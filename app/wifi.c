@@ -1,67 +1,251 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include "FreeRTOS.h"
 #include "task.h"
 #include "esp_at.h"
-#include "page.h"
+#include "workqueue.h"
+#include "ccm.h"
+#include "tim_delay.h"
+#include "shell.h"
+#include "log.h"
 #include "wifi.h"
 
-void wifi_init(void)
+// Connection manager: brings the ESP32 up, joins the access point and
+// keeps checking the link, one step at a time from its own low priority
+// task, so the seconds a join or a boot blocks on the module never hold
+// up the workqueue; the AT driver serializes it against the network jobs.
+// A failed step waits an exponential backoff with jitter before the next
+// try; every WIFI_RESET_FAILURES in a row the module is reset (EN, or
+// AT+RST on a board without it, see esp_at.c) and brought up from scratch.
+#define WIFI_BACKOFF_BASE_MS    2000
+#define WIFI_BACKOFF_MAX_MS     (5 * 60 * 1000)
+#define WIFI_RESET_FAILURES     4
+#define WIFI_CHECK_INTERVAL_MS  5000
+// link checks the module did not answer before it counts as hung
+#define WIFI_CHECK_MISSES       3
+#define WIFI_TASK_PRIORITY      2
+
+static const char *state_names[] = { "start", "join", "online", "backoff" };
+
+static wifi_event_func_t event_func;
+// the link the last online event reported
+static esp_wifi_info_t event_info;
+static wifi_stats_t wifi_stats;
+// where BACKOFF goes once it has waited
+static wifi_state_t retry_state;
+static uint32_t check_misses;
+static uint32_t random_state;
+
+// xorshift32, only for the jitter; boot takes the same number of cycles
+// every time, the module's reply times don't, so they are stirred in
+static uint32_t wifi_random(void)
 {
-    if (!esp_at_init())
+    random_state ^= tim_get_cycles();
+    if (random_state == 0)
+        random_state = 1;
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// half the doubled delay fixed, half random, so clocks that lost the same
+// access point don't all come back at the same moment
+static uint32_t wifi_backoff_ms(uint32_t failures)
+{
+    uint32_t ceiling = WIFI_BACKOFF_BASE_MS;
+    for (uint32_t i = 1; i < failures && ceiling < WIFI_BACKOFF_MAX_MS; i++)
+        ceiling *= 2;
+    if (ceiling > WIFI_BACKOFF_MAX_MS)
+        ceiling = WIFI_BACKOFF_MAX_MS;
+    
+    return ceiling / 2 + wifi_random() % (ceiling / 2 + 1);
+}
+
+static void wifi_set_state(wifi_state_t state)
+{
+    taskENTER_CRITICAL();
+    wifi_stats.state = state;
+    taskEXIT_CRITICAL();
+}
+
+static void wifi_event_work(void *param)
+{
+    if (param == NULL)
     {
-        printf("[AT] init failed\n");
-        goto err;
+        event_func(NULL);
+        return;
     }
-    printf("[AT] inited\n");
     
-    if (!esp_at_wifi_init())
+    esp_wifi_info_t info;
+    taskENTER_CRITICAL();
+    memcpy(&info, &event_info, sizeof(esp_wifi_info_t));
+    taskEXIT_CRITICAL();
+    event_func(&info);
+}
+
+// handlers run on the workqueue, next to the jobs that use what they set
+static void wifi_event(const esp_wifi_info_t *info)
+{
+    if (info)
     {
-        printf("[WIFI] init failed\n");
-        goto err;
+        taskENTER_CRITICAL();
+        memcpy(&event_info, info, sizeof(esp_wifi_info_t));
+        taskEXIT_CRITICAL();
     }
-    printf("[WIFI] inited\n");
-    
-    if (!esp_at_sntp_init())
+    workqueue_run(wifi_event_work, info ? &event_info : NULL);
+}
+
+static uint32_t wifi_failed(const char *what)
+{
+    wifi_stats.failures++;
+    if (wifi_stats.failures % WIFI_RESET_FAILURES == 0)
     {
-        printf("[SNTP] init failed\n");
-        goto err;
+        LOG("[WIFI] %lu failures in a row, resetting the module\n", wifi_stats.failures);
+        esp_at_hard_reset();
+        wifi_stats.resets++;
+        retry_state = WIFI_STATE_START;
     }
-    printf("[SNTP] inited\n");
     
-    return;
+    wifi_stats.backoff_ms = wifi_backoff_ms(wifi_stats.failures);
+    LOG("%s failed, retry in %lu ms\n", what, wifi_stats.backoff_ms);
+    wifi_set_state(WIFI_STATE_BACKOFF);
+    return wifi_stats.backoff_ms;
+}
+
+static uint32_t wifi_start(void)
+{
+    retry_state = WIFI_STATE_START;
+    
+    if (!esp_at_init())
+        return wifi_failed("[AT] init");
+    LOG("[AT] inited\n");
     
-err:
-    error_page_display("wireless init failed");
-    while (1)
-    {
-        ;
-    }
+    if (!esp_at_wifi_init())
+        return wifi_failed("[WIFI] init");
+    LOG("[WIFI] inited\n");
+    
+    if (!esp_at_sntp_init())
+        return wifi_failed("[SNTP] init");
+    LOG("[SNTP] inited\n");
+    
+    retry_state = WIFI_STATE_JOIN;
+    wifi_set_state(WIFI_STATE_JOIN);
+    return 0;
 }
 
-void wifi_wait_connect(void)
+static uint32_t wifi_join(void)
 {
-    printf("[WIFI] connecting\n");
+    LOG("[WIFI] connecting\n");
+    
+    esp_wifi_info_t info = { 0 };
+    if (!esp_at_connect_wifi(WIFI_SSID, WIFI_PASSWD, NULL) ||
+        !esp_at_get_wifi_info(&info) || !info.connected)
+        return wifi_failed("[WIFI] join");
     
-    esp_at_connect_wifi(WIFI_SSID, WIFI_PASSWD, NULL);
+    LOG("[WIFI] connected to %s\n", info.ssid);
+    LOG("[WIFI] SSID: %s, BSSID: %s, Channel: %d, RSSI: %d\n",
+        info.ssid, info.bssid, info.channel, info.rssi);
     
-    for (uint32_t t = 0; t < 10 * 1000; t += 100)
+    wifi_stats.failures = 0;
+    wifi_stats.connects++;
+    check_misses = 0;
+    wifi_set_state(WIFI_STATE_ONLINE);
+    wifi_event(&info);
+    return WIFI_CHECK_INTERVAL_MS;
+}
+
+static uint32_t wifi_check(void)
+{
+    esp_wifi_info_t info = { 0 };
+    if (!esp_at_get_wifi_info(&info))
     {
-        vTaskDelay(pdMS_TO_TICKS(100));
-        esp_wifi_info_t wifi = { 0 };
-        if (esp_at_get_wifi_info(&wifi) && wifi.connected)
-        {
-            printf("[WIFI] Connected\n");
-            printf("[WIFI] SSID: %s, BSSID: %s, Channel: %d, RSSI: %d\n",
-                wifi.ssid, wifi.bssid, wifi.channel, wifi.rssi);
-            return;
-        }
+        if (++check_misses < WIFI_CHECK_MISSES)
+            return WIFI_CHECK_INTERVAL_MS;
+    
+        LOG("[WIFI] module not answering, resetting it\n");
+        esp_at_hard_reset();
+        wifi_stats.resets++;
+        retry_state = WIFI_STATE_START;
+    }
+    else if (!info.connected)
+    {
+        LOG("[WIFI] link lost\n");
+        retry_state = WIFI_STATE_JOIN;
+    }
+    else
+    {
+        check_misses = 0;
+        return WIFI_CHECK_INTERVAL_MS;
     }
     
-    printf("[WIFI] Connection Timeout\n");
-    error_page_display("wireless connect failed");
+    // join again straight away, the backoff starts with the first failure
+    wifi_stats.drops++;
+    wifi_set_state(retry_state);
+    wifi_event(NULL);
+    return 0;
+}
+
+static void wifi_func(void *param)
+{
     while (1)
     {
-        ;
+        uint32_t delay_ms = 0;
+        
+        switch (wifi_stats.state)
+        {
+        case WIFI_STATE_START:
+            delay_ms = wifi_start();
+            break;
+        case WIFI_STATE_JOIN:
+            delay_ms = wifi_join();
+            break;
+        case WIFI_STATE_ONLINE:
+            delay_ms = wifi_check();
+            break;
+        case WIFI_STATE_BACKOFF:
+            wifi_set_state(retry_state);
+            break;
+        }
+        
+        if (delay_ms)
+            vTaskDelay(pdMS_TO_TICKS(delay_ms));
     }
 }
+
+static void cmd_wifi(int argc, char *argv[])
+{
+    wifi_stats_t stats;
+    wifi_get_stats(&stats);
+    
+    shell_printf("  state     %s", state_names[stats.state]);
+    if (stats.state == WIFI_STATE_BACKOFF)
+        shell_printf(" %lu ms, then %s", stats.backoff_ms, state_names[retry_state]);
+    shell_printf("\n  failures  %lu in a row\n", stats.failures);
+    shell_printf("  connects  %lu, drops %lu, resets %lu\n", stats.connects, stats.drops, stats.resets);
+}
+
+// returns at once, the first step runs from the manager's task
+void wifi_init(wifi_event_func_t func)
+{
+    event_func = func;
+    wifi_stats.state = WIFI_STATE_START;
+    
+    ccm_task_create(wifi_func, "wifi", 512, NULL, WIFI_TASK_PRIORITY, NULL);
+    
+    shell_register("wifi", "connection state, failures and resets", cmd_wifi);
+}
+
+bool wifi_is_online(void)
+{
+    return wifi_stats.state == WIFI_STATE_ONLINE;
+}
+
+void wifi_get_stats(wifi_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &wifi_stats, sizeof(wifi_stats_t));
+    taskEXIT_CRITICAL();
+}
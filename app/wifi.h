@@ -1,12 +1,41 @@
 #ifndef __WIFI_H__
 #define __WIFI_H__
 
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_at.h"
+
 #define APP_VERSION "v1.0"
 #define WIFI_SSID   "vivo X200 Pro mini"
 #define WIFI_PASSWD "abc123456"
 
-void wifi_init(void);
-void wifi_wait_connect(void);
+typedef enum
+{
+    WIFI_STATE_START,
+    WIFI_STATE_JOIN,
+    WIFI_STATE_ONLINE,
+    WIFI_STATE_BACKOFF,
+} wifi_state_t;
+
+typedef struct
+{
+    wifi_state_t state;
+    // in a row, back to 0 once online
+    uint32_t failures;
+    uint32_t connects;
+    uint32_t drops;
+    uint32_t resets;
+    // the wait before the next attempt, while in WIFI_STATE_BACKOFF
+    uint32_t backoff_ms;
+} wifi_stats_t;
+
+// from the workqueue, on every change between online and offline; info
+// is the link that came up, NULL when it went down
+typedef void (*wifi_event_func_t)(const esp_wifi_info_t *info);
+
+void wifi_init(wifi_event_func_t func);
+bool wifi_is_online(void);
+void wifi_get_stats(wifi_stats_t *stats);
 
 
 #endif /* __WIFI_H__ */
@@ -1,16 +1,23 @@
 #include <stdint.h>
+#include <string.h>
 #include "FreeRTOS.h"
 #include "task.h"
 #include "queue.h"
+#include "tim_delay.h"
+#include "ccm.h"
 #include "workqueue.h"
 
+#define WORKQUEUE_LENGTH    16
+
 typedef struct
 {
     work_t work;
     void *param;
+    uint64_t queued_us;
 } work_message_t;
 
 static QueueHandle_t work_msg_queue;
+static workqueue_stats_t work_stats;
 
 static void work_func(void *param)
 {
@@ -19,25 +26,63 @@ static void work_func(void *param)
     while (1)
     {
         xQueueReceive(work_msg_queue, &msg, portMAX_DELAY);
+        
+        uint64_t start = tim_get_us();
         msg.work(msg.param);
+        uint64_t end = tim_get_us();
+        
+        uint32_t wait_us = (uint32_t)(start - msg.queued_us);
+        uint32_t run_us = (uint32_t)(end - start);
+        
+        taskENTER_CRITICAL();
+        work_stats.jobs++;
+        work_stats.wait_total_us += wait_us;
+        work_stats.run_total_us += run_us;
+        if (wait_us > work_stats.wait_max_us)
+            work_stats.wait_max_us = wait_us;
+        if (run_us > work_stats.run_max_us)
+            work_stats.run_max_us = run_us;
+        taskEXIT_CRITICAL();
     }
 }
 
 void workqueue_init(void)
 {
-    work_msg_queue = xQueueCreate(16, sizeof(work_message_t));
+    work_msg_queue = xQueueCreate(WORKQUEUE_LENGTH, sizeof(work_message_t));
     configASSERT(work_msg_queue);
-    xTaskCreate(work_func, "workqueue", 1024, NULL, 5, NULL);
+    vQueueAddToRegistry(work_msg_queue, "workqueue");
+    ccm_task_create(work_func, "workqueue", 1024, NULL, 5, NULL);
 }
 
 void workqueue_run(work_t work, void *param)
 {
     configASSERT(work_msg_queue);
-    work_message_t msg = { work, param };
+    work_message_t msg = { work, param, tim_get_us() };
     xQueueSend(work_msg_queue, &msg, portMAX_DELAY);
+    
+    uint32_t depth = uxQueueMessagesWaiting(work_msg_queue);
+    if (depth > work_stats.pending_peak)
+        work_stats.pending_peak = depth;
 }
- 
-
 
+uint32_t workqueue_pending(void)
+{
+    configASSERT(work_msg_queue);
+    return uxQueueMessagesWaiting(work_msg_queue);
+}
 
+void workqueue_get_stats(workqueue_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &work_stats, sizeof(workqueue_stats_t));
+    taskEXIT_CRITICAL();
+    stats->pending = workqueue_pending();
+    stats->length = WORKQUEUE_LENGTH;
+}
 
+void workqueue_reset_stats(void)
+{
+    taskENTER_CRITICAL();
+    memset(&work_stats, 0, sizeof(workqueue_stats_t));
+    taskEXIT_CRITICAL();
+}
@@ -1,9 +1,28 @@
 #ifndef __APP_WORKQUEUE_H__
 #define __APP_WORKQUEUE_H__
 
+#include <stdint.h>
+
 typedef void (*work_t)(void *param);
 
+typedef struct
+{
+    uint32_t jobs;
+    uint32_t pending;
+    uint32_t pending_peak;
+    uint32_t length;
+    // queued -> started
+    uint32_t wait_max_us;
+    uint64_t wait_total_us;
+    // started -> finished
+    uint32_t run_max_us;
+    uint64_t run_total_us;
+} workqueue_stats_t;
+
 void workqueue_init(void);
 void workqueue_run(work_t work, void *param);
+uint32_t workqueue_pending(void);
+void workqueue_get_stats(workqueue_stats_t *stats);
+void workqueue_reset_stats(void);
 
 #endif /* __APP_WORKQUEUE_H__ */
@@ -2,8 +2,9 @@
 #include <stdint.h>
 #include "FreeRTOS.h"
 #include "task.h"
-#include "stm32f4xx.h"
-#include "tim_delay.h"
+#include "i2c_bus.h"
+
+#define AHT20_ADDR  0x70
 
 static bool aht20_write(uint8_t data[], uint32_t length);
 static bool aht20_read(uint8_t data[], uint32_t length);
@@ -11,27 +12,6 @@ static bool aht20_is_ready(void);
 
 bool aht20_init(void)
 {
-    I2C_InitTypeDef I2C_InitStruct;
-    I2C_StructInit(&I2C_InitStruct);
-    I2C_InitStruct.I2C_Ack = I2C_Ack_Enable;
-    I2C_InitStruct.I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
-    I2C_InitStruct.I2C_ClockSpeed = 100ul * 1000ul;
-    I2C_InitStruct.I2C_DutyCycle = I2C_DutyCycle_2;
-    I2C_InitStruct.I2C_Mode = I2C_Mode_I2C;
-    I2C_InitStruct.I2C_OwnAddress1 = 0x00;
-    I2C_Init(I2C2, &I2C_InitStruct);
-
-    GPIO_InitTypeDef GPIO_InitStruct;
-    GPIO_StructInit(&GPIO_InitStruct);
-    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
-    GPIO_InitStruct.GPIO_OType = GPIO_OType_OD;
-    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_NOPULL;
-    GPIO_InitStruct.GPIO_Speed = GPIO_High_Speed;
-    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_10 | GPIO_Pin_11;
-    GPIO_Init(GPIOB, &GPIO_InitStruct);
-    GPIO_PinAFConfig(GPIOB, GPIO_PinSource10, GPIO_AF_I2C2);
-    GPIO_PinAFConfig(GPIOB, GPIO_PinSource11, GPIO_AF_I2C2);
-    
     vTaskDelay(pdMS_TO_TICKS(40));
     if (aht20_is_ready())
         return true;
@@ -49,62 +29,23 @@ bool aht20_init(void)
     return false;
 }
 
-#define I2C_CHECK_EVENT(EVENT, TIMEOUT) \
-    do { \
-        uint32_t timeout = TIMEOUT; \
-        while (!I2C_CheckEvent(I2C2, EVENT) && timeout > 0) { \
-            tim_delay_us(10); \
-            timeout -= 10; \
-        } \
-        if (timeout <= 0) \
-            return false; \
-    } while (0)
-
 static bool aht20_write(uint8_t data[], uint32_t length)
 {
-    I2C_AcknowledgeConfig(I2C2, ENABLE);
-    I2C_GenerateSTART(I2C2, ENABLE);
-    I2C_CHECK_EVENT(I2C_EVENT_MASTER_MODE_SELECT, 1000);
-    I2C_Send7bitAddress(I2C2, 0x70, I2C_Direction_Transmitter);
-    I2C_CHECK_EVENT(I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED, 1000);
-    for (uint32_t i = 0; i < length; i++)
-    {
-        I2C_SendData(I2C2, data[i]);
-        I2C_CHECK_EVENT(I2C_EVENT_MASTER_BYTE_TRANSMITTING, 1000);
-    }
-    I2C_GenerateSTOP(I2C2, ENABLE);
-    
-    return true;
+    i2c_bus_xfer_t xfer = { AHT20_ADDR, data, length, NULL, 0 };
+    return i2c_bus_transfer(&xfer, 1) == I2C_BUS_OK;
 }
 
 static bool aht20_read(uint8_t data[], uint32_t length)
 {
-    I2C_AcknowledgeConfig(I2C2, ENABLE);
-    I2C_GenerateSTART(I2C2, ENABLE);
-    I2C_CHECK_EVENT(I2C_EVENT_MASTER_MODE_SELECT, 1000);
-    I2C_Send7bitAddress(I2C2, 0x70, I2C_Direction_Receiver);
-    I2C_CHECK_EVENT(I2C_EVENT_MASTER_RECEIVER_MODE_SELECTED, 1000);
-    for (uint32_t i = 0; i < length; i++)
-    {
-        if (i == length - 1)
-            I2C_AcknowledgeConfig(I2C2, DISABLE);
-        I2C_CHECK_EVENT(I2C_EVENT_MASTER_BYTE_RECEIVED, 1000);
-        data[i] = I2C_ReceiveData(I2C2);
-    }
-    I2C_GenerateSTOP(I2C2, ENABLE);
-    
-    return true;
+    i2c_bus_xfer_t xfer = { AHT20_ADDR, NULL, 0, data, length };
+    return i2c_bus_transfer(&xfer, 1) == I2C_BUS_OK;
 }
 
 static bool aht20_read_status(uint8_t *status)
 {
     uint8_t cmd = 0x71;
-    if (!aht20_write(&cmd, 1))
-        return false;
-    if (!aht20_read(status, 1))
-        return false;
-    
-    return true;
+    i2c_bus_xfer_t xfer = { AHT20_ADDR, &cmd, 1, status, 1 };
+    return i2c_bus_transfer(&xfer, 1) == I2C_BUS_OK;
 }
 
 static bool aht20_is_busy(void)
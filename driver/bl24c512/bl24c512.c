@@ -0,0 +1,76 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "i2c_bus.h"
+#include "bl24c512.h"
+
+// 512 Kbit EEPROM on I2C2, A2..A0 tied low. A write goes one page at a
+// time: the chip wraps inside a 128-byte page and then stops answering
+// for its write cycle (5 ms max), so the next page waits until it ACKs
+// its address again.
+#define BL24C512_ADDR           0xA0
+#define BL24C512_WRITE_POLLS    10
+
+static bool bl24c512_wait_ready(void)
+{
+    uint8_t addr[2] = { 0, 0 };
+    
+    for (uint32_t t = 0; t < BL24C512_WRITE_POLLS; t++)
+    {
+        // an address-only write: ACKed once the write cycle is over
+        i2c_bus_xfer_t xfer = { BL24C512_ADDR, addr, 2, NULL, 0 };
+        if (i2c_bus_transfer(&xfer, 1) == I2C_BUS_OK)
+            return true;
+        vTaskDelay(pdMS_TO_TICKS(1));
+    }
+    
+    return false;
+}
+
+bool bl24c512_init(void)
+{
+    uint8_t data;
+    return bl24c512_read(0, &data, 1);
+}
+
+bool bl24c512_read(uint16_t addr, void *data, uint32_t length)
+{
+    if (length == 0 || addr + length > BL24C512_SIZE)
+        return false;
+    
+    uint8_t waddr[2] = { addr >> 8, addr & 0xFF };
+    i2c_bus_xfer_t xfer = { BL24C512_ADDR, waddr, 2, data, length };
+    return i2c_bus_transfer(&xfer, 1) == I2C_BUS_OK;
+}
+
+bool bl24c512_write(uint16_t addr, const void *data, uint32_t length)
+{
+    const uint8_t *p = data;
+    uint8_t buf[2 + BL24C512_PAGE_SIZE];
+    
+    if (addr + length > BL24C512_SIZE)
+        return false;
+    
+    while (length > 0)
+    {
+        uint32_t chunk = BL24C512_PAGE_SIZE - addr % BL24C512_PAGE_SIZE;
+        if (chunk > length)
+            chunk = length;
+        
+        buf[0] = addr >> 8;
+        buf[1] = addr & 0xFF;
+        memcpy(&buf[2], p, chunk);
+        
+        i2c_bus_xfer_t xfer = { BL24C512_ADDR, buf, 2 + chunk, NULL, 0 };
+        if (i2c_bus_transfer(&xfer, 1) != I2C_BUS_OK || !bl24c512_wait_ready())
+            return false;
+        
+        addr += chunk;
+        p += chunk;
+        length -= chunk;
+    }
+    
+    return true;
+}
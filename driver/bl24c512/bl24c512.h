@@ -1,6 +1,14 @@
 #ifndef __BL24C512_H
 #define __BL24C512_H
 
+#include <stdbool.h>
+#include <stdint.h>
 
+#define BL24C512_SIZE       (64 * 1024)
+#define BL24C512_PAGE_SIZE  128
+
+bool bl24c512_init(void);
+bool bl24c512_read(uint16_t addr, void *data, uint32_t length);
+bool bl24c512_write(uint16_t addr, const void *data, uint32_t length);
 
 #endif /* __BL24C512_H */
@@ -0,0 +1,161 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f4xx.h"
+#include "tim_delay.h"
+#include "ccm.h"
+
+// Task stacks and TCBs come from a bump pool: a task placed here lives for
+// the whole run, nothing is ever handed back. Whatever the pool can't take
+// goes to the FreeRTOS heap in SRAM instead. The rest of CCM holds the
+// CCM_DATA statics and the interrupt stack (see the scatter file).
+#define CCM_POOL_SIZE       (32 * 1024)
+
+#define CCM_PROBE_WORDS     1024
+// one word each way per item: outlasts a probe pass at any clock level
+#define CCM_LOAD_ITEMS      65535
+
+static CCM_DATA uint64_t ccm_pool[CCM_POOL_SIZE / sizeof(uint64_t)];
+static uint32_t ccm_pool_used;
+static ccm_stats_t ccm_stats = { .pool_size = CCM_POOL_SIZE };
+
+static CCM_DATA uint32_t ccm_probe[CCM_PROBE_WORDS];
+static DMA_DATA uint32_t sram_probe[CCM_PROBE_WORDS];
+static DMA_DATA uint32_t load_word[2];
+
+static CCM_DATA StaticTask_t idle_tcb;
+static CCM_DATA StackType_t idle_stack[configMINIMAL_STACK_SIZE];
+static CCM_DATA StaticTask_t timer_tcb;
+static CCM_DATA StackType_t timer_stack[configTIMER_TASK_STACK_DEPTH];
+
+void *ccm_alloc(uint32_t size)
+{
+    void *p = NULL;
+    size = (size + 7) & ~7u;
+    
+    taskENTER_CRITICAL();
+    if (size <= CCM_POOL_SIZE - ccm_pool_used)
+    {
+        p = (uint8_t *)ccm_pool + ccm_pool_used;
+        ccm_pool_used += size;
+        ccm_stats.pool_used = ccm_pool_used;
+    }
+    taskEXIT_CRITICAL();
+    
+    return p;
+}
+
+// same arguments as xTaskCreate, for tasks that never pass a stack buffer
+// to DMA and are never deleted
+BaseType_t ccm_task_create(TaskFunction_t func, const char *name, uint16_t depth,
+                           void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+    StaticTask_t *tcb = ccm_alloc(sizeof(StaticTask_t));
+    StackType_t *stack = tcb ? ccm_alloc(depth * sizeof(StackType_t)) : NULL;
+    
+    if (stack == NULL)
+    {
+        ccm_stats.fallbacks++;
+        return xTaskCreate(func, name, depth, param, priority, handle);
+    }
+    
+    TaskHandle_t task = xTaskCreateStatic(func, name, depth, param, priority, stack, tcb);
+    if (handle)
+        *handle = task;
+    ccm_stats.tasks++;
+    
+    return pdPASS;
+}
+
+bool ccm_contains(const void *addr)
+{
+    uint32_t a = (uint32_t)(uintptr_t)addr;
+    return a >= CCMDATARAM_BASE && a < CCMDATARAM_BASE + CCM_SIZE;
+}
+
+void ccm_get_stats(ccm_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &ccm_stats, sizeof(ccm_stats_t));
+    taskEXIT_CRITICAL();
+}
+
+static uint32_t ccm_probe_pass(volatile uint32_t *buf)
+{
+    uint32_t sum = 0;
+    uint32_t start = tim_get_cycles();
+    
+    for (uint32_t i = 0; i < CCM_PROBE_WORDS; i++)
+    {
+        sum += buf[i];
+        buf[i] = sum;
+    }
+    
+    return tim_get_cycles() - start;
+}
+
+// DMA2 stream 0 in memory-to-memory mode, source and destination both
+// fixed words in SRAM1: every item is a read and a write on the SRAM bus
+static void ccm_load_start(void)
+{
+    RCC_AHB1PeriphClockCmd(RCC_AHB1Periph_DMA2, ENABLE);
+    
+    DMA_InitTypeDef DMA_InitStruct;
+    DMA_StructInit(&DMA_InitStruct);
+    DMA_InitStruct.DMA_Channel = DMA_Channel_0;
+    DMA_InitStruct.DMA_PeripheralBaseAddr = (uint32_t)&load_word[0];
+    DMA_InitStruct.DMA_Memory0BaseAddr = (uint32_t)&load_word[1];
+    DMA_InitStruct.DMA_DIR = DMA_DIR_MemoryToMemory;
+    DMA_InitStruct.DMA_BufferSize = CCM_LOAD_ITEMS;
+    DMA_InitStruct.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Word;
+    DMA_InitStruct.DMA_MemoryDataSize = DMA_MemoryDataSize_Word;
+    DMA_InitStruct.DMA_Priority = DMA_Priority_VeryHigh;
+    DMA_InitStruct.DMA_FIFOMode = DMA_FIFOMode_Enable;
+    DMA_InitStruct.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
+    DMA_Init(DMA2_Stream0, &DMA_InitStruct);
+    
+    DMA_ClearFlag(DMA2_Stream0, DMA_FLAG_TCIF0 | DMA_FLAG_HTIF0 | DMA_FLAG_TEIF0 |
+                                DMA_FLAG_DMEIF0 | DMA_FLAG_FEIF0);
+    DMA_Cmd(DMA2_Stream0, ENABLE);
+}
+
+static void ccm_load_stop(void)
+{
+    DMA_Cmd(DMA2_Stream0, DISABLE);
+    while (DMA_GetCmdStatus(DMA2_Stream0) != DISABLE);
+}
+
+// interrupts off throughout, the passes take a few microseconds each
+void ccm_measure_contention(ccm_contention_t *result)
+{
+    taskENTER_CRITICAL();
+    
+    // first passes only warm up
+    ccm_probe_pass(sram_probe);
+    ccm_probe_pass(ccm_probe);
+    result->sram_idle = ccm_probe_pass(sram_probe);
+    result->ccm_idle = ccm_probe_pass(ccm_probe);
+    
+    ccm_load_start();
+    result->sram_busy = ccm_probe_pass(sram_probe);
+    result->ccm_busy = ccm_probe_pass(ccm_probe);
+    ccm_load_stop();
+    
+    taskEXIT_CRITICAL();
+}
+
+void vApplicationGetIdleTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *depth)
+{
+    *tcb = &idle_tcb;
+    *stack = idle_stack;
+    *depth = configMINIMAL_STACK_SIZE;
+}
+
+void vApplicationGetTimerTaskMemory(StaticTask_t **tcb, StackType_t **stack, uint32_t *depth)
+{
+    *tcb = &timer_tcb;
+    *stack = timer_stack;
+    *depth = configTIMER_TASK_STACK_DEPTH;
+}
@@ -0,0 +1,53 @@
+#ifndef __CCM_H__
+#define __CCM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "task.h"
+
+// The 64 KB core-coupled RAM at 0x10000000 sits on the CPU's D-bus alone:
+// loads and stores there never wait behind a DMA stream, and no DMA stream
+// can reach it. firmware/weatherclock.sct only lets sections named .ccm in,
+// so anything not marked CCM_DATA stays in SRAM1/2.
+//
+// CCM_DATA    zero-initialised, CPU-only data (stacks, ISR rings, scratch)
+// DMA_DATA    a buffer a DMA stream reads or writes, pinned to SRAM1/2;
+//             both on one object is a section conflict and doesn't build
+#if defined(__CC_ARM)
+#define CCM_DATA    __attribute__((section(".ccm"), zero_init))
+#define DMA_DATA    __attribute__((section(".dma"), zero_init))
+#else
+#define CCM_DATA    __attribute__((section(".bss.ccm")))
+#define DMA_DATA    __attribute__((section(".bss.dma")))
+#endif
+
+#define CCM_SIZE    (64 * 1024)
+
+typedef struct
+{
+    uint32_t pool_size;
+    uint32_t pool_used;
+    uint32_t tasks;
+    // tasks that did not fit and went to the FreeRTOS heap
+    uint32_t fallbacks;
+} ccm_stats_t;
+
+// cycles for one read-modify-write pass over 4 KB, with the bus quiet and
+// with a DMA2 stream copying SRAM1 to SRAM1 back to back
+typedef struct
+{
+    uint32_t sram_idle;
+    uint32_t sram_busy;
+    uint32_t ccm_idle;
+    uint32_t ccm_busy;
+} ccm_contention_t;
+
+void *ccm_alloc(uint32_t size);
+BaseType_t ccm_task_create(TaskFunction_t func, const char *name, uint16_t depth,
+                           void *param, UBaseType_t priority, TaskHandle_t *handle);
+bool ccm_contains(const void *addr);
+void ccm_get_stats(ccm_stats_t *stats);
+void ccm_measure_contention(ccm_contention_t *result);
+
+#endif /* __CCM_H__ */
@@ -0,0 +1,241 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f4xx.h"
+#include "tim_delay.h"
+#include "clkscale.h"
+
+// Tasks ask for a level while they have heavy work (rendering, parsing);
+// the clock runs at the highest level asked for, or at the floor when
+// nobody asks. A change is made with interrupts masked: every registered
+// driver may put it off in CLKSCALE_PRE_CHANGE (a transfer in flight), then
+// the prescalers and flash wait states move and the drivers retime
+// themselves in CLKSCALE_POST_CHANGE. A change that was put off is retried
+// on the next request and from the idle task.
+#define CLKSCALE_MAX_NOTIFIERS  8
+
+typedef struct
+{
+    uint32_t hpre;
+    uint32_t ppre1;
+    uint32_t ppre2;
+    uint32_t latency;
+    uint8_t hclk_div;
+    uint8_t pclk1_div;
+    uint8_t pclk2_div;
+} clkscale_config_t;
+
+// wait states for 2.7..3.6 V: one per 30 MHz of HCLK
+static const clkscale_config_t configs[CLKSCALE_LEVEL_COUNT] =
+{
+    [CLKSCALE_LOW] = { RCC_CFGR_HPRE_DIV4, RCC_CFGR_PPRE1_DIV1, RCC_CFGR_PPRE2_DIV1, FLASH_Latency_1, 4, 1, 1 },
+    [CLKSCALE_MID] = { RCC_CFGR_HPRE_DIV2, RCC_CFGR_PPRE1_DIV2, RCC_CFGR_PPRE2_DIV1, FLASH_Latency_2, 2, 2, 1 },
+    [CLKSCALE_HIGH] = { RCC_CFGR_HPRE_DIV1, RCC_CFGR_PPRE1_DIV4, RCC_CFGR_PPRE2_DIV2, FLASH_Latency_5, 1, 4, 2 },
+};
+
+static const char *const level_names[CLKSCALE_LEVEL_COUNT] = { "low", "mid", "high" };
+
+static clkscale_notify_t notifiers[CLKSCALE_MAX_NOTIFIERS];
+static uint32_t notifier_count;
+static uint8_t demand[CLKSCALE_LEVEL_COUNT];
+static clkscale_level_t level = CLKSCALE_HIGH;
+static clkscale_level_t floor_level = CLKSCALE_LOW;
+static uint32_t sysclk;
+static bool clkscale_ready;
+static clkscale_stats_t clkscale_stats;
+static uint64_t level_since;
+// SysTick restarts its period on a change, the part already counted is
+// lost; it is handed back to the kernel from the idle task
+static uint32_t tick_debt_us;
+
+static void clkscale_clocks(clkscale_level_t lvl, clkscale_clocks_t *clocks)
+{
+    const clkscale_config_t *config = &configs[lvl];
+    
+    clocks->sysclk = sysclk;
+    clocks->hclk = sysclk / config->hclk_div;
+    clocks->pclk1 = clocks->hclk / config->pclk1_div;
+    clocks->pclk2 = clocks->hclk / config->pclk2_div;
+    // timers run at twice the bus clock unless the bus is not divided
+    clocks->apb1_tim = config->pclk1_div == 1 ? clocks->pclk1 : clocks->pclk1 * 2;
+    clocks->apb2_tim = config->pclk2_div == 1 ? clocks->pclk2 : clocks->pclk2 * 2;
+}
+
+static void clkscale_systick(uint32_t old_hclk, uint32_t new_hclk)
+{
+    uint32_t counted = SysTick->LOAD - SysTick->VAL;
+    tick_debt_us += (uint32_t)((uint64_t)counted * 1000000 / old_hclk);
+    
+    SysTick->LOAD = new_hclk / configTICK_RATE_HZ - 1;
+    SysTick->VAL = 0;
+}
+
+// caller holds PRIMASK
+static bool clkscale_apply(clkscale_level_t target)
+{
+    if (target == level)
+        return true;
+    
+    clkscale_clocks_t clocks;
+    clkscale_clocks(target, &clocks);
+    
+    for (uint32_t i = 0; i < notifier_count; i++)
+    {
+        if (!notifiers[i](&clocks, CLKSCALE_PRE_CHANGE))
+        {
+            clkscale_stats.deferred++;
+            return false;
+        }
+    }
+    
+    uint64_t now = tim_now();
+    clkscale_stats.level_us[level] += now - level_since;
+    level_since = now;
+    
+    const clkscale_config_t *config = &configs[target];
+    uint32_t old_hclk = SystemCoreClock;
+    
+    // more wait states before speeding up, fewer only after slowing down
+    if (target > level)
+    {
+        FLASH_SetLatency(config->latency);
+        while ((FLASH->ACR & FLASH_ACR_LATENCY) != config->latency);
+    }
+    RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)) |
+                config->hpre | config->ppre1 | config->ppre2;
+    if (target < level)
+    {
+        FLASH_SetLatency(config->latency);
+        while ((FLASH->ACR & FLASH_ACR_LATENCY) != config->latency);
+    }
+    
+    SystemCoreClock = clocks.hclk;
+    clkscale_systick(old_hclk, clocks.hclk);
+    level = target;
+    
+    for (uint32_t i = 0; i < notifier_count; i++)
+        notifiers[i](&clocks, CLKSCALE_POST_CHANGE);
+    
+    clkscale_stats.changes++;
+    return true;
+}
+
+static clkscale_level_t clkscale_target(void)
+{
+    for (int32_t i = CLKSCALE_LEVEL_COUNT - 1; i > (int32_t)floor_level; i--)
+    {
+        if (demand[i] > 0)
+            return (clkscale_level_t)i;
+    }
+    return floor_level;
+}
+
+static void clkscale_update(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (clkscale_ready)
+        clkscale_apply(clkscale_target());
+    __set_PRIMASK(primask);
+}
+
+// before the notifying drivers run at the new speed, so from their init
+bool clkscale_register(clkscale_notify_t func)
+{
+    if (notifier_count >= CLKSCALE_MAX_NOTIFIERS)
+        return false;
+    
+    notifiers[notifier_count++] = func;
+    return true;
+}
+
+void clkscale_request(clkscale_level_t lvl)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    demand[lvl]++;
+    __set_PRIMASK(primask);
+    
+    clkscale_update();
+}
+
+void clkscale_release(clkscale_level_t lvl)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (demand[lvl] > 0)
+        demand[lvl]--;
+    __set_PRIMASK(primask);
+    
+    clkscale_update();
+}
+
+void clkscale_set_floor(clkscale_level_t lvl)
+{
+    floor_level = lvl;
+    clkscale_update();
+}
+
+clkscale_level_t clkscale_get_level(void)
+{
+    return level;
+}
+
+clkscale_level_t clkscale_get_floor(void)
+{
+    return floor_level;
+}
+
+const char *clkscale_level_name(clkscale_level_t lvl)
+{
+    return lvl < CLKSCALE_LEVEL_COUNT ? level_names[lvl] : "?";
+}
+
+void clkscale_get_clocks(clkscale_clocks_t *clocks)
+{
+    clkscale_clocks(level, clocks);
+}
+
+void clkscale_get_stats(clkscale_stats_t *stats)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memcpy(stats, &clkscale_stats, sizeof(clkscale_stats_t));
+    stats->level_us[level] += tim_now() - level_since;
+    __set_PRIMASK(primask);
+}
+
+// from the idle task, scheduler suspended and interrupts masked: retry a
+// change that was put off, and step the tick count by the lost time while
+// the next wake up is still further away; returns the ticks stepped
+uint32_t clkscale_idle(uint32_t expected_ticks)
+{
+    if (!clkscale_ready)
+        return 0;
+    
+    clkscale_apply(clkscale_target());
+    
+    uint32_t ticks = tick_debt_us / portTICK_PERIOD_MS / 1000;
+    if (ticks >= expected_ticks)
+        ticks = expected_ticks - 1;
+    if (ticks > 0)
+    {
+        vTaskStepTick(ticks);
+        tick_debt_us -= ticks * portTICK_PERIOD_MS * 1000;
+    }
+    
+    return ticks;
+}
+
+// first thing in board_init, so drivers can time themselves from
+// clkscale_get_clocks(). Stays at the speed SystemInit left (the full
+// 168 MHz) until the first request or release.
+void clkscale_init(void)
+{
+    RCC_ClocksTypeDef RCC_ClocksStruct;
+    RCC_GetClocksFreq(&RCC_ClocksStruct);
+    sysclk = RCC_ClocksStruct.SYSCLK_Frequency;
+    clkscale_ready = true;
+}
@@ -0,0 +1,55 @@
+#ifndef __CLKSCALE_H__
+#define __CLKSCALE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// PLL stays at 168 MHz, only the AHB and APB prescalers move. PCLK1 is
+// 42 MHz at every level, so USART2, SPI2 and I2C2 never notice.
+typedef enum
+{
+    CLKSCALE_LOW,       // HCLK 42 MHz, PCLK2 42 MHz
+    CLKSCALE_MID,       // HCLK 84 MHz, PCLK2 84 MHz
+    CLKSCALE_HIGH,      // HCLK 168 MHz, PCLK2 84 MHz
+    CLKSCALE_LEVEL_COUNT,
+} clkscale_level_t;
+
+typedef enum
+{
+    CLKSCALE_PRE_CHANGE,    // return false to put the change off
+    CLKSCALE_POST_CHANGE,
+} clkscale_phase_t;
+
+typedef struct
+{
+    uint32_t sysclk;
+    uint32_t hclk;
+    uint32_t pclk1;
+    uint32_t pclk2;
+    uint32_t apb1_tim;
+    uint32_t apb2_tim;
+} clkscale_clocks_t;
+
+typedef struct
+{
+    uint32_t changes;
+    uint32_t deferred;
+    uint64_t level_us[CLKSCALE_LEVEL_COUNT];
+} clkscale_stats_t;
+
+// runs with interrupts masked, keep it to register writes
+typedef bool (*clkscale_notify_t)(const clkscale_clocks_t *clocks, clkscale_phase_t phase);
+
+void clkscale_init(void);
+bool clkscale_register(clkscale_notify_t func);
+void clkscale_request(clkscale_level_t level);
+void clkscale_release(clkscale_level_t level);
+void clkscale_set_floor(clkscale_level_t level);
+clkscale_level_t clkscale_get_level(void);
+clkscale_level_t clkscale_get_floor(void);
+const char *clkscale_level_name(clkscale_level_t level);
+void clkscale_get_clocks(clkscale_clocks_t *clocks);
+void clkscale_get_stats(clkscale_stats_t *stats);
+uint32_t clkscale_idle(uint32_t expected_ticks);
+
+#endif /* __CLKSCALE_H__ */
@@ -1,12 +1,47 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
-#include "FreeRTOS.h"
-#include "semphr.h"
 #include "stm32f4xx.h"
+#include "trace.h"
+#include "tim_delay.h"
+#include "lowpower.h"
+#include "clkscale.h"
+#include "ccm.h"
 #include "console.h"
 
-static SemaphoreHandle_t write_async_semaphore;
+// Output goes through a lock-free multi-producer ring drained by
+// DMA2_Stream7. Positions are free-running 16-bit counters; log_state
+// packs the reserve position (low half) with the number of writers still
+// copying (high half) so both change in one LDREX/STREX. Data becomes
+// visible to the DMA only once no writer is in flight.
+#define CONSOLE_LOG_SIZE    4096
+#define CONSOLE_POS_MASK    0xFFFFu
+#define CONSOLE_WRITER_ONE  0x10000u
+
+// single producer (USART1 ISR), single consumer ring for received bytes
+#define CONSOLE_RX_SIZE     256
+
+#define CONSOLE_BAUDRATE    115200u
+
+// The USART has no clock in STOP mode, so the first start bit on PA10
+// wakes the MCU through EXTI instead and that byte is lost. The console
+// then stays out of STOP until no byte came in for CONSOLE_AWAKE_US.
+#define CONSOLE_AWAKE_US    (30u * 1000 * 1000)
+
+static DMA_DATA uint8_t log_buf[CONSOLE_LOG_SIZE];
+static volatile uint32_t log_state;
+static volatile uint32_t log_commit;
+static volatile uint32_t log_read;
+static volatile uint32_t log_dma_busy;
+static uint32_t log_dma_len;
+static console_stats_t console_stats = { .size = CONSOLE_LOG_SIZE };
 static console_received_func_t received_func;
+static CCM_DATA uint8_t rx_buf[CONSOLE_RX_SIZE];
+static volatile uint32_t rx_head;
+static volatile uint32_t rx_tail;
+static bool tx_locked;
+static bool rx_awake;
+static tim_oneshot_t awake_timer;
 
 static void console_io_init(void)
 {
@@ -26,7 +61,7 @@ static void console_usart_init(void)
     USART_InitTypeDef USART_InitStructure;
     USART_StructInit(&USART_InitStructure);
 
-    USART_InitStructure.USART_BaudRate = 115200u;
+    USART_InitStructure.USART_BaudRate = CONSOLE_BAUDRATE;
     USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
     USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
     USART_InitStructure.USART_Parity = USART_Parity_No;
@@ -54,7 +89,7 @@ static void console_dma_init(void)
     DMA_InitStruct.DMA_Priority = DMA_Priority_Low;
     DMA_InitStruct.DMA_FIFOMode = DMA_FIFOMode_Enable;
     DMA_InitStruct.DMA_FIFOThreshold = DMA_FIFOThreshold_Full;
-    DMA_InitStruct.DMA_MemoryBurst = DMA_MemoryBurst_INC8;
+    DMA_InitStruct.DMA_MemoryBurst = DMA_MemoryBurst_Single;
     DMA_InitStruct.DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
     DMA_ITConfig(DMA2_Stream7, DMA_IT_TC, ENABLE);
     DMA_Init(DMA2_Stream7, &DMA_InitStruct);
@@ -73,70 +108,339 @@ static void console_int_init(void)
     NVIC_InitStructure.NVIC_IRQChannel = DMA2_Stream7_IRQn;
     NVIC_Init(&NVIC_InitStructure);
     NVIC_SetPriority(DMA2_Stream7_IRQn, 5);
+    
+    NVIC_InitStructure.NVIC_IRQChannel = EXTI15_10_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+    NVIC_SetPriority(EXTI15_10_IRQn, 5);
 }
 
-void console_init(void)
+static void console_wake_init(void)
 {
-    write_async_semaphore = xSemaphoreCreateBinary();
-    configASSERT(write_async_semaphore);
+    SYSCFG_EXTILineConfig(EXTI_PortSourceGPIOA, EXTI_PinSource10);
     
+    EXTI_InitTypeDef EXTI_InitStructure;
+    EXTI_StructInit(&EXTI_InitStructure);
+    EXTI_InitStructure.EXTI_Line = EXTI_Line10;
+    EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+    EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Falling;
+    EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+    EXTI_ClearITPendingBit(EXTI_Line10);
+    EXTI_Init(&EXTI_InitStructure);
+}
+
+// PCLK2 moves with the clock level; a byte going out would be garbled, so
+// the change waits until the last one has left the shift register
+static bool console_clock_changed(const clkscale_clocks_t *clocks, clkscale_phase_t phase)
+{
+    if (phase == CLKSCALE_PRE_CHANGE)
+        return !tx_locked;
+    
+    // 16x oversampling: BRR is PCLK2 / baud in 12.4 fixed point
+    uint16_t brr = (clocks->pclk2 + CONSOLE_BAUDRATE / 2) / CONSOLE_BAUDRATE;
+    if (USART1->BRR != brr)
+    {
+        USART_Cmd(USART1, DISABLE);
+        USART1->BRR = brr;
+        USART_Cmd(USART1, ENABLE);
+    }
+    return true;
+}
+
+void console_init(void)
+{
     console_usart_init();
+    clkscale_register(console_clock_changed);
     console_dma_init();
     console_int_init();
     console_io_init();
+    console_wake_init();
 }
 
 
-void console_write(const char str[])
+static void console_atomic_add(volatile uint32_t *value, uint32_t delta)
 {
-    uint32_t len = strlen(str);
-    do
-    {
-        uint32_t chunk_size = len < 65535 ? len : 65535;
+    uint32_t v;
+    do {
+        v = __LDREXW(value);
+    } while (__STREXW(v + delta, value) != 0);
+}
 
-        DMA2_Stream7->M0AR = (uint32_t)str;
-        DMA2_Stream7->NDTR = chunk_size;
+static bool console_log_reserve(uint32_t length, uint32_t *pos)
+{
+    uint32_t state, next, used;
+    do {
+        state = __LDREXW(&log_state);
+        used = ((state & CONSOLE_POS_MASK) - log_read) & CONSOLE_POS_MASK;
+        if (used + length > CONSOLE_LOG_SIZE)
+        {
+            __CLREX();
+            return false;
+        }
+        next = ((state & ~CONSOLE_POS_MASK) + CONSOLE_WRITER_ONE) |
+               ((state + length) & CONSOLE_POS_MASK);
+    } while (__STREXW(next, &log_state) != 0);
+    
+    *pos = state & CONSOLE_POS_MASK;
+    if (used + length > console_stats.peak_used)
+        console_stats.peak_used = used + length;
+    return true;
+}
 
-        DMA_Cmd(DMA2_Stream7, ENABLE);
-        xSemaphoreTake(write_async_semaphore, portMAX_DELAY);
+static void console_log_commit(uint32_t pos)
+{
+    uint32_t commit;
+    do {
+        commit = __LDREXW(&log_commit);
+        if ((int16_t)(pos - commit) <= 0)
+        {
+            __CLREX();
+            return;
+        }
+    } while (__STREXW(pos, &log_commit) != 0);
+}
+
+static void console_log_release(void)
+{
+    uint32_t state;
+    do {
+        state = __LDREXW(&log_state) - CONSOLE_WRITER_ONE;
+    } while (__STREXW(state, &log_state) != 0);
+    
+    if ((state & ~CONSOLE_POS_MASK) == 0)
+        console_log_commit(state & CONSOLE_POS_MASK);
+}
+
+static bool console_dma_claim(void)
+{
+    do {
+        if (__LDREXW(&log_dma_busy) != 0)
+        {
+            __CLREX();
+            return false;
+        }
+    } while (__STREXW(1, &log_dma_busy) != 0);
+    __DMB();
+    
+    return true;
+}
+
+static void console_log_kick(void)
+{
+    while (console_dma_claim())
+    {
+        uint32_t len = (log_commit - log_read) & CONSOLE_POS_MASK;
+        if (len > 0)
+        {
+            uint32_t start = log_read & (CONSOLE_LOG_SIZE - 1);
+            if (start + len > CONSOLE_LOG_SIZE)
+                len = CONSOLE_LOG_SIZE - start;
+            
+            if (!tx_locked)
+            {
+                tx_locked = true;
+                lowpower_lock(LOWPOWER_LOCK_CONSOLE_TX);
+            }
+            
+            log_dma_len = len;
+            USART_ClearFlag(USART1, USART_FLAG_TC);
+            DMA2_Stream7->M0AR = (uint32_t)&log_buf[start];
+            DMA2_Stream7->NDTR = len;
+            DMA_ClearFlag(DMA2_Stream7, DMA_FLAG_TCIF7 | DMA_FLAG_HTIF7 | DMA_FLAG_TEIF7 | DMA_FLAG_FEIF7);
+            DMA_Cmd(DMA2_Stream7, ENABLE);
+            return;
+        }
         
-        str += chunk_size;
-        len -= chunk_size;
-    } while (len > 0);
+        // a writer that committed while we held the claim gave up on its
+        // own kick, so look again after releasing it
+        __DMB();
+        log_dma_busy = 0;
+        __DMB();
+        if (((log_commit - log_read) & CONSOLE_POS_MASK) == 0)
+            return;
+    }
+}
+
+// safe from any task or interrupt, never blocks: drops the whole write
+// when the ring is full
+uint32_t console_write_data(const void *data, uint32_t length)
+{
+    uint32_t pos;
+    
+    if (length == 0 || length > CONSOLE_LOG_SIZE)
+        return 0;
+    
+    if (!console_log_reserve(length, &pos))
+    {
+        console_atomic_add(&console_stats.bytes_dropped, length);
+        console_atomic_add(&console_stats.writes_dropped, 1);
+        return 0;
+    }
+    
+    uint32_t start = pos & (CONSOLE_LOG_SIZE - 1);
+    uint32_t first = CONSOLE_LOG_SIZE - start;
+    if (first > length)
+        first = length;
+    memcpy(&log_buf[start], data, first);
+    memcpy(log_buf, (const uint8_t *)data + first, length - first);
+    
+    console_log_release();
+    console_atomic_add(&console_stats.bytes_written, length);
+    console_log_kick();
+    
+    return length;
+}
+
+void console_write(const char str[])
+{
+    console_write_data(str, strlen(str));
+}
+
+static void console_poll_putc(uint8_t ch)
+{
+    while (USART_GetFlagStatus(USART1, USART_FLAG_TXE) == RESET);
+    USART_SendData(USART1, ch);
+}
+
+// for fault paths with interrupts off: stops the DMA, pushes out whatever
+// is left in the ring by polling, then the message itself
+void console_panic_write(const char str[])
+{
+    DMA_Cmd(DMA2_Stream7, DISABLE);
+    while (DMA_GetCmdStatus(DMA2_Stream7) != DISABLE);
     
+    uint32_t read = log_read;
+    if (log_dma_busy)
+        read += log_dma_len - DMA2_Stream7->NDTR;
+    while (((log_commit - read) & CONSOLE_POS_MASK) != 0)
+    {
+        console_poll_putc(log_buf[read & (CONSOLE_LOG_SIZE - 1)]);
+        read++;
+    }
+    log_read = log_commit;
+    
+    while (*str)
+        console_poll_putc(*str++);
     while (USART_GetFlagStatus(USART1, USART_FLAG_TC) == RESET);
-    USART_ClearFlag(USART1, USART_FLAG_TC);
 }
 
+uint32_t console_get_free(void)
+{
+    uint32_t used = ((log_state & CONSOLE_POS_MASK) - log_read) & CONSOLE_POS_MASK;
+    return CONSOLE_LOG_SIZE - used;
+}
+
+void console_get_stats(console_stats_t *stats)
+{
+    memcpy(stats, &console_stats, sizeof(console_stats_t));
+}
+
+uint32_t console_read(uint8_t data[], uint32_t length)
+{
+    uint32_t count = 0;
+    uint32_t tail = rx_tail;
+    
+    while (count < length && tail != rx_head)
+    {
+        data[count++] = rx_buf[tail % CONSOLE_RX_SIZE];
+        tail++;
+    }
+    __DMB();
+    rx_tail = tail;
+    
+    return count;
+}
+
+// func runs in interrupt context after the byte is queued, use it to wake
+// the reader
 void console_received_register(console_received_func_t func)
 {
     received_func = func;
 }
 
+// runs in the TIM5 interrupt
+static void console_awake_expired(void *param)
+{
+    rx_awake = false;
+    EXTI_ClearITPendingBit(EXTI_Line10);
+    EXTI->IMR |= EXTI_Line10;
+    lowpower_unlock(LOWPOWER_LOCK_CONSOLE_RX);
+}
+
+// the pin edge is only needed to get out of STOP, so it is masked while
+// the console is awake
+static void console_stay_awake(void)
+{
+    if (!rx_awake)
+    {
+        rx_awake = true;
+        EXTI->IMR &= ~EXTI_Line10;
+        lowpower_lock(LOWPOWER_LOCK_CONSOLE_RX);
+    }
+    tim_oneshot_start(&awake_timer, CONSOLE_AWAKE_US, console_awake_expired, NULL);
+}
+
+void EXTI15_10_IRQHandler(void)
+{
+    TRACE_ISR_ENTER();
+    if (EXTI_GetITStatus(EXTI_Line10) != RESET)
+    {
+        EXTI_ClearITPendingBit(EXTI_Line10);
+        console_stay_awake();
+    }
+    TRACE_ISR_EXIT();
+}
+
 void USART1_IRQHandler(void)
 {
-    if (USART_GetITStatus(USART1, USART_IT_RXNE) == SET)
+    TRACE_ISR_ENTER();
+    if (USART_GetITStatus(USART1, USART_IT_RXNE) == SET ||
+        USART_GetFlagStatus(USART1, USART_FLAG_ORE) == SET)
     {
-        if (received_func != NULL)
+        uint8_t data = USART_ReceiveData(USART1);
+        
+        console_stats.bytes_received++;
+        if (rx_head - rx_tail < CONSOLE_RX_SIZE)
         {
-            uint8_t data = USART_ReceiveData(USART1);
-            received_func(data);
+            rx_buf[rx_head % CONSOLE_RX_SIZE] = data;
+            __DMB();
+            rx_head++;
+        }
+        else
+        {
+            console_stats.bytes_lost++;
         }
         
-        USART_ClearITPendingBit(USART1, USART_IT_RXNE);
+        console_stay_awake();
+        if (received_func != NULL)
+            received_func(data);
     }
+    
+    // the last DMA transfer has left the shifter, STOP is safe again
+    if (USART_GetITStatus(USART1, USART_IT_TC) == SET)
+    {
+        USART_ITConfig(USART1, USART_IT_TC, DISABLE);
+        if (!log_dma_busy && tx_locked)
+        {
+            tx_locked = false;
+            lowpower_unlock(LOWPOWER_LOCK_CONSOLE_TX);
+        }
+    }
+    TRACE_ISR_EXIT();
 }
 
 void DMA2_Stream7_IRQHandler(void)
 {
+    TRACE_ISR_ENTER();
     if (DMA_GetITStatus(DMA2_Stream7, DMA_IT_TCIF7) == SET)
     {
-        BaseType_t pxHigherPriorityTaskWoken;
-        xSemaphoreGiveFromISR(write_async_semaphore, &pxHigherPriorityTaskWoken);
-        portYIELD_FROM_ISR(pxHigherPriorityTaskWoken);
-        
         DMA_ClearITPendingBit(DMA2_Stream7, DMA_IT_TCIF7);
+        
+        log_read += log_dma_len;
+        __DMB();
+        log_dma_busy = 0;
+        console_log_kick();
+        if (!log_dma_busy)
+            USART_ITConfig(USART1, USART_IT_TC, ENABLE);
     }
+    TRACE_ISR_EXIT();
 }
-
-
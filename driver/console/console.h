@@ -5,8 +5,24 @@
 
 typedef void (*console_received_func_t)(uint8_t data);
 
+typedef struct
+{
+    uint32_t bytes_written;
+    uint32_t bytes_dropped;
+    uint32_t writes_dropped;
+    uint32_t peak_used;
+    uint32_t size;
+    uint32_t bytes_received;
+    uint32_t bytes_lost;
+} console_stats_t;
+
 void console_init(void);
 void console_write(const char str[]);
+uint32_t console_write_data(const void *data, uint32_t length);
+void console_panic_write(const char str[]);
+uint32_t console_get_free(void);
+uint32_t console_read(uint8_t data[], uint32_t length);
+void console_get_stats(console_stats_t *stats);
 void console_received_register(console_received_func_t func);
 
 #endif /* __CONSOLE_H__ */
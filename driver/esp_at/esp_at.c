@@ -7,10 +7,21 @@
 #include "task.h"
 #include "semphr.h"
 #include "stm32f4xx.h"
+#include "tim_delay.h"
+#include "log.h"
+#include "trace.h"
+#include "lowpower.h"
 #include "esp_at.h"
+#include "esp_at_parse.h"
+#include "ccm.h"
 
 #define ESP_AT_DEBUG    1
 
+// CHIP_PU (EN) of the ESP32, held low the module stays in reset. Only a
+// board that wires it to a GPIO defines ESP_EN_PORT / ESP_EN_PIN in its
+// build (-DESP_EN_PORT=GPIOA -DESP_EN_PIN=GPIO_Pin_4); without them the
+// pin is never touched and a reset is AT+RST.
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 typedef enum
@@ -37,10 +48,16 @@ static const at_ack_match_t at_ack_matches[] =
 };
 
 static char *rxline;
-static char rxbuf[1024];
+// filled by the USART2 interrupt, parsed in place
+static CCM_DATA char rxbuf[1024];
+// commands built at run time, DMA1 stream 6 sends from here
+static DMA_DATA char txbuf[256];
 static uint32_t rxlen;
 static at_ack_t rxack;
 static SemaphoreHandle_t at_ack_sempahore;
+// one caller at a time from the first command to the last look at rxbuf
+static SemaphoreHandle_t at_mutex;
+static esp_at_stats_t esp_at_stats;
 
 static bool esp_at_write_command(const char *command, uint32_t timeout);
 static bool esp_at_wait_boot(uint32_t timeout);
@@ -57,6 +74,16 @@ static void esp_at_io_init(void)
     GPIO_InitStructure.GPIO_Speed = GPIO_High_Speed;
     GPIO_InitStructure.GPIO_Pin = GPIO_Pin_2 | GPIO_Pin_3;
     GPIO_Init(GPIOA, &GPIO_InitStructure);
+    
+#ifdef ESP_EN_PORT
+    // released before it becomes an output, the module keeps running
+    GPIO_SetBits(ESP_EN_PORT, ESP_EN_PIN);
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_OUT;
+    GPIO_InitStructure.GPIO_OType = GPIO_OType_PP;
+    GPIO_InitStructure.GPIO_Speed = GPIO_Low_Speed;
+    GPIO_InitStructure.GPIO_Pin = ESP_EN_PIN;
+    GPIO_Init(ESP_EN_PORT, &GPIO_InitStructure);
+#endif
 }
 
 static void esp_at_usart_init(void)
@@ -116,26 +143,64 @@ static void esp_at_lowlevel_init(void)
     esp_at_io_init();
 }
 
+static void esp_at_take(void)
+{
+    xSemaphoreTakeRecursive(at_mutex, portMAX_DELAY);
+}
+
+static void esp_at_give(void)
+{
+    xSemaphoreGiveRecursive(at_mutex);
+}
+
+// runs again after esp_at_hard_reset(), the peripherals are only set up
+// the first time
 bool esp_at_init(void)
 {
-    at_ack_sempahore = xSemaphoreCreateBinary();
-    configASSERT(at_ack_sempahore);
+    if (at_ack_sempahore == NULL)
+    {
+        at_mutex = xSemaphoreCreateRecursiveMutex();
+        configASSERT(at_mutex);
+        at_ack_sempahore = xSemaphoreCreateBinary();
+        configASSERT(at_ack_sempahore);
+        esp_at_lowlevel_init();
+    }
     
-    esp_at_lowlevel_init();
+    esp_at_take();
+    // an ack nobody waited for, from before the module went away
+    xSemaphoreTake(at_ack_sempahore, 0);
     
-    if (!esp_at_wait_boot(3000))
-        return false;
-    if (!esp_at_write_command("AT+RESTORE\r\n", 2000))
-        return false;
-    if (!esp_at_wait_ready(5000))
-        return false;
+    // "ready" arrives on its own after the restore, keep USART2 clocked
+    lowpower_lock(LOWPOWER_LOCK_ESP);
+    bool ok = esp_at_wait_boot(3000) &&
+              esp_at_write_command("AT+RESTORE\r\n", 2000) &&
+              esp_at_wait_ready(5000);
+    lowpower_unlock(LOWPOWER_LOCK_ESP);
+    esp_at_give();
     
-    return true;
+    return ok;
+}
+
+// for callers that read a response the driver returned (esp_at_http_get),
+// or that would rather skip their turn than wait behind a slow command;
+// false before esp_at_init() or when the wait ran out. Nests
+bool esp_at_lock(uint32_t timeout_ms)
+{
+    if (at_mutex == NULL)
+        return false;
+    return xSemaphoreTakeRecursive(at_mutex, pdMS_TO_TICKS(timeout_ms)) == pdPASS;
+}
+
+void esp_at_unlock(void)
+{
+    xSemaphoreGiveRecursive(at_mutex);
 }
 
 static void esp_at_usart_write(const char *data)
 {
     uint32_t len = strlen(data);
+    configASSERT(!ccm_contains(data));
+    esp_at_stats.bytes_sent += len;
     
     DMA1_Stream6->M0AR = (uint32_t)data;
     DMA1_Stream6->NDTR = len;
@@ -172,14 +237,27 @@ static bool esp_at_wait_ready(uint32_t timeout)
 static bool esp_at_write_command(const char *command, uint32_t timeout)
 {
 #if ESP_AT_DEBUG
-    printf("[DEBUG] Send: %s\n", command);
+    LOG("[DEBUG] Send: %s\n", command);
 #endif
 
+    // no STOP while the command goes out and the response comes back
+    lowpower_lock(LOWPOWER_LOCK_ESP);
+    uint64_t start = tim_get_us();
     esp_at_usart_write(command);
     at_ack_t ack = esp_at_usart_wait_receive(timeout);
+    uint32_t elapsed_us = (uint32_t)(tim_get_us() - start);
+    lowpower_unlock(LOWPOWER_LOCK_ESP);
+    
+    esp_at_stats.commands++;
+    if (ack == AT_ACK_NONE)
+        esp_at_stats.timeouts++;
+    else if (ack != AT_ACK_OK)
+        esp_at_stats.errors++;
+    if (elapsed_us > esp_at_stats.response_max_us)
+        esp_at_stats.response_max_us = elapsed_us;
 
 #if ESP_AT_DEBUG
-    printf("[DEBUG] Response:\n%s\n", rxbuf);
+    LOG("[DEBUG] Response:\n%s\n", rxbuf);
 #endif
 
     return ack == AT_ACK_OK;
@@ -201,9 +279,28 @@ static bool esp_at_wait_boot(uint32_t timeout)
     return false;
 }
 
+// for a module that stopped answering; esp_at_init() has to run again
+// before it takes commands. Without EN the module has to still read its
+// UART, the reply to AT+RST does not matter
+void esp_at_hard_reset(void)
+{
+    esp_at_take();
+#ifdef ESP_EN_PORT
+    GPIO_ResetBits(ESP_EN_PORT, ESP_EN_PIN);
+    vTaskDelay(pdMS_TO_TICKS(10));
+    GPIO_SetBits(ESP_EN_PORT, ESP_EN_PIN);
+#else
+    esp_at_write_command("AT+RST\r\n", 1000);
+#endif
+    esp_at_give();
+}
+
 bool esp_at_wifi_init(void)
 {
-    return esp_at_write_command("AT+CWMODE=1\r\n", 2000);
+    esp_at_take();
+    bool ok = esp_at_write_command("AT+CWMODE=1\r\n", 2000);
+    esp_at_give();
+    return ok;
 }
 
 bool esp_at_connect_wifi(const char *ssid, const char *pwd, const char *mac)
@@ -211,67 +308,31 @@ bool esp_at_connect_wifi(const char *ssid, const char *pwd, const char *mac)
     if (ssid == NULL || pwd == NULL)
         return false;
     
-    char *cmd = rxbuf;
-    int len = snprintf(cmd, sizeof(rxbuf), "AT+CWJAP=\"%s\",\"%s\"\r\n", ssid, pwd);
+    esp_at_take();
+    int len = snprintf(txbuf, sizeof(txbuf), "AT+CWJAP=\"%s\",\"%s\"\r\n", ssid, pwd);
     if (mac)
-        snprintf(cmd + len, sizeof(rxbuf) - len, ",\"%s\"", mac);
+        snprintf(txbuf + len, sizeof(txbuf) - len, ",\"%s\"", mac);
     
-    return esp_at_write_command(cmd, 5000);
-}
-
-static bool parse_cwstate_response(const char *response, esp_wifi_info_t *info)
-{
-//    AT+CWSTATE?
-//    +CWSTATE:2,"Xiaomi Mi MIX 3_5577"
-
-//    OK
-	response = strstr(response, "+CWSTATE:");
-	if (response == NULL)
-		return false;
-	
-	int wifi_state;
-	if (sscanf(response, "+CWSTATE:%d,\"%63[^\"]", &wifi_state, info->ssid) != 2)
-		return false;
-	
-	info->connected = (wifi_state == 2);
-	
-	return true;
-}
-
-static bool parse_cwjap_response(const char *response, esp_wifi_info_t *info)
-{
-//    AT+CWJAP?
-//    +CWJAP:"Xiaomi Mi MIX 3_5577","da:b5:3a:e3:2f:60",9,-48,0,1,3,0,1
-
-//    OK
-	response = strstr(response, "+CWJAP:");
-	if (response == NULL)
-		return false;
-	
-	if (sscanf(response, "+CWJAP:\"%63[^\"]\",\"%17[^\"]\",%d,%d", info->ssid, info->bssid, &info->channel, &info->rssi) != 4)
-		return false;
-	
-	return true;
+    // the module answers once it has an IP or has given up (jap_timeout, 15 s)
+    bool ok = esp_at_write_command(txbuf, 16000);
+    esp_at_give();
+    return ok;
 }
 
 bool esp_at_get_wifi_info(esp_wifi_info_t *info)
 {
-    if (!esp_at_write_command("AT+CWSTATE?\r\n", 2000))
-        return false;
+    esp_at_take();
+    bool ok = esp_at_write_command("AT+CWSTATE?\r\n", 2000) &&
+              parse_cwstate_response(esp_at_get_response(), info);
     
-    if (!parse_cwstate_response(esp_at_get_response(), info))
-        return false;
-    
-    if (info->connected == true)
+    if (ok && info->connected == true)
     {
-        if (!esp_at_write_command("AT+CWJAP?\r\n", 2000))
-            return false;
-        
-        if (!parse_cwjap_response(esp_at_get_response(), info))
-            return false;
+        ok = esp_at_write_command("AT+CWJAP?\r\n", 2000) &&
+             parse_cwjap_response(esp_at_get_response(), info);
     }
+    esp_at_give();
     
-    return true;
+    return ok;
 }
 
 bool wifi_is_connected(void)
@@ -286,67 +347,21 @@ bool wifi_is_connected(void)
 
 bool esp_at_sntp_init(void)
 {
-    if (!esp_at_write_command("AT+CIPSNTPCFG=1,8\r\n", 2000))
-        return false;
+    esp_at_take();
+    bool ok = esp_at_write_command("AT+CIPSNTPCFG=1,8\r\n", 2000);
+    esp_at_give();
     
-    return true;
-}
-
-static uint8_t month_str_to_num(const char *month_str)
-{
-	const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", 
-		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
-	for (uint8_t i = 0; i < 12; i++)
-	{
-		if (strcmp(month_str, months[i]) == 0)
-		{
-			return i + 1;
-		}
-	}
-	return 0;
-}
-
-
-static uint8_t weekday_str_to_num(const char *weekday_str)
-{
-	const char *weekdays[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
-	for (uint8_t i = 0; i < 7; i++) {
-		if (strcmp(weekday_str, weekdays[i]) == 0)
-		{
-			return i + 1;
-		}
-	}
-	return 0;
-}
-
-static bool parse_cipsntptime_response(const char *response, esp_date_time_t *date)
-{
-//	AT+CIPSNTPTIME?
-//	+CIPSNTPTIME:Sun Jul 27 14:07:19 2025
-//	OK
-	char weekday_str[8];
-	char month_str[4];
-	response = strstr(response, "+CIPSNTPTIME:");
-	if (sscanf(response, "+CIPSNTPTIME:%3s %3s %hhu %hhu:%hhu:%hhu %hu", 
-			   weekday_str, month_str, 
-			   &date->day, &date->hour, &date->minute, &date->second, &date->year) != 7)
-		return false;
-	
-	date->weekday = weekday_str_to_num(weekday_str);
-	date->month = month_str_to_num(month_str);
-	
-	return true;
+    return ok;
 }
 
 bool esp_at_sntp_get_time(esp_date_time_t *date)
 {
-    if (!esp_at_write_command("AT+CIPSNTPTIME?\r\n", 2000))
-        return false;
+    esp_at_take();
+    bool ok = esp_at_write_command("AT+CIPSNTPTIME?\r\n", 2000) &&
+              parse_cipsntptime_response(esp_at_get_response(), date);
+    esp_at_give();
     
-    if (!parse_cipsntptime_response(esp_at_get_response(), date))
-        return false;
-    
-    return true;
+    return ok;
 }
 
 const char *esp_at_http_get(const char *url)
@@ -355,16 +370,26 @@ const char *esp_at_http_get(const char *url)
 //    +HTTPCLIENT:261,{"results":[{"location":{"id":"WTEMH46Z5N09","name":"Hefei","country":"CN","path":"Hefei,Hefei,Anhui,China","timezone":"Asia/Shanghai","timezone_offset":"+08:00"},"now":{"text":"Cloudy","code":"4","temperature":"32"},"last_update":"2025-07-26T16:30:00+08:00"}]}
 
 //    OK
-    char *txbuf = rxbuf;
-    snprintf(txbuf, sizeof(rxbuf), "AT+HTTPCLIENT=2,1,\"%s\",,,2\r\n", url);
+    esp_at_take();
+    snprintf(txbuf, sizeof(txbuf), "AT+HTTPCLIENT=2,1,\"%s\",,,2\r\n", url);
     bool ret = esp_at_write_command(txbuf, 5000);
+    esp_at_give();
     return ret ? esp_at_get_response() : NULL;
 }
 
+void esp_at_get_stats(esp_at_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &esp_at_stats, sizeof(esp_at_stats_t));
+    taskEXIT_CRITICAL();
+}
+
 void USART2_IRQHandler(void)
 {    
+    TRACE_ISR_ENTER();
     if (USART_GetITStatus(USART2, USART_IT_RXNE) == SET)
     {
+        esp_at_stats.bytes_received++;
         if (rxlen < sizeof(rxbuf) - 1)
         {
             rxbuf[rxlen++] = USART_ReceiveData(USART2);
@@ -382,7 +407,13 @@ void USART2_IRQHandler(void)
                 rxline = rxbuf + rxlen;
             }
         }
+        else
+        {
+            (void)USART_ReceiveData(USART2);
+            esp_at_stats.bytes_dropped++;
+        }
 
         USART_ClearITPendingBit(USART2, USART_IT_RXNE);
     }
+    TRACE_ISR_EXIT();
 }
@@ -24,13 +24,29 @@ typedef struct
     uint8_t weekday;
 } esp_date_time_t;
 
+typedef struct
+{
+    uint32_t commands;
+    uint32_t errors;
+    uint32_t timeouts;
+    uint32_t response_max_us;
+    uint32_t bytes_sent;
+    uint32_t bytes_received;
+    uint32_t bytes_dropped;
+} esp_at_stats_t;
+
 bool esp_at_init(void);
+bool esp_at_lock(uint32_t timeout_ms);
+void esp_at_unlock(void);
+void esp_at_hard_reset(void);
 bool esp_at_wifi_init(void);
 bool esp_at_connect_wifi(const char *ssid, const char *pwd, const char *mac);
 bool esp_at_get_wifi_info(esp_wifi_info_t *info);
 bool wifi_is_connected(void);
 bool esp_at_sntp_init(void);
 bool esp_at_sntp_get_time(esp_date_time_t *date);
+// the response is only valid while the caller holds esp_at_lock()
 const char *esp_at_http_get(const char *url);
+void esp_at_get_stats(esp_at_stats_t *stats);
 
 #endif /* __ESP_AT_H__ */
@@ -0,0 +1,96 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include "esp_at.h"
+#include "esp_at_parse.h"
+
+// Parsers for the AT responses, kept apart from the driver so they build
+// on their own for the fuzzing harnesses in sim/fuzz. The input is the
+// NUL-terminated receive buffer, whatever the module (or the line) sent.
+
+bool parse_cwstate_response(const char *response, esp_wifi_info_t *info)
+{
+//    AT+CWSTATE?
+//    +CWSTATE:2,"Xiaomi Mi MIX 3_5577"
+
+//    OK
+	response = strstr(response, "+CWSTATE:");
+	if (response == NULL)
+		return false;
+	
+	// the SSID is "" while not connected, %[ matches nothing then
+	int wifi_state;
+	info->ssid[0] = '\0';
+	if (sscanf(response, "+CWSTATE:%d,\"%63[^\"]", &wifi_state, info->ssid) < 1)
+		return false;
+	
+	info->connected = (wifi_state == 2);
+	
+	return true;
+}
+
+bool parse_cwjap_response(const char *response, esp_wifi_info_t *info)
+{
+//    AT+CWJAP?
+//    +CWJAP:"Xiaomi Mi MIX 3_5577","da:b5:3a:e3:2f:60",9,-48,0,1,3,0,1
+
+//    OK
+	response = strstr(response, "+CWJAP:");
+	if (response == NULL)
+		return false;
+	
+	if (sscanf(response, "+CWJAP:\"%63[^\"]\",\"%17[^\"]\",%d,%d", info->ssid, info->bssid, &info->channel, &info->rssi) != 4)
+		return false;
+	
+	return true;
+}
+
+static uint8_t month_str_to_num(const char *month_str)
+{
+	const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", 
+		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+	for (uint8_t i = 0; i < 12; i++)
+	{
+		if (strcmp(month_str, months[i]) == 0)
+		{
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+
+static uint8_t weekday_str_to_num(const char *weekday_str)
+{
+	const char *weekdays[] = {"Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun"};
+	for (uint8_t i = 0; i < 7; i++) {
+		if (strcmp(weekday_str, weekdays[i]) == 0)
+		{
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+bool parse_cipsntptime_response(const char *response, esp_date_time_t *date)
+{
+//	AT+CIPSNTPTIME?
+//	+CIPSNTPTIME:Sun Jul 27 14:07:19 2025
+//	OK
+	char weekday_str[8];
+	char month_str[4];
+	response = strstr(response, "+CIPSNTPTIME:");
+	if (response == NULL)
+		return false;
+	
+	if (sscanf(response, "+CIPSNTPTIME:%3s %3s %hhu %hhu:%hhu:%hhu %hu", 
+			   weekday_str, month_str, 
+			   &date->day, &date->hour, &date->minute, &date->second, &date->year) != 7)
+		return false;
+	
+	date->weekday = weekday_str_to_num(weekday_str);
+	date->month = month_str_to_num(month_str);
+	
+	return true;
+}
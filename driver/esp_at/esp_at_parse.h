@@ -0,0 +1,11 @@
+#ifndef __ESP_AT_PARSE_H__
+#define __ESP_AT_PARSE_H__
+
+#include <stdbool.h>
+#include "esp_at.h"
+
+bool parse_cwstate_response(const char *response, esp_wifi_info_t *info);
+bool parse_cwjap_response(const char *response, esp_wifi_info_t *info);
+bool parse_cipsntptime_response(const char *response, esp_date_time_t *date);
+
+#endif /* __ESP_AT_PARSE_H__ */
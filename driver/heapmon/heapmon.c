@@ -0,0 +1,186 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "heapmon.h"
+
+// heap_4 calls the hooks with the scheduler suspended and never from an
+// interrupt, so the tables need no further locking on that side; readers
+// suspend the scheduler while they copy. Each live block remembers which
+// site it came from so frees can be charged back to it.
+#define HEAPMON_MAX_SITES   32
+#define HEAPMON_MAX_LIVE    128
+#define HEAPMON_NO_SITE     0xFF
+
+// heap_4's BlockLink_t, padded to portBYTE_ALIGNMENT in front of every
+// block; the top bit of the size marks it allocated. traceFREE reports
+// that size and traceMALLOC only what was asked for (plus the header),
+// which is less when the block was not split, so both sides charge the
+// size in the header.
+typedef struct
+{
+    void *next;
+    size_t size;
+} heapmon_link_t;
+
+#define HEAPMON_LINK_SIZE   ((sizeof(heapmon_link_t) + portBYTE_ALIGNMENT - 1) & ~(size_t)portBYTE_ALIGNMENT_MASK)
+#define HEAPMON_SIZE_MASK   (~((size_t)1 << (sizeof(size_t) * 8 - 1)))
+
+typedef struct
+{
+    void *addr;
+    uint32_t size;
+    uint8_t site;
+} heapmon_block_t;
+
+static heapmon_site_t sites[HEAPMON_MAX_SITES];
+static uint32_t site_count;
+static heapmon_block_t blocks[HEAPMON_MAX_LIVE];
+static heapmon_stats_t heapmon_stats;
+
+static uint8_t heapmon_find_site(uintptr_t caller)
+{
+    for (uint32_t i = 0; i < site_count; i++)
+    {
+        if (sites[i].caller == caller)
+            return i;
+    }
+
+    if (site_count >= HEAPMON_MAX_SITES)
+        return HEAPMON_NO_SITE;
+
+    sites[site_count].caller = caller;
+    return site_count++;
+}
+
+static size_t heapmon_block_size(void *addr)
+{
+    const heapmon_link_t *link = (const heapmon_link_t *)((uint8_t *)addr - HEAPMON_LINK_SIZE);
+    return link->size & HEAPMON_SIZE_MASK;
+}
+
+void heapmon_malloc(void *addr, size_t size, uintptr_t caller)
+{
+    if (addr == NULL)
+    {
+        heapmon_stats.failed++;
+        heapmon_stats.failed_size = size;
+        heapmon_stats.failed_caller = caller;
+        return;
+    }
+
+    size = heapmon_block_size(addr);
+
+    heapmon_stats.allocs++;
+    heapmon_stats.used += size;
+    if (heapmon_stats.used > heapmon_stats.peak_used)
+        heapmon_stats.peak_used = heapmon_stats.used;
+
+    uint8_t site = heapmon_find_site(caller);
+    if (site != HEAPMON_NO_SITE)
+    {
+        heapmon_site_t *s = &sites[site];
+        s->allocs++;
+        s->live_count++;
+        s->live_bytes += size;
+        if (s->live_bytes > s->peak_bytes)
+            s->peak_bytes = s->live_bytes;
+    }
+
+    for (uint32_t i = 0; i < HEAPMON_MAX_LIVE; i++)
+    {
+        if (blocks[i].addr == NULL)
+        {
+            blocks[i].addr = addr;
+            blocks[i].size = size;
+            blocks[i].site = site;
+            if (site == HEAPMON_NO_SITE)
+                heapmon_stats.untracked++;
+            return;
+        }
+    }
+
+    // no slot: the free will not find it, so do not charge the site
+    heapmon_stats.untracked++;
+    if (site != HEAPMON_NO_SITE)
+    {
+        sites[site].live_count--;
+        sites[site].live_bytes -= size;
+    }
+}
+
+// a block the table had no slot for was charged its header size too
+void heapmon_free(void *addr, size_t size)
+{
+    heapmon_stats.frees++;
+
+    for (uint32_t i = 0; i < HEAPMON_MAX_LIVE; i++)
+    {
+        if (blocks[i].addr == addr)
+        {
+            heapmon_stats.used -= blocks[i].size;
+            if (blocks[i].site != HEAPMON_NO_SITE)
+            {
+                heapmon_site_t *s = &sites[blocks[i].site];
+                s->frees++;
+                s->live_count--;
+                s->live_bytes -= blocks[i].size;
+            }
+            blocks[i].addr = NULL;
+            return;
+        }
+    }
+
+    heapmon_stats.used -= size;
+}
+
+void heapmon_get_stats(heapmon_stats_t *stats)
+{
+    HeapStats_t heap;
+    vPortGetHeapStats(&heap);
+
+    vTaskSuspendAll();
+    memcpy(stats, &heapmon_stats, sizeof(heapmon_stats_t));
+    (void)xTaskResumeAll();
+
+    stats->total = configTOTAL_HEAP_SIZE;
+    stats->free_blocks = heap.xNumberOfFreeBlocks;
+    stats->largest_free = heap.xSizeOfLargestFreeBlockInBytes;
+    stats->fragmentation = heap.xAvailableHeapSpaceInBytes == 0 ? 0 :
+        1000 - (uint32_t)((uint64_t)heap.xSizeOfLargestFreeBlockInBytes * 1000 /
+                          heap.xAvailableHeapSpaceInBytes);
+}
+
+// sorted by live bytes, biggest first
+uint32_t heapmon_get_sites(heapmon_site_t out[], uint32_t max)
+{
+    uint32_t count = 0;
+
+    vTaskSuspendAll();
+    for (uint32_t i = 0; i < site_count; i++)
+    {
+        uint32_t pos = count < max ? count++ : max;
+        while (pos > 0 && out[pos - 1].live_bytes < sites[i].live_bytes)
+        {
+            if (pos < max)
+                out[pos] = out[pos - 1];
+            pos--;
+        }
+        if (pos < max)
+            out[pos] = sites[i];
+    }
+    (void)xTaskResumeAll();
+
+    return count;
+}
+
+// remember the current live bytes of every site, so growth since the mark
+// (live_bytes - mark_bytes) shows up as a leak candidate
+void heapmon_mark(void)
+{
+    vTaskSuspendAll();
+    for (uint32_t i = 0; i < site_count; i++)
+        sites[i].mark_bytes = sites[i].live_bytes;
+    (void)xTaskResumeAll();
+}
@@ -0,0 +1,57 @@
+#ifndef __HEAPMON_H__
+#define __HEAPMON_H__
+
+// Included at the end of FreeRTOSConfig.h so heap_4 picks up the
+// traceMALLOC / traceFREE hooks: keep it to plain C declarations.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__CC_ARM)
+#define HEAPMON_CALLER()    ((uintptr_t)__return_address())
+#else
+#define HEAPMON_CALLER()    ((uintptr_t)__builtin_return_address(0))
+#endif
+
+typedef struct
+{
+    // return address into the function that called pvPortMalloc
+    uintptr_t caller;
+    uint32_t live_bytes;
+    uint32_t live_count;
+    uint32_t peak_bytes;
+    uint32_t mark_bytes;
+    uint32_t allocs;
+    uint32_t frees;
+} heapmon_site_t;
+
+typedef struct
+{
+    uint32_t total;
+    uint32_t used;
+    uint32_t peak_used;
+    uint32_t free_blocks;
+    uint32_t largest_free;
+    // 1 - largest free block / free bytes, in 0.1 % units
+    uint32_t fragmentation;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed;
+    uint32_t failed_size;
+    uintptr_t failed_caller;
+    // allocations not attributed because a table was full
+    uint32_t untracked;
+} heapmon_stats_t;
+
+void heapmon_malloc(void *addr, size_t size, uintptr_t caller);
+void heapmon_free(void *addr, size_t size);
+void heapmon_get_stats(heapmon_stats_t *stats);
+uint32_t heapmon_get_sites(heapmon_site_t sites[], uint32_t max);
+void heapmon_mark(void);
+
+#define traceMALLOC(pvAddress, uiSize) \
+    heapmon_malloc((pvAddress), (uiSize), HEAPMON_CALLER())
+#define traceFREE(pvAddress, uiSize) \
+    heapmon_free((pvAddress), (uiSize))
+
+#endif /* __HEAPMON_H__ */
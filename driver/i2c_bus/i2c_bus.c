@@ -0,0 +1,270 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "stm32f4xx.h"
+#include "tim_delay.h"
+#include "ccm.h"
+#include "i2c_bus.h"
+
+// SCL -- PB10
+// SDA -- PB11
+
+#define I2C_BUS_QUEUE_LENGTH    8
+#define I2C_BUS_TIMEOUT_US      1000
+
+typedef struct
+{
+    const i2c_bus_xfer_t *xfers;
+    uint32_t count;
+    i2c_bus_done_func_t done;
+    void *param;
+} i2c_bus_message_t;
+
+typedef struct
+{
+    TaskHandle_t task;
+    i2c_bus_status_t status;
+} i2c_bus_waiter_t;
+
+static QueueHandle_t i2c_bus_queue;
+static i2c_bus_stats_t i2c_bus_stats;
+
+static void i2c_bus_lowlevel_init(void)
+{
+    I2C_InitTypeDef I2C_InitStruct;
+    I2C_StructInit(&I2C_InitStruct);
+    I2C_InitStruct.I2C_Ack = I2C_Ack_Enable;
+    I2C_InitStruct.I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
+    I2C_InitStruct.I2C_ClockSpeed = 100ul * 1000ul;
+    I2C_InitStruct.I2C_DutyCycle = I2C_DutyCycle_2;
+    I2C_InitStruct.I2C_Mode = I2C_Mode_I2C;
+    I2C_InitStruct.I2C_OwnAddress1 = 0x00;
+    I2C_Init(I2C2, &I2C_InitStruct);
+
+    GPIO_InitTypeDef GPIO_InitStruct;
+    GPIO_StructInit(&GPIO_InitStruct);
+    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
+    GPIO_InitStruct.GPIO_OType = GPIO_OType_OD;
+    GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_NOPULL;
+    GPIO_InitStruct.GPIO_Speed = GPIO_High_Speed;
+    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_10 | GPIO_Pin_11;
+    GPIO_Init(GPIOB, &GPIO_InitStruct);
+    GPIO_PinAFConfig(GPIOB, GPIO_PinSource10, GPIO_AF_I2C2);
+    GPIO_PinAFConfig(GPIOB, GPIO_PinSource11, GPIO_AF_I2C2);
+}
+
+static void i2c_bus_recover(void)
+{
+    I2C_SoftwareResetCmd(I2C2, ENABLE);
+    I2C_SoftwareResetCmd(I2C2, DISABLE);
+    i2c_bus_lowlevel_init();
+}
+
+static i2c_bus_status_t i2c_bus_wait_event(uint32_t event)
+{
+    uint64_t start = tim_get_us();
+    while (!I2C_CheckEvent(I2C2, event))
+    {
+        if (I2C_GetFlagStatus(I2C2, I2C_FLAG_AF) == SET)
+        {
+            I2C_ClearFlag(I2C2, I2C_FLAG_AF);
+            return I2C_BUS_ERR_NACK;
+        }
+        if (I2C_GetFlagStatus(I2C2, I2C_FLAG_BERR) == SET ||
+            I2C_GetFlagStatus(I2C2, I2C_FLAG_ARLO) == SET)
+        {
+            I2C_ClearFlag(I2C2, I2C_FLAG_BERR | I2C_FLAG_ARLO);
+            return I2C_BUS_ERR_BUS;
+        }
+        if (tim_get_us() - start > I2C_BUS_TIMEOUT_US)
+            return I2C_BUS_ERR_TIMEOUT;
+    }
+    return I2C_BUS_OK;
+}
+
+#define I2C_CHECK_EVENT(EVENT) \
+    do { \
+        i2c_bus_status_t status = i2c_bus_wait_event(EVENT); \
+        if (status != I2C_BUS_OK) \
+            return status; \
+    } while (0)
+
+static i2c_bus_status_t i2c_bus_do_write(uint8_t addr, const uint8_t data[], uint16_t length)
+{
+    I2C_AcknowledgeConfig(I2C2, ENABLE);
+    I2C_GenerateSTART(I2C2, ENABLE);
+    I2C_CHECK_EVENT(I2C_EVENT_MASTER_MODE_SELECT);
+    I2C_Send7bitAddress(I2C2, addr, I2C_Direction_Transmitter);
+    I2C_CHECK_EVENT(I2C_EVENT_MASTER_TRANSMITTER_MODE_SELECTED);
+    for (uint16_t i = 0; i < length; i++)
+    {
+        I2C_SendData(I2C2, data[i]);
+        I2C_CHECK_EVENT(I2C_EVENT_MASTER_BYTE_TRANSMITTED);
+    }
+
+    return I2C_BUS_OK;
+}
+
+static i2c_bus_status_t i2c_bus_do_read(uint8_t addr, uint8_t data[], uint16_t length)
+{
+    I2C_AcknowledgeConfig(I2C2, ENABLE);
+    I2C_GenerateSTART(I2C2, ENABLE);
+    I2C_CHECK_EVENT(I2C_EVENT_MASTER_MODE_SELECT);
+    I2C_Send7bitAddress(I2C2, addr, I2C_Direction_Receiver);
+    I2C_CHECK_EVENT(I2C_EVENT_MASTER_RECEIVER_MODE_SELECTED);
+    for (uint16_t i = 0; i < length; i++)
+    {
+        if (i == length - 1)
+        {
+            I2C_AcknowledgeConfig(I2C2, DISABLE);
+            I2C_GenerateSTOP(I2C2, ENABLE);
+        }
+        I2C_CHECK_EVENT(I2C_EVENT_MASTER_BYTE_RECEIVED);
+        data[i] = I2C_ReceiveData(I2C2);
+    }
+
+    return I2C_BUS_OK;
+}
+
+static i2c_bus_status_t i2c_bus_do_xfer(const i2c_bus_xfer_t *xfer)
+{
+    i2c_bus_status_t status = I2C_BUS_OK;
+
+    if (xfer->wlen > 0)
+    {
+        status = i2c_bus_do_write(xfer->addr, xfer->wdata, xfer->wlen);
+        if (status != I2C_BUS_OK)
+            return status;
+        i2c_bus_stats.bytes_written += xfer->wlen;
+    }
+
+    // no STOP between write and read: the second START is a repeated start
+    if (xfer->rlen > 0)
+    {
+        status = i2c_bus_do_read(xfer->addr, xfer->rdata, xfer->rlen);
+        if (status != I2C_BUS_OK)
+            return status;
+        i2c_bus_stats.bytes_read += xfer->rlen;
+    }
+    else
+    {
+        I2C_GenerateSTOP(I2C2, ENABLE);
+    }
+
+    return I2C_BUS_OK;
+}
+
+static i2c_bus_status_t i2c_bus_do_batch(const i2c_bus_message_t *msg)
+{
+    i2c_bus_status_t status = I2C_BUS_OK;
+
+    for (uint32_t i = 0; i < msg->count; i++)
+    {
+        i2c_bus_stats.transactions++;
+        status = i2c_bus_do_xfer(&msg->xfers[i]);
+        if (status != I2C_BUS_OK)
+            break;
+    }
+
+    switch (status)
+    {
+    case I2C_BUS_OK:
+        break;
+    case I2C_BUS_ERR_NACK:
+        i2c_bus_stats.errors_nack++;
+        I2C_GenerateSTOP(I2C2, ENABLE);
+        break;
+    case I2C_BUS_ERR_TIMEOUT:
+        i2c_bus_stats.errors_timeout++;
+        i2c_bus_recover();
+        break;
+    default:
+        i2c_bus_stats.errors_bus++;
+        i2c_bus_recover();
+        break;
+    }
+
+    return status;
+}
+
+static void i2c_bus_func(void *param)
+{
+    i2c_bus_message_t msg;
+
+    while (1)
+    {
+        xQueueReceive(i2c_bus_queue, &msg, portMAX_DELAY);
+
+        uint64_t start = tim_get_us();
+        i2c_bus_status_t status = i2c_bus_do_batch(&msg);
+        i2c_bus_stats.busy_us += tim_get_us() - start;
+        i2c_bus_stats.batches++;
+
+        if (msg.done)
+            msg.done(status, msg.param);
+    }
+}
+
+void i2c_bus_init(void)
+{
+    i2c_bus_lowlevel_init();
+
+    i2c_bus_queue = xQueueCreate(I2C_BUS_QUEUE_LENGTH, sizeof(i2c_bus_message_t));
+    configASSERT(i2c_bus_queue);
+    vQueueAddToRegistry(i2c_bus_queue, "i2c bus");
+    i2c_bus_reset_stats();
+    ccm_task_create(i2c_bus_func, "i2c bus", 256, NULL, 7, NULL);
+}
+
+bool i2c_bus_submit(const i2c_bus_xfer_t xfers[], uint32_t count, i2c_bus_done_func_t done, void *param)
+{
+    configASSERT(i2c_bus_queue);
+    if (xfers == NULL || count == 0)
+        return false;
+
+    i2c_bus_message_t msg = { xfers, count, done, param };
+    if (xQueueSend(i2c_bus_queue, &msg, portMAX_DELAY) != pdPASS)
+        return false;
+
+    uint32_t depth = uxQueueMessagesWaiting(i2c_bus_queue);
+    if (depth > i2c_bus_stats.queue_peak)
+        i2c_bus_stats.queue_peak = depth;
+
+    return true;
+}
+
+static void i2c_bus_transfer_done(i2c_bus_status_t status, void *param)
+{
+    i2c_bus_waiter_t *waiter = param;
+    waiter->status = status;
+    xTaskNotifyGive(waiter->task);
+}
+
+i2c_bus_status_t i2c_bus_transfer(const i2c_bus_xfer_t xfers[], uint32_t count)
+{
+    i2c_bus_waiter_t waiter = { xTaskGetCurrentTaskHandle(), I2C_BUS_ERR_BUS };
+
+    if (!i2c_bus_submit(xfers, count, i2c_bus_transfer_done, &waiter))
+        return I2C_BUS_ERR_BUS;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    return waiter.status;
+}
+
+void i2c_bus_get_stats(i2c_bus_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &i2c_bus_stats, sizeof(i2c_bus_stats_t));
+    taskEXIT_CRITICAL();
+}
+
+void i2c_bus_reset_stats(void)
+{
+    taskENTER_CRITICAL();
+    memset(&i2c_bus_stats, 0, sizeof(i2c_bus_stats_t));
+    i2c_bus_stats.since_us = tim_get_us();
+    taskEXIT_CRITICAL();
+}
@@ -0,0 +1,50 @@
+#ifndef __I2C_BUS_H__
+#define __I2C_BUS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum
+{
+    I2C_BUS_OK,
+    I2C_BUS_ERR_TIMEOUT,
+    I2C_BUS_ERR_NACK,
+    I2C_BUS_ERR_BUS,
+} i2c_bus_status_t;
+
+// addr is the 8-bit form (R/W bit clear), same as I2C_Send7bitAddress.
+// wlen == 0: read only, rlen == 0: write only,
+// both set: write then read with a repeated start.
+typedef struct
+{
+    uint8_t addr;
+    const uint8_t *wdata;
+    uint16_t wlen;
+    uint8_t *rdata;
+    uint16_t rlen;
+} i2c_bus_xfer_t;
+
+typedef void (*i2c_bus_done_func_t)(i2c_bus_status_t status, void *param);
+
+typedef struct
+{
+    uint32_t batches;
+    uint32_t transactions;
+    uint32_t errors_timeout;
+    uint32_t errors_nack;
+    uint32_t errors_bus;
+    uint32_t bytes_written;
+    uint32_t bytes_read;
+    uint32_t queue_peak;
+    uint64_t busy_us;
+    uint64_t since_us;
+} i2c_bus_stats_t;
+
+void i2c_bus_init(void);
+// xfers[] must stay valid until done is called from the bus task.
+bool i2c_bus_submit(const i2c_bus_xfer_t xfers[], uint32_t count, i2c_bus_done_func_t done, void *param);
+i2c_bus_status_t i2c_bus_transfer(const i2c_bus_xfer_t xfers[], uint32_t count);
+void i2c_bus_get_stats(i2c_bus_stats_t *stats);
+void i2c_bus_reset_stats(void);
+
+#endif /* __I2C_BUS_H__ */
@@ -0,0 +1,220 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "console.h"
+#include "log.h"
+
+// Frame: SYNC, varint payload length, payload.
+// Payload: varint (fmt - LOG_STRING_BASE), then one field per conversion:
+//   signed integers   zigzag varint
+//   unsigned / char   varint
+//   floating point    IEEE754 float, little endian
+//   strings           varint (length << 1 | cut), then the bytes; cut is
+//                     set when the string was shortened to fit the frame
+// '*' width and precision arguments are sent as signed integers. A frame
+// that does not fit at all goes out as log_dropped_fmt instead.
+
+// room in front of the payload for the sync byte and the length varint
+#define LOG_HEADER_MAX      3
+
+typedef struct
+{
+    uint8_t data[LOG_HEADER_MAX + LOG_FRAME_MAX];
+    uint32_t len;
+    bool overflow;
+    bool truncated;
+} log_frame_t;
+
+static const char log_dropped_fmt[] = "[LOG] frame dropped, format 0x%08lx\n";
+static log_stats_t log_stats;
+
+static void log_put_byte(log_frame_t *frame, uint8_t byte)
+{
+    if (frame->len < LOG_FRAME_MAX)
+        frame->data[LOG_HEADER_MAX + frame->len++] = byte;
+    else
+        frame->overflow = true;
+}
+
+static void log_put_varint(log_frame_t *frame, uint64_t value)
+{
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        log_put_byte(frame, value ? (byte | 0x80) : byte);
+    } while (value);
+}
+
+static void log_put_signed(log_frame_t *frame, int64_t value)
+{
+    log_put_varint(frame, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void log_put_float(log_frame_t *frame, double value)
+{
+    float f = (float)value;
+    uint8_t bytes[4];
+    memcpy(bytes, &f, sizeof(bytes));
+    for (uint32_t i = 0; i < sizeof(bytes); i++)
+        log_put_byte(frame, bytes[i]);
+}
+
+static void log_put_string(log_frame_t *frame, const char *str)
+{
+    if (str == NULL)
+        str = "(null)";
+    
+    uint32_t len = strlen(str);
+    uint32_t room = LOG_FRAME_MAX - frame->len;
+    room = room > 2 ? room - 2 : 0;
+    bool cut = len > room;
+    if (cut)
+    {
+        len = room;
+        frame->truncated = true;
+    }
+    
+    log_put_varint(frame, ((uint64_t)len << 1) | cut);
+    for (uint32_t i = 0; i < len; i++)
+        log_put_byte(frame, str[i]);
+}
+
+// walks the conversions the same way printf would, pulling each argument
+// with its promoted type; nothing is formatted on the target
+static void log_put_args(log_frame_t *frame, const char *fmt, va_list ap)
+{
+    while (*fmt)
+    {
+        if (*fmt++ != '%')
+            continue;
+        if (*fmt == '%')
+        {
+            fmt++;
+            continue;
+        }
+        
+        while (strchr("-+ #0", *fmt) && *fmt)
+            fmt++;
+        if (*fmt == '*')
+        {
+            log_put_signed(frame, va_arg(ap, int));
+            fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+            fmt++;
+        if (*fmt == '.')
+        {
+            fmt++;
+            if (*fmt == '*')
+            {
+                log_put_signed(frame, va_arg(ap, int));
+                fmt++;
+            }
+            while (*fmt >= '0' && *fmt <= '9')
+                fmt++;
+        }
+        
+        int longs = 0;
+        while (strchr("hlLqjzt", *fmt) && *fmt)
+        {
+            if (*fmt == 'l' || *fmt == 'L' || *fmt == 'q' || *fmt == 'j')
+                longs++;
+            fmt++;
+        }
+        
+        switch (*fmt)
+        {
+        case 'd':
+        case 'i':
+            if (longs >= 2)
+                log_put_signed(frame, va_arg(ap, long long));
+            else if (longs == 1)
+                log_put_signed(frame, va_arg(ap, long));
+            else
+                log_put_signed(frame, va_arg(ap, int));
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            if (longs >= 2)
+                log_put_varint(frame, va_arg(ap, unsigned long long));
+            else if (longs == 1)
+                log_put_varint(frame, va_arg(ap, unsigned long));
+            else
+                log_put_varint(frame, va_arg(ap, unsigned int));
+            break;
+        case 'p':
+            log_put_varint(frame, (uintptr_t)va_arg(ap, void *));
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            log_put_float(frame, va_arg(ap, double));
+            break;
+        case 's':
+            log_put_string(frame, va_arg(ap, const char *));
+            break;
+        case 'n':
+            (void)va_arg(ap, int *);
+            break;
+        case '\0':
+            return;
+        default:
+            break;
+        }
+        fmt++;
+    }
+}
+
+void log_emit(const char *fmt, ...)
+{
+    log_frame_t frame;
+    frame.len = 0;
+    frame.overflow = false;
+    frame.truncated = false;
+    
+    log_put_varint(&frame, (uint32_t)((uintptr_t)fmt - LOG_STRING_BASE));
+    
+    va_list ap;
+    va_start(ap, fmt);
+    log_put_args(&frame, fmt, ap);
+    va_end(ap);
+    
+    if (frame.overflow)
+    {
+        log_stats.dropped++;
+        log_emit(log_dropped_fmt, (unsigned long)(uintptr_t)fmt);
+        return;
+    }
+    log_stats.frames++;
+    if (frame.truncated)
+        log_stats.truncated++;
+    
+    uint8_t header[LOG_HEADER_MAX];
+    uint32_t header_len = 0;
+    uint32_t len = frame.len;
+    header[header_len++] = LOG_FRAME_SYNC;
+    do {
+        header[header_len++] = (len & 0x7F) | (len > 0x7F ? 0x80 : 0);
+        len >>= 7;
+    } while (len);
+    
+    // header and payload have to land in the ring as one write
+    uint8_t *out = &frame.data[LOG_HEADER_MAX - header_len];
+    memcpy(out, header, header_len);
+    console_write_data(out, header_len + frame.len);
+}
+
+void log_get_stats(log_stats_t *stats)
+{
+    memcpy(stats, &log_stats, sizeof(log_stats_t));
+}
@@ -0,0 +1,36 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// 1: only the format string address and the raw arguments go out on the
+// console, tools/log_decode.py formats them on the host from the .axf.
+// 0: plain printf.
+#ifndef LOG_TOKENIZED
+#define LOG_TOKENIZED       1
+#endif
+
+#define LOG_FRAME_SYNC      0x1E
+#define LOG_FRAME_MAX       256
+#define LOG_STRING_BASE     0x08000000u
+
+#if LOG_TOKENIZED
+#define LOG(...)            log_emit(__VA_ARGS__)
+#else
+#define LOG(...)            printf(__VA_ARGS__)
+#endif
+
+typedef struct
+{
+    uint32_t frames;
+    // did not fit in LOG_FRAME_MAX, a marker frame went out instead
+    uint32_t dropped;
+    // went out with a %s argument cut short
+    uint32_t truncated;
+} log_stats_t;
+
+void log_emit(const char *fmt, ...);
+void log_get_stats(log_stats_t *stats);
+
+#endif /* __LOG_H__ */
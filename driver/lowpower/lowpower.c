@@ -0,0 +1,247 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f4xx.h"
+#include "rtc.h"
+#include "tim_delay.h"
+#include "clkscale.h"
+#include "lowpower.h"
+
+// Tickless idle (configUSE_TICKLESS_IDLE 2): the kernel hands over the
+// number of ticks until the next task or timer is due. Short gaps, or any
+// gap while a driver holds a lock, are slept with WFI and SysTick running.
+// Longer ones stop SysTick, arm the RTC wakeup timer and enter STOP mode;
+// the RTC alarm (clock task), the wakeup timer and the console RX pin are
+// the wake sources. STOP switches to HSI on exit, so the clocks are put
+// back before anything else runs, then TIM5 and the tick count are moved
+// forward by the time the RTC says has passed.
+#define LOWPOWER_MIN_STOP_TICKS     pdMS_TO_TICKS(20)
+#define LOWPOWER_MAX_STOP_MS        30000
+// HSE and PLL take about 2 ms to come back, so wake up that much early
+#define LOWPOWER_WAKE_MARGIN_MS     3
+
+// rough typical MCU currents from the F407 datasheet (ART on, STOP with
+// the low-power regulator), run and sleep per clkscale level from the
+// tables at the nearest HCLK with the PLL left running; good for comparing
+// builds, measure the board for real numbers
+static const uint32_t run_ua[CLKSCALE_LEVEL_COUNT] = { 12000, 22000, 40000 };
+static const uint32_t sleep_ua[CLKSCALE_LEVEL_COUNT] = { 6000, 9000, 15000 };
+#define LOWPOWER_STOP_UA            300
+
+static const char *const lock_names[LOWPOWER_LOCK_COUNT] =
+{
+    "console tx",
+    "console rx",
+    "esp",
+    "lcd",
+    "backlight",
+};
+
+static uint8_t lock_counts[LOWPOWER_LOCK_COUNT];
+static volatile uint32_t lock_mask;
+static bool lowpower_ready;
+static bool stop_enabled = true;
+static lowpower_stats_t lowpower_stats;
+static uint64_t stats_since;
+// clkscale residency at the last reset
+static uint64_t level_since_us[CLKSCALE_LEVEL_COUNT];
+
+void lowpower_lock(lowpower_lock_t lock)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (lock_counts[lock]++ == 0)
+        lock_mask |= 1u << lock;
+    __set_PRIMASK(primask);
+}
+
+void lowpower_unlock(lowpower_lock_t lock)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (lock_counts[lock] > 0 && --lock_counts[lock] == 0)
+        lock_mask &= ~(1u << lock);
+    __set_PRIMASK(primask);
+}
+
+const char *lowpower_lock_name(lowpower_lock_t lock)
+{
+    return lock < LOWPOWER_LOCK_COUNT ? lock_names[lock] : "?";
+}
+
+void lowpower_set_stop_enabled(bool enabled)
+{
+    stop_enabled = enabled;
+}
+
+bool lowpower_get_stop_enabled(void)
+{
+    return stop_enabled;
+}
+
+static uint64_t lowpower_rtc_ms(void)
+{
+    rtc_date_time_t date;
+    uint16_t ms;
+    rtc_get_time_ms(&date, &ms);
+    
+    return (uint64_t)rtc_to_seconds(&date) * 1000 + ms;
+}
+
+// back to the system clock that was running before STOP (HSE, or HSE and
+// the PLL); flash latency and bus prescalers survive STOP
+static void lowpower_restore_clocks(uint32_t sws)
+{
+    if (sws == RCC_CFGR_SWS_HSI)
+        return;
+    
+    RCC_HSEConfig(RCC_HSE_ON);
+    while (RCC_GetFlagStatus(RCC_FLAG_HSERDY) == RESET);
+    
+    if (sws == RCC_CFGR_SWS_PLL)
+    {
+        RCC_PLLCmd(ENABLE);
+        while (RCC_GetFlagStatus(RCC_FLAG_PLLRDY) == RESET);
+        RCC_SYSCLKConfig(RCC_SYSCLKSource_PLLCLK);
+    }
+    else
+    {
+        RCC_SYSCLKConfig(RCC_SYSCLKSource_HSE);
+    }
+    while ((RCC->CFGR & RCC_CFGR_SWS) != sws);
+}
+
+// interrupts are masked, so WFI still wakes on a pending interrupt but the
+// handler only runs once the tick count is right again
+static bool lowpower_stop(uint32_t expected_ticks)
+{
+    uint32_t ms = expected_ticks * portTICK_PERIOD_MS;
+    if (ms > LOWPOWER_MAX_STOP_MS)
+        ms = LOWPOWER_MAX_STOP_MS;
+    uint32_t oneshot_ms = tim_oneshot_remaining_us() / 1000;
+    if (ms > oneshot_ms)
+        ms = oneshot_ms;
+    if (ms <= LOWPOWER_WAKE_MARGIN_MS)
+        return false;
+    ms -= LOWPOWER_WAKE_MARGIN_MS;
+    
+    uint32_t sws = RCC->CFGR & RCC_CFGR_SWS;
+    clkscale_clocks_t clocks;
+    clkscale_get_clocks(&clocks);
+    // the AHB prescaler survives STOP, so HCLK is HSI divided down
+    uint32_t hsi_hclk_mhz = HSI_VALUE / (clocks.sysclk / clocks.hclk) / 1000000;
+    uint64_t before = lowpower_rtc_ms();
+    uint32_t tim_before = TIM5->CNT;
+    
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    rtc_wakeup_start(ms);
+    PWR_ClearFlag(PWR_FLAG_WU);
+    PWR_EnterSTOPMode(PWR_Regulator_LowPower, PWR_STOPEntry_WFI);
+    
+    // running from HSI (16 MHz) until the clocks are back
+    uint32_t woke = DWT->CYCCNT;
+    lowpower_restore_clocks(sws);
+    uint32_t wake_us = (DWT->CYCCNT - woke) / hsi_hclk_mhz;
+    
+    rtc_wakeup_stop();
+    rtc_resume();
+    uint64_t after = lowpower_rtc_ms();
+    uint32_t slept_ms = after > before ? (uint32_t)(after - before) : 0;
+    
+    tim_stop_compensate(tim_before, slept_ms * 1000);
+    
+    // the tick that unblocks the next task still comes from SysTick
+    uint32_t ticks = pdMS_TO_TICKS(slept_ms);
+    if (ticks >= expected_ticks)
+        ticks = expected_ticks - 1;
+    vTaskStepTick(ticks);
+    SysTick->VAL = 0;
+    SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    
+    lowpower_stats.stops++;
+    lowpower_stats.stop_us += (uint64_t)slept_ms * 1000;
+    lowpower_stats.wake_us = wake_us;
+    if (wake_us > lowpower_stats.wake_max_us)
+        lowpower_stats.wake_max_us = wake_us;
+    
+    return true;
+}
+
+// portSUPPRESS_TICKS_AND_SLEEP: called by the idle task with the scheduler
+// suspended
+void lowpower_idle(uint32_t expected_ticks)
+{
+    __disable_irq();
+    if (eTaskConfirmSleepModeStatus() == eAbortSleep)
+    {
+        __enable_irq();
+        return;
+    }
+    
+    expected_ticks -= clkscale_idle(expected_ticks);
+    bool long_idle = expected_ticks >= LOWPOWER_MIN_STOP_TICKS;
+    if (long_idle && lock_mask != 0)
+        lowpower_stats.blocked++;
+    
+    if (!lowpower_ready || !stop_enabled || !long_idle || lock_mask != 0 ||
+        !lowpower_stop(expected_ticks))
+    {
+        uint32_t start = TIM5->CNT;
+        __DSB();
+        __WFI();
+        __ISB();
+        lowpower_stats.sleep_us += TIM5->CNT - start;
+    }
+    
+    __enable_irq();
+}
+
+void lowpower_get_stats(lowpower_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &lowpower_stats, sizeof(lowpower_stats_t));
+    stats->locks = lock_mask;
+    stats->total_us = tim_now() - stats_since;
+    taskEXIT_CRITICAL();
+    
+    // run and sleep are taken to spread over the levels the way the time does
+    clkscale_stats_t clk;
+    clkscale_get_stats(&clk);
+    uint64_t level_total = 0, run_sum = 0, sleep_sum = 0;
+    for (uint32_t i = 0; i < CLKSCALE_LEVEL_COUNT; i++)
+    {
+        uint64_t us = clk.level_us[i] - level_since_us[i];
+        level_total += us;
+        run_sum += us * run_ua[i];
+        sleep_sum += us * sleep_ua[i];
+    }
+    uint32_t level_run_ua = level_total ? (uint32_t)(run_sum / level_total) : run_ua[CLKSCALE_HIGH];
+    uint32_t level_sleep_ua = level_total ? (uint32_t)(sleep_sum / level_total) : sleep_ua[CLKSCALE_HIGH];
+    
+    uint64_t idle_us = stats->stop_us + stats->sleep_us;
+    uint64_t run_us = stats->total_us > idle_us ? stats->total_us - idle_us : 0;
+    stats->average_ua = stats->total_us == 0 ? 0 :
+        (uint32_t)((run_us * level_run_ua + stats->sleep_us * level_sleep_ua +
+                    stats->stop_us * LOWPOWER_STOP_UA) / stats->total_us);
+}
+
+void lowpower_reset_stats(void)
+{
+    clkscale_stats_t clk;
+    clkscale_get_stats(&clk);
+    
+    taskENTER_CRITICAL();
+    memcpy(level_since_us, clk.level_us, sizeof(level_since_us));
+    memset(&lowpower_stats, 0, sizeof(lowpower_stats_t));
+    stats_since = tim_now();
+    taskEXIT_CRITICAL();
+}
+
+// after rtc_init and tim_delay_init: both are needed to measure STOP
+void lowpower_init(void)
+{
+    lowpower_reset_stats();
+    lowpower_ready = true;
+}
@@ -0,0 +1,48 @@
+#ifndef __LOWPOWER_H__
+#define __LOWPOWER_H__
+
+// Included at the end of FreeRTOSConfig.h, so this is seen by the kernel
+// sources as well: keep it to plain C declarations and macros.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// a driver holds its lock while a transfer needs the bus clocks; STOP is
+// only entered when no lock is held, plain WFI sleep otherwise
+typedef enum
+{
+    LOWPOWER_LOCK_CONSOLE_TX,
+    LOWPOWER_LOCK_CONSOLE_RX,
+    LOWPOWER_LOCK_ESP,
+    LOWPOWER_LOCK_LCD,
+    LOWPOWER_LOCK_BACKLIGHT,
+    LOWPOWER_LOCK_COUNT,
+} lowpower_lock_t;
+
+typedef struct
+{
+    uint32_t stops;
+    uint32_t blocked;
+    uint32_t wake_us;
+    uint32_t wake_max_us;
+    uint64_t stop_us;
+    uint64_t sleep_us;
+    uint64_t total_us;
+    uint32_t locks;
+    uint32_t average_ua;
+} lowpower_stats_t;
+
+void lowpower_init(void);
+void lowpower_lock(lowpower_lock_t lock);
+void lowpower_unlock(lowpower_lock_t lock);
+const char *lowpower_lock_name(lowpower_lock_t lock);
+void lowpower_set_stop_enabled(bool enabled);
+bool lowpower_get_stop_enabled(void);
+void lowpower_get_stats(lowpower_stats_t *stats);
+void lowpower_reset_stats(void);
+void lowpower_idle(uint32_t expected_ticks);
+
+#define portSUPPRESS_TICKS_AND_SLEEP(xExpectedIdleTime) \
+    lowpower_idle(xExpectedIdleTime)
+
+#endif /* __LOWPOWER_H__ */
@@ -0,0 +1,114 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f4xx.h"
+#include "mempool.h"
+
+// The list of pools is only for the statistics. Alloc and free run under
+// PRIMASK for a handful of instructions, like trace_record, so they work
+// from any interrupt priority.
+
+static mempool_t *pools[MEMPOOL_MAX_POOLS];
+static uint32_t pool_count;
+
+bool mempool_init(mempool_t *pool, const char *name, void *storage, uint16_t block_size, uint16_t block_count)
+{
+    block_size = MEMPOOL_BLOCK_SIZE(block_size);
+    if (block_size < sizeof(mempool_block_t) || block_count == 0 || ((uintptr_t)storage & 3) != 0)
+        return false;
+    
+    memset(pool, 0, sizeof(mempool_t));
+    pool->name = name;
+    pool->base = storage;
+    pool->block_size = block_size;
+    pool->block_count = block_count;
+    pool->free = block_count;
+    pool->free_min = block_count;
+    
+    // in address order, the first allocations come from the start
+    for (int32_t i = block_count - 1; i >= 0; i--)
+    {
+        mempool_block_t *block = (mempool_block_t *)(pool->base + i * block_size);
+        block->next = pool->free_list;
+        pool->free_list = block;
+    }
+    
+    taskENTER_CRITICAL();
+    configASSERT(pool_count < MEMPOOL_MAX_POOLS);
+    pools[pool_count++] = pool;
+    taskEXIT_CRITICAL();
+    
+    return true;
+}
+
+void *mempool_alloc(mempool_t *pool)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    mempool_block_t *block = pool->free_list;
+    if (block)
+    {
+        pool->free_list = block->next;
+        pool->free--;
+        if (pool->free < pool->free_min)
+            pool->free_min = pool->free;
+        pool->allocs++;
+    }
+    else
+    {
+        pool->failed++;
+    }
+    
+    __set_PRIMASK(primask);
+    return block;
+}
+
+void mempool_free(mempool_t *pool, void *block)
+{
+    if (block == NULL)
+        return;
+    
+    uint32_t offset = (uint8_t *)block - pool->base;
+    configASSERT((uint8_t *)block >= pool->base &&
+                 offset < (uint32_t)pool->block_size * pool->block_count &&
+                 offset % pool->block_size == 0);
+    
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    mempool_block_t *b = block;
+    b->next = pool->free_list;
+    pool->free_list = b;
+    pool->free++;
+    pool->frees++;
+    
+    __set_PRIMASK(primask);
+}
+
+uint32_t mempool_get_stats(mempool_stats_t stats[], uint32_t max)
+{
+    uint32_t count = 0;
+    
+    for (; count < pool_count && count < max; count++)
+    {
+        const mempool_t *pool = pools[count];
+        mempool_stats_t *s = &stats[count];
+        
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        s->name = pool->name;
+        s->block_size = pool->block_size;
+        s->block_count = pool->block_count;
+        s->free = pool->free;
+        s->free_min = pool->free_min;
+        s->allocs = pool->allocs;
+        s->frees = pool->frees;
+        s->failed = pool->failed;
+        __set_PRIMASK(primask);
+    }
+    
+    return count;
+}
@@ -0,0 +1,56 @@
+#ifndef __MEMPOOL_H__
+#define __MEMPOOL_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Fixed-size block pools: allocation and free pop and push a singly linked
+// free list threaded through the free blocks themselves, so both are O(1)
+// and a pool can't fragment. Both are safe from tasks and interrupts.
+//
+// Storage is the owner's, declared with MEMPOOL_STORAGE so blocks stay
+// word aligned; put it in CCM (CCM_DATA) unless a DMA stream touches it.
+
+#define MEMPOOL_MAX_POOLS   8
+
+#define MEMPOOL_BLOCK_SIZE(size)    (((size) + 3) & ~3u)
+#define MEMPOOL_STORAGE(name, size, count) \
+    uint32_t name[MEMPOOL_BLOCK_SIZE(size) / 4 * (count)]
+
+typedef struct mempool_block
+{
+    struct mempool_block *next;
+} mempool_block_t;
+
+typedef struct
+{
+    const char *name;
+    uint8_t *base;
+    uint16_t block_size;
+    uint16_t block_count;
+    mempool_block_t *free_list;
+    uint16_t free;
+    uint16_t free_min;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed;
+} mempool_t;
+
+typedef struct
+{
+    const char *name;
+    uint16_t block_size;
+    uint16_t block_count;
+    uint16_t free;
+    uint16_t free_min;
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failed;
+} mempool_stats_t;
+
+bool mempool_init(mempool_t *pool, const char *name, void *storage, uint16_t block_size, uint16_t block_count);
+void *mempool_alloc(mempool_t *pool);
+void mempool_free(mempool_t *pool, void *block);
+uint32_t mempool_get_stats(mempool_stats_t stats[], uint32_t max);
+
+#endif /* __MEMPOOL_H__ */
@@ -1,15 +1,85 @@
 #include <string.h>
 #include "stm32f4xx.h"
+#include "trace.h"
 #include "rtc.h"
 
+// smooth calibration over a 32 s window: one CALM pulse is 1 / 2^20
+#define RTC_CALIB_PPM_PER_PULSE     (1000000.0f / 1048576.0f)
+#define RTC_CALIB_PLUS_PULSES       512
+
+// 32768 / (7 + 1) / (4095 + 1): the sub-second counter steps every 244 us,
+// fine enough to measure how long a STOP-mode sleep lasted
+#define RTC_ASYNCH_PREDIV           7
+#define RTC_SYNCH_PREDIV            4095
+
+// the wakeup timer runs from RTCCLK / 16, one count is ~488 us and the
+// 16-bit reload gives 32 s at most
+#define RTC_WAKEUP_HZ               (32768 / 16)
+#define RTC_WAKEUP_MAX_COUNTS       0x10000
+
+static rtc_second_func_t second_func;
+
+// Alarm A with every field masked fires each time the calendar seconds
+// increment, so the interrupt is phase-locked to the second rollover.
+static void rtc_alarm_init(void)
+{
+    RTC_AlarmCmd(RTC_Alarm_A, DISABLE);
+    
+    RTC_AlarmTypeDef RTC_AlarmStruct;
+    RTC_AlarmStructInit(&RTC_AlarmStruct);
+    RTC_AlarmStruct.RTC_AlarmMask = RTC_AlarmMask_All;
+    RTC_SetAlarm(RTC_Format_BIN, RTC_Alarm_A, &RTC_AlarmStruct);
+    RTC_AlarmSubSecondConfig(RTC_Alarm_A, 0, RTC_AlarmSubSecondMask_All);
+    
+    RTC_ClearITPendingBit(RTC_IT_ALRA);
+    RTC_ITConfig(RTC_IT_ALRA, ENABLE);
+    RTC_AlarmCmd(RTC_Alarm_A, ENABLE);
+}
+
+static void rtc_int_init(void)
+{
+    EXTI_InitTypeDef EXTI_InitStructure;
+    EXTI_StructInit(&EXTI_InitStructure);
+    EXTI_InitStructure.EXTI_Line = EXTI_Line17;
+    EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+    EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+    EXTI_ClearITPendingBit(EXTI_Line17);
+    EXTI_Init(&EXTI_InitStructure);
+    
+    EXTI_InitStructure.EXTI_Line = EXTI_Line22;
+    EXTI_ClearITPendingBit(EXTI_Line22);
+    EXTI_Init(&EXTI_InitStructure);
+    
+    NVIC_InitTypeDef NVIC_InitStructure;
+    NVIC_InitStructure.NVIC_IRQChannel = RTC_Alarm_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 5;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+    NVIC_SetPriority(RTC_Alarm_IRQn, 5);
+    
+    NVIC_InitStructure.NVIC_IRQChannel = RTC_WKUP_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+    NVIC_SetPriority(RTC_WKUP_IRQn, 5);
+}
+
 void rtc_init(void)
 {
     RTC_InitTypeDef RTC_InitStruct;
     RTC_StructInit(&RTC_InitStruct);
+    RTC_InitStruct.RTC_AsynchPrediv = RTC_ASYNCH_PREDIV;
+    RTC_InitStruct.RTC_SynchPrediv = RTC_SYNCH_PREDIV;
     RTC_Init(&RTC_InitStruct);
     
     RCC_RTCCLKCmd(ENABLE);
     RTC_WaitForSynchro();
+    
+    rtc_alarm_init();
+    RTC_WakeUpCmd(DISABLE);
+    RTC_WakeUpClockConfig(RTC_WakeUpClock_RTCCLK_Div16);
+    RTC_ITConfig(RTC_IT_WUT, ENABLE);
+    rtc_int_init();
 }
 
 static void _rtc_set_time_once(const rtc_date_time_t *date_time)
@@ -72,3 +142,129 @@ void rtc_get_time(rtc_date_time_t *date_time)
     
     memcpy(date_time, &time1, sizeof(rtc_date_time_t));
 }
+
+void rtc_get_time_ms(rtc_date_time_t *date_time, uint16_t *ms)
+{
+    // reading SSR locks TR and DR until DR is read, so this is one snapshot
+    uint32_t ss = RTC->SSR & RTC_SSR_SS;
+    uint32_t prediv_s = RTC->PRER & RTC_PRER_PREDIV_S;
+    
+    RTC_TimeTypeDef time;
+    RTC_DateTypeDef date;
+    RTC_GetTime(RTC_Format_BIN, &time);
+    RTC_GetDate(RTC_Format_BIN, &date);
+    
+    date_time->year = 2000 + date.RTC_Year;
+    date_time->month = date.RTC_Month;
+    date_time->day = date.RTC_Date;
+    date_time->weekday = date.RTC_WeekDay;
+    date_time->hour = time.RTC_Hours;
+    date_time->minute = time.RTC_Minutes;
+    date_time->second = time.RTC_Seconds;
+    
+    if (ss > prediv_s)
+        ss = prediv_s;
+    *ms = (prediv_s - ss) * 1000 / (prediv_s + 1);
+}
+
+uint32_t rtc_to_seconds(const rtc_date_time_t *date_time)
+{
+    static const uint16_t days_before_month[] =
+        { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+    
+    uint32_t year = date_time->year - 2000;
+    uint32_t days = year * 365 + (year + 3) / 4;
+    if (date_time->month >= 1 && date_time->month <= 12)
+        days += days_before_month[date_time->month - 1];
+    if (date_time->month > 2 && year % 4 == 0)
+        days += 1;
+    days += date_time->day - 1;
+    
+    return ((days * 24 + date_time->hour) * 60 + date_time->minute) * 60 + date_time->second;
+}
+
+// ppm > 0 speeds the calendar up, ppm < 0 slows it down
+void rtc_set_calibration_ppm(float ppm)
+{
+    uint32_t plus = RTC_SmoothCalibPlusPulses_Reset;
+    float pulses = -ppm / RTC_CALIB_PPM_PER_PULSE;
+    
+    if (ppm > 0.0f)
+    {
+        plus = RTC_SmoothCalibPlusPulses_Set;
+        pulses += RTC_CALIB_PLUS_PULSES;
+    }
+    
+    int32_t minus = (int32_t)(pulses + 0.5f);
+    if (minus < 0)
+        minus = 0;
+    if (minus > 511)
+        minus = 511;
+    
+    RTC_SmoothCalibConfig(RTC_SmoothCalibPeriod_32sec, plus, minus);
+}
+
+float rtc_get_calibration_ppm(void)
+{
+    int32_t pulses = -(int32_t)(RTC->CALR & RTC_CALR_CALM);
+    if (RTC->CALR & RTC_CALR_CALP)
+        pulses += RTC_CALIB_PLUS_PULSES;
+    
+    return pulses * RTC_CALIB_PPM_PER_PULSE;
+}
+
+void rtc_second_callback_register(rtc_second_func_t func)
+{
+    second_func = func;
+}
+
+// one-shot wake-up source for STOP mode, the interrupt only clears flags
+void rtc_wakeup_start(uint32_t ms)
+{
+    uint32_t counts = ms * RTC_WAKEUP_HZ / 1000;
+    if (counts == 0)
+        counts = 1;
+    if (counts > RTC_WAKEUP_MAX_COUNTS)
+        counts = RTC_WAKEUP_MAX_COUNTS;
+    
+    RTC_WakeUpCmd(DISABLE);
+    RTC_SetWakeUpCounter(counts - 1);
+    RTC_ClearITPendingBit(RTC_IT_WUT);
+    EXTI_ClearITPendingBit(EXTI_Line22);
+    RTC_WakeUpCmd(ENABLE);
+}
+
+void rtc_wakeup_stop(void)
+{
+    RTC_WakeUpCmd(DISABLE);
+    RTC_ClearITPendingBit(RTC_IT_WUT);
+    EXTI_ClearITPendingBit(EXTI_Line22);
+}
+
+// the shadow registers are stale after STOP until RSF is set again
+void rtc_resume(void)
+{
+    RTC_WaitForSynchro();
+}
+
+void RTC_WKUP_IRQHandler(void)
+{
+    TRACE_ISR_ENTER();
+    RTC_ClearITPendingBit(RTC_IT_WUT);
+    EXTI_ClearITPendingBit(EXTI_Line22);
+    TRACE_ISR_EXIT();
+}
+
+void RTC_Alarm_IRQHandler(void)
+{
+    TRACE_ISR_ENTER();
+    if (RTC_GetITStatus(RTC_IT_ALRA) != RESET)
+    {
+        RTC_ClearITPendingBit(RTC_IT_ALRA);
+        if (second_func)
+            second_func();
+    }
+    
+    EXTI_ClearITPendingBit(EXTI_Line17);
+    TRACE_ISR_EXIT();
+}
@@ -14,8 +14,18 @@ typedef struct
     uint8_t weekday;
 } rtc_date_time_t;
 
+typedef void (*rtc_second_func_t)(void);
+
 void rtc_init(void);
 void rtc_set_time(const rtc_date_time_t *date_time);
 void rtc_get_time(rtc_date_time_t *date_time);
+void rtc_get_time_ms(rtc_date_time_t *date_time, uint16_t *ms);
+uint32_t rtc_to_seconds(const rtc_date_time_t *date_time);
+void rtc_set_calibration_ppm(float ppm);
+float rtc_get_calibration_ppm(void);
+void rtc_second_callback_register(rtc_second_func_t func);
+void rtc_wakeup_start(uint32_t ms);
+void rtc_wakeup_stop(void);
+void rtc_resume(void);
 
 #endif /* __RTC_H__ */
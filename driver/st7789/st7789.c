@@ -2,13 +2,19 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
+#include <math.h>
 #include "FreeRTOS.h"
 #include "task.h"
 #include "semphr.h"
 #include "stm32f4xx.h"
+#include "tim_delay.h"
 #include "st7789.h"
 #include "font.h"
+#include "trace.h"
+#include "lowpower.h"
+#include "clkscale.h"
 #include "image.h"
+#include "ccm.h"
 
 // CLK  PB13
 // MOSI  PC3
@@ -27,9 +33,40 @@
 #define BL_PORT     GPIOE
 #define BL_PIN      GPIO_Pin_5
 
+// PE5 is TIM9_CH1, a 20 kHz PWM. Brightness goes through a square law so
+// equal steps look equal. A fade is a ramp of compare values that
+// DMA2_Stream5 (TIM1_UP, channel 6) copies into TIM9->CCR1 on every TIM1
+// update, so the CPU only sets it up. TIM9 has no clock in STOP mode and
+// would freeze the pin mid-period, so anything but fully on or fully off
+// holds a low-power lock.
+#define BL_PWM_HZ           20000
+#define BL_FADE_CLOCK_HZ    10000
+#define BL_FADE_STEP_MS     10
+#define BL_FADE_STEPS_MAX   200
+// TIM1's reload is 16 bits; longer fades are cut to 200 steps of this
+#define BL_FADE_STEP_MAX_MS (0x10000ul * 1000 / BL_FADE_CLOCK_HZ)
+
+// SLPIN and SLPOUT need 120 ms between each other, and 5 ms before the
+// next command
+#define ST7789_SLEEP_SETTLE_MS  120
+#define ST7789_SLEEP_CMD_MS     5
+
 static SemaphoreHandle_t write_gram_semaphore;
+static st7789_stats_t st7789_stats;
+static uint16_t bl_period;
+static DMA_DATA uint16_t bl_ramp[BL_FADE_STEPS_MAX];
+static uint32_t bl_steps;
+// DMA source of a fill, the caller's stack may be in CCM
+static DMA_DATA uint16_t fill_pixel;
+// glyphs are expanded here and sent as they are
+static DMA_DATA uint8_t font_buff[72 * 72 * 2];
+static uint8_t bl_percent;
+static volatile bool bl_fading;
+static bool bl_locked;
+static uint64_t sleep_changed_ms;
 
 static void st7789_init_display(void);
+static bool st7789_backlight_clock_changed(const clkscale_clocks_t *clocks, clkscale_phase_t phase);
 
 static void st7789_io_init(void)
 {
@@ -43,9 +80,14 @@ static void st7789_io_init(void)
     GPIO_InitStruct.GPIO_OType = GPIO_OType_PP;
     GPIO_InitStruct.GPIO_Speed = GPIO_High_Speed;
     GPIO_InitStruct.GPIO_PuPd = GPIO_PuPd_NOPULL;
-    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_2 | GPIO_Pin_3 | GPIO_Pin_4 | GPIO_Pin_5;
+    GPIO_InitStruct.GPIO_Pin = GPIO_Pin_2 | GPIO_Pin_3 | GPIO_Pin_4;
     GPIO_Init(GPIOE, &GPIO_InitStruct);
     
+    GPIO_PinAFConfig(BL_PORT, GPIO_PinSource5, GPIO_AF_TIM9);
+    GPIO_InitStruct.GPIO_Mode = GPIO_Mode_AF;
+    GPIO_InitStruct.GPIO_Pin = BL_PIN;
+    GPIO_Init(BL_PORT, &GPIO_InitStruct);
+    
     GPIO_PinAFConfig(GPIOB, GPIO_PinSource13, GPIO_AF_SPI2);
     GPIO_PinAFConfig(GPIOC, GPIO_PinSource2, GPIO_AF_SPI2);
     GPIO_PinAFConfig(GPIOC, GPIO_PinSource3, GPIO_AF_SPI2);
@@ -97,6 +139,58 @@ static void st7789_dma_init(void)
     DMA_Init(DMA1_Stream4, &DMA_InitStruct);
 }
 
+static void st7789_backlight_init(void)
+{
+    clkscale_clocks_t clocks;
+    clkscale_get_clocks(&clocks);
+    uint32_t apb2_tim_freq = clocks.apb2_tim;
+    bl_period = apb2_tim_freq / BL_PWM_HZ;
+    
+    TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure;
+    TIM_TimeBaseStructInit(&TIM_TimeBaseStructure);
+    TIM_TimeBaseStructure.TIM_Prescaler = 0;
+    TIM_TimeBaseStructure.TIM_Period = bl_period - 1;
+    TIM_TimeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+    TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+    TIM_TimeBaseInit(TIM9, &TIM_TimeBaseStructure);
+    
+    TIM_OCInitTypeDef TIM_OCInitStructure;
+    TIM_OCStructInit(&TIM_OCInitStructure);
+    TIM_OCInitStructure.TIM_OCMode = TIM_OCMode_PWM1;
+    TIM_OCInitStructure.TIM_OutputState = TIM_OutputState_Enable;
+    TIM_OCInitStructure.TIM_Pulse = 0;
+    TIM_OCInitStructure.TIM_OCPolarity = TIM_OCPolarity_High;
+    // no preload: a new duty applies at once, so the lock is only dropped
+    // once the pin really is steady
+    TIM_OC1Init(TIM9, &TIM_OCInitStructure);
+    TIM_OC1PreloadConfig(TIM9, TIM_OCPreload_Disable);
+    TIM_Cmd(TIM9, ENABLE);
+    
+    // TIM1 only paces the fade: one update, one DMA request, one step
+    TIM_TimeBaseStructure.TIM_Prescaler = apb2_tim_freq / BL_FADE_CLOCK_HZ - 1;
+    TIM_TimeBaseStructure.TIM_Period = BL_FADE_STEP_MS * BL_FADE_CLOCK_HZ / 1000 - 1;
+    TIM_TimeBaseInit(TIM1, &TIM_TimeBaseStructure);
+    // a forced update (new prescaler) must not step the ramp
+    TIM_UpdateRequestConfig(TIM1, TIM_UpdateSource_Regular);
+    TIM_DMACmd(TIM1, TIM_DMA_Update, ENABLE);
+    
+    DMA_InitTypeDef DMA_InitStruct;
+    DMA_StructInit(&DMA_InitStruct);
+    DMA_InitStruct.DMA_Channel = DMA_Channel_6;
+    DMA_InitStruct.DMA_PeripheralBaseAddr = (uint32_t)&TIM9->CCR1;
+    DMA_InitStruct.DMA_Memory0BaseAddr = (uint32_t)bl_ramp;
+    DMA_InitStruct.DMA_DIR = DMA_DIR_MemoryToPeripheral;
+    DMA_InitStruct.DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStruct.DMA_PeripheralDataSize = DMA_PeripheralDataSize_HalfWord;
+    DMA_InitStruct.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStruct.DMA_MemoryDataSize = DMA_MemoryDataSize_HalfWord;
+    DMA_InitStruct.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStruct.DMA_Priority = DMA_Priority_Low;
+    DMA_InitStruct.DMA_FIFOMode = DMA_FIFOMode_Disable;
+    DMA_ITConfig(DMA2_Stream5, DMA_IT_TC, ENABLE);
+    DMA_Init(DMA2_Stream5, &DMA_InitStruct);
+}
+
 static void st7789_int_init(void)
 {
     NVIC_InitTypeDef NVIC_InitStructure;
@@ -106,6 +200,10 @@ static void st7789_int_init(void)
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
     NVIC_SetPriority(DMA1_Stream4_IRQn, 5);
+    
+    NVIC_InitStructure.NVIC_IRQChannel = DMA2_Stream5_IRQn;
+    NVIC_Init(&NVIC_InitStructure);
+    NVIC_SetPriority(DMA2_Stream5_IRQn, 5);
 }
 
 void st7789_init(void)
@@ -115,6 +213,8 @@ void st7789_init(void)
     
     st7789_spi_init();
     st7789_dma_init();
+    st7789_backlight_init();
+    clkscale_register(st7789_backlight_clock_changed);
     st7789_int_init();
     st7789_io_init();
     
@@ -141,15 +241,23 @@ static void st7789_write_register(uint8_t reg, uint8_t data[], uint16_t length)
     while (SPI_GetFlagStatus(SPI2, SPI_FLAG_BSY) != RESET);
     
     GPIO_SetBits(CS_PORT, CS_PIN);
+    
+    st7789_stats.commands++;
+    st7789_stats.bytes_written += 1 + length;
 }
 
 static void st7789_write_gram(uint8_t data[], uint32_t length, bool singlecolor)
 {
+    configASSERT(!ccm_contains(data));
     SPI_DataSizeConfig(SPI2, SPI_DataSize_16b);
     
     GPIO_ResetBits(CS_PORT, CS_PIN);
     GPIO_SetBits(DC_PORT, DC_PIN);
     
+    // SPI2 and DMA1 stop in STOP mode, so hold it off for the whole burst
+    lowpower_lock(LOWPOWER_LOCK_LCD);
+    uint64_t start = tim_get_us();
+    st7789_stats.bytes_written += length;
     length >>= 1;
     
     do
@@ -163,6 +271,7 @@ static void st7789_write_gram(uint8_t data[], uint32_t length, bool singlecolor)
 
         DMA_Cmd(DMA1_Stream4, ENABLE);
         xSemaphoreTake(write_gram_semaphore, portMAX_DELAY);
+        st7789_stats.dma_transfers++;
         
         if (!singlecolor)
             data += chunk_size * 2;
@@ -172,6 +281,9 @@ static void st7789_write_gram(uint8_t data[], uint32_t length, bool singlecolor)
     while (SPI_GetFlagStatus(SPI2, SPI_FLAG_BSY) != RESET);
 
     GPIO_SetBits(CS_PORT, CS_PIN);
+    lowpower_unlock(LOWPOWER_LOCK_LCD);
+    
+    st7789_stats.gram_us += tim_get_us() - start;
 }
 
 static void st7789_reset(void)
@@ -182,9 +294,132 @@ static void st7789_reset(void)
     vTaskDelay(pdMS_TO_TICKS(120));
 }
 
-static void st7789_set_backlight(bool on)
+// with interrupts masked, or from the fade interrupt
+static void st7789_backlight_update_lock(void)
+{
+    uint32_t ccr = TIM9->CCR1;
+    bool need = bl_fading || (ccr != 0 && ccr < bl_period);
+    
+    if (need && !bl_locked)
+        lowpower_lock(LOWPOWER_LOCK_BACKLIGHT);
+    else if (!need && bl_locked)
+        lowpower_unlock(LOWPOWER_LOCK_BACKLIGHT);
+    bl_locked = need;
+}
+
+// caller holds PRIMASK; a completion interrupt that is already pending
+// finds its flag cleared and does nothing
+static void st7789_backlight_stop_fade(void)
+{
+    TIM_Cmd(TIM1, DISABLE);
+    DMA_Cmd(DMA2_Stream5, DISABLE);
+    while (DMA_GetCmdStatus(DMA2_Stream5) != DISABLE);
+    DMA_ClearFlag(DMA2_Stream5, DMA_FLAG_TCIF5 | DMA_FLAG_HTIF5 | DMA_FLAG_TEIF5 | DMA_FLAG_FEIF5);
+    bl_fading = false;
+}
+
+static uint16_t st7789_backlight_duty(float level)
+{
+    return (uint16_t)(level * level * bl_period + 0.5f);
+}
+
+// 0..100 %, fade_ms 0 switches at once
+void st7789_set_brightness(uint8_t percent, uint32_t fade_ms)
+{
+    if (percent > 100)
+        percent = 100;
+    
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    st7789_backlight_stop_fade();
+    bl_percent = percent;
+    
+    // rounded up, so the ramp never needs more than BL_FADE_STEPS_MAX
+    uint32_t step_ms = (fade_ms + BL_FADE_STEPS_MAX - 1) / BL_FADE_STEPS_MAX;
+    if (step_ms < BL_FADE_STEP_MS)
+        step_ms = BL_FADE_STEP_MS;
+    if (step_ms > BL_FADE_STEP_MAX_MS)
+        step_ms = BL_FADE_STEP_MAX_MS;
+    uint32_t steps = fade_ms / step_ms;
+    if (steps > BL_FADE_STEPS_MAX)
+        steps = BL_FADE_STEPS_MAX;
+    
+    float from = sqrtf((float)TIM9->CCR1 / bl_period);
+    float to = percent / 100.0f;
+    if (steps < 2 || st7789_backlight_duty(from) == st7789_backlight_duty(to))
+    {
+        TIM_SetCompare1(TIM9, st7789_backlight_duty(to));
+        st7789_backlight_update_lock();
+        __set_PRIMASK(primask);
+        return;
+    }
+    
+    for (uint32_t i = 0; i < steps; i++)
+        bl_ramp[i] = st7789_backlight_duty(from + (to - from) * (i + 1) / steps);
+    
+    bl_steps = steps;
+    bl_fading = true;
+    st7789_backlight_update_lock();
+    
+    DMA2_Stream5->M0AR = (uint32_t)bl_ramp;
+    DMA2_Stream5->NDTR = steps;
+    DMA_Cmd(DMA2_Stream5, ENABLE);
+    TIM_SetAutoreload(TIM1, step_ms * BL_FADE_CLOCK_HZ / 1000 - 1);
+    TIM_SetCounter(TIM1, 0);
+    TIM_Cmd(TIM1, ENABLE);
+    
+    __set_PRIMASK(primask);
+}
+
+uint8_t st7789_get_brightness(void)
 {
-    GPIO_WriteBit(BL_PORT, BL_PIN, on ? Bit_SET : Bit_RESET);
+    return bl_percent;
+}
+
+// TIM1 and TIM9 run from the APB2 timer clock: keep 20 kHz and the same
+// duty. A fade in progress was worked out for the old period, so what is
+// left of its ramp is scaled to the new one and it carries on from there.
+static bool st7789_backlight_clock_changed(const clkscale_clocks_t *clocks, clkscale_phase_t phase)
+{
+    uint16_t period = clocks->apb2_tim / BL_PWM_HZ;
+    if (phase != CLKSCALE_POST_CHANGE || period == bl_period)
+        return true;
+    
+    uint32_t remaining = 0;
+    if (bl_fading)
+    {
+        // a disabled stream keeps the count it has not sent yet
+        TIM_Cmd(TIM1, DISABLE);
+        DMA_Cmd(DMA2_Stream5, DISABLE);
+        while (DMA_GetCmdStatus(DMA2_Stream5) != DISABLE);
+        remaining = DMA2_Stream5->NDTR;
+        DMA_ClearFlag(DMA2_Stream5, DMA_FLAG_TCIF5 | DMA_FLAG_HTIF5 | DMA_FLAG_TEIF5 | DMA_FLAG_FEIF5);
+        bl_fading = remaining > 0;
+    }
+    
+    for (uint32_t i = bl_steps - remaining; i < bl_steps; i++)
+        bl_ramp[i] = (uint16_t)(((uint32_t)bl_ramp[i] * period + bl_period / 2) / bl_period);
+    uint16_t ccr = (uint16_t)(((uint32_t)TIM9->CCR1 * period + bl_period / 2) / bl_period);
+    
+    bl_period = period;
+    // the fade still ends exactly where it was going
+    if (remaining > 0)
+        bl_ramp[bl_steps - 1] = st7789_backlight_duty(bl_percent / 100.0f);
+    TIM_SetAutoreload(TIM9, bl_period - 1);
+    TIM_SetCounter(TIM9, 0);
+    TIM_SetCompare1(TIM9, ccr);
+    TIM_PrescalerConfig(TIM1, clocks->apb2_tim / BL_FADE_CLOCK_HZ - 1, TIM_PSCReloadMode_Immediate);
+    
+    if (remaining > 0)
+    {
+        DMA2_Stream5->M0AR = (uint32_t)&bl_ramp[bl_steps - remaining];
+        DMA2_Stream5->NDTR = remaining;
+        DMA_Cmd(DMA2_Stream5, ENABLE);
+        TIM_Cmd(TIM1, ENABLE);
+    }
+    st7789_backlight_update_lock();
+    return true;
 }
 
 static void st7789_init_display(void)
@@ -192,7 +427,8 @@ static void st7789_init_display(void)
     st7789_reset();
     
     st7789_write_register(0x11, NULL, 0);
-    vTaskDelay(pdMS_TO_TICKS(5));
+    sleep_changed_ms = tim_get_ms();
+    vTaskDelay(pdMS_TO_TICKS(ST7789_SLEEP_CMD_MS));
     
     st7789_write_register(0x36, (uint8_t[]){0x00}, 1);
     st7789_write_register(0x3A, (uint8_t[]){0x55}, 1);
@@ -210,7 +446,7 @@ static void st7789_init_display(void)
     st7789_write_register(0x29, NULL, 0);
     
     st7789_fill_color(0, 0, ST7789_WIDTH - 1, ST7789_HEIGHT - 1, 0x0000);
-    st7789_set_backlight(true);
+    st7789_set_brightness(100, 500);
 }
 
 static bool in_screen_range(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2)
@@ -240,15 +476,15 @@ void st7789_fill_color(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint1
     st7789_set_range_and_prepare_gram(x1, y1, x2, y2);
     
     uint32_t pixels = (x2 - x1 + 1) * (y2 - y1 + 1);
-    st7789_write_gram((uint8_t *)&color, pixels * 2, true);
+    fill_pixel = color;
+    st7789_write_gram((uint8_t *)&fill_pixel, pixels * 2, true);
 }
 
 static void st7789_draw_font(uint16_t x, uint16_t y, uint16_t width, uint16_t height, const uint8_t *model, uint16_t color, uint16_t bg_color)
 {
     uint16_t bytes_per_row = (width + 7) / 8;
     
-    static uint8_t buff[72 * 72 * 2];
-    uint8_t *pbuf = buff;
+    uint8_t *pbuf = font_buff;
 	for (uint16_t row = 0; row < height; row++)
 	{
 		const uint8_t *row_data = model + row * bytes_per_row;
@@ -262,7 +498,7 @@ static void st7789_draw_font(uint16_t x, uint16_t y, uint16_t width, uint16_t he
 	}
     
     st7789_set_range_and_prepare_gram(x, y, x + width - 1, y + height - 1);
-    st7789_write_gram(buff, pbuf - buff, false);
+    st7789_write_gram(font_buff, pbuf - font_buff, false);
 }
 
 static const uint8_t *ascii_get_model(const char ch, const font_t *font)
@@ -379,8 +615,46 @@ void st7789_draw_image(uint16_t x, uint16_t y, const image_t *image)
     st7789_write_gram((uint8_t *)image->data, image->width * image->height * 2, false);
 }
 
+// only rows y1..y2 are driven, the rest of the panel is blanked; GRAM
+// outside the area keeps its content
+void st7789_set_partial(uint16_t y1, uint16_t y2)
+{
+    st7789_write_register(0x30, (uint8_t[]){y1 >> 8, y1 & 0xFF, y2 >> 8, y2 & 0xFF}, 4);
+    st7789_write_register(0x12, NULL, 0);
+}
+
+void st7789_set_normal(void)
+{
+    st7789_write_register(0x13, NULL, 0);
+}
+
+// 8 colours: only the top bit of each of R, G and B is shown
+void st7789_set_idle(bool idle)
+{
+    st7789_write_register(idle ? 0x39 : 0x38, NULL, 0);
+}
+
+void st7789_sleep(bool sleep)
+{
+    uint64_t since = tim_get_ms() - sleep_changed_ms;
+    if (since < ST7789_SLEEP_SETTLE_MS)
+        vTaskDelay(pdMS_TO_TICKS(ST7789_SLEEP_SETTLE_MS - since));
+    
+    st7789_write_register(sleep ? 0x10 : 0x11, NULL, 0);
+    sleep_changed_ms = tim_get_ms();
+    vTaskDelay(pdMS_TO_TICKS(ST7789_SLEEP_CMD_MS));
+}
+
+void st7789_get_stats(st7789_stats_t *stats)
+{
+    taskENTER_CRITICAL();
+    memcpy(stats, &st7789_stats, sizeof(st7789_stats_t));
+    taskEXIT_CRITICAL();
+}
+
 void DMA1_Stream4_IRQHandler(void)
 {
+    TRACE_ISR_ENTER();
     if (DMA_GetITStatus(DMA1_Stream4, DMA_IT_TCIF4) == SET)
     {
         BaseType_t pxHigherPriorityTaskWoken;
@@ -389,4 +663,18 @@ void DMA1_Stream4_IRQHandler(void)
         
         DMA_ClearITPendingBit(DMA1_Stream4, DMA_IT_TCIF4);
     }
+    TRACE_ISR_EXIT();
+}
+
+void DMA2_Stream5_IRQHandler(void)
+{
+    TRACE_ISR_ENTER();
+    if (DMA_GetITStatus(DMA2_Stream5, DMA_IT_TCIF5) == SET)
+    {
+        DMA_ClearITPendingBit(DMA2_Stream5, DMA_IT_TCIF5);
+        TIM_Cmd(TIM1, DISABLE);
+        bl_fading = false;
+        st7789_backlight_update_lock();
+    }
+    TRACE_ISR_EXIT();
 }
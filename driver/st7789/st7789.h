@@ -9,9 +9,25 @@
 #define ST7789_WIDTH    240
 #define ST7789_HEIGHT   320
 
+typedef struct
+{
+    uint32_t commands;
+    uint32_t dma_transfers;
+    uint32_t bytes_written;
+    // time spent pushing pixel data, including waiting for the DMA
+    uint64_t gram_us;
+} st7789_stats_t;
+
 void st7789_init(void);
 void st7789_fill_color(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint16_t color);
 void st7789_write_string(uint16_t x, uint16_t y, const char *str, uint16_t color, uint16_t bg_color, const font_t *font);
 void st7789_draw_image(uint16_t x, uint16_t y, const image_t *image);
+void st7789_set_brightness(uint8_t percent, uint32_t fade_ms);
+uint8_t st7789_get_brightness(void);
+void st7789_set_partial(uint16_t y1, uint16_t y2);
+void st7789_set_normal(void);
+void st7789_set_idle(bool idle);
+void st7789_sleep(bool sleep);
+void st7789_get_stats(st7789_stats_t *stats);
 
 #endif /* __ST7789_H__ */
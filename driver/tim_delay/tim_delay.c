@@ -1,43 +1,96 @@
 #include <stdint.h>
 #include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
 #include "stm32f4xx.h"
+#include "trace.h"
+#include "clkscale.h"
 #include "tim_delay.h"
 
-static volatile uint64_t tim_tick_count;
-static tim_periodic_callback_t periodic_callback;
+// TIM5 is a free-running 32-bit microsecond counter that wraps every
+// ~71 minutes. The upper 32 bits are extended in software whenever the
+// counter is read, so a slow keepalive timer guarantees at least one read
+// per wrap period and no periodic interrupt is needed.
+#define TIM_KEEPALIVE_INTERVAL_MS   (10ul * 60 * 1000)
+
+#define TIM_US_PER_TICK             (1000000 / configTICK_RATE_HZ)
+
+static uint32_t tim_high;
+static uint32_t tim_last;
+static tim_oneshot_t *oneshot_head;
+
+static void tim_keepalive(TimerHandle_t timer)
+{
+    tim_now();
+}
+
+static void tim_cycle_counter_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// the new prescaler only loads on an update event, which also clears the
+// counter: force one and put the count back, so microseconds keep going
+static bool tim_clock_changed(const clkscale_clocks_t *clocks, clkscale_phase_t phase)
+{
+    uint32_t psc = clocks->apb1_tim / 1000000 - 1;
+    if (phase != CLKSCALE_POST_CHANGE || TIM5->PSC == psc)
+        return true;
+    
+    uint32_t cnt = TIM5->CNT;
+    TIM_PrescalerConfig(TIM5, psc, TIM_PSCReloadMode_Immediate);
+    TIM5->CNT = cnt;
+    return true;
+}
 
 void tim_delay_init(void)
 {
-    RCC_ClocksTypeDef RCC_ClocksStruct;
-    RCC_GetClocksFreq(&RCC_ClocksStruct);
-    uint32_t apb1_tim_freq_mhz = RCC_ClocksStruct.PCLK1_Frequency / 1000 / 1000 * 2;
+    clkscale_clocks_t clocks;
+    clkscale_get_clocks(&clocks);
+    uint32_t apb1_tim_freq_mhz = clocks.apb1_tim / 1000 / 1000;
     
     TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure;
     TIM_TimeBaseStructInit(&TIM_TimeBaseStructure);
     TIM_TimeBaseStructure.TIM_Prescaler = apb1_tim_freq_mhz - 1;
-    TIM_TimeBaseStructure.TIM_Period = 999;
+    TIM_TimeBaseStructure.TIM_Period = 0xFFFFFFFF;
     TIM_TimeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
     TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
-    TIM_TimeBaseInit(TIM6, &TIM_TimeBaseStructure);
-    TIM_ITConfig(TIM6, TIM_IT_Update, ENABLE);
-    TIM_Cmd(TIM6, ENABLE);
+    TIM_TimeBaseInit(TIM5, &TIM_TimeBaseStructure);
+    TIM_UpdateRequestConfig(TIM5, TIM_UpdateSource_Regular);
+    TIM_Cmd(TIM5, ENABLE);
+    clkscale_register(tim_clock_changed);
     
     NVIC_InitTypeDef NVIC_InitStructure;
-    NVIC_InitStructure.NVIC_IRQChannel = TIM6_DAC_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannel = TIM5_IRQn;
     NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 5;
     NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
     NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
     NVIC_Init(&NVIC_InitStructure);
+    NVIC_SetPriority(TIM5_IRQn, 5);
+    
+    tim_cycle_counter_init();
+    
+    TimerHandle_t keepalive_timer = xTimerCreate("tim keepalive", pdMS_TO_TICKS(TIM_KEEPALIVE_INTERVAL_MS), pdTRUE, NULL, tim_keepalive);
+    configASSERT(keepalive_timer);
+    xTimerStart(keepalive_timer, 0);
 }
 
 uint64_t tim_now(void)
 {
-    uint64_t now, last_count;
-    do {
-        last_count = tim_tick_count;
-        now = tim_tick_count + TIM_GetCounter(TIM6);
-    } while (last_count != tim_tick_count);
-    return now;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    uint32_t now = TIM5->CNT;
+    if (now < tim_last)
+        tim_high++;
+    tim_last = now;
+    uint64_t result = ((uint64_t)tim_high << 32) | now;
+    
+    __set_PRIMASK(primask);
+    return result;
 }
 
 uint64_t tim_get_us(void)
@@ -45,35 +98,193 @@ uint64_t tim_get_us(void)
     return tim_now();
 }
 
-uint64_t cpu_get_ms(void)
+uint64_t tim_get_ms(void)
 {
     return tim_now() / 1000;
 }
 
+uint32_t tim_get_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+uint32_t tim_cycles_to_us(uint32_t cycles)
+{
+    return (uint32_t)((uint64_t)cycles * 1000000 / SystemCoreClock);
+}
+
+static bool tim_can_sleep(void)
+{
+    return xTaskGetSchedulerState() == taskSCHEDULER_RUNNING && !xPortIsInsideInterrupt();
+}
+
+// a deadline that has already passed returns at once
+void tim_delay_until(uint64_t deadline)
+{
+    if (tim_can_sleep())
+    {
+        // vTaskDelay(n) returns after n-1 to n tick periods, so sleeping
+        // n-1 ticks never overshoots and the spin below covers the rest
+        uint64_t now = tim_now();
+        if (now < deadline && deadline - now >= 2 * TIM_US_PER_TICK)
+            vTaskDelay((TickType_t)((deadline - now) / TIM_US_PER_TICK) - 1);
+    }
+    
+    while (tim_now() < deadline);
+}
+
 void tim_delay_us(uint32_t us)
 {
-    uint64_t now = tim_now();
-    while (tim_now() - now < (uint64_t)us);
+    tim_delay_until(tim_now() + us);
 }
 
 void tim_delay_ms(uint32_t ms)
 {
-    uint64_t now = tim_now();
-    while (tim_now() - now < (uint64_t)ms * 1000);
+    tim_delay_until(tim_now() + (uint64_t)ms * 1000);
 }
 
-void tim_register_periodic_callback(tim_periodic_callback_t callback)
+// caller holds PRIMASK
+static void tim_oneshot_arm(void)
 {
-    periodic_callback = callback;
+    if (oneshot_head == NULL)
+    {
+        TIM_ITConfig(TIM5, TIM_IT_CC1, DISABLE);
+        return;
+    }
+    
+    TIM_SetCompare1(TIM5, (uint32_t)oneshot_head->deadline);
+    TIM_ClearITPendingBit(TIM5, TIM_IT_CC1);
+    TIM_ITConfig(TIM5, TIM_IT_CC1, ENABLE);
+    
+    // the compare only matches on the way up, so a deadline that has
+    // already passed has to be kicked by hand
+    if (tim_now() >= oneshot_head->deadline)
+        TIM_GenerateEvent(TIM5, TIM_EventSource_CC1);
+}
+
+static void tim_oneshot_remove(tim_oneshot_t *timer)
+{
+    tim_oneshot_t **pp = &oneshot_head;
+    while (*pp != NULL && *pp != timer)
+        pp = &(*pp)->next;
+    if (*pp != NULL)
+        *pp = timer->next;
+    timer->active = false;
+}
+
+void tim_oneshot_start(tim_oneshot_t *timer, uint32_t us, tim_oneshot_func_t func, void *param)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    if (timer->active)
+        tim_oneshot_remove(timer);
+    
+    timer->deadline = tim_now() + us;
+    timer->func = func;
+    timer->param = param;
+    timer->active = true;
+    
+    tim_oneshot_t **pp = &oneshot_head;
+    while (*pp != NULL && (*pp)->deadline <= timer->deadline)
+        pp = &(*pp)->next;
+    timer->next = *pp;
+    *pp = timer;
+    
+    tim_oneshot_arm();
+    __set_PRIMASK(primask);
+}
+
+bool tim_oneshot_cancel(tim_oneshot_t *timer)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    bool was_active = timer->active;
+    if (was_active)
+    {
+        tim_oneshot_remove(timer);
+        tim_oneshot_arm();
+    }
+    
+    __set_PRIMASK(primask);
+    return was_active;
+}
+
+// microseconds until the earliest one-shot fires, UINT32_MAX when none is
+// armed
+uint32_t tim_oneshot_remaining_us(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    uint32_t remaining = UINT32_MAX;
+    if (oneshot_head != NULL)
+    {
+        uint64_t now = tim_now();
+        remaining = oneshot_head->deadline <= now ? 0 :
+                    (uint32_t)(oneshot_head->deadline - now);
+    }
+    
+    __set_PRIMASK(primask);
+    return remaining;
+}
+
+// TIM5 has no clock in STOP mode: move it to where it would be, counted
+// from the value it had before STOP. It never goes backwards, and one-shots
+// that fell due meanwhile are fired by the re-arm.
+void tim_stop_compensate(uint32_t since, uint32_t elapsed_us)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    
+    uint32_t target = since + elapsed_us;
+    if ((int32_t)(target - TIM5->CNT) > 0)
+        TIM5->CNT = target;
+    tim_now();
+    tim_oneshot_arm();
+    
+    __set_PRIMASK(primask);
+}
+
+void tim_prof_begin(tim_prof_t *prof)
+{
+    prof->start = DWT->CYCCNT;
+}
+
+void tim_prof_end(tim_prof_t *prof)
+{
+    uint32_t cycles = DWT->CYCCNT - prof->start;
+    
+    if (prof->count == 0 || cycles < prof->min)
+        prof->min = cycles;
+    if (cycles > prof->max)
+        prof->max = cycles;
+    prof->total += cycles;
+    prof->count++;
 }
 
-void TIM6_DAC_IRQHandler(void)
+void TIM5_IRQHandler(void)
 {
-    if (TIM_GetITStatus(TIM6, TIM_IT_Update) != RESET)
+    TRACE_ISR_ENTER();
+    if (TIM_GetITStatus(TIM5, TIM_IT_CC1) != RESET)
     {
-        TIM_ClearITPendingBit(TIM6, TIM_IT_Update);
-        tim_tick_count += 1000;
-        if (periodic_callback)
-            periodic_callback();
+        TIM_ClearITPendingBit(TIM5, TIM_IT_CC1);
+        
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        while (oneshot_head != NULL && oneshot_head->deadline <= tim_now())
+        {
+            tim_oneshot_t *timer = oneshot_head;
+            oneshot_head = timer->next;
+            timer->active = false;
+            
+            __set_PRIMASK(primask);
+            timer->func(timer->param);
+            __disable_irq();
+        }
+        tim_oneshot_arm();
+        __set_PRIMASK(primask);
     }
+    TRACE_ISR_EXIT();
 }
@@ -1,16 +1,44 @@
 #ifndef __TIM_DELAY_H__
 #define __TIM_DELAY_H__
 
+#include <stdbool.h>
 #include <stdint.h>
 
-typedef void (*tim_periodic_callback_t)(void);
+typedef struct
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t start;
+} tim_prof_t;
+
+typedef void (*tim_oneshot_func_t)(void *param);
+
+typedef struct tim_oneshot
+{
+    uint64_t deadline;
+    tim_oneshot_func_t func;
+    void *param;
+    struct tim_oneshot *next;
+    bool active;
+} tim_oneshot_t;
 
 void tim_delay_init(void);
 uint64_t tim_now(void);
 uint64_t tim_get_us(void);
 uint64_t tim_get_ms(void);
+uint32_t tim_get_cycles(void);
+uint32_t tim_cycles_to_us(uint32_t cycles);
 void tim_delay_us(uint32_t us);
 void tim_delay_ms(uint32_t ms);
-void tim_register_periodic_callback(tim_periodic_callback_t callback);
+void tim_delay_until(uint64_t deadline);
+// func runs in the TIM5 interrupt, only FromISR APIs may be used there
+void tim_oneshot_start(tim_oneshot_t *timer, uint32_t us, tim_oneshot_func_t func, void *param);
+bool tim_oneshot_cancel(tim_oneshot_t *timer);
+uint32_t tim_oneshot_remaining_us(void);
+void tim_stop_compensate(uint32_t since, uint32_t elapsed_us);
+void tim_prof_begin(tim_prof_t *prof);
+void tim_prof_end(tim_prof_t *prof);
 
 #endif /* __TIM_DELAY_H__ */
@@ -0,0 +1,180 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "stm32f4xx.h"
+#include "ccm.h"
+#include "trace.h"
+
+// Events go into a RAM ring that keeps the newest TRACE_EVENTS entries.
+// Recording is a few stores under PRIMASK, so it is safe from the kernel
+// hooks (already inside critical sections), tasks and interrupts alike.
+// Names (tasks, queues, user channels) are kept aside and only sent with
+// the dump, which tools/trace2perfetto.py turns into Chrome trace JSON.
+#define TRACE_MAX_TASKS     32
+#define TRACE_MAX_QUEUES    32
+#define TRACE_MAX_CHANNELS  16
+
+static CCM_DATA trace_event_t trace_buf[TRACE_EVENTS];
+static uint32_t trace_head;
+static volatile bool trace_running;
+static uint8_t trace_task;
+static uint32_t queue_count;
+static char task_names[TRACE_MAX_TASKS][configMAX_TASK_NAME_LEN];
+static const char *queue_names[TRACE_MAX_QUEUES];
+static uint8_t queue_types[TRACE_MAX_QUEUES];
+static const char *channel_names[TRACE_MAX_CHANNELS];
+
+void trace_record(uint8_t type, uint16_t arg)
+{
+    if (!trace_running)
+        return;
+    
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    trace_event_t *evt = &trace_buf[trace_head % TRACE_EVENTS];
+    trace_head++;
+    evt->time = TIM5->CNT;
+    evt->type = type;
+    evt->task = trace_task;
+    evt->arg = arg;
+    __set_PRIMASK(primask);
+}
+
+void trace_task_create(uint32_t number, const char *name)
+{
+    strncpy(task_names[number % TRACE_MAX_TASKS], name, configMAX_TASK_NAME_LEN - 1);
+    trace_record(TRACE_EVT_TASK_CREATE, number);
+}
+
+void trace_task_switched_in(uint32_t number)
+{
+    if (trace_task == number)
+        return;
+    
+    trace_task = number;
+    trace_record(TRACE_EVT_TASK_SWITCH, number);
+}
+
+uint32_t trace_queue_create(uint8_t type)
+{
+    uint32_t number = ++queue_count;
+    queue_types[number % TRACE_MAX_QUEUES] = type;
+    queue_names[number % TRACE_MAX_QUEUES] = NULL;
+    trace_record(TRACE_EVT_QUEUE_CREATE, number);
+    
+    return number;
+}
+
+void trace_queue_name(uint32_t number, const char *name)
+{
+    queue_names[number % TRACE_MAX_QUEUES] = name;
+}
+
+void trace_isr_enter(void)
+{
+    trace_record(TRACE_EVT_ISR_ENTER, __get_IPSR() - 16);
+}
+
+void trace_isr_exit(void)
+{
+    trace_record(TRACE_EVT_ISR_EXIT, __get_IPSR() - 16);
+}
+
+void trace_user_name(uint8_t channel, const char *name)
+{
+    if (channel < TRACE_MAX_CHANNELS)
+        channel_names[channel] = name;
+}
+
+void trace_mark(uint8_t channel, uint16_t value)
+{
+    trace_record(TRACE_EVT_USER_MARK, (uint16_t)(channel << 12) | (value & 0x0FFF));
+}
+
+void trace_begin(uint8_t channel)
+{
+    trace_record(TRACE_EVT_USER_BEGIN, channel);
+}
+
+void trace_end(uint8_t channel)
+{
+    trace_record(TRACE_EVT_USER_END, channel);
+}
+
+void trace_start(void)
+{
+    trace_running = true;
+}
+
+void trace_stop(void)
+{
+    trace_running = false;
+}
+
+bool trace_is_running(void)
+{
+    return trace_running;
+}
+
+void trace_clear(void)
+{
+    bool running = trace_running;
+    trace_running = false;
+    trace_head = 0;
+    trace_running = running;
+}
+
+// text format, one record per line:
+//   #trace <version> <events> <dropped>
+//   #task <number> <name>
+//   #queue <number> <type> <name>
+//   #user <channel> <name>
+//   <time> <type> <task> <arg>
+//   #end
+void trace_dump(trace_print_func_t print)
+{
+    bool running = trace_running;
+    trace_running = false;
+    
+    uint32_t head = trace_head;
+    uint32_t count = head < TRACE_EVENTS ? head : TRACE_EVENTS;
+    
+    print("#trace 1 %lu %lu\n", count, head - count);
+    for (uint32_t i = 0; i < TRACE_MAX_TASKS; i++)
+    {
+        if (task_names[i][0] != '\0')
+            print("#task %lu %s\n", i, task_names[i]);
+    }
+    for (uint32_t i = 0; i < TRACE_MAX_QUEUES; i++)
+    {
+        if (i != 0 && i <= queue_count)
+            print("#queue %lu %u %s\n", i, queue_types[i], queue_names[i] ? queue_names[i] : "-");
+    }
+    for (uint32_t i = 0; i < TRACE_MAX_CHANNELS; i++)
+    {
+        if (channel_names[i] != NULL)
+            print("#user %lu %s\n", i, channel_names[i]);
+    }
+    
+    for (uint32_t i = head - count; i != head; i++)
+    {
+        const trace_event_t *evt = &trace_buf[i % TRACE_EVENTS];
+        print("%lu %u %u %u\n", evt->time, evt->type, evt->task, evt->arg);
+    }
+    print("#end\n");
+    
+    trace_running = running;
+}
+
+void trace_init(void)
+{
+    trace_user_name(TRACE_CH_UI_DRAW, "ui draw");
+    trace_user_name(TRACE_CH_WEATHER_HTTP, "weather http");
+    trace_user_name(TRACE_CH_WEATHER_PARSE, "weather parse");
+    
+#if TRACE_ENABLE
+    trace_start();
+#endif
+}
@@ -0,0 +1,133 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+// Included at the end of FreeRTOSConfig.h, so this is seen by the kernel
+// sources as well: keep it to plain C declarations and macros.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE        1
+#endif
+
+#define TRACE_EVENTS        1024
+
+typedef enum
+{
+    TRACE_EVT_TASK_CREATE,
+    TRACE_EVT_TASK_DELETE,
+    TRACE_EVT_TASK_SWITCH,
+    TRACE_EVT_TASK_READY,
+    TRACE_EVT_TASK_DELAY,
+    TRACE_EVT_NOTIFY_BLOCK,
+    TRACE_EVT_NOTIFY_FROM_ISR,
+    TRACE_EVT_QUEUE_CREATE,
+    TRACE_EVT_QUEUE_SEND,
+    TRACE_EVT_QUEUE_SEND_FAILED,
+    TRACE_EVT_QUEUE_SEND_FROM_ISR,
+    TRACE_EVT_QUEUE_RECEIVE,
+    TRACE_EVT_QUEUE_RECEIVE_FAILED,
+    TRACE_EVT_QUEUE_RECEIVE_FROM_ISR,
+    TRACE_EVT_QUEUE_BLOCK_SEND,
+    TRACE_EVT_QUEUE_BLOCK_RECEIVE,
+    TRACE_EVT_ISR_ENTER,
+    TRACE_EVT_ISR_EXIT,
+    TRACE_EVT_USER_MARK,
+    TRACE_EVT_USER_BEGIN,
+    TRACE_EVT_USER_END,
+} trace_event_type_t;
+
+// time is TIM5 microseconds, task is the task running when it was recorded
+// (0 before the scheduler starts), arg depends on the type: a task number,
+// queue number, IRQ number or user channel / value
+typedef struct
+{
+    uint32_t time;
+    uint8_t type;
+    uint8_t task;
+    uint16_t arg;
+} trace_event_t;
+
+typedef void (*trace_print_func_t)(const char *fmt, ...);
+
+void trace_init(void);
+void trace_start(void);
+void trace_stop(void);
+void trace_clear(void);
+bool trace_is_running(void);
+void trace_record(uint8_t type, uint16_t arg);
+void trace_dump(trace_print_func_t print);
+
+void trace_task_create(uint32_t number, const char *name);
+void trace_task_switched_in(uint32_t number);
+uint32_t trace_queue_create(uint8_t type);
+void trace_queue_name(uint32_t number, const char *name);
+void trace_isr_enter(void);
+void trace_isr_exit(void);
+
+// user markers: channel 0..15, named once with trace_user_name()
+#define TRACE_CH_UI_DRAW        0
+#define TRACE_CH_WEATHER_HTTP   1
+#define TRACE_CH_WEATHER_PARSE  2
+
+void trace_user_name(uint8_t channel, const char *name);
+void trace_mark(uint8_t channel, uint16_t value);
+void trace_begin(uint8_t channel);
+void trace_end(uint8_t channel);
+
+#if TRACE_ENABLE
+
+#define TRACE_ISR_ENTER()   trace_isr_enter()
+#define TRACE_ISR_EXIT()    trace_isr_exit()
+
+#define traceTASK_CREATE(pxNewTCB) \
+    trace_task_create((pxNewTCB)->uxTCBNumber, (pxNewTCB)->pcTaskName)
+#define traceTASK_DELETE(pxTCB) \
+    trace_record(TRACE_EVT_TASK_DELETE, (pxTCB)->uxTCBNumber)
+#define traceTASK_SWITCHED_IN() \
+    trace_task_switched_in(pxCurrentTCB->uxTCBNumber)
+#define traceMOVED_TASK_TO_READY_STATE(pxTCB) \
+    trace_record(TRACE_EVT_TASK_READY, (pxTCB)->uxTCBNumber)
+#define traceTASK_DELAY() \
+    trace_record(TRACE_EVT_TASK_DELAY, 0)
+#define traceTASK_DELAY_UNTIL(xTimeToWake) \
+    trace_record(TRACE_EVT_TASK_DELAY, 0)
+#define traceTASK_NOTIFY_TAKE_BLOCK(uxIndexToWait) \
+    trace_record(TRACE_EVT_NOTIFY_BLOCK, (uxIndexToWait))
+#define traceTASK_NOTIFY_WAIT_BLOCK(uxIndexToWait) \
+    trace_record(TRACE_EVT_NOTIFY_BLOCK, (uxIndexToWait))
+#define traceTASK_NOTIFY_GIVE_FROM_ISR(uxIndexToNotify) \
+    trace_record(TRACE_EVT_NOTIFY_FROM_ISR, (pxTCB)->uxTCBNumber)
+#define traceTASK_NOTIFY_FROM_ISR(uxIndexToNotify) \
+    trace_record(TRACE_EVT_NOTIFY_FROM_ISR, (pxTCB)->uxTCBNumber)
+
+#define traceQUEUE_CREATE(pxNewQueue) \
+    (pxNewQueue)->uxQueueNumber = trace_queue_create((pxNewQueue)->ucQueueType)
+#define traceQUEUE_REGISTRY_ADD(xQueue, pcQueueName) \
+    trace_queue_name(((Queue_t *)(xQueue))->uxQueueNumber, (pcQueueName))
+#define traceQUEUE_SEND(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_SEND, (pxQueue)->uxQueueNumber)
+#define traceQUEUE_SEND_FAILED(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_SEND_FAILED, (pxQueue)->uxQueueNumber)
+#define traceQUEUE_SEND_FROM_ISR(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_SEND_FROM_ISR, (pxQueue)->uxQueueNumber)
+#define traceQUEUE_RECEIVE(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_RECEIVE, (pxQueue)->uxQueueNumber)
+#define traceQUEUE_RECEIVE_FAILED(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_RECEIVE_FAILED, (pxQueue)->uxQueueNumber)
+#define traceQUEUE_RECEIVE_FROM_ISR(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_RECEIVE_FROM_ISR, (pxQueue)->uxQueueNumber)
+#define traceBLOCKING_ON_QUEUE_SEND(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_BLOCK_SEND, (pxQueue)->uxQueueNumber)
+#define traceBLOCKING_ON_QUEUE_RECEIVE(pxQueue) \
+    trace_record(TRACE_EVT_QUEUE_BLOCK_RECEIVE, (pxQueue)->uxQueueNumber)
+
+#else
+
+#define TRACE_ISR_ENTER()
+#define TRACE_ISR_EXIT()
+
+#endif /* TRACE_ENABLE */
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,195 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timesync.h"
+#include "clkscale.h"
+#include "st7789.h"
+#include "heapmon.h"
+#include "tim_delay.h"
+#include "ui.h"
+#include "image.h"
+#include "sim.h"
+
+// Host checks (-c, make check): properties of the firmware that are easy
+// to get wrong and hard to see on the board. They run from a task next to
+// the firmware, once it is up, against the same code the target runs; the
+// exit code is the verdict.
+
+#define SIM_CHECK_START_MS  1500
+
+static uint32_t failures;
+
+#define CHECK(cond)         sim_check((cond), #cond)
+
+static void sim_check(bool ok, const char *what)
+{
+    sim_log("check %s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok)
+        failures++;
+}
+
+// the longest RTC discipline interval has to reach the timer in one piece
+static void check_ticks(void)
+{
+    CHECK(pdMS_TO_TICKS(TIMESYNC_MAX_INTERVAL) == 86400000u);
+    CHECK(pdMS_TO_TICKS(TIMESYNC_MIN_INTERVAL) == 3600000u);
+    CHECK(pdMS_TO_TICKS(2ul * 60 * 60 * 1000) == 7200000u);
+}
+
+// a step leaves the RTC up to a second behind; an LSE without drift
+// sampled at the far end of that at the minimum baseline stays within the
+// noise and gets no calibration (timesync.c)
+static void check_timesync(void)
+{
+    rtc_date_time_t reset = { 2000, 1, 1, 0, 0, 0, 6 };
+    rtc_date_time_t step = { 2026, 1, 1, 10, 0, 0, 4 };
+    rtc_date_time_t rtc = { 2026, 1, 1, 10, 29, 59, 4 };
+    rtc_date_time_t ntp = { 2026, 1, 1, 10, 30, 0, 4 };
+    
+    rtc_set_time(&reset);
+    timesync_discipline(&step);
+    float calibration = rtc_get_calibration_ppm();
+    
+    // stepped 0.9 s into the second, sampled at its start 30 minutes on
+    rtc_set_time(&rtc);
+    vTaskDelay(pdMS_TO_TICKS(100));
+    timesync_discipline(&ntp);
+    CHECK(rtc_get_calibration_ppm() == calibration);
+}
+
+// a task preempted past its deadline must not sleep on the wrapped
+// difference (tim_delay.c)
+static void check_delay_expired(void)
+{
+    TickType_t start = xTaskGetTickCount();
+    tim_delay_until(tim_now() - 5000);
+    tim_delay_until(0);
+    CHECK(xTaskGetTickCount() - start <= 1);
+    
+    uint64_t begin = tim_now();
+    tim_delay_us(3000);
+    CHECK(tim_now() - begin >= 3000);
+}
+
+// the clock moving in the middle of a fade scales the rest of the ramp
+// instead of cutting it short (st7789.c)
+static void check_backlight_fade(void)
+{
+    clkscale_level_t floor = clkscale_get_floor();
+    clkscale_set_floor(CLKSCALE_HIGH);
+    st7789_set_brightness(100, 0);
+    st7789_set_brightness(10, 1000);
+    
+    // per mille of the period: 100 % falls towards 1 % on a square law
+    vTaskDelay(pdMS_TO_TICKS(300));
+    uint32_t before = TIM9->CCR1 * 1000 / (TIM9->ARR + 1);
+    clkscale_set_floor(CLKSCALE_LOW);
+    vTaskDelay(pdMS_TO_TICKS(200));
+    uint32_t during = TIM9->CCR1 * 1000 / (TIM9->ARR + 1);
+    CHECK(clkscale_get_level() == CLKSCALE_LOW);
+    CHECK(during < before && during > 10);
+    
+    vTaskDelay(pdMS_TO_TICKS(700));
+    clkscale_clocks_t clocks;
+    clkscale_get_clocks(&clocks);
+    uint32_t period = clocks.apb2_tim / 20000;
+    CHECK(TIM9->ARR + 1 == period);
+    CHECK(TIM9->CCR1 == (period + 50) / 100);
+    clkscale_set_floor(floor);
+}
+
+// any fade length fits the ramp and TIM1's 16 bit reload (st7789.c)
+static void check_backlight_steps(void)
+{
+    st7789_set_brightness(100, 0);
+    st7789_set_brightness(10, 2999);
+    CHECK(DMA2_Stream5->NDTR <= 200);
+    st7789_set_brightness(100, 2000000);
+    CHECK(DMA2_Stream5->NDTR <= 200 && TIM1->ARR <= 0xFFFF);
+    st7789_set_brightness(100, 0);
+}
+
+// images in the night band go through the night palette, every channel
+// fully on or off, like the rest of the band (ui.c)
+static void check_night_image(void)
+{
+    ui_lock();
+    ui_mode_t mode = ui_get_mode();
+    ui_set_mode(UI_MODE_NIGHT, 15, 154);
+    ui_draw_image(23, 20, &icon_wifi);
+    ui_sync();
+    
+    uint32_t odd = 0;
+    for (uint16_t y = 0; y < icon_wifi.height; y++)
+    {
+        for (uint16_t x = 0; x < icon_wifi.width; x++)
+        {
+            uint32_t rgb = sim_lcd_get_pixel(23 + x, 20 + y);
+            for (int shift = 0; shift < 24; shift += 8)
+            {
+                uint8_t channel = (rgb >> shift) & 0xFF;
+                if (channel != 0 && channel != 0xFF)
+                    odd++;
+            }
+        }
+    }
+    CHECK(odd == 0);
+    
+    ui_set_mode(mode, 0, 0);
+    ui_sync();
+    ui_unlock();
+}
+
+// without a board EN define PA4 stays an input, whatever sits on it
+// (esp_at.c)
+static void check_esp_en(void)
+{
+#ifndef ESP_EN_PORT
+    CHECK(((GPIOA->MODER >> (4 * 2)) & 3) == GPIO_Mode_IN);
+#endif
+}
+
+// a hole that is reused whole, without a split, is charged and given
+// back at the same size (heapmon.c)
+static void check_heap_accounting(void)
+{
+    heapmon_stats_t before, after;
+    
+    vTaskSuspendAll();
+    heapmon_get_stats(&before);
+    void *a = pvPortMalloc(100);
+    void *b = pvPortMalloc(16);
+    vPortFree(a);
+    void *c = pvPortMalloc(96);
+    vPortFree(c);
+    vPortFree(b);
+    heapmon_get_stats(&after);
+    (void)xTaskResumeAll();
+    
+    CHECK(c == a);
+    CHECK(after.used == before.used);
+}
+
+static void sim_check_func(void *param)
+{
+    vTaskDelay(pdMS_TO_TICKS(SIM_CHECK_START_MS));
+
+    check_ticks();
+    check_timesync();
+    check_delay_expired();
+    check_backlight_fade();
+    check_backlight_steps();
+    check_night_image();
+    check_heap_accounting();
+    check_esp_en();
+
+    sim_log("check: %s\n", failures ? "FAIL" : "pass");
+    sim_stop(failures ? 1 : 0);
+    vTaskDelete(NULL);
+}
+
+void sim_check_init(void)
+{
+    xTaskCreate(sim_check_func, "sim check", 1024, NULL, 1, NULL);
+}
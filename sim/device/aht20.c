@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "sim.h"
+
+// AHT20 at 0x38: always calibrated, busy for a conversion time after the
+// trigger command, then reports a fixed 24.0 C and 45 %RH. A read returns
+// the status byte followed by the last conversion.
+
+#define AHT20_SIM_ADDR          0x38
+#define AHT20_SIM_STATUS        0x18
+#define AHT20_SIM_BUSY          0x80
+#define AHT20_SIM_CONVERSION_NS (80ull * 1000000)
+
+#define AHT20_SIM_HUMIDITY      (45u * 0x100000 / 100)
+#define AHT20_SIM_TEMPERATURE   ((24u + 50) * 0x100000 / 200)
+
+static uint8_t command[3];
+static uint32_t command_len;
+static uint32_t read_index;
+static uint64_t busy_until_ns;
+static uint8_t data[6];
+
+static void aht20_convert(void)
+{
+    data[1] = (uint8_t)(AHT20_SIM_HUMIDITY >> 12);
+    data[2] = (uint8_t)(AHT20_SIM_HUMIDITY >> 4);
+    data[3] = (uint8_t)(((AHT20_SIM_HUMIDITY & 0x0F) << 4) | ((AHT20_SIM_TEMPERATURE >> 16) & 0x0F));
+    data[4] = (uint8_t)(AHT20_SIM_TEMPERATURE >> 8);
+    data[5] = (uint8_t)AHT20_SIM_TEMPERATURE;
+    busy_until_ns = sim_time_ns() + AHT20_SIM_CONVERSION_NS;
+}
+
+static bool aht20_start(bool read)
+{
+    if (read)
+        read_index = 0;
+    else
+        command_len = 0;
+    return true;
+}
+
+static bool aht20_write(uint8_t byte)
+{
+    if (command_len < sizeof(command))
+        command[command_len++] = byte;
+    if (command_len == 3 && command[0] == 0xAC)
+        aht20_convert();
+    return true;
+}
+
+static uint8_t aht20_read(void)
+{
+    uint32_t index = read_index++;
+    if (index == 0)
+        return AHT20_SIM_STATUS | (sim_time_ns() < busy_until_ns ? AHT20_SIM_BUSY : 0);
+    return index < sizeof(data) ? data[index] : 0xFF;
+}
+
+static const sim_i2c_device_t aht20_device =
+{
+    .addr = AHT20_SIM_ADDR,
+    .start = aht20_start,
+    .write = aht20_write,
+    .read = aht20_read,
+};
+
+void sim_aht20_init(void)
+{
+    sim_i2c_attach(&aht20_device);
+}
@@ -0,0 +1,105 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sim.h"
+
+// BL24C512 at 0x50: 64 KB, two address bytes then data, page writes wrap
+// inside 128 bytes and are committed on STOP. The write cycle that follows
+// NACKs the address for 5 ms. Reads run on across the whole array.
+//
+// Starts erased (0xFF). With -e the contents come from a file and every
+// committed page is written back to it, so a second run boots with what
+// the first one stored.
+
+#define EEPROM_SIM_ADDR         0x50
+#define EEPROM_SIM_SIZE         (64 * 1024)
+#define EEPROM_SIM_PAGE         128
+#define EEPROM_SIM_WRITE_NS     (5ull * 1000000)
+
+static uint8_t memory[EEPROM_SIM_SIZE];
+static uint8_t page[EEPROM_SIM_PAGE];
+static uint16_t pointer;
+static uint32_t address_bytes;
+static uint32_t data_bytes;
+static uint16_t page_start;
+static uint64_t busy_until_ns;
+static int backing_fd = -1;
+
+static bool eeprom_start(bool read)
+{
+    if (sim_time_ns() < busy_until_ns)
+        return false;
+    
+    if (!read)
+    {
+        address_bytes = 0;
+        data_bytes = 0;
+    }
+    return true;
+}
+
+static bool eeprom_write(uint8_t byte)
+{
+    if (address_bytes < 2)
+    {
+        pointer = (uint16_t)((pointer << 8) | byte);
+        if (++address_bytes == 2)
+        {
+            page_start = pointer & ~(EEPROM_SIM_PAGE - 1);
+            memcpy(page, &memory[page_start], EEPROM_SIM_PAGE);
+        }
+        return true;
+    }
+    
+    page[pointer % EEPROM_SIM_PAGE] = byte;
+    pointer = page_start + (pointer + 1) % EEPROM_SIM_PAGE;
+    data_bytes++;
+    return true;
+}
+
+static uint8_t eeprom_read(void)
+{
+    return memory[pointer++];
+}
+
+static void eeprom_stop(void)
+{
+    if (data_bytes == 0)
+        return;
+    
+    memcpy(&memory[page_start], page, EEPROM_SIM_PAGE);
+    data_bytes = 0;
+    busy_until_ns = sim_time_ns() + EEPROM_SIM_WRITE_NS;
+    
+    if (backing_fd >= 0 &&
+        pwrite(backing_fd, &memory[page_start], EEPROM_SIM_PAGE, page_start) != EEPROM_SIM_PAGE)
+        sim_log("[SIM] eeprom: write to %s failed\n", sim_options.eeprom_file);
+}
+
+static const sim_i2c_device_t eeprom_device =
+{
+    .addr = EEPROM_SIM_ADDR,
+    .start = eeprom_start,
+    .write = eeprom_write,
+    .read = eeprom_read,
+    .stop = eeprom_stop,
+};
+
+void sim_eeprom_init(void)
+{
+    memset(memory, 0xFF, sizeof(memory));
+    
+    if (sim_options.eeprom_file != NULL)
+    {
+        backing_fd = open(sim_options.eeprom_file, O_RDWR | O_CREAT, 0644);
+        if (backing_fd < 0)
+            sim_log("[SIM] eeprom: can't open %s\n", sim_options.eeprom_file);
+        else if (pread(backing_fd, memory, sizeof(memory), 0) != sizeof(memory) &&
+                 pwrite(backing_fd, memory, sizeof(memory), 0) != sizeof(memory))
+            sim_log("[SIM] eeprom: can't initialise %s\n", sim_options.eeprom_file);
+    }
+    
+    sim_i2c_attach(&eeprom_device);
+}
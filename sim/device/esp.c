@@ -0,0 +1,265 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// ESP32 AT firmware on USART2, answering the commands driver/esp_at sends
+// the way the real module does: the command echoed back, then the reply
+// and OK / ERROR. Joining the access point takes a while, SNTP time is
+// the host clock and HTTP GETs return a canned seniverse reply. AT+RST
+// restarts it; so does EN (PA4) on a build that drives it: held low the
+// module stays in reset, released it boots again and says ready.
+//
+// Commands come in from the DMA, under sim_lock; replies are queued with
+// the time they are due and handed to the USART by sim_esp_poll.
+
+#define ESP_BOOT_NS         (300ull * 1000000)
+#define ESP_REPLY_NS        (2ull * 1000000)
+#define ESP_RESTART_NS      (500ull * 1000000)
+#define ESP_JOIN_NS         (2000ull * 1000000)
+#define ESP_HTTP_NS         (300ull * 1000000)
+// how long the access point stays away after -d
+#define ESP_AP_DOWN_NS      (30000ull * 1000000)
+
+#define ESP_EN_PIN          GPIO_Pin_4
+
+#define ESP_QUEUE_LENGTH    8
+#define ESP_LINE_SIZE       256
+#define ESP_TEXT_SIZE       640
+
+#define ESP_BSSID           "da:b5:3a:e3:2f:60"
+#define ESP_WEATHER_JSON    "{\"results\":[{\"location\":{\"id\":\"WTEMH46Z5N09\",\"name\":\"Hefei\"," \
+                            "\"country\":\"CN\",\"path\":\"Hefei,Hefei,Anhui,China\"," \
+                            "\"timezone\":\"Asia/Shanghai\",\"timezone_offset\":\"+08:00\"}," \
+                            "\"now\":{\"text\":\"Cloudy\",\"code\":\"4\",\"temperature\":\"32\"}," \
+                            "\"last_update\":\"2025-07-26T16:30:00+08:00\"}]}"
+
+typedef struct
+{
+    uint64_t due_ns;
+    char text[ESP_TEXT_SIZE];
+} esp_reply_t;
+
+static esp_reply_t queue[ESP_QUEUE_LENGTH];
+static uint32_t queue_head;
+static uint32_t queue_tail;
+static uint64_t queue_last_ns;
+
+static char line[ESP_LINE_SIZE];
+static uint32_t line_len;
+
+static char ssid[64];
+static uint64_t joined_ns;
+static bool joining;
+static int sntp_timezone;
+
+// EN low; bytes sent before booted_ns go nowhere
+static bool held;
+static uint64_t booted_ns = ESP_BOOT_NS;
+static bool dropped;
+
+static const char *weekdays[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// replies keep their order, none is due earlier than the one before it
+static void esp_reply(uint64_t delay_ns, const char *fmt, ...)
+{
+    if (queue_head - queue_tail >= ESP_QUEUE_LENGTH)
+        return;
+
+    esp_reply_t *reply = &queue[queue_head % ESP_QUEUE_LENGTH];
+    uint64_t due = sim_time_ns() + delay_ns;
+    reply->due_ns = due > queue_last_ns ? due : queue_last_ns;
+    queue_last_ns = reply->due_ns;
+
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(reply->text, sizeof(reply->text), fmt, args);
+    va_end(args);
+    queue_head++;
+}
+
+static bool esp_connected(void)
+{
+    return joining && sim_time_ns() >= joined_ns;
+}
+
+static bool esp_ap_down(void)
+{
+    uint64_t drop_ns = (uint64_t)sim_options.wifi_drop_seconds * 1000000000u;
+    uint64_t now = sim_time_ns();
+    return sim_options.wifi_drop_seconds != 0 && now >= drop_ns && now < drop_ns + ESP_AP_DOWN_NS;
+}
+
+static void esp_join(const char *args)
+{
+    char name[64], pwd[64];
+    if (sscanf(args, "\"%63[^\"]\",\"%63[^\"]\"", name, pwd) != 2)
+    {
+        esp_reply(ESP_REPLY_NS, "\r\nERROR\r\n");
+        return;
+    }
+
+    if (sim_options.no_wifi || esp_ap_down())
+    {
+        joining = false;
+        esp_reply(ESP_JOIN_NS, "+CWJAP:3\r\n\r\nERROR\r\n");
+        return;
+    }
+
+    snprintf(ssid, sizeof(ssid), "%s", name);
+    joining = true;
+    joined_ns = sim_time_ns() + ESP_JOIN_NS;
+    esp_reply(ESP_JOIN_NS, "WIFI CONNECTED\r\nWIFI GOT IP\r\n\r\nOK\r\n");
+}
+
+static void esp_sntp_time(void)
+{
+    struct tm tm;
+    time_t now = esp_connected() ? time(NULL) + sntp_timezone * 3600 : 0;
+    gmtime_r(&now, &tm);
+
+    esp_reply(ESP_REPLY_NS, "+CIPSNTPTIME:%s %s %02d %02d:%02d:%02d %d\r\n\r\nOK\r\n",
+              weekdays[tm.tm_wday], months[tm.tm_mon], tm.tm_mday,
+              tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_year + 1900);
+}
+
+static void esp_command(const char *cmd)
+{
+    // echo on, as the module ships
+    esp_reply(ESP_REPLY_NS, "%s\r\n", cmd);
+
+    if (strcmp(cmd, "AT") == 0 || strncmp(cmd, "AT+CWMODE=", 10) == 0)
+    {
+        esp_reply(ESP_REPLY_NS, "\r\nOK\r\n");
+    }
+    else if (strcmp(cmd, "AT+RESTORE") == 0)
+    {
+        joining = false;
+        sntp_timezone = 0;
+        esp_reply(ESP_REPLY_NS, "\r\nOK\r\n");
+        esp_reply(ESP_RESTART_NS, "\r\nready\r\n");
+    }
+    else if (strcmp(cmd, "AT+RST") == 0)
+    {
+        joining = false;
+        sntp_timezone = 0;
+        esp_reply(ESP_REPLY_NS, "\r\nOK\r\n");
+        booted_ns = sim_time_ns() + ESP_REPLY_NS + ESP_BOOT_NS;
+        esp_reply(ESP_REPLY_NS + ESP_BOOT_NS, "\r\nready\r\n");
+    }
+    else if (strncmp(cmd, "AT+CWJAP=", 9) == 0)
+    {
+        esp_join(cmd + 9);
+    }
+    else if (strcmp(cmd, "AT+CWSTATE?") == 0)
+    {
+        int state = esp_connected() ? 2 : joining ? 1 : 0;
+        esp_reply(ESP_REPLY_NS, "+CWSTATE:%d,\"%s\"\r\n\r\nOK\r\n", state, joining ? ssid : "");
+    }
+    else if (strcmp(cmd, "AT+CWJAP?") == 0)
+    {
+        if (esp_connected())
+            esp_reply(ESP_REPLY_NS, "+CWJAP:\"%s\",\"%s\",9,-48,0,1,3,0,1\r\n\r\nOK\r\n", ssid, ESP_BSSID);
+        else
+            esp_reply(ESP_REPLY_NS, "No AP\r\n\r\nOK\r\n");
+    }
+    else if (sscanf(cmd, "AT+CIPSNTPCFG=1,%d", &sntp_timezone) == 1)
+    {
+        esp_reply(ESP_REPLY_NS, "\r\nOK\r\n");
+    }
+    else if (strcmp(cmd, "AT+CIPSNTPTIME?") == 0)
+    {
+        esp_sntp_time();
+    }
+    else if (strncmp(cmd, "AT+HTTPCLIENT=", 14) == 0)
+    {
+        if (esp_connected())
+            esp_reply(ESP_HTTP_NS, "+HTTPCLIENT:%u,%s\r\n\r\nOK\r\n",
+                      (unsigned)strlen(ESP_WEATHER_JSON), ESP_WEATHER_JSON);
+        else
+            esp_reply(ESP_HTTP_NS, "\r\nERROR\r\n");
+    }
+    else
+    {
+        esp_reply(ESP_REPLY_NS, "\r\nERROR\r\n");
+    }
+}
+
+static void esp_receive(const uint8_t *data, uint32_t length)
+{
+    // in reset or still booting, the bytes go nowhere
+    if (held || sim_time_ns() < booted_ns)
+        return;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (data[i] == '\n')
+        {
+            if (line_len > 0 && line[line_len - 1] == '\r')
+                line_len--;
+            line[line_len] = '\0';
+            esp_command(line);
+            line_len = 0;
+        }
+        else if (line_len < sizeof(line) - 1)
+        {
+            line[line_len++] = (char)data[i];
+        }
+    }
+}
+
+// only the edges of EN count, the rest of port A is the USARTs
+static void esp_en(GPIO_TypeDef *port, uint16_t odr)
+{
+    bool low = (odr & ESP_EN_PIN) == 0;
+
+    sim_lock();
+    if (low && !held)
+    {
+        // whatever was still on its way is lost with the module's state
+        held = true;
+        joining = false;
+        sntp_timezone = 0;
+        line_len = 0;
+        queue_tail = queue_head;
+        queue_last_ns = 0;
+    }
+    else if (!low && held)
+    {
+        held = false;
+        booted_ns = sim_time_ns() + ESP_BOOT_NS;
+        esp_reply(ESP_BOOT_NS, "\r\nready\r\n");
+    }
+    sim_unlock();
+}
+
+void sim_esp_init(void)
+{
+    sim_usart_sink(USART2, esp_receive);
+    sim_gpio_watch(GPIOA, esp_en);
+}
+
+void sim_esp_poll(void)
+{
+    uint64_t now = sim_time_ns();
+
+    if (esp_ap_down() && !dropped)
+    {
+        dropped = true;
+        joining = false;
+        esp_reply(0, "WIFI DISCONNECT\r\n");
+    }
+
+    while (queue_tail != queue_head && queue[queue_tail % ESP_QUEUE_LENGTH].due_ns <= now)
+    {
+        const char *text = queue[queue_tail % ESP_QUEUE_LENGTH].text;
+        sim_usart_receive(USART2, (const uint8_t *)text, strlen(text));
+        queue_tail++;
+    }
+}
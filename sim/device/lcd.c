@@ -0,0 +1,514 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// ST7789 on SPI2: follows CS (PE2), RESET (PE3) and DC (PE4) and runs the
+// command / parameter / pixel stream into a 240x320 frame memory, the way
+// the controller does: CASET / RASET set the window, RAMWR / RAMWRC fill it
+// left to right and top to bottom, wrapping inside it, with MADCTL deciding
+// how window addresses land in memory and COLMOD how many bytes make a
+// pixel (16 and 18 bit). Snapshots are that memory as the firmware wrote
+// it; sleep, partial, idle and inversion change what the glass shows, not
+// what is stored, and are left out.
+//
+// Traffic is counted per frame: a frame starts with the first command
+// after the bus was quiet for LCD_FRAME_GAP_NS and ends when it goes quiet
+// again. Overdrawn pixels were written more than once in the frame,
+// unchanged ones were written with the colour they already had; both are
+// bytes a better renderer would not have sent.
+
+#define LCD_CS_PIN          GPIO_Pin_2
+#define LCD_RST_PIN         GPIO_Pin_3
+#define LCD_DC_PIN          GPIO_Pin_4
+
+#define LCD_WIDTH           240
+#define LCD_HEIGHT          320
+#define LCD_PIXELS          (LCD_WIDTH * LCD_HEIGHT)
+
+#define LCD_FRAME_GAP_NS    (50ull * 1000000)
+
+#define LCD_CMD_DISPON      0x29
+#define LCD_CMD_CASET       0x2A
+#define LCD_CMD_RASET       0x2B
+#define LCD_CMD_RAMWR       0x2C
+#define LCD_CMD_MADCTL      0x36
+#define LCD_CMD_COLMOD      0x3A
+#define LCD_CMD_RAMWRC      0x3C
+
+#define LCD_MADCTL_MY       0x80
+#define LCD_MADCTL_MX       0x40
+#define LCD_MADCTL_MV       0x20
+#define LCD_MADCTL_BGR      0x08
+
+// PNG with stored (uncompressed) deflate blocks: no zlib needed
+#define PNG_ROW_SIZE        (1 + LCD_WIDTH * 3)
+#define PNG_RAW_SIZE        (PNG_ROW_SIZE * LCD_HEIGHT)
+#define PNG_BLOCK_SIZE      65535
+#define PNG_BLOCKS          ((PNG_RAW_SIZE + PNG_BLOCK_SIZE - 1) / PNG_BLOCK_SIZE)
+#define PNG_FILE_SIZE       (8 + 25 + 12 + 2 + PNG_BLOCKS * 5 + PNG_RAW_SIZE + 4 + 12)
+
+static bool selected;
+static bool data_mode;
+static uint8_t command;
+static uint32_t param_index;
+static uint8_t params[4];
+
+static uint8_t madctl;
+static uint8_t colmod;
+static uint16_t col_start, col_end, row_start, row_end;
+static uint16_t col, row;
+static uint8_t pixel_bytes[3];
+static uint32_t pixel_index;
+
+// 0x00RRGGBB, and the frame each pixel was last written in
+static uint32_t gram[LCD_PIXELS];
+static uint32_t written_in[LCD_PIXELS];
+
+static sim_lcd_stats_t total;
+static sim_lcd_stats_t frame;
+static bool frame_open;
+static uint64_t frame_start_ns;
+static uint64_t last_activity_ns;
+
+static uint8_t file_buf[PNG_FILE_SIZE];
+static uint32_t crc_table[256];
+
+static void lcd_reset(void)
+{
+    command = 0;
+    param_index = 0;
+    madctl = 0;
+    colmod = 0x66;
+    col_start = 0;
+    col_end = LCD_WIDTH - 1;
+    row_start = 0;
+    row_end = LCD_HEIGHT - 1;
+    col = row = 0;
+    pixel_index = 0;
+}
+
+static void lcd_activity(void)
+{
+    last_activity_ns = sim_time_ns();
+    if (frame_open)
+        return;
+
+    frame_open = true;
+    frame_start_ns = last_activity_ns;
+    memset(&frame, 0, sizeof(frame));
+    frame.frames = ++total.frames;
+}
+
+static void lcd_store(uint32_t rgb)
+{
+    uint32_t x = col, y = row;
+    if (madctl & LCD_MADCTL_MV)
+    {
+        x = row;
+        y = col;
+    }
+    if (madctl & LCD_MADCTL_MX)
+        x = LCD_WIDTH - 1 - x;
+    if (madctl & LCD_MADCTL_MY)
+        y = LCD_HEIGHT - 1 - y;
+
+    if (x < LCD_WIDTH && y < LCD_HEIGHT)
+    {
+        uint32_t i = y * LCD_WIDTH + x;
+        if (written_in[i] == frame.frames)
+            frame.overdrawn++;
+        if (gram[i] == rgb)
+            frame.unchanged++;
+        written_in[i] = frame.frames;
+        gram[i] = rgb;
+        frame.pixels++;
+    }
+
+    if (col++ >= col_end)
+    {
+        col = col_start;
+        if (row++ >= row_end)
+            row = row_start;
+    }
+}
+
+static void lcd_pixel_byte(uint8_t data)
+{
+    uint32_t size = colmod == 0x66 ? 3 : 2;
+
+    frame.pixel_bytes++;
+    pixel_bytes[pixel_index++] = data;
+    if (pixel_index < size)
+        return;
+    pixel_index = 0;
+
+    uint32_t r, g, b;
+    if (size == 3)
+    {
+        r = (pixel_bytes[0] & 0xFC) | (pixel_bytes[0] >> 6);
+        g = (pixel_bytes[1] & 0xFC) | (pixel_bytes[1] >> 6);
+        b = (pixel_bytes[2] & 0xFC) | (pixel_bytes[2] >> 6);
+    }
+    else
+    {
+        uint32_t v = (uint32_t)pixel_bytes[0] << 8 | pixel_bytes[1];
+        r = (v >> 11) & 0x1F;
+        g = (v >> 5) & 0x3F;
+        b = v & 0x1F;
+        r = (r << 3) | (r >> 2);
+        g = (g << 2) | (g >> 4);
+        b = (b << 3) | (b >> 2);
+    }
+    if (madctl & LCD_MADCTL_BGR)
+    {
+        uint32_t t = r;
+        r = b;
+        b = t;
+    }
+
+    lcd_store(r << 16 | g << 8 | b);
+}
+
+static void lcd_command(uint8_t cmd)
+{
+    lcd_activity();
+    command = cmd;
+    param_index = 0;
+    frame.commands++;
+
+    switch (cmd)
+    {
+    case LCD_CMD_RAMWR:
+        col = col_start;
+        row = row_start;
+        pixel_index = 0;
+        break;
+    case LCD_CMD_RAMWRC:
+        pixel_index = 0;
+        break;
+    case LCD_CMD_DISPON:
+        sim_log("[SIM] LCD display on at %u ms\n", (unsigned)(sim_time_ns() / 1000000));
+        break;
+    default:
+        break;
+    }
+}
+
+static void lcd_data(uint8_t data)
+{
+    if (command == LCD_CMD_RAMWR || command == LCD_CMD_RAMWRC)
+    {
+        lcd_pixel_byte(data);
+        return;
+    }
+
+    if (param_index < sizeof(params))
+        params[param_index] = data;
+    param_index++;
+
+    switch (command)
+    {
+    case LCD_CMD_CASET:
+        if (param_index == 4)
+        {
+            col_start = (uint16_t)(params[0] << 8 | params[1]);
+            col_end = (uint16_t)(params[2] << 8 | params[3]);
+        }
+        break;
+    case LCD_CMD_RASET:
+        if (param_index == 4)
+        {
+            row_start = (uint16_t)(params[0] << 8 | params[1]);
+            row_end = (uint16_t)(params[2] << 8 | params[3]);
+        }
+        break;
+    case LCD_CMD_MADCTL:
+        if (param_index == 1)
+            madctl = data;
+        break;
+    case LCD_CMD_COLMOD:
+        if (param_index == 1)
+            colmod = data;
+        break;
+    default:
+        break;
+    }
+}
+
+static void lcd_pins(GPIO_TypeDef *port, uint16_t odr)
+{
+    sim_lock();
+    selected = (odr & LCD_CS_PIN) == 0;
+    data_mode = (odr & LCD_DC_PIN) != 0;
+    if ((odr & LCD_RST_PIN) == 0)
+        lcd_reset();
+    sim_unlock();
+}
+
+// a 16 bit frame goes out high byte first
+static void lcd_frames(const void *frames, uint32_t count, bool dff16, bool minc)
+{
+    if (!selected)
+        return;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t n = minc ? i : 0;
+        uint16_t value = dff16 ? ((const uint16_t *)frames)[n] : ((const uint8_t *)frames)[n];
+
+        if (!data_mode)
+        {
+            // a command is a single byte with DC low
+            lcd_command((uint8_t)value);
+            continue;
+        }
+
+        lcd_activity();
+        if (dff16)
+            lcd_data(value >> 8);
+        lcd_data(value & 0xFF);
+    }
+}
+
+static bool lcd_write_file(const char *path, const uint8_t *data, uint32_t length)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        sim_log("[SIM] LCD can not write %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    while (length > 0)
+    {
+        ssize_t n = write(fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            sim_log("[SIM] LCD can not write %s: %s\n", path, strerror(errno));
+            close(fd);
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+
+    close(fd);
+    return true;
+}
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    if (crc_table[1] == 0)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i;
+            for (uint32_t k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (uint32_t i = 0; i < length; i++)
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+    return p + 4;
+}
+
+// type, data and CRC already in place after the length
+static uint8_t *png_chunk_end(uint8_t *chunk, uint8_t *end)
+{
+    uint32_t length = end - chunk - 8;
+    put_be32(chunk, length);
+    return put_be32(end, crc32_update(0, chunk + 4, length + 4));
+}
+
+static uint32_t png_encode(void)
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t *p = file_buf;
+
+    memcpy(p, signature, sizeof(signature));
+    p += sizeof(signature);
+
+    uint8_t *chunk = p;
+    memcpy(p + 4, "IHDR", 4);
+    p = put_be32(p + 8, LCD_WIDTH);
+    p = put_be32(p, LCD_HEIGHT);
+    // 8 bit RGB, deflate, no filter, no interlace
+    *p++ = 8;
+    *p++ = 2;
+    *p++ = 0;
+    *p++ = 0;
+    *p++ = 0;
+    p = png_chunk_end(chunk, p);
+
+    chunk = p;
+    memcpy(p + 4, "IDAT", 4);
+    p += 8;
+    *p++ = 0x78;
+    *p++ = 0x01;
+
+    uint32_t a = 1, b = 0;
+    uint32_t raw = 0;
+    uint32_t block_left = 0;
+    for (uint32_t y = 0; y < LCD_HEIGHT; y++)
+    {
+        for (uint32_t i = 0; i < PNG_ROW_SIZE; i++)
+        {
+            if (block_left == 0)
+            {
+                block_left = PNG_RAW_SIZE - raw < PNG_BLOCK_SIZE ? PNG_RAW_SIZE - raw : PNG_BLOCK_SIZE;
+                *p++ = PNG_RAW_SIZE - raw == block_left;
+                *p++ = block_left & 0xFF;
+                *p++ = block_left >> 8;
+                *p++ = ~block_left & 0xFF;
+                *p++ = (~block_left >> 8) & 0xFF;
+            }
+
+            uint8_t value = 0;
+            if (i > 0)
+            {
+                uint32_t rgb = gram[y * LCD_WIDTH + (i - 1) / 3];
+                value = (uint8_t)(rgb >> (16 - 8 * ((i - 1) % 3)));
+            }
+            *p++ = value;
+            a = (a + value) % 65521;
+            b = (b + a) % 65521;
+            raw++;
+            block_left--;
+        }
+    }
+    p = put_be32(p, b << 16 | a);
+    p = png_chunk_end(chunk, p);
+
+    chunk = p;
+    memcpy(p + 4, "IEND", 4);
+    p = png_chunk_end(chunk, p + 8);
+
+    return p - file_buf;
+}
+
+static uint32_t ppm_encode(void)
+{
+    int header = snprintf((char *)file_buf, 32, "P6\n%d %d\n255\n", LCD_WIDTH, LCD_HEIGHT);
+    uint8_t *p = file_buf + header;
+
+    for (uint32_t i = 0; i < LCD_PIXELS; i++)
+    {
+        *p++ = gram[i] >> 16;
+        *p++ = gram[i] >> 8;
+        *p++ = gram[i];
+    }
+
+    return p - file_buf;
+}
+
+// .ppm is written as PPM, anything else as PNG
+bool sim_lcd_snapshot(const char *path)
+{
+    size_t length = strlen(path);
+    bool ppm = length >= 4 && strcmp(path + length - 4, ".ppm") == 0;
+
+    sim_lock();
+    uint32_t size = ppm ? ppm_encode() : png_encode();
+    sim_unlock();
+
+    return lcd_write_file(path, file_buf, size);
+}
+
+static void lcd_frame_end(void)
+{
+    frame_open = false;
+    total.commands += frame.commands;
+    total.pixel_bytes += frame.pixel_bytes;
+    total.pixels += frame.pixels;
+    total.overdrawn += frame.overdrawn;
+    total.unchanged += frame.unchanged;
+
+    if (sim_options.lcd_frame_log)
+        sim_log("[SIM] LCD frame %u at %u ms: %u commands, %llu pixel bytes, "
+                "%llu overdrawn, %llu unchanged\n",
+                (unsigned)frame.frames, (unsigned)(frame_start_ns / 1000000),
+                (unsigned)frame.commands, (unsigned long long)frame.pixel_bytes,
+                (unsigned long long)frame.overdrawn, (unsigned long long)frame.unchanged);
+
+    if (sim_options.lcd_frame_dir != NULL)
+    {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/frame-%05u.png", sim_options.lcd_frame_dir, (unsigned)frame.frames);
+        sim_lcd_snapshot(path);
+    }
+}
+
+// totals so far, the frame still being drawn included
+void sim_lcd_get_stats(sim_lcd_stats_t *stats)
+{
+    sim_lock();
+    *stats = total;
+    if (frame_open)
+    {
+        stats->commands += frame.commands;
+        stats->pixel_bytes += frame.pixel_bytes;
+        stats->pixels += frame.pixels;
+        stats->overdrawn += frame.overdrawn;
+        stats->unchanged += frame.unchanged;
+    }
+    sim_unlock();
+}
+
+// 0x00RRGGBB as stored, 0 outside the panel
+uint32_t sim_lcd_get_pixel(uint16_t x, uint16_t y)
+{
+    if (x >= LCD_WIDTH || y >= LCD_HEIGHT)
+        return 0;
+
+    sim_lock();
+    uint32_t rgb = gram[y * LCD_WIDTH + x];
+    sim_unlock();
+    return rgb;
+}
+
+// from the interrupt task
+void sim_lcd_poll(void)
+{
+    sim_lock();
+    bool ended = frame_open && sim_time_ns() - last_activity_ns >= LCD_FRAME_GAP_NS;
+    sim_unlock();
+
+    if (ended)
+        lcd_frame_end();
+}
+
+void sim_lcd_exit(void)
+{
+    if (frame_open)
+        lcd_frame_end();
+
+    if (sim_options.lcd_snapshot != NULL)
+        sim_lcd_snapshot(sim_options.lcd_snapshot);
+}
+
+void sim_lcd_init(void)
+{
+    lcd_reset();
+    sim_gpio_watch(GPIOE, lcd_pins);
+    sim_spi_sink(lcd_frames);
+}
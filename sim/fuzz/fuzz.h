@@ -0,0 +1,29 @@
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// the firmware's receive buffer (esp_at.c rxbuf): at most this much, and
+// always NUL-terminated
+#define FUZZ_RESPONSE_SIZE  1024
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+// as the parsers see it; a NUL inside the input ends the string early,
+// the same as in rxbuf
+static inline const char *fuzz_response(const uint8_t *data, size_t size, char buf[FUZZ_RESPONSE_SIZE])
+{
+    if (size > FUZZ_RESPONSE_SIZE - 1)
+        size = FUZZ_RESPONSE_SIZE - 1;
+    memcpy(buf, data, size);
+    buf[size] = '\0';
+    return buf;
+}
+
+// any field the parser wrote must still be a string inside its array
+#define FUZZ_CHECK_STRING(field) \
+    do { if (memchr((field), '\0', sizeof(field)) == NULL) __builtin_trap(); } while (0)
+
+#endif /* __FUZZ_H__ */
@@ -0,0 +1,15 @@
+#include <stdbool.h>
+#include "esp_at_parse.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char buf[FUZZ_RESPONSE_SIZE];
+    esp_date_time_t date = { 0 };
+
+    // unknown names come back as 0, never out of range
+    if (parse_cipsntptime_response(fuzz_response(data, size, buf), &date) &&
+        (date.month > 12 || date.weekday > 7))
+        __builtin_trap();
+    return 0;
+}
@@ -0,0 +1,13 @@
+#include <stdbool.h>
+#include "esp_at_parse.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char buf[FUZZ_RESPONSE_SIZE];
+    esp_wifi_info_t info = { 0 };
+
+    if (parse_cwstate_response(fuzz_response(data, size, buf), &info))
+        FUZZ_CHECK_STRING(info.ssid);
+    return 0;
+}
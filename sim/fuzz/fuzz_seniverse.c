@@ -0,0 +1,17 @@
+#include <stdbool.h>
+#include "weather.h"
+#include "fuzz.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    char buf[FUZZ_RESPONSE_SIZE];
+    weather_info_t info = { 0 };
+
+    if (parse_seniverse_response(fuzz_response(data, size, buf), &info))
+    {
+        FUZZ_CHECK_STRING(info.city);
+        FUZZ_CHECK_STRING(info.loaction);
+        FUZZ_CHECK_STRING(info.weather);
+    }
+    return 0;
+}
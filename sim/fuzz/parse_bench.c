@@ -0,0 +1,109 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "esp_at_parse.h"
+#include "weather.h"
+
+// Parser throughput on the host, over the responses the firmware sees in
+// normal operation (as captured from the module, echo included). The
+// numbers only compare one parser version with another on the same host.
+
+#define BENCH_DEFAULT_MS    500
+
+typedef struct
+{
+    const char *name;
+    const char *response;
+    bool (*parse)(const char *response);
+} parse_bench_t;
+
+static esp_wifi_info_t wifi_info;
+static esp_date_time_t date_time;
+static weather_info_t weather_info;
+
+static bool bench_cwstate(const char *response)
+{
+    return parse_cwstate_response(response, &wifi_info);
+}
+
+static bool bench_cwjap(const char *response)
+{
+    return parse_cwjap_response(response, &wifi_info);
+}
+
+static bool bench_cipsntptime(const char *response)
+{
+    return parse_cipsntptime_response(response, &date_time);
+}
+
+static bool bench_seniverse(const char *response)
+{
+    return parse_seniverse_response(response, &weather_info);
+}
+
+static const parse_bench_t benches[] =
+{
+    { "cwstate", "AT+CWSTATE?\r\n+CWSTATE:2,\"vivo X200 Pro mini\"\r\n\r\nOK\r\n", bench_cwstate },
+    { "cwjap", "AT+CWJAP?\r\n+CWJAP:\"vivo X200 Pro mini\",\"da:b5:3a:e3:2f:60\",9,-48,0,1,3,0,1\r\n\r\nOK\r\n",
+      bench_cwjap },
+    { "cipsntptime", "AT+CIPSNTPTIME?\r\n+CIPSNTPTIME:Sun Jul 27 14:07:19 2025\r\n\r\nOK\r\n", bench_cipsntptime },
+    { "seniverse", "+HTTPCLIENT:261,{\"results\":[{\"location\":{\"id\":\"WTEMH46Z5N09\",\"name\":\"Hefei\","
+      "\"country\":\"CN\",\"path\":\"Hefei,Hefei,Anhui,China\",\"timezone\":\"Asia/Shanghai\","
+      "\"timezone_offset\":\"+08:00\"},\"now\":{\"text\":\"Cloudy\",\"code\":\"4\",\"temperature\":\"32\"},"
+      "\"last_update\":\"2025-07-26T16:30:00+08:00\"}]}\r\n\r\nOK\r\n", bench_seniverse },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t run_ms = BENCH_DEFAULT_MS;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1)
+    {
+        if (opt != 't')
+        {
+            fprintf(stderr, "usage: %s [-t ms per parser]\n", argv[0]);
+            return 2;
+        }
+        run_ms = (uint32_t)strtoul(optarg, NULL, 0);
+    }
+
+    printf("  %-12s %6s %10s %10s\n", "parser", "bytes", "ns/call", "MB/s");
+    for (uint32_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+    {
+        const parse_bench_t *bench = &benches[i];
+        size_t length = strlen(bench->response);
+
+        if (!bench->parse(bench->response))
+        {
+            printf("  %-12s does not parse its sample\n", bench->name);
+            return 1;
+        }
+
+        uint64_t calls = 0;
+        uint64_t start = now_ns();
+        uint64_t elapsed;
+        do
+        {
+            for (uint32_t n = 0; n < 1000; n++)
+                bench->parse(bench->response);
+            calls += 1000;
+            elapsed = now_ns() - start;
+        } while (elapsed < (uint64_t)run_ms * 1000000);
+
+        printf("  %-12s %6zu %10.1f %10.1f\n", bench->name, length,
+               (double)elapsed / calls, (double)length * calls * 1000 / elapsed);
+    }
+
+    return 0;
+}
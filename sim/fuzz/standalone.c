@@ -0,0 +1,168 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fuzz.h"
+
+// main() for the harnesses when there is no libFuzzer: AFL runs it with
+// one input on stdin; given files or directories it runs every file once
+// (corpus regression under the sanitizers), and with -n each of them
+// again that many times randomly mutated, a crude fuzzer for machines
+// without clang.
+
+#define INPUT_MAX   (FUZZ_RESPONSE_SIZE * 2)
+
+static uint8_t input[INPUT_MAX];
+static uint8_t mutated[INPUT_MAX];
+static uint32_t files;
+static uint32_t mutations;
+static uint32_t rng_state;
+
+static uint32_t rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// a few edits of one kind or another, the way the line garbles bytes or
+// the module sends something unexpected
+static size_t mutate(const uint8_t *data, size_t size, uint8_t *out)
+{
+    static const char *const bytes = "\"\\,:-+0123456789\r\n \xff";
+    size_t length = size;
+    memcpy(out, data, size);
+
+    uint32_t edits = 1 + rng() % 8;
+    for (uint32_t i = 0; i < edits; i++)
+    {
+        size_t at = length > 0 ? rng() % length : 0;
+        switch (rng() % 5)
+        {
+        case 0:
+            if (length > 0)
+                out[at] ^= (uint8_t)(1u << (rng() % 8));
+            break;
+        case 1:
+            if (length < INPUT_MAX)
+            {
+                memmove(out + at + 1, out + at, length - at);
+                out[at] = (uint8_t)bytes[rng() % strlen(bytes)];
+                length++;
+            }
+            break;
+        case 2:
+            if (length > 0)
+            {
+                size_t count = 1 + rng() % (length - at);
+                memmove(out + at, out + at + count, length - at - count);
+                length -= count;
+            }
+            break;
+        case 3:
+            if (length > 0)
+            {
+                // repeat a piece, long fields and runs of separators
+                size_t count = 1 + rng() % (length - at);
+                if (length + count > INPUT_MAX)
+                    count = INPUT_MAX - length;
+                memmove(out + at + count, out + at, length - at);
+                length += count;
+            }
+            break;
+        default:
+            if (length > 0)
+                out[at] = (uint8_t)rng();
+            break;
+        }
+    }
+
+    return length;
+}
+
+static void run_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        exit(2);
+    }
+    size_t size = fread(input, 1, sizeof(input), file);
+    fclose(file);
+
+    LLVMFuzzerTestOneInput(input, size);
+    files++;
+
+    for (uint32_t i = 0; i < mutations; i++)
+    {
+        size_t length = mutate(input, size, mutated);
+        LLVMFuzzerTestOneInput(mutated, length);
+    }
+}
+
+static void run_path(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        perror(path);
+        exit(2);
+    }
+
+    if (!S_ISDIR(st.st_mode))
+    {
+        run_file(path);
+        return;
+    }
+
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        char child[4096];
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+        run_path(child);
+    }
+    closedir(dir);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    rng_state = 0x2545F491;
+    while ((opt = getopt(argc, argv, "n:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            mutations = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            rng_state = (uint32_t)strtoul(optarg, NULL, 0) | 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n mutations] [-s seed] [file|dir ...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (optind == argc)
+    {
+        size_t size = fread(input, 1, sizeof(input), stdin);
+        LLVMFuzzerTestOneInput(input, size);
+        return 0;
+    }
+
+    for (int i = optind; i < argc; i++)
+        run_path(argv[i]);
+    printf("%s: %u inputs, %u mutations each\n", argv[0], files, mutations);
+    return 0;
+}
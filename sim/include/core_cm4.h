@@ -0,0 +1,62 @@
+#ifndef __SIM_CORE_CM4_H__
+#define __SIM_CORE_CM4_H__
+
+// Host stand-in for the CMSIS core header: the register and bit
+// definitions come from the real core_cm4.h, the intrinsics (ARM
+// instructions there) and the core peripherals the firmware touches are
+// provided by the simulator.
+
+#include <stdint.h>
+
+// keep the ARM intrinsic headers out
+#define __CORE_CMINSTR_H
+#define __CORE_CMFUNC_H
+#define __CORE_CMSIMD_H
+
+uint32_t sim_get_primask(void);
+void sim_set_primask(uint32_t primask);
+uint32_t sim_get_ipsr(void);
+uint32_t sim_ldrex(volatile uint32_t *addr);
+uint32_t sim_strex(uint32_t value, volatile uint32_t *addr);
+void sim_clrex(void);
+void sim_wfi(void);
+void sim_irq_set_priority(IRQn_Type irq, uint32_t priority);
+
+#define __enable_irq()          sim_set_primask(0)
+#define __disable_irq()         sim_set_primask(1)
+#define __get_PRIMASK()         sim_get_primask()
+#define __set_PRIMASK(x)        sim_set_primask(x)
+#define __get_IPSR()            sim_get_ipsr()
+#define __LDREXW(addr)          sim_ldrex(addr)
+#define __STREXW(value, addr)   sim_strex((value), (addr))
+#define __CLREX()               sim_clrex()
+#define __DMB()                 __sync_synchronize()
+#define __DSB()                 __sync_synchronize()
+#define __ISB()                 __sync_synchronize()
+#define __NOP()                 ((void)0)
+#define __WFI()                 sim_wfi()
+
+// the inline NVIC_SetPriority writes the NVIC directly, park it under
+// another name
+#define NVIC_SetPriority        sim_core_NVIC_SetPriority
+#include_next "core_cm4.h"
+#undef NVIC_SetPriority
+
+static inline void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    sim_irq_set_priority(IRQn, priority);
+}
+
+extern SysTick_Type sim_systick;
+extern CoreDebug_Type sim_coredebug;
+DWT_Type *sim_dwt(void);
+
+#undef SysTick
+#define SysTick         (&sim_systick)
+#undef CoreDebug
+#define CoreDebug       (&sim_coredebug)
+// the cycle counter is brought up to date on every access
+#undef DWT
+#define DWT             (sim_dwt())
+
+#endif /* __SIM_CORE_CM4_H__ */
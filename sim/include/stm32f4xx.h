@@ -0,0 +1,105 @@
+#ifndef __SIM_STM32F4XX_H__
+#define __SIM_STM32F4XX_H__
+
+// Host stand-in for the device header: types, bit definitions and the
+// standard peripheral library prototypes are the real ones, the
+// peripherals the firmware uses are moved into host memory (sim/periph).
+// Counters that run on their own are brought up to date on every access.
+
+#include_next "stm32f4xx.h"
+
+extern GPIO_TypeDef sim_gpio[5];
+extern DMA_TypeDef sim_dma[2];
+extern DMA_Stream_TypeDef sim_dma_stream[16];
+extern USART_TypeDef sim_usart1;
+extern USART_TypeDef sim_usart2;
+extern SPI_TypeDef sim_spi2;
+extern I2C_TypeDef sim_i2c2;
+extern TIM_TypeDef sim_tim1;
+extern TIM_TypeDef sim_tim9;
+extern RCC_TypeDef sim_rcc;
+extern FLASH_TypeDef sim_flash;
+extern PWR_TypeDef sim_pwr;
+extern EXTI_TypeDef sim_exti;
+extern SYSCFG_TypeDef sim_syscfg;
+TIM_TypeDef *sim_tim5(void);
+RTC_TypeDef *sim_rtc(void);
+
+#undef GPIOA
+#undef GPIOB
+#undef GPIOC
+#undef GPIOD
+#undef GPIOE
+#define GPIOA           (&sim_gpio[0])
+#define GPIOB           (&sim_gpio[1])
+#define GPIOC           (&sim_gpio[2])
+#define GPIOD           (&sim_gpio[3])
+#define GPIOE           (&sim_gpio[4])
+
+#undef DMA1
+#undef DMA2
+#define DMA1            (&sim_dma[0])
+#define DMA2            (&sim_dma[1])
+
+#undef DMA1_Stream0
+#undef DMA1_Stream1
+#undef DMA1_Stream2
+#undef DMA1_Stream3
+#undef DMA1_Stream4
+#undef DMA1_Stream5
+#undef DMA1_Stream6
+#undef DMA1_Stream7
+#undef DMA2_Stream0
+#undef DMA2_Stream1
+#undef DMA2_Stream2
+#undef DMA2_Stream3
+#undef DMA2_Stream4
+#undef DMA2_Stream5
+#undef DMA2_Stream6
+#undef DMA2_Stream7
+#define DMA1_Stream0    (&sim_dma_stream[0])
+#define DMA1_Stream1    (&sim_dma_stream[1])
+#define DMA1_Stream2    (&sim_dma_stream[2])
+#define DMA1_Stream3    (&sim_dma_stream[3])
+#define DMA1_Stream4    (&sim_dma_stream[4])
+#define DMA1_Stream5    (&sim_dma_stream[5])
+#define DMA1_Stream6    (&sim_dma_stream[6])
+#define DMA1_Stream7    (&sim_dma_stream[7])
+#define DMA2_Stream0    (&sim_dma_stream[8])
+#define DMA2_Stream1    (&sim_dma_stream[9])
+#define DMA2_Stream2    (&sim_dma_stream[10])
+#define DMA2_Stream3    (&sim_dma_stream[11])
+#define DMA2_Stream4    (&sim_dma_stream[12])
+#define DMA2_Stream5    (&sim_dma_stream[13])
+#define DMA2_Stream6    (&sim_dma_stream[14])
+#define DMA2_Stream7    (&sim_dma_stream[15])
+
+#undef USART1
+#undef USART2
+#undef SPI2
+#undef I2C2
+#undef TIM1
+#undef TIM5
+#undef TIM9
+#undef RTC
+#define USART1          (&sim_usart1)
+#define USART2          (&sim_usart2)
+#define SPI2            (&sim_spi2)
+#define I2C2            (&sim_i2c2)
+#define TIM1            (&sim_tim1)
+#define TIM5            (sim_tim5())
+#define TIM9            (&sim_tim9)
+#define RTC             (sim_rtc())
+
+#undef RCC
+#undef FLASH
+#undef PWR
+#undef EXTI
+#undef SYSCFG
+#define RCC             (&sim_rcc)
+#define FLASH           (&sim_flash)
+#define PWR             (&sim_pwr)
+#define EXTI            (&sim_exti)
+#define SYSCFG          (&sim_syscfg)
+
+#endif /* __SIM_STM32F4XX_H__ */
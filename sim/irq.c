@@ -0,0 +1,273 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "sim.h"
+
+// Interrupts are levels: every vector looks at its peripheral's flags and
+// enable bits, the way the NVIC sees the request lines. The handlers run
+// one at a time on the highest priority task, inside a critical section so
+// the port's tick can not cut in while they use the FromISR calls. That task
+// is woken when a peripheral raises a request from a task, and otherwise
+// looks once per tick for work the models did on their own.
+//
+// PRIMASK and the simulator's own register updates block the port's
+// signals, so nothing is switched out halfway; a request raised meanwhile
+// is held back until they are released.
+
+typedef struct
+{
+    IRQn_Type irq;
+    void (*handler)(void);
+    bool (*level)(void);
+} sim_vector_t;
+
+void sim_default_handler(void);
+
+#define SIM_WEAK_HANDLER(name) \
+    void name(void) __attribute__((weak, alias("sim_default_handler")))
+
+SIM_WEAK_HANDLER(DMA1_Stream4_IRQHandler);
+SIM_WEAK_HANDLER(DMA2_Stream5_IRQHandler);
+SIM_WEAK_HANDLER(DMA2_Stream7_IRQHandler);
+SIM_WEAK_HANDLER(USART1_IRQHandler);
+SIM_WEAK_HANDLER(USART2_IRQHandler);
+SIM_WEAK_HANDLER(TIM5_IRQHandler);
+SIM_WEAK_HANDLER(RTC_Alarm_IRQHandler);
+SIM_WEAK_HANDLER(RTC_WKUP_IRQHandler);
+SIM_WEAK_HANDLER(EXTI15_10_IRQHandler);
+
+static bool dma1_stream4_level(void) { return sim_dma_level(DMA1_Stream4); }
+static bool dma2_stream5_level(void) { return sim_dma_level(DMA2_Stream5); }
+static bool dma2_stream7_level(void) { return sim_dma_level(DMA2_Stream7); }
+static bool usart1_level(void) { return sim_usart_level(USART1); }
+static bool usart2_level(void) { return sim_usart_level(USART2); }
+static bool exti15_10_level(void) { return sim_exti_level(0xFC00); }
+
+static const sim_vector_t vectors[] =
+{
+    { DMA1_Stream4_IRQn, DMA1_Stream4_IRQHandler, dma1_stream4_level },
+    { DMA2_Stream5_IRQn, DMA2_Stream5_IRQHandler, dma2_stream5_level },
+    { DMA2_Stream7_IRQn, DMA2_Stream7_IRQHandler, dma2_stream7_level },
+    { USART1_IRQn, USART1_IRQHandler, usart1_level },
+    { USART2_IRQn, USART2_IRQHandler, usart2_level },
+    { TIM5_IRQn, TIM5_IRQHandler, sim_tim5_level },
+    { RTC_Alarm_IRQn, RTC_Alarm_IRQHandler, sim_rtc_alarm_level },
+    { RTC_WKUP_IRQn, RTC_WKUP_IRQHandler, sim_rtc_wakeup_level },
+    { EXTI15_10_IRQn, EXTI15_10_IRQHandler, exti15_10_level },
+};
+
+#define SIM_VECTOR_COUNT    (sizeof(vectors) / sizeof(vectors[0]))
+#define SIM_IRQ_COUNT       (FPU_IRQn + 1)
+
+static volatile bool irq_enabled[SIM_IRQ_COUNT];
+static volatile uint8_t irq_priority[SIM_IRQ_COUNT];
+static TaskHandle_t irq_task;
+
+static __thread uint32_t primask;
+static __thread sigset_t primask_saved;
+static __thread uint32_t lock_depth;
+static __thread sigset_t lock_saved;
+static __thread bool irq_deferred;
+static __thread uint32_t ipsr;
+static __thread volatile uint32_t *reserve_addr;
+static __thread uint32_t reserve_value;
+
+void sim_default_handler(void)
+{
+    // nothing clears the request, keep it from firing forever
+    IRQn_Type irq = (IRQn_Type)((int32_t)ipsr - 16);
+    sim_log("[SIM] no handler for IRQ %d, disabled\n", irq);
+    irq_enabled[irq] = false;
+}
+
+static bool sim_signals_blocked(void)
+{
+    sigset_t current;
+    pthread_sigmask(SIG_BLOCK, NULL, &current);
+    return sigismember(&current, SIGALRM);
+}
+
+static void irq_kick(void)
+{
+    if (ipsr != 0 || irq_task == NULL ||
+        xTaskGetSchedulerState() != taskSCHEDULER_RUNNING ||
+        xTaskGetCurrentTaskHandle() == irq_task)
+        return;
+
+    if (sim_signals_blocked())
+    {
+        irq_deferred = true;
+        return;
+    }
+
+    xTaskNotifyGive(irq_task);
+}
+
+static void irq_release(void)
+{
+    if (irq_deferred && primask == 0 && lock_depth == 0)
+    {
+        irq_deferred = false;
+        irq_kick();
+    }
+}
+
+uint32_t sim_get_primask(void)
+{
+    return primask;
+}
+
+void sim_set_primask(uint32_t value)
+{
+    value &= 1;
+    if (value == primask)
+        return;
+
+    if (value)
+    {
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &primask_saved);
+        primask = 1;
+    }
+    else
+    {
+        primask = 0;
+        pthread_sigmask(SIG_SETMASK, &primask_saved, NULL);
+        irq_release();
+    }
+}
+
+// register updates that have to look atomic to the firmware, nests
+void sim_lock(void)
+{
+    if (lock_depth++ == 0)
+    {
+        sigset_t all;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &lock_saved);
+    }
+}
+
+void sim_unlock(void)
+{
+    if (--lock_depth == 0)
+    {
+        pthread_sigmask(SIG_SETMASK, &lock_saved, NULL);
+        irq_release();
+    }
+}
+
+uint32_t sim_get_ipsr(void)
+{
+    return ipsr;
+}
+
+bool sim_in_isr(void)
+{
+    return ipsr != 0;
+}
+
+long xPortIsInsideInterrupt(void)
+{
+    return ipsr != 0;
+}
+
+// exclusive access within one thread; another thread that wrote in
+// between makes the compare and swap, and so the store, fail
+uint32_t sim_ldrex(volatile uint32_t *addr)
+{
+    reserve_addr = addr;
+    reserve_value = *addr;
+    return reserve_value;
+}
+
+uint32_t sim_strex(uint32_t value, volatile uint32_t *addr)
+{
+    if (reserve_addr != addr)
+        return 1;
+
+    reserve_addr = NULL;
+    return __sync_bool_compare_and_swap(addr, reserve_value, value) ? 0 : 1;
+}
+
+void sim_clrex(void)
+{
+    reserve_addr = NULL;
+}
+
+void sim_irq_set_priority(IRQn_Type irq, uint32_t priority)
+{
+    if (irq >= 0 && irq < (IRQn_Type)SIM_IRQ_COUNT)
+        irq_priority[irq] = (uint8_t)priority;
+}
+
+void sim_irq_enable(IRQn_Type irq, bool enable)
+{
+    if (irq >= 0 && irq < (IRQn_Type)SIM_IRQ_COUNT)
+        irq_enabled[irq] = enable;
+    sim_irq_update();
+}
+
+static const sim_vector_t *sim_irq_next(void)
+{
+    const sim_vector_t *next = NULL;
+
+    for (uint32_t i = 0; i < SIM_VECTOR_COUNT; i++)
+    {
+        const sim_vector_t *v = &vectors[i];
+        if (!irq_enabled[v->irq] || !v->level())
+            continue;
+        if (next == NULL || irq_priority[v->irq] < irq_priority[next->irq] ||
+            (irq_priority[v->irq] == irq_priority[next->irq] && v->irq < next->irq))
+            next = v;
+    }
+
+    return next;
+}
+
+// after a peripheral may have raised a request
+void sim_irq_update(void)
+{
+    if (sim_irq_next() != NULL)
+        irq_kick();
+}
+
+// on the interrupt task only
+void sim_irq_run(void)
+{
+    if (ipsr != 0 || xTaskGetCurrentTaskHandle() != irq_task)
+        return;
+
+    const sim_vector_t *v;
+    taskENTER_CRITICAL();
+    while ((v = sim_irq_next()) != NULL)
+    {
+        ipsr = (uint32_t)v->irq + 16;
+        v->handler();
+        ipsr = 0;
+    }
+    taskEXIT_CRITICAL();
+}
+
+static void sim_irq_func(void *param)
+{
+    while (1)
+    {
+        ulTaskNotifyTake(pdTRUE, 1);
+
+        taskENTER_CRITICAL();
+        sim_poll();
+        sim_irq_run();
+        taskEXIT_CRITICAL();
+    }
+}
+
+void sim_irq_init(void)
+{
+    xTaskCreate(sim_irq_func, "sim irq", 1024, NULL, configMAX_PRIORITIES - 1, &irq_task);
+    configASSERT(irq_task);
+}
@@ -0,0 +1,273 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// DMA1 and DMA2, memory to peripheral only (all the firmware uses). A
+// stream feeding a USART or SPI data register empties in one go when it is
+// enabled: the bytes are handed to the peripheral model and the transfer
+// complete flag is up before DMA_Cmd returns. Any other stream moves one
+// item per request from the peripheral that paces it (sim_dma_request),
+// e.g. TIM1 updates stepping the backlight ramp into TIM9->CCR1.
+//
+// The flag layout and masks are those of the standard peripheral library.
+
+#define DMA_STREAM_FLAGS        (DMA_LISR_FEIF0 | DMA_LISR_DMEIF0 | DMA_LISR_TEIF0 | \
+                                 DMA_LISR_HTIF0 | DMA_LISR_TCIF0)
+#define DMA_TRANSFER_IT_MASK    0x0F3C0F3Cu
+#define DMA_HIGH_ISR_MASK       0x20000000u
+#define DMA_RESERVED_MASK       0x0F7D0F7Du
+#define DMA_TRANSFER_IT_ENABLE  (DMA_SxCR_TCIE | DMA_SxCR_HTIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE)
+
+DMA_TypeDef sim_dma[2];
+DMA_Stream_TypeDef sim_dma_stream[16];
+
+static const uint8_t flag_shifts[4] = { 0, 6, 16, 22 };
+
+// NDTR when the stream was enabled, the memory side runs from M0AR
+static uint32_t start_ndtr[16];
+
+static DMA_TypeDef *dma_controller(DMA_Stream_TypeDef *stream)
+{
+    return stream < DMA2_Stream0 ? DMA1 : DMA2;
+}
+
+static volatile uint32_t *dma_isr(DMA_Stream_TypeDef *stream)
+{
+    DMA_TypeDef *dma = dma_controller(stream);
+    return (stream - sim_dma_stream) % 8 < 4 ? &dma->LISR : &dma->HISR;
+}
+
+static uint32_t dma_shift(DMA_Stream_TypeDef *stream)
+{
+    return flag_shifts[(stream - sim_dma_stream) % 4];
+}
+
+static uint32_t dma_flags(DMA_Stream_TypeDef *stream)
+{
+    return (*dma_isr(stream) >> dma_shift(stream)) & DMA_STREAM_FLAGS;
+}
+
+static void dma_set_flags(DMA_Stream_TypeDef *stream, uint32_t flags)
+{
+    *dma_isr(stream) |= flags << dma_shift(stream);
+}
+
+// flag and interrupt arguments carry the high register in bit 29
+static void dma_clear(DMA_Stream_TypeDef *stream, uint32_t flags)
+{
+    DMA_TypeDef *dma = dma_controller(stream);
+
+    sim_lock();
+    if (flags & DMA_HIGH_ISR_MASK)
+        dma->HISR &= ~(flags & DMA_RESERVED_MASK);
+    else
+        dma->LISR &= ~(flags & DMA_RESERVED_MASK);
+    sim_unlock();
+}
+
+static USART_TypeDef *dma_usart(uint32_t par)
+{
+    if (par == (uint32_t)(uintptr_t)&USART1->DR)
+        return USART1;
+    if (par == (uint32_t)(uintptr_t)&USART2->DR)
+        return USART2;
+    return NULL;
+}
+
+static bool dma_is_spi(uint32_t par)
+{
+    return par == (uint32_t)(uintptr_t)&SPI2->DR;
+}
+
+// caller holds sim_lock
+static void dma_move(DMA_Stream_TypeDef *stream, uint32_t count)
+{
+    uint32_t index = stream - sim_dma_stream;
+    uint32_t msize = 1u << ((stream->CR & DMA_SxCR_MSIZE) >> 13);
+    uint32_t psize = 1u << ((stream->CR & DMA_SxCR_PSIZE) >> 11);
+    bool minc = (stream->CR & DMA_SxCR_MINC) != 0;
+    uint32_t done = start_ndtr[index] - stream->NDTR;
+    const uint8_t *mem = (const uint8_t *)(uintptr_t)stream->M0AR + (minc ? done * msize : 0);
+    USART_TypeDef *usart = dma_usart(stream->PAR);
+
+    if (usart != NULL)
+    {
+        sim_usart_write(usart, mem, count);
+    }
+    else if (dma_is_spi(stream->PAR))
+    {
+        sim_spi_write(mem, count, psize == 2, minc);
+    }
+    else
+    {
+        uint8_t *per = (uint8_t *)(uintptr_t)stream->PAR;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (psize == 1)
+                *(volatile uint8_t *)per = *mem;
+            else if (psize == 2)
+                *(volatile uint16_t *)per = *(const uint16_t *)mem;
+            else
+                *(volatile uint32_t *)per = *(const uint32_t *)mem;
+            if (minc)
+                mem += msize;
+        }
+    }
+
+    uint32_t before = stream->NDTR;
+    stream->NDTR -= count;
+    if (before > start_ndtr[index] / 2 && stream->NDTR <= start_ndtr[index] / 2)
+        dma_set_flags(stream, DMA_LISR_HTIF0);
+    if (stream->NDTR == 0)
+    {
+        stream->CR &= ~DMA_SxCR_EN;
+        dma_set_flags(stream, DMA_LISR_TCIF0);
+    }
+}
+
+void sim_dma_init(void)
+{
+    memset(sim_dma, 0, sizeof(sim_dma));
+    memset(sim_dma_stream, 0, sizeof(sim_dma_stream));
+    for (uint32_t i = 0; i < 16; i++)
+        sim_dma_stream[i].FCR = 0x21;
+}
+
+// one request from the pacing peripheral moves one item
+void sim_dma_request(DMA_Stream_TypeDef *stream, uint32_t count)
+{
+    sim_lock();
+    if ((stream->CR & DMA_SxCR_EN) && stream->NDTR > 0)
+        dma_move(stream, count < stream->NDTR ? count : stream->NDTR);
+    sim_unlock();
+
+    sim_irq_update();
+}
+
+bool sim_dma_level(DMA_Stream_TypeDef *stream)
+{
+    uint32_t flags = dma_flags(stream);
+    uint32_t cr = stream->CR;
+
+    return ((flags & DMA_LISR_TCIF0) && (cr & DMA_SxCR_TCIE)) ||
+           ((flags & DMA_LISR_HTIF0) && (cr & DMA_SxCR_HTIE)) ||
+           ((flags & DMA_LISR_TEIF0) && (cr & DMA_SxCR_TEIE)) ||
+           ((flags & DMA_LISR_DMEIF0) && (cr & DMA_SxCR_DMEIE)) ||
+           ((flags & DMA_LISR_FEIF0) && (stream->FCR & DMA_IT_FE));
+}
+
+void DMA_Init(DMA_Stream_TypeDef* DMAy_Streamx, DMA_InitTypeDef* DMA_InitStruct)
+{
+    sim_lock();
+    uint32_t cr = DMAy_Streamx->CR;
+    cr &= ~(DMA_SxCR_CHSEL | DMA_SxCR_MBURST | DMA_SxCR_PBURST | DMA_SxCR_PL | DMA_SxCR_MSIZE |
+            DMA_SxCR_PSIZE | DMA_SxCR_MINC | DMA_SxCR_PINC | DMA_SxCR_CIRC | DMA_SxCR_DIR);
+    cr |= DMA_InitStruct->DMA_Channel | DMA_InitStruct->DMA_DIR |
+          DMA_InitStruct->DMA_PeripheralInc | DMA_InitStruct->DMA_MemoryInc |
+          DMA_InitStruct->DMA_PeripheralDataSize | DMA_InitStruct->DMA_MemoryDataSize |
+          DMA_InitStruct->DMA_Mode | DMA_InitStruct->DMA_Priority |
+          DMA_InitStruct->DMA_MemoryBurst | DMA_InitStruct->DMA_PeripheralBurst;
+    DMAy_Streamx->CR = cr;
+    DMAy_Streamx->FCR = (DMAy_Streamx->FCR & ~(DMA_SxFCR_DMDIS | DMA_SxFCR_FTH)) |
+                        DMA_InitStruct->DMA_FIFOMode | DMA_InitStruct->DMA_FIFOThreshold;
+    DMAy_Streamx->NDTR = DMA_InitStruct->DMA_BufferSize;
+    DMAy_Streamx->PAR = DMA_InitStruct->DMA_PeripheralBaseAddr;
+    DMAy_Streamx->M0AR = DMA_InitStruct->DMA_Memory0BaseAddr;
+    sim_unlock();
+}
+
+void DMA_StructInit(DMA_InitTypeDef* DMA_InitStruct)
+{
+    DMA_InitStruct->DMA_Channel = 0;
+    DMA_InitStruct->DMA_PeripheralBaseAddr = 0;
+    DMA_InitStruct->DMA_Memory0BaseAddr = 0;
+    DMA_InitStruct->DMA_DIR = DMA_DIR_PeripheralToMemory;
+    DMA_InitStruct->DMA_BufferSize = 0;
+    DMA_InitStruct->DMA_PeripheralInc = DMA_PeripheralInc_Disable;
+    DMA_InitStruct->DMA_MemoryInc = DMA_MemoryInc_Disable;
+    DMA_InitStruct->DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStruct->DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStruct->DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStruct->DMA_Priority = DMA_Priority_Low;
+    DMA_InitStruct->DMA_FIFOMode = DMA_FIFOMode_Disable;
+    DMA_InitStruct->DMA_FIFOThreshold = DMA_FIFOThreshold_1QuarterFull;
+    DMA_InitStruct->DMA_MemoryBurst = DMA_MemoryBurst_Single;
+    DMA_InitStruct->DMA_PeripheralBurst = DMA_PeripheralBurst_Single;
+}
+
+void DMA_Cmd(DMA_Stream_TypeDef* DMAy_Streamx, FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+    {
+        DMAy_Streamx->CR |= DMA_SxCR_EN;
+        start_ndtr[DMAy_Streamx - sim_dma_stream] = DMAy_Streamx->NDTR;
+        if (DMAy_Streamx->NDTR > 0 &&
+            (dma_usart(DMAy_Streamx->PAR) != NULL || dma_is_spi(DMAy_Streamx->PAR)))
+            dma_move(DMAy_Streamx, DMAy_Streamx->NDTR);
+    }
+    else if (DMAy_Streamx->CR & DMA_SxCR_EN)
+    {
+        // a stream stopped early still reports transfer complete
+        DMAy_Streamx->CR &= ~DMA_SxCR_EN;
+        dma_set_flags(DMAy_Streamx, DMA_LISR_TCIF0);
+    }
+    sim_unlock();
+
+    sim_irq_update();
+}
+
+FunctionalState DMA_GetCmdStatus(DMA_Stream_TypeDef* DMAy_Streamx)
+{
+    return (DMAy_Streamx->CR & DMA_SxCR_EN) != 0 ? ENABLE : DISABLE;
+}
+
+void DMA_ITConfig(DMA_Stream_TypeDef* DMAy_Streamx, uint32_t DMA_IT, FunctionalState NewState)
+{
+    sim_lock();
+    if (DMA_IT & DMA_IT_FE)
+    {
+        if (NewState != DISABLE)
+            DMAy_Streamx->FCR |= DMA_IT_FE;
+        else
+            DMAy_Streamx->FCR &= ~DMA_IT_FE;
+    }
+    if (DMA_IT != DMA_IT_FE)
+    {
+        if (NewState != DISABLE)
+            DMAy_Streamx->CR |= DMA_IT & DMA_TRANSFER_IT_ENABLE;
+        else
+            DMAy_Streamx->CR &= ~(DMA_IT & DMA_TRANSFER_IT_ENABLE);
+    }
+    sim_unlock();
+
+    sim_irq_update();
+}
+
+ITStatus DMA_GetITStatus(DMA_Stream_TypeDef* DMAy_Streamx, uint32_t DMA_IT)
+{
+    DMA_TypeDef *dma = dma_controller(DMAy_Streamx);
+    uint32_t enabled;
+
+    if (DMA_IT & DMA_TRANSFER_IT_MASK)
+        enabled = DMAy_Streamx->CR & ((DMA_IT >> 11) & DMA_TRANSFER_IT_ENABLE);
+    else
+        enabled = DMAy_Streamx->FCR & DMA_IT_FE;
+
+    uint32_t isr = (DMA_IT & DMA_HIGH_ISR_MASK) ? dma->HISR : dma->LISR;
+    isr &= DMA_RESERVED_MASK;
+
+    return (isr & DMA_IT) != 0 && enabled != 0 ? SET : RESET;
+}
+
+void DMA_ClearITPendingBit(DMA_Stream_TypeDef* DMAy_Streamx, uint32_t DMA_IT)
+{
+    dma_clear(DMAy_Streamx, DMA_IT);
+}
+
+void DMA_ClearFlag(DMA_Stream_TypeDef* DMAy_Streamx, uint32_t DMA_FLAG)
+{
+    dma_clear(DMAy_Streamx, DMA_FLAG);
+}
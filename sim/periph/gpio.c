@@ -0,0 +1,117 @@
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// Ports A..E. Nothing drives the inputs, so an input reads its pull (high
+// when floating) and an output reads back what was written. A watcher
+// sees every change of a port's ODR, that is how the LCD model follows
+// CS, DC and RESET.
+
+#define SIM_GPIO_PORTS  5
+
+GPIO_TypeDef sim_gpio[SIM_GPIO_PORTS];
+
+static sim_gpio_watch_t watchers[SIM_GPIO_PORTS];
+
+static void gpio_update_idr(GPIO_TypeDef *port)
+{
+    uint32_t idr = 0;
+    for (uint32_t pin = 0; pin < 16; pin++)
+    {
+        uint32_t mode = (port->MODER >> (pin * 2)) & 3;
+        uint32_t pupd = (port->PUPDR >> (pin * 2)) & 3;
+        uint32_t level = mode == GPIO_Mode_OUT ? (port->ODR >> pin) & 1 :
+                         pupd == GPIO_PuPd_DOWN ? 0 : 1;
+        idr |= level << pin;
+    }
+    port->IDR = idr;
+}
+
+static void gpio_write(GPIO_TypeDef *port, uint16_t set, uint16_t reset)
+{
+    sim_lock();
+    uint16_t old = port->ODR;
+    port->ODR = (old & ~reset) | set;
+    gpio_update_idr(port);
+    uint16_t odr = port->ODR;
+    sim_unlock();
+
+    sim_gpio_watch_t watcher = watchers[port - sim_gpio];
+    if (odr != old && watcher != NULL)
+        watcher(port, odr);
+}
+
+void sim_gpio_init(void)
+{
+    memset(sim_gpio, 0, sizeof(sim_gpio));
+    for (uint32_t i = 0; i < SIM_GPIO_PORTS; i++)
+        gpio_update_idr(&sim_gpio[i]);
+}
+
+void sim_gpio_watch(GPIO_TypeDef *port, sim_gpio_watch_t func)
+{
+    watchers[port - sim_gpio] = func;
+}
+
+void GPIO_Init(GPIO_TypeDef* GPIOx, GPIO_InitTypeDef* GPIO_InitStruct)
+{
+    sim_lock();
+    for (uint32_t pin = 0; pin < 16; pin++)
+    {
+        if ((GPIO_InitStruct->GPIO_Pin & (1u << pin)) == 0)
+            continue;
+
+        GPIOx->MODER = (GPIOx->MODER & ~(3u << (pin * 2))) | ((uint32_t)GPIO_InitStruct->GPIO_Mode << (pin * 2));
+        if (GPIO_InitStruct->GPIO_Mode == GPIO_Mode_OUT || GPIO_InitStruct->GPIO_Mode == GPIO_Mode_AF)
+        {
+            GPIOx->OSPEEDR = (GPIOx->OSPEEDR & ~(3u << (pin * 2))) | ((uint32_t)GPIO_InitStruct->GPIO_Speed << (pin * 2));
+            GPIOx->OTYPER = (GPIOx->OTYPER & ~(1u << pin)) | ((uint32_t)GPIO_InitStruct->GPIO_OType << pin);
+        }
+        GPIOx->PUPDR = (GPIOx->PUPDR & ~(3u << (pin * 2))) | ((uint32_t)GPIO_InitStruct->GPIO_PuPd << (pin * 2));
+    }
+    gpio_update_idr(GPIOx);
+    sim_unlock();
+}
+
+void GPIO_StructInit(GPIO_InitTypeDef* GPIO_InitStruct)
+{
+    GPIO_InitStruct->GPIO_Pin = GPIO_Pin_All;
+    GPIO_InitStruct->GPIO_Mode = GPIO_Mode_IN;
+    GPIO_InitStruct->GPIO_Speed = GPIO_Speed_2MHz;
+    GPIO_InitStruct->GPIO_OType = GPIO_OType_PP;
+    GPIO_InitStruct->GPIO_PuPd = GPIO_PuPd_NOPULL;
+}
+
+void GPIO_PinAFConfig(GPIO_TypeDef* GPIOx, uint16_t GPIO_PinSource, uint8_t GPIO_AF)
+{
+    uint32_t shift = (GPIO_PinSource & 7) * 4;
+
+    sim_lock();
+    GPIOx->AFR[GPIO_PinSource >> 3] = (GPIOx->AFR[GPIO_PinSource >> 3] & ~(0xFu << shift)) |
+                                      ((uint32_t)GPIO_AF << shift);
+    sim_unlock();
+}
+
+void GPIO_SetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+    gpio_write(GPIOx, GPIO_Pin, 0);
+}
+
+void GPIO_ResetBits(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+    gpio_write(GPIOx, 0, GPIO_Pin);
+}
+
+void GPIO_WriteBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, BitAction BitVal)
+{
+    if (BitVal != Bit_RESET)
+        gpio_write(GPIOx, GPIO_Pin, 0);
+    else
+        gpio_write(GPIOx, 0, GPIO_Pin);
+}
+
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->IDR & GPIO_Pin) != 0 ? (uint8_t)Bit_SET : (uint8_t)Bit_RESET;
+}
@@ -0,0 +1,218 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// I2C2 as a master with devices attached by 7-bit address. Every phase
+// completes as soon as it is started, so the polling in driver/i2c_bus
+// sees its event on the first look. Reading the status registers clears
+// ADDR as on the part; that is also when a receiver gets its first byte,
+// and each byte taken from DR fetches the next until STOP was asked for.
+
+#define I2C_SIM_DEVICES     4
+#define I2C_SR1_FLAGS       0x10000000u
+#define I2C_FLAG_MASK       0x00FFFFFFu
+
+I2C_TypeDef sim_i2c2;
+
+static const sim_i2c_device_t *devices[I2C_SIM_DEVICES];
+static const sim_i2c_device_t *current;
+static bool reading;
+static bool stop_pending;
+
+static void i2c_reset(void)
+{
+    sim_i2c2.SR1 = 0;
+    sim_i2c2.SR2 = 0;
+    current = NULL;
+    reading = false;
+    stop_pending = false;
+}
+
+static void i2c_end(void)
+{
+    if (current != NULL && current->stop != NULL)
+        current->stop();
+    i2c_reset();
+}
+
+static void i2c_fetch(void)
+{
+    sim_i2c2.DR = current->read != NULL ? current->read() : 0xFF;
+    sim_i2c2.SR1 |= I2C_SR1_RXNE;
+}
+
+void sim_i2c_init(void)
+{
+    memset(&sim_i2c2, 0, sizeof(sim_i2c2));
+    memset(devices, 0, sizeof(devices));
+    i2c_reset();
+}
+
+bool sim_i2c_attach(const sim_i2c_device_t *device)
+{
+    for (uint32_t i = 0; i < I2C_SIM_DEVICES; i++)
+    {
+        if (devices[i] == NULL)
+        {
+            devices[i] = device;
+            return true;
+        }
+    }
+    return false;
+}
+
+void I2C_Init(I2C_TypeDef* I2Cx, I2C_InitTypeDef* I2C_InitStruct)
+{
+    I2Cx->CR1 = (I2Cx->CR1 & ~I2C_CR1_ACK) | I2C_InitStruct->I2C_Ack | I2C_CR1_PE;
+    I2Cx->OAR1 = I2C_InitStruct->I2C_AcknowledgedAddress | I2C_InitStruct->I2C_OwnAddress1;
+}
+
+void I2C_StructInit(I2C_InitTypeDef* I2C_InitStruct)
+{
+    I2C_InitStruct->I2C_ClockSpeed = 5000;
+    I2C_InitStruct->I2C_Mode = I2C_Mode_I2C;
+    I2C_InitStruct->I2C_DutyCycle = I2C_DutyCycle_2;
+    I2C_InitStruct->I2C_OwnAddress1 = 0;
+    I2C_InitStruct->I2C_Ack = I2C_Ack_Disable;
+    I2C_InitStruct->I2C_AcknowledgedAddress = I2C_AcknowledgedAddress_7bit;
+}
+
+void I2C_SoftwareResetCmd(I2C_TypeDef* I2Cx, FunctionalState NewState)
+{
+    if (NewState != DISABLE)
+    {
+        i2c_end();
+        I2Cx->CR1 = I2C_CR1_SWRST;
+    }
+    else
+    {
+        I2Cx->CR1 &= ~I2C_CR1_SWRST;
+    }
+}
+
+void I2C_AcknowledgeConfig(I2C_TypeDef* I2Cx, FunctionalState NewState)
+{
+    if (NewState != DISABLE)
+        I2Cx->CR1 |= I2C_CR1_ACK;
+    else
+        I2Cx->CR1 &= ~I2C_CR1_ACK;
+}
+
+// a START while a transfer is open is a repeated start
+void I2C_GenerateSTART(I2C_TypeDef* I2Cx, FunctionalState NewState)
+{
+    if (NewState == DISABLE)
+        return;
+
+    I2Cx->SR1 = I2C_SR1_SB;
+    I2Cx->SR2 = I2C_SR2_MSL | I2C_SR2_BUSY;
+    stop_pending = false;
+}
+
+// a receiver stops after the byte it is receiving
+void I2C_GenerateSTOP(I2C_TypeDef* I2Cx, FunctionalState NewState)
+{
+    if (NewState == DISABLE)
+        return;
+
+    if (reading && (I2Cx->SR1 & I2C_SR1_RXNE))
+        stop_pending = true;
+    else
+        i2c_end();
+}
+
+void I2C_Send7bitAddress(I2C_TypeDef* I2Cx, uint8_t Address, uint8_t I2C_Direction)
+{
+    bool read = I2C_Direction == I2C_Direction_Receiver;
+    const sim_i2c_device_t *device = NULL;
+
+    for (uint32_t i = 0; i < I2C_SIM_DEVICES; i++)
+    {
+        if (devices[i] != NULL && devices[i]->addr == (Address >> 1))
+            device = devices[i];
+    }
+
+    I2Cx->SR1 &= ~I2C_SR1_SB;
+    if (device == NULL || (device->start != NULL && !device->start(read)))
+    {
+        I2Cx->SR1 |= I2C_SR1_AF;
+        current = NULL;
+        return;
+    }
+
+    current = device;
+    reading = read;
+    I2Cx->SR1 |= I2C_SR1_ADDR;
+    if (!read)
+    {
+        I2Cx->SR1 |= I2C_SR1_TXE;
+        I2Cx->SR2 |= I2C_SR2_TRA;
+    }
+    else
+    {
+        I2Cx->SR2 &= ~I2C_SR2_TRA;
+    }
+}
+
+ErrorStatus I2C_CheckEvent(I2C_TypeDef* I2Cx, uint32_t I2C_EVENT)
+{
+    uint32_t last = ((uint32_t)I2Cx->SR1 | ((uint32_t)I2Cx->SR2 << 16)) & I2C_FLAG_MASK;
+
+    // SR1 then SR2 read: ADDR is cleared and the transfer moves on
+    if (I2Cx->SR1 & I2C_SR1_ADDR)
+    {
+        I2Cx->SR1 &= ~I2C_SR1_ADDR;
+        if (reading && current != NULL)
+            i2c_fetch();
+    }
+
+    return (last & I2C_EVENT) == I2C_EVENT ? SUCCESS : ERROR;
+}
+
+void I2C_SendData(I2C_TypeDef* I2Cx, uint8_t Data)
+{
+    I2Cx->DR = Data;
+    if (current == NULL || reading)
+        return;
+
+    I2Cx->SR1 &= ~(I2C_SR1_TXE | I2C_SR1_BTF);
+    if (current->write != NULL && !current->write(Data))
+        I2Cx->SR1 |= I2C_SR1_AF;
+    else
+        I2Cx->SR1 |= I2C_SR1_TXE | I2C_SR1_BTF;
+}
+
+uint8_t I2C_ReceiveData(I2C_TypeDef* I2Cx)
+{
+    uint8_t data = (uint8_t)I2Cx->DR;
+
+    I2Cx->SR1 &= ~I2C_SR1_RXNE;
+    if (current == NULL || !reading)
+        return data;
+
+    if (stop_pending || (I2Cx->CR1 & I2C_CR1_ACK) == 0)
+        i2c_end();
+    else
+        i2c_fetch();
+
+    return data;
+}
+
+FlagStatus I2C_GetFlagStatus(I2C_TypeDef* I2Cx, uint32_t I2C_FLAG)
+{
+    uint32_t value;
+
+    if (I2C_FLAG & I2C_SR1_FLAGS)
+        value = I2Cx->SR1 & (I2C_FLAG & I2C_FLAG_MASK);
+    else
+        value = I2Cx->SR2 & ((I2C_FLAG & I2C_FLAG_MASK) >> 16);
+
+    return value != 0 ? SET : RESET;
+}
+
+void I2C_ClearFlag(I2C_TypeDef* I2Cx, uint32_t I2C_FLAG)
+{
+    I2Cx->SR1 &= ~(I2C_FLAG & I2C_FLAG_MASK);
+}
@@ -0,0 +1,84 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// NVIC, EXTI and SYSCFG: the interrupt enables go to sim/irq.c, EXTI keeps
+// its mask and pending registers so the console's wake-up pin behaves.
+
+EXTI_TypeDef sim_exti;
+SYSCFG_TypeDef sim_syscfg;
+
+void NVIC_Init(NVIC_InitTypeDef* NVIC_InitStruct)
+{
+    IRQn_Type irq = (IRQn_Type)NVIC_InitStruct->NVIC_IRQChannel;
+    sim_irq_set_priority(irq, NVIC_InitStruct->NVIC_IRQChannelPreemptionPriority);
+    sim_irq_enable(irq, NVIC_InitStruct->NVIC_IRQChannelCmd != DISABLE);
+}
+
+void EXTI_Init(EXTI_InitTypeDef* EXTI_InitStruct)
+{
+    uint32_t line = EXTI_InitStruct->EXTI_Line;
+
+    sim_lock();
+    EXTI->IMR &= ~line;
+    EXTI->EMR &= ~line;
+    if (EXTI_InitStruct->EXTI_LineCmd != DISABLE)
+    {
+        if (EXTI_InitStruct->EXTI_Mode == EXTI_Mode_Interrupt)
+            EXTI->IMR |= line;
+        else
+            EXTI->EMR |= line;
+
+        EXTI->RTSR &= ~line;
+        EXTI->FTSR &= ~line;
+        if (EXTI_InitStruct->EXTI_Trigger != EXTI_Trigger_Falling)
+            EXTI->RTSR |= line;
+        if (EXTI_InitStruct->EXTI_Trigger != EXTI_Trigger_Rising)
+            EXTI->FTSR |= line;
+    }
+    sim_unlock();
+}
+
+void EXTI_StructInit(EXTI_InitTypeDef* EXTI_InitStruct)
+{
+    EXTI_InitStruct->EXTI_Line = 0;
+    EXTI_InitStruct->EXTI_Mode = EXTI_Mode_Interrupt;
+    EXTI_InitStruct->EXTI_Trigger = EXTI_Trigger_Falling;
+    EXTI_InitStruct->EXTI_LineCmd = DISABLE;
+}
+
+ITStatus EXTI_GetITStatus(uint32_t EXTI_Line)
+{
+    return (EXTI->PR & EXTI_Line) != 0 ? SET : RESET;
+}
+
+// PR is write-one-to-clear
+void EXTI_ClearITPendingBit(uint32_t EXTI_Line)
+{
+    sim_lock();
+    EXTI->PR &= ~EXTI_Line;
+    sim_unlock();
+}
+
+void SYSCFG_EXTILineConfig(uint8_t EXTI_PortSourceGPIOx, uint8_t EXTI_PinSourcex)
+{
+}
+
+// an edge on a pin routed to the line; pending only while it is unmasked
+void sim_exti_edge(uint32_t line)
+{
+    uint32_t mask = 1u << line;
+
+    sim_lock();
+    if (EXTI->IMR & mask)
+        EXTI->PR |= mask;
+    sim_unlock();
+
+    sim_irq_update();
+}
+
+bool sim_exti_level(uint32_t lines)
+{
+    return (EXTI->PR & EXTI->IMR & lines) != 0;
+}
@@ -0,0 +1,110 @@
+#include <stdint.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// Clock tree as SystemInit leaves it: 8 MHz HSE, PLL to 168 MHz, APB1 /4,
+// APB2 /2. The oscillators are always ready and the clock enables do
+// nothing; only the prescalers in CFGR matter, the timers and USARTs
+// derive their rates from them.
+
+#define SIM_PLLCFGR     (8 | (336 << 6) | (0 << 16) | RCC_PLLCFGR_PLLSRC_HSE | (7 << 24))
+#define SIM_CFGR        (RCC_CFGR_SWS_PLL | RCC_CFGR_SW_PLL | RCC_CFGR_HPRE_DIV1 | \
+                         RCC_CFGR_PPRE1_DIV4 | RCC_CFGR_PPRE2_DIV2)
+
+static const uint8_t prescaler_shifts[16] = { 0, 0, 0, 0, 1, 2, 3, 4, 1, 2, 3, 4, 6, 7, 8, 9 };
+
+uint32_t SystemCoreClock = 168000000;
+
+RCC_TypeDef sim_rcc = { .CFGR = SIM_CFGR, .PLLCFGR = SIM_PLLCFGR };
+FLASH_TypeDef sim_flash = { .ACR = FLASH_Latency_5 };
+PWR_TypeDef sim_pwr;
+SysTick_Type sim_systick;
+CoreDebug_Type sim_coredebug;
+
+void RCC_GetClocksFreq(RCC_ClocksTypeDef* RCC_Clocks)
+{
+    uint32_t pllm = RCC->PLLCFGR & RCC_PLLCFGR_PLLM;
+    uint32_t plln = (RCC->PLLCFGR & RCC_PLLCFGR_PLLN) >> 6;
+    uint32_t pllp = (((RCC->PLLCFGR & RCC_PLLCFGR_PLLP) >> 16) + 1) * 2;
+    uint32_t pllin = (RCC->PLLCFGR & RCC_PLLCFGR_PLLSRC) ? HSE_VALUE : HSI_VALUE;
+
+    switch (RCC->CFGR & RCC_CFGR_SWS)
+    {
+    case RCC_CFGR_SWS_HSE:
+        RCC_Clocks->SYSCLK_Frequency = HSE_VALUE;
+        break;
+    case RCC_CFGR_SWS_PLL:
+        RCC_Clocks->SYSCLK_Frequency = pllin / pllm * plln / pllp;
+        break;
+    default:
+        RCC_Clocks->SYSCLK_Frequency = HSI_VALUE;
+        break;
+    }
+
+    uint32_t cfgr = RCC->CFGR;
+    RCC_Clocks->HCLK_Frequency = RCC_Clocks->SYSCLK_Frequency >> prescaler_shifts[(cfgr & RCC_CFGR_HPRE) >> 4];
+    RCC_Clocks->PCLK1_Frequency = RCC_Clocks->HCLK_Frequency >> prescaler_shifts[(cfgr & RCC_CFGR_PPRE1) >> 10];
+    RCC_Clocks->PCLK2_Frequency = RCC_Clocks->HCLK_Frequency >> prescaler_shifts[(cfgr & RCC_CFGR_PPRE2) >> 13];
+}
+
+FlagStatus RCC_GetFlagStatus(uint8_t RCC_FLAG)
+{
+    return SET;
+}
+
+void RCC_SYSCLKConfig(uint32_t RCC_SYSCLKSource)
+{
+    RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_SW | RCC_CFGR_SWS)) |
+                RCC_SYSCLKSource | (RCC_SYSCLKSource << 2);
+}
+
+void RCC_AHB1PeriphClockCmd(uint32_t RCC_AHB1Periph, FunctionalState NewState)
+{
+}
+
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState)
+{
+}
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState)
+{
+}
+
+void RCC_HSEConfig(uint8_t RCC_HSE)
+{
+}
+
+void RCC_LSEConfig(uint8_t RCC_LSE)
+{
+}
+
+void RCC_PLLCmd(FunctionalState NewState)
+{
+}
+
+void RCC_RTCCLKCmd(FunctionalState NewState)
+{
+}
+
+void RCC_RTCCLKConfig(uint32_t RCC_RTCCLKSource)
+{
+}
+
+void FLASH_SetLatency(uint32_t FLASH_Latency)
+{
+    FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | FLASH_Latency;
+}
+
+void PWR_BackupAccessCmd(FunctionalState NewState)
+{
+}
+
+void PWR_ClearFlag(uint32_t PWR_FLAG)
+{
+}
+
+// tickless idle is off in this build, nothing gets here
+void PWR_EnterSTOPMode(uint32_t PWR_Regulator, uint8_t PWR_STOPEntry)
+{
+    sim_wfi();
+}
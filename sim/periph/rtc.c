@@ -0,0 +1,409 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// The calendar is a count of seconds since 2000-01-01 00:00:00 that runs
+// with the host clock from wherever it was last set; it starts at the
+// host's local time (or at the epoch with -r). TR, DR and SSR are worked
+// out on access and, as on the part, stay frozen from any access until DR
+// is read by RTC_GetDate. Alarm A only has to fire on each new second and
+// the wakeup timer only counts RTCCLK / 16, which is all driver/rtc asks.
+
+#define RTC_LSE_HZ          32768u
+#define RTC_SECONDS_PER_DAY 86400u
+// 2000-01-01 was a Saturday
+#define RTC_EPOCH_WEEKDAY   RTC_Weekday_Saturday
+
+static RTC_TypeDef rtc_regs;
+
+static uint64_t base_ns;
+static uint32_t base_seconds;
+static uint32_t base_sub_ns;
+// what RTC_SetDate was told, relative to the real weekday of the date
+static uint32_t weekday_offset;
+static bool shadow_locked;
+static uint32_t last_second;
+static uint64_t wakeup_next_ns;
+
+static const uint8_t days_in_month[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+static uint8_t rtc_bcd(uint32_t value)
+{
+    return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+static uint8_t rtc_bin(uint32_t value)
+{
+    return (uint8_t)(((value >> 4) & 0x0F) * 10 + (value & 0x0F));
+}
+
+static uint32_t rtc_month_days(uint32_t year, uint32_t month)
+{
+    return days_in_month[month - 1] + (month == 2 && year % 4 == 0 ? 1 : 0);
+}
+
+// year 0..99 is 2000..2099, where every fourth year is a leap year
+static uint32_t rtc_days(uint32_t year, uint32_t month, uint32_t day)
+{
+    uint32_t days = year * 365 + (year + 3) / 4;
+    for (uint32_t m = 1; m < month; m++)
+        days += rtc_month_days(year, m);
+    return days + day - 1;
+}
+
+static void rtc_civil(uint32_t days, uint32_t *year, uint32_t *month, uint32_t *day)
+{
+    uint32_t y = 0;
+    while (days >= (y % 4 == 0 ? 366u : 365u))
+    {
+        days -= y % 4 == 0 ? 366 : 365;
+        y++;
+    }
+
+    uint32_t m = 1;
+    while (days >= rtc_month_days(y, m))
+    {
+        days -= rtc_month_days(y, m);
+        m++;
+    }
+
+    *year = y % 100;
+    *month = m;
+    *day = days + 1;
+}
+
+static void rtc_now(uint32_t *seconds, uint32_t *sub_ns)
+{
+    uint64_t elapsed = sim_time_ns() - base_ns + base_sub_ns;
+    *seconds = base_seconds + (uint32_t)(elapsed / 1000000000u);
+    *sub_ns = (uint32_t)(elapsed % 1000000000u);
+}
+
+static void rtc_rebase(uint32_t seconds, uint32_t sub_ns)
+{
+    base_ns = sim_time_ns();
+    base_seconds = seconds;
+    base_sub_ns = sub_ns;
+    last_second = seconds;
+}
+
+static void rtc_shadow_update(void)
+{
+    uint32_t seconds, sub_ns;
+    rtc_now(&seconds, &sub_ns);
+
+    uint32_t days = seconds / RTC_SECONDS_PER_DAY;
+    uint32_t of_day = seconds % RTC_SECONDS_PER_DAY;
+    uint32_t year, month, day;
+    rtc_civil(days, &year, &month, &day);
+    uint32_t weekday = (days + RTC_EPOCH_WEEKDAY - 1 + weekday_offset) % 7 + 1;
+
+    uint32_t prediv_s = rtc_regs.PRER & RTC_PRER_PREDIV_S;
+    rtc_regs.TR = ((uint32_t)rtc_bcd(of_day / 3600) << 16) |
+                  ((uint32_t)rtc_bcd(of_day / 60 % 60) << 8) |
+                  rtc_bcd(of_day % 60);
+    rtc_regs.DR = ((uint32_t)rtc_bcd(year) << 16) | (weekday << 13) |
+                  ((uint32_t)rtc_bcd(month) << 8) | rtc_bcd(day);
+    rtc_regs.SSR = prediv_s - (uint32_t)((uint64_t)sub_ns * (prediv_s + 1) / 1000000000u);
+}
+
+RTC_TypeDef *sim_rtc(void)
+{
+    sim_lock();
+    if (!shadow_locked)
+        rtc_shadow_update();
+    shadow_locked = true;
+    sim_unlock();
+
+    return &rtc_regs;
+}
+
+void sim_rtc_init(void)
+{
+    memset(&rtc_regs, 0, sizeof(rtc_regs));
+    rtc_regs.PRER = (0x7F << 16) | 0xFF;
+    rtc_regs.WUTR = 0xFFFF;
+    weekday_offset = 0;
+    shadow_locked = false;
+
+    uint32_t seconds = 0;
+    if (!sim_options.rtc_reset)
+    {
+        time_t now = time(NULL);
+        struct tm local;
+        localtime_r(&now, &local);
+
+        uint32_t year = local.tm_year >= 100 ? (uint32_t)(local.tm_year - 100) % 100 : 0;
+        seconds = rtc_days(year, local.tm_mon + 1, local.tm_mday) * RTC_SECONDS_PER_DAY +
+                  local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+    }
+    rtc_rebase(seconds, 0);
+}
+
+void sim_rtc_poll(void)
+{
+    uint32_t seconds, sub_ns;
+    rtc_now(&seconds, &sub_ns);
+
+    sim_lock();
+    if (seconds != last_second)
+    {
+        last_second = seconds;
+        if (rtc_regs.CR & RTC_CR_ALRAE)
+            rtc_regs.ISR |= RTC_ISR_ALRAF;
+    }
+
+    uint64_t now = sim_time_ns();
+    if ((rtc_regs.CR & RTC_CR_WUTE) && now >= wakeup_next_ns)
+    {
+        rtc_regs.ISR |= RTC_ISR_WUTF;
+        wakeup_next_ns = now + ((uint64_t)rtc_regs.WUTR + 1) * 16 * 1000000000u / RTC_LSE_HZ;
+    }
+    sim_unlock();
+}
+
+bool sim_rtc_alarm_level(void)
+{
+    return (rtc_regs.ISR & RTC_ISR_ALRAF) && (rtc_regs.CR & RTC_CR_ALRAIE);
+}
+
+bool sim_rtc_wakeup_level(void)
+{
+    return (rtc_regs.ISR & RTC_ISR_WUTF) && (rtc_regs.CR & RTC_CR_WUTIE);
+}
+
+ErrorStatus RTC_Init(RTC_InitTypeDef* RTC_InitStruct)
+{
+    sim_lock();
+    rtc_regs.CR = (rtc_regs.CR & ~RTC_CR_FMT) | RTC_InitStruct->RTC_HourFormat;
+    rtc_regs.PRER = (RTC_InitStruct->RTC_AsynchPrediv << 16) | RTC_InitStruct->RTC_SynchPrediv;
+    sim_unlock();
+
+    return SUCCESS;
+}
+
+void RTC_StructInit(RTC_InitTypeDef* RTC_InitStruct)
+{
+    RTC_InitStruct->RTC_HourFormat = RTC_HourFormat_24;
+    RTC_InitStruct->RTC_AsynchPrediv = 0x7F;
+    RTC_InitStruct->RTC_SynchPrediv = 0xFF;
+}
+
+ErrorStatus RTC_WaitForSynchro(void)
+{
+    rtc_regs.ISR |= RTC_ISR_RSF;
+    return SUCCESS;
+}
+
+ErrorStatus RTC_SetTime(uint32_t RTC_Format, RTC_TimeTypeDef* RTC_TimeStruct)
+{
+    uint32_t hours = RTC_TimeStruct->RTC_Hours;
+    uint32_t minutes = RTC_TimeStruct->RTC_Minutes;
+    uint32_t seconds = RTC_TimeStruct->RTC_Seconds;
+
+    if (RTC_Format != RTC_Format_BIN)
+    {
+        hours = rtc_bin(hours);
+        minutes = rtc_bin(minutes);
+        seconds = rtc_bin(seconds);
+    }
+    if (hours > 23 || minutes > 59 || seconds > 59)
+        return ERROR;
+
+    uint32_t now, sub_ns;
+    rtc_now(&now, &sub_ns);
+
+    // leaving init mode restarts the prescalers
+    sim_lock();
+    rtc_rebase(now / RTC_SECONDS_PER_DAY * RTC_SECONDS_PER_DAY + hours * 3600 + minutes * 60 + seconds, 0);
+    shadow_locked = false;
+    sim_unlock();
+
+    return SUCCESS;
+}
+
+ErrorStatus RTC_SetDate(uint32_t RTC_Format, RTC_DateTypeDef* RTC_DateStruct)
+{
+    uint32_t year = RTC_DateStruct->RTC_Year;
+    uint32_t month = RTC_DateStruct->RTC_Month;
+    uint32_t day = RTC_DateStruct->RTC_Date;
+
+    if (RTC_Format != RTC_Format_BIN)
+    {
+        year = rtc_bin(year);
+        month = rtc_bin(month);
+        day = rtc_bin(day);
+    }
+    if (year > 99 || month < 1 || month > 12 || day < 1 || day > rtc_month_days(year, month) ||
+        RTC_DateStruct->RTC_WeekDay < 1 || RTC_DateStruct->RTC_WeekDay > 7)
+        return ERROR;
+
+    uint32_t now, sub_ns;
+    rtc_now(&now, &sub_ns);
+
+    uint32_t days = rtc_days(year, month, day);
+    uint32_t actual = (days + RTC_EPOCH_WEEKDAY - 1) % 7 + 1;
+
+    sim_lock();
+    weekday_offset = (RTC_DateStruct->RTC_WeekDay + 7 - actual) % 7;
+    rtc_rebase(days * RTC_SECONDS_PER_DAY + now % RTC_SECONDS_PER_DAY, sub_ns);
+    shadow_locked = false;
+    sim_unlock();
+
+    return SUCCESS;
+}
+
+void RTC_GetTime(uint32_t RTC_Format, RTC_TimeTypeDef* RTC_TimeStruct)
+{
+    uint32_t tr = sim_rtc()->TR;
+
+    RTC_TimeStruct->RTC_Hours = (uint8_t)((tr >> 16) & 0x3F);
+    RTC_TimeStruct->RTC_Minutes = (uint8_t)((tr >> 8) & 0x7F);
+    RTC_TimeStruct->RTC_Seconds = (uint8_t)(tr & 0x7F);
+    RTC_TimeStruct->RTC_H12 = RTC_H12_AM;
+    if (RTC_Format == RTC_Format_BIN)
+    {
+        RTC_TimeStruct->RTC_Hours = rtc_bin(RTC_TimeStruct->RTC_Hours);
+        RTC_TimeStruct->RTC_Minutes = rtc_bin(RTC_TimeStruct->RTC_Minutes);
+        RTC_TimeStruct->RTC_Seconds = rtc_bin(RTC_TimeStruct->RTC_Seconds);
+    }
+}
+
+// reading DR releases the shadow registers
+void RTC_GetDate(uint32_t RTC_Format, RTC_DateTypeDef* RTC_DateStruct)
+{
+    uint32_t dr = sim_rtc()->DR;
+    shadow_locked = false;
+
+    RTC_DateStruct->RTC_Year = (uint8_t)((dr >> 16) & 0xFF);
+    RTC_DateStruct->RTC_Month = (uint8_t)((dr >> 8) & 0x1F);
+    RTC_DateStruct->RTC_Date = (uint8_t)(dr & 0x3F);
+    RTC_DateStruct->RTC_WeekDay = (uint8_t)((dr >> 13) & 0x07);
+    if (RTC_Format == RTC_Format_BIN)
+    {
+        RTC_DateStruct->RTC_Year = rtc_bin(RTC_DateStruct->RTC_Year);
+        RTC_DateStruct->RTC_Month = rtc_bin(RTC_DateStruct->RTC_Month);
+        RTC_DateStruct->RTC_Date = rtc_bin(RTC_DateStruct->RTC_Date);
+    }
+}
+
+void RTC_TimeStructInit(RTC_TimeTypeDef* RTC_TimeStruct)
+{
+    RTC_TimeStruct->RTC_H12 = RTC_H12_AM;
+    RTC_TimeStruct->RTC_Hours = 0;
+    RTC_TimeStruct->RTC_Minutes = 0;
+    RTC_TimeStruct->RTC_Seconds = 0;
+}
+
+void RTC_DateStructInit(RTC_DateTypeDef* RTC_DateStruct)
+{
+    RTC_DateStruct->RTC_WeekDay = RTC_Weekday_Monday;
+    RTC_DateStruct->RTC_Date = 1;
+    RTC_DateStruct->RTC_Month = RTC_Month_January;
+    RTC_DateStruct->RTC_Year = 0;
+}
+
+void RTC_AlarmStructInit(RTC_AlarmTypeDef* RTC_AlarmStruct)
+{
+    RTC_AlarmStruct->RTC_AlarmTime.RTC_H12 = RTC_H12_AM;
+    RTC_AlarmStruct->RTC_AlarmTime.RTC_Hours = 0;
+    RTC_AlarmStruct->RTC_AlarmTime.RTC_Minutes = 0;
+    RTC_AlarmStruct->RTC_AlarmTime.RTC_Seconds = 0;
+    RTC_AlarmStruct->RTC_AlarmDateWeekDaySel = RTC_AlarmDateWeekDaySel_Date;
+    RTC_AlarmStruct->RTC_AlarmDateWeekDay = 1;
+    RTC_AlarmStruct->RTC_AlarmMask = RTC_AlarmMask_None;
+}
+
+// only the every-second alarm is modelled, the fields are kept for show
+void RTC_SetAlarm(uint32_t RTC_Format, uint32_t RTC_Alarm, RTC_AlarmTypeDef* RTC_AlarmStruct)
+{
+    if (RTC_Alarm == RTC_Alarm_A)
+        rtc_regs.ALRMAR = RTC_AlarmStruct->RTC_AlarmMask;
+    else
+        rtc_regs.ALRMBR = RTC_AlarmStruct->RTC_AlarmMask;
+}
+
+void RTC_AlarmSubSecondConfig(uint32_t RTC_Alarm, uint32_t RTC_AlarmSubSecondValue, uint32_t RTC_AlarmSubSecondMask)
+{
+    if (RTC_Alarm == RTC_Alarm_A)
+        rtc_regs.ALRMASSR = RTC_AlarmSubSecondValue | RTC_AlarmSubSecondMask;
+    else
+        rtc_regs.ALRMBSSR = RTC_AlarmSubSecondValue | RTC_AlarmSubSecondMask;
+}
+
+ErrorStatus RTC_AlarmCmd(uint32_t RTC_Alarm, FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+        rtc_regs.CR |= RTC_Alarm;
+    else
+        rtc_regs.CR &= ~RTC_Alarm;
+    sim_unlock();
+
+    return SUCCESS;
+}
+
+ErrorStatus RTC_WakeUpCmd(FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+    {
+        rtc_regs.CR |= RTC_CR_WUTE;
+        wakeup_next_ns = sim_time_ns() + ((uint64_t)rtc_regs.WUTR + 1) * 16 * 1000000000u / RTC_LSE_HZ;
+    }
+    else
+    {
+        rtc_regs.CR &= ~RTC_CR_WUTE;
+    }
+    sim_unlock();
+
+    return SUCCESS;
+}
+
+void RTC_WakeUpClockConfig(uint32_t RTC_WakeUpClock)
+{
+    rtc_regs.CR = (rtc_regs.CR & ~RTC_CR_WUCKSEL) | RTC_WakeUpClock;
+}
+
+void RTC_SetWakeUpCounter(uint32_t RTC_WakeUpCounter)
+{
+    rtc_regs.WUTR = RTC_WakeUpCounter;
+}
+
+ErrorStatus RTC_SmoothCalibConfig(uint32_t RTC_SmoothCalibPeriod, uint32_t RTC_SmoothCalibPlusPulses,
+                                  uint32_t RTC_SmouthCalibMinusPulsesValue)
+{
+    rtc_regs.CALR = RTC_SmoothCalibPeriod | RTC_SmoothCalibPlusPulses | RTC_SmouthCalibMinusPulsesValue;
+    return SUCCESS;
+}
+
+void RTC_ITConfig(uint32_t RTC_IT, FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+        rtc_regs.CR |= RTC_IT & ~RTC_TAFCR_TAMPIE;
+    else
+        rtc_regs.CR &= ~(RTC_IT & ~RTC_TAFCR_TAMPIE);
+    sim_unlock();
+
+    sim_irq_update();
+}
+
+// the status bit is the interrupt code shifted right by four
+ITStatus RTC_GetITStatus(uint32_t RTC_IT)
+{
+    uint32_t enabled = rtc_regs.CR & RTC_IT;
+    uint32_t pending = rtc_regs.ISR & (RTC_IT >> 4);
+
+    return enabled != 0 && pending != 0 ? SET : RESET;
+}
+
+void RTC_ClearITPendingBit(uint32_t RTC_IT)
+{
+    sim_lock();
+    rtc_regs.ISR &= ~(RTC_IT >> 4);
+    sim_unlock();
+}
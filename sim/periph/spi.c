@@ -0,0 +1,93 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// SPI2, transmit only: every frame goes straight to the sink (the LCD
+// model), so TXE is always set and BSY never is.
+
+SPI_TypeDef sim_spi2;
+
+static sim_spi_sink_t sink;
+
+void sim_spi_init(void)
+{
+    memset(&sim_spi2, 0, sizeof(sim_spi2));
+    sim_spi2.SR = SPI_SR_TXE;
+    sink = NULL;
+}
+
+void sim_spi_sink(sim_spi_sink_t func)
+{
+    sink = func;
+}
+
+void sim_spi_write(const void *frames, uint32_t count, bool dff16, bool minc)
+{
+    sim_lock();
+    if ((sim_spi2.CR1 & SPI_CR1_SPE) && sink != NULL && count > 0)
+        sink(frames, count, dff16, minc);
+    sim_unlock();
+}
+
+void SPI_Init(SPI_TypeDef* SPIx, SPI_InitTypeDef* SPI_InitStruct)
+{
+    SPIx->CR1 = (SPIx->CR1 & SPI_CR1_SPE) |
+                SPI_InitStruct->SPI_Direction | SPI_InitStruct->SPI_Mode |
+                SPI_InitStruct->SPI_DataSize | SPI_InitStruct->SPI_CPOL |
+                SPI_InitStruct->SPI_CPHA | SPI_InitStruct->SPI_NSS |
+                SPI_InitStruct->SPI_BaudRatePrescaler | SPI_InitStruct->SPI_FirstBit;
+    SPIx->CRCPR = SPI_InitStruct->SPI_CRCPolynomial;
+}
+
+void SPI_StructInit(SPI_InitTypeDef* SPI_InitStruct)
+{
+    SPI_InitStruct->SPI_Direction = SPI_Direction_2Lines_FullDuplex;
+    SPI_InitStruct->SPI_Mode = SPI_Mode_Slave;
+    SPI_InitStruct->SPI_DataSize = SPI_DataSize_8b;
+    SPI_InitStruct->SPI_CPOL = SPI_CPOL_Low;
+    SPI_InitStruct->SPI_CPHA = SPI_CPHA_1Edge;
+    SPI_InitStruct->SPI_NSS = SPI_NSS_Hard;
+    SPI_InitStruct->SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_2;
+    SPI_InitStruct->SPI_FirstBit = SPI_FirstBit_MSB;
+    SPI_InitStruct->SPI_CRCPolynomial = 7;
+}
+
+void SPI_Cmd(SPI_TypeDef* SPIx, FunctionalState NewState)
+{
+    if (NewState != DISABLE)
+        SPIx->CR1 |= SPI_CR1_SPE;
+    else
+        SPIx->CR1 &= (uint16_t)~SPI_CR1_SPE;
+}
+
+void SPI_DataSizeConfig(SPI_TypeDef* SPIx, uint16_t SPI_DataSize)
+{
+    SPIx->CR1 = (SPIx->CR1 & (uint16_t)~SPI_DataSize_16b) | SPI_DataSize;
+}
+
+void SPI_I2S_DMACmd(SPI_TypeDef* SPIx, uint16_t SPI_I2S_DMAReq, FunctionalState NewState)
+{
+    if (NewState != DISABLE)
+        SPIx->CR2 |= SPI_I2S_DMAReq;
+    else
+        SPIx->CR2 &= (uint16_t)~SPI_I2S_DMAReq;
+}
+
+void SPI_I2S_SendData(SPI_TypeDef* SPIx, uint16_t Data)
+{
+    bool dff16 = (SPIx->CR1 & SPI_CR1_DFF) != 0;
+    uint16_t frame = dff16 ? Data : (uint8_t)Data;
+
+    SPIx->DR = Data;
+    if (dff16)
+        sim_spi_write(&frame, 1, true, true);
+    else
+        sim_spi_write((uint8_t *)&frame, 1, false, true);
+}
+
+FlagStatus SPI_I2S_GetFlagStatus(SPI_TypeDef* SPIx, uint16_t SPI_I2S_FLAG)
+{
+    return (SPIx->SR & SPI_I2S_FLAG) != 0 ? SET : RESET;
+}
@@ -0,0 +1,353 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// TIM1, TIM5, TIM9 and the DWT cycle counter follow the host clock at the
+// rate the RCC prescalers give them. A counter is worked out from the time
+// it was last (re)based: a write to CNT, or a change of prescaler, reload,
+// enable or input clock, starts it over from the written value.
+//
+// TIM5 is read on every access (it is the firmware's microsecond clock),
+// the others only by sim_tim_poll. Overflows set UIF; on TIM1 they are
+// also the DMA requests that step the backlight fade. TIM5 sets CC1IF when
+// the count passes CCR1, which is all the one-shots need.
+
+typedef struct
+{
+    TIM_TypeDef *regs;
+    bool apb2;
+    uint64_t base_ns;
+    uint32_t base_cnt;
+    uint32_t last_cnt;
+    uint32_t psc;
+    uint32_t arr;
+    bool running;
+    uint32_t tclk;
+    uint64_t updates;
+} sim_tim_t;
+
+TIM_TypeDef sim_tim1;
+TIM_TypeDef sim_tim9;
+static TIM_TypeDef tim5_regs;
+
+static sim_tim_t tim1 = { .regs = &sim_tim1, .apb2 = true };
+static sim_tim_t tim5 = { .regs = &tim5_regs, .apb2 = false };
+static sim_tim_t tim9 = { .regs = &sim_tim9, .apb2 = true };
+
+static DWT_Type dwt_regs;
+static uint64_t dwt_base_ns;
+static uint32_t dwt_base;
+static uint32_t dwt_last;
+static uint32_t dwt_clock;
+static bool dwt_running;
+
+static sim_tim_t *tim_state(TIM_TypeDef *regs)
+{
+    if (regs == &sim_tim1)
+        return &tim1;
+    if (regs == &tim5_regs)
+        return &tim5;
+    return &tim9;
+}
+
+// a timer on a divided APB bus runs at twice its PCLK
+static uint32_t tim_clock(const sim_tim_t *tim)
+{
+    RCC_ClocksTypeDef clocks;
+    RCC_GetClocksFreq(&clocks);
+
+    uint32_t pclk = tim->apb2 ? clocks.PCLK2_Frequency : clocks.PCLK1_Frequency;
+    return pclk == clocks.HCLK_Frequency ? pclk : pclk * 2;
+}
+
+static uint64_t tim_cycles(uint64_t ns, uint32_t clock)
+{
+    return ns / 1000000000u * clock + ns % 1000000000u * clock / 1000000000u;
+}
+
+static void tim_rebase(sim_tim_t *tim, uint64_t now, uint32_t tclk)
+{
+    TIM_TypeDef *regs = tim->regs;
+
+    tim->base_ns = now;
+    tim->base_cnt = regs->CNT;
+    tim->last_cnt = regs->CNT;
+    tim->psc = regs->PSC;
+    tim->arr = regs->ARR;
+    tim->running = (regs->CR1 & TIM_CR1_CEN) != 0;
+    tim->tclk = tclk;
+    tim->updates = 0;
+}
+
+static void tim_refresh(sim_tim_t *tim)
+{
+    TIM_TypeDef *regs = tim->regs;
+    uint64_t now = sim_time_ns();
+    uint32_t tclk = tim_clock(tim);
+
+    sim_lock();
+    if (regs->CNT != tim->last_cnt || regs->PSC != tim->psc || regs->ARR != tim->arr ||
+        ((regs->CR1 & TIM_CR1_CEN) != 0) != tim->running || tclk != tim->tclk)
+    {
+        tim_rebase(tim, now, tclk);
+        sim_unlock();
+        return;
+    }
+
+    if (!tim->running)
+    {
+        sim_unlock();
+        return;
+    }
+
+    uint64_t period = (uint64_t)tim->arr + 1;
+    uint64_t total = tim->base_cnt + tim_cycles(now - tim->base_ns, tclk) / (tim->psc + 1);
+    uint32_t cnt = (uint32_t)(total % period);
+    uint64_t updates = total / period - tim->updates;
+    tim->updates += updates;
+
+    // the compare matches once on the way up
+    uint32_t prev = tim->last_cnt;
+    if (updates == 0 && cnt != prev && (uint32_t)(regs->CCR1 - prev - 1) < (uint32_t)(cnt - prev))
+        regs->SR |= TIM_SR_CC1IF;
+    else if (updates > 0 && regs->CCR1 <= cnt)
+        regs->SR |= TIM_SR_CC1IF;
+
+    regs->CNT = cnt;
+    tim->last_cnt = cnt;
+    if (updates > 0)
+        regs->SR |= TIM_SR_UIF;
+    sim_unlock();
+
+    if (updates > 0 && tim == &tim1 && (regs->DIER & TIM_DIER_UDE))
+        sim_dma_request(DMA2_Stream5, updates > UINT32_MAX ? UINT32_MAX : (uint32_t)updates);
+}
+
+TIM_TypeDef *sim_tim5(void)
+{
+    tim_refresh(&tim5);
+    return &tim5_regs;
+}
+
+DWT_Type *sim_dwt(void)
+{
+    uint64_t now = sim_time_ns();
+    bool running = (dwt_regs.CTRL & DWT_CTRL_CYCCNTENA_Msk) != 0;
+
+    sim_lock();
+    if (dwt_regs.CYCCNT != dwt_last || SystemCoreClock != dwt_clock || running != dwt_running)
+    {
+        dwt_base_ns = now;
+        dwt_base = dwt_regs.CYCCNT;
+        dwt_clock = SystemCoreClock;
+        dwt_running = running;
+    }
+    else if (running)
+    {
+        dwt_regs.CYCCNT = dwt_base + (uint32_t)tim_cycles(now - dwt_base_ns, dwt_clock);
+    }
+    dwt_last = dwt_regs.CYCCNT;
+    sim_unlock();
+
+    return &dwt_regs;
+}
+
+void sim_tim_init(void)
+{
+    sim_tim_t *timers[] = { &tim1, &tim5, &tim9 };
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        TIM_TypeDef *regs = timers[i]->regs;
+        memset(regs, 0, sizeof(*regs));
+        regs->ARR = 0xFFFF;
+        tim_rebase(timers[i], 0, tim_clock(timers[i]));
+    }
+    tim5_regs.ARR = 0xFFFFFFFF;
+    tim5.arr = 0xFFFFFFFF;
+}
+
+void sim_tim_poll(void)
+{
+    tim_refresh(&tim1);
+    tim_refresh(&tim5);
+    tim_refresh(&tim9);
+}
+
+uint32_t sim_run_time_counter(void)
+{
+    return sim_tim5()->CNT;
+}
+
+bool sim_tim5_level(void)
+{
+    return (tim5_regs.SR & tim5_regs.DIER & 0xFF) != 0;
+}
+
+static void tim_update_event(TIM_TypeDef *regs)
+{
+    regs->CNT = 0;
+    if ((regs->CR1 & TIM_CR1_URS) == 0)
+        regs->SR |= TIM_SR_UIF;
+}
+
+void TIM_TimeBaseInit(TIM_TypeDef* TIMx, TIM_TimeBaseInitTypeDef* TIM_TimeBaseInitStruct)
+{
+    tim_refresh(tim_state(TIMx));
+
+    sim_lock();
+    uint16_t cr1 = TIMx->CR1;
+    cr1 &= ~(TIM_CR1_DIR | TIM_CR1_CMS | TIM_CR1_CKD);
+    cr1 |= TIM_TimeBaseInitStruct->TIM_CounterMode | TIM_TimeBaseInitStruct->TIM_ClockDivision;
+    TIMx->CR1 = cr1;
+    TIMx->ARR = TIM_TimeBaseInitStruct->TIM_Period;
+    TIMx->PSC = TIM_TimeBaseInitStruct->TIM_Prescaler;
+    if (TIMx == TIM1)
+        TIMx->RCR = TIM_TimeBaseInitStruct->TIM_RepetitionCounter;
+    // the library generates an update to load the prescaler
+    tim_update_event(TIMx);
+    sim_unlock();
+}
+
+void TIM_TimeBaseStructInit(TIM_TimeBaseInitTypeDef* TIM_TimeBaseInitStruct)
+{
+    TIM_TimeBaseInitStruct->TIM_Period = 0xFFFFFFFF;
+    TIM_TimeBaseInitStruct->TIM_Prescaler = 0x0000;
+    TIM_TimeBaseInitStruct->TIM_ClockDivision = TIM_CKD_DIV1;
+    TIM_TimeBaseInitStruct->TIM_CounterMode = TIM_CounterMode_Up;
+    TIM_TimeBaseInitStruct->TIM_RepetitionCounter = 0x0000;
+}
+
+void TIM_PrescalerConfig(TIM_TypeDef* TIMx, uint16_t Prescaler, uint16_t TIM_PSCReloadMode)
+{
+    tim_refresh(tim_state(TIMx));
+
+    sim_lock();
+    TIMx->PSC = Prescaler;
+    if (TIM_PSCReloadMode == TIM_PSCReloadMode_Immediate)
+        tim_update_event(TIMx);
+    sim_unlock();
+}
+
+// counts on from the written value even if it equals the current one
+void TIM_SetCounter(TIM_TypeDef* TIMx, uint32_t Counter)
+{
+    sim_tim_t *tim = tim_state(TIMx);
+    tim_refresh(tim);
+
+    sim_lock();
+    TIMx->CNT = Counter;
+    tim_rebase(tim, sim_time_ns(), tim->tclk);
+    sim_unlock();
+}
+
+void TIM_SetAutoreload(TIM_TypeDef* TIMx, uint32_t Autoreload)
+{
+    tim_refresh(tim_state(TIMx));
+    TIMx->ARR = Autoreload;
+}
+
+void TIM_SetCompare1(TIM_TypeDef* TIMx, uint32_t Compare1)
+{
+    tim_refresh(tim_state(TIMx));
+    TIMx->CCR1 = Compare1;
+}
+
+void TIM_Cmd(TIM_TypeDef* TIMx, FunctionalState NewState)
+{
+    tim_refresh(tim_state(TIMx));
+
+    sim_lock();
+    if (NewState != DISABLE)
+        TIMx->CR1 |= TIM_CR1_CEN;
+    else
+        TIMx->CR1 &= (uint16_t)~TIM_CR1_CEN;
+    sim_unlock();
+}
+
+void TIM_UpdateRequestConfig(TIM_TypeDef* TIMx, uint16_t TIM_UpdateSource)
+{
+    sim_lock();
+    if (TIM_UpdateSource != TIM_UpdateSource_Global)
+        TIMx->CR1 |= TIM_CR1_URS;
+    else
+        TIMx->CR1 &= (uint16_t)~TIM_CR1_URS;
+    sim_unlock();
+}
+
+void TIM_OC1Init(TIM_TypeDef* TIMx, TIM_OCInitTypeDef* TIM_OCInitStruct)
+{
+    sim_lock();
+    TIMx->CCMR1 = (TIMx->CCMR1 & ~(TIM_CCMR1_OC1M | TIM_CCMR1_CC1S)) | TIM_OCInitStruct->TIM_OCMode;
+    TIMx->CCER = (TIMx->CCER & ~(TIM_CCER_CC1P | TIM_CCER_CC1E)) |
+                 TIM_OCInitStruct->TIM_OCPolarity | TIM_OCInitStruct->TIM_OutputState;
+    TIMx->CCR1 = TIM_OCInitStruct->TIM_Pulse;
+    sim_unlock();
+}
+
+void TIM_OCStructInit(TIM_OCInitTypeDef* TIM_OCInitStruct)
+{
+    TIM_OCInitStruct->TIM_OCMode = TIM_OCMode_Timing;
+    TIM_OCInitStruct->TIM_OutputState = TIM_OutputState_Disable;
+    TIM_OCInitStruct->TIM_OutputNState = TIM_OutputNState_Disable;
+    TIM_OCInitStruct->TIM_Pulse = 0x00000000;
+    TIM_OCInitStruct->TIM_OCPolarity = TIM_OCPolarity_High;
+    TIM_OCInitStruct->TIM_OCNPolarity = TIM_OCPolarity_High;
+    TIM_OCInitStruct->TIM_OCIdleState = TIM_OCIdleState_Reset;
+    TIM_OCInitStruct->TIM_OCNIdleState = TIM_OCNIdleState_Reset;
+}
+
+void TIM_OC1PreloadConfig(TIM_TypeDef* TIMx, uint16_t TIM_OCPreload)
+{
+    sim_lock();
+    TIMx->CCMR1 = (TIMx->CCMR1 & ~TIM_CCMR1_OC1PE) | TIM_OCPreload;
+    sim_unlock();
+}
+
+void TIM_DMACmd(TIM_TypeDef* TIMx, uint16_t TIM_DMASource, FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+        TIMx->DIER |= TIM_DMASource;
+    else
+        TIMx->DIER &= (uint16_t)~TIM_DMASource;
+    sim_unlock();
+}
+
+void TIM_ITConfig(TIM_TypeDef* TIMx, uint16_t TIM_IT, FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+        TIMx->DIER |= TIM_IT;
+    else
+        TIMx->DIER &= (uint16_t)~TIM_IT;
+    sim_unlock();
+
+    sim_irq_update();
+}
+
+ITStatus TIM_GetITStatus(TIM_TypeDef* TIMx, uint16_t TIM_IT)
+{
+    return (TIMx->SR & TIM_IT) != 0 && (TIMx->DIER & TIM_IT) != 0 ? SET : RESET;
+}
+
+void TIM_ClearITPendingBit(TIM_TypeDef* TIMx, uint16_t TIM_IT)
+{
+    sim_lock();
+    TIMx->SR &= (uint16_t)~TIM_IT;
+    sim_unlock();
+}
+
+void TIM_GenerateEvent(TIM_TypeDef* TIMx, uint16_t TIM_EventSource)
+{
+    tim_refresh(tim_state(TIMx));
+
+    sim_lock();
+    if (TIM_EventSource & TIM_EventSource_Update)
+        tim_update_event(TIMx);
+    TIMx->SR |= TIM_EventSource & (TIM_SR_CC1IF | TIM_SR_CC2IF | TIM_SR_CC3IF | TIM_SR_CC4IF);
+    sim_unlock();
+
+    sim_irq_update();
+}
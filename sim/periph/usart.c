@@ -0,0 +1,243 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sim.h"
+
+// USART1 (console, stdin / stdout) and USART2 (ESP). Transmission is
+// instant: what the DMA or USART_SendData hands over goes to the sink and
+// TXE / TC stay set. Received bytes are queued and delivered at the line
+// rate BRR gives, one into DR at a time; the next one waits for the
+// firmware to take it rather than overrunning. Bytes on USART1 also pulse
+// the RX pin's EXTI line, as a start bit does on the board.
+
+#define USART_QUEUE_SIZE    4096
+#define USART_BITS_PER_BYTE 10
+
+typedef struct
+{
+    USART_TypeDef *regs;
+    sim_usart_sink_t sink;
+    uint8_t queue[USART_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint64_t next_ns;
+} sim_usart_t;
+
+USART_TypeDef sim_usart1;
+USART_TypeDef sim_usart2;
+
+static sim_usart_t usarts[2] = { { .regs = &sim_usart1 }, { .regs = &sim_usart2 } };
+
+static sim_usart_t *usart_state(USART_TypeDef *regs)
+{
+    return regs == &sim_usart1 ? &usarts[0] : &usarts[1];
+}
+
+static uint32_t usart_pclk(USART_TypeDef *regs)
+{
+    RCC_ClocksTypeDef clocks;
+    RCC_GetClocksFreq(&clocks);
+
+    return regs == &sim_usart1 ? clocks.PCLK2_Frequency : clocks.PCLK1_Frequency;
+}
+
+static bool usart_enabled(USART_TypeDef *regs, uint16_t direction)
+{
+    return (regs->CR1 & (USART_CR1_UE | direction)) == (USART_CR1_UE | direction);
+}
+
+void sim_usart_init(void)
+{
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        memset(usarts[i].regs, 0, sizeof(USART_TypeDef));
+        usarts[i].regs->SR = USART_SR_TXE | USART_SR_TC;
+        usarts[i].head = usarts[i].tail = 0;
+        usarts[i].next_ns = 0;
+        usarts[i].sink = NULL;
+    }
+    usarts[0].sink = sim_console_output;
+}
+
+void sim_usart_sink(USART_TypeDef *usart, sim_usart_sink_t func)
+{
+    usart_state(usart)->sink = func;
+}
+
+void sim_usart_write(USART_TypeDef *usart, const uint8_t *data, uint32_t length)
+{
+    sim_usart_t *state = usart_state(usart);
+
+    if (usart_enabled(usart, USART_CR1_TE) && state->sink != NULL)
+        state->sink(data, length);
+
+    sim_lock();
+    usart->SR |= USART_SR_TXE | USART_SR_TC;
+    sim_unlock();
+}
+
+// from the simulator side only (stdin, device models)
+void sim_usart_receive(USART_TypeDef *usart, const uint8_t *data, uint32_t length)
+{
+    sim_usart_t *state = usart_state(usart);
+
+    for (uint32_t i = 0; i < length && state->head - state->tail < USART_QUEUE_SIZE; i++)
+        state->queue[state->head++ % USART_QUEUE_SIZE] = data[i];
+}
+
+void sim_usart_poll(void)
+{
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        sim_usart_t *state = &usarts[i];
+        USART_TypeDef *regs = state->regs;
+
+        while (state->tail != state->head && (regs->SR & USART_SR_RXNE) == 0)
+        {
+            uint64_t now = sim_time_ns();
+            if (state->next_ns > now)
+                break;
+
+            uint8_t data = state->queue[state->tail++ % USART_QUEUE_SIZE];
+            if (!usart_enabled(regs, USART_CR1_RE) || regs->BRR == 0)
+                continue;
+
+            uint64_t byte_ns = (uint64_t)USART_BITS_PER_BYTE * 1000000000u * regs->BRR / usart_pclk(regs);
+            state->next_ns = (state->next_ns + byte_ns < now ? now : state->next_ns) + byte_ns;
+
+            sim_lock();
+            regs->DR = data;
+            regs->SR |= USART_SR_RXNE;
+            sim_unlock();
+
+            if (regs == &sim_usart1)
+                sim_exti_edge(10);
+            sim_irq_run();
+        }
+    }
+}
+
+bool sim_usart_level(USART_TypeDef *usart)
+{
+    uint16_t sr = usart->SR;
+    uint16_t cr1 = usart->CR1;
+
+    return ((sr & USART_SR_RXNE) && (cr1 & USART_CR1_RXNEIE)) ||
+           ((sr & USART_SR_ORE) && (cr1 & USART_CR1_RXNEIE)) ||
+           ((sr & USART_SR_TC) && (cr1 & USART_CR1_TCIE)) ||
+           ((sr & USART_SR_TXE) && (cr1 & USART_CR1_TXEIE));
+}
+
+void USART_Init(USART_TypeDef* USARTx, USART_InitTypeDef* USART_InitStruct)
+{
+    sim_lock();
+    USARTx->CR2 = (USARTx->CR2 & ~USART_CR2_STOP) | USART_InitStruct->USART_StopBits;
+    USARTx->CR1 = (USARTx->CR1 & ~(USART_CR1_M | USART_CR1_PCE | USART_CR1_PS | USART_CR1_TE | USART_CR1_RE)) |
+                  USART_InitStruct->USART_WordLength | USART_InitStruct->USART_Parity |
+                  USART_InitStruct->USART_Mode;
+    USARTx->CR3 = (USARTx->CR3 & ~(USART_CR3_RTSE | USART_CR3_CTSE)) |
+                  USART_InitStruct->USART_HardwareFlowControl;
+
+    uint32_t divider = (25 * usart_pclk(USARTx)) / (4 * USART_InitStruct->USART_BaudRate);
+    uint32_t brr = (divider / 100) << 4;
+    uint32_t fraction = divider - 100 * (brr >> 4);
+    brr |= ((fraction * 16 + 50) / 100) & 0x0F;
+    USARTx->BRR = (uint16_t)brr;
+    sim_unlock();
+}
+
+void USART_StructInit(USART_InitTypeDef* USART_InitStruct)
+{
+    USART_InitStruct->USART_BaudRate = 9600;
+    USART_InitStruct->USART_WordLength = USART_WordLength_8b;
+    USART_InitStruct->USART_StopBits = USART_StopBits_1;
+    USART_InitStruct->USART_Parity = USART_Parity_No;
+    USART_InitStruct->USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
+    USART_InitStruct->USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+}
+
+void USART_Cmd(USART_TypeDef* USARTx, FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+        USARTx->CR1 |= USART_CR1_UE;
+    else
+        USARTx->CR1 &= (uint16_t)~USART_CR1_UE;
+    sim_unlock();
+}
+
+void USART_DMACmd(USART_TypeDef* USARTx, uint16_t USART_DMAReq, FunctionalState NewState)
+{
+    sim_lock();
+    if (NewState != DISABLE)
+        USARTx->CR3 |= USART_DMAReq;
+    else
+        USARTx->CR3 &= (uint16_t)~USART_DMAReq;
+    sim_unlock();
+}
+
+// the register is in bits 7:5 of the interrupt code, the enable bit in 4:0
+// and the status bit in 15:8
+void USART_ITConfig(USART_TypeDef* USARTx, uint16_t USART_IT, FunctionalState NewState)
+{
+    uint32_t reg = (uint8_t)USART_IT >> 5;
+    uint16_t mask = (uint16_t)(1u << (USART_IT & 0x1F));
+    volatile uint16_t *cr = reg == 1 ? &USARTx->CR1 : reg == 2 ? &USARTx->CR2 : &USARTx->CR3;
+
+    sim_lock();
+    if (NewState != DISABLE)
+        *cr |= mask;
+    else
+        *cr &= (uint16_t)~mask;
+    sim_unlock();
+
+    sim_irq_update();
+}
+
+ITStatus USART_GetITStatus(USART_TypeDef* USARTx, uint16_t USART_IT)
+{
+    uint32_t reg = (uint8_t)USART_IT >> 5;
+    uint16_t mask = (uint16_t)(1u << (USART_IT & 0x1F));
+    uint16_t cr = reg == 1 ? USARTx->CR1 : reg == 2 ? USARTx->CR2 : USARTx->CR3;
+    uint16_t status = (uint16_t)(1u << (USART_IT >> 8));
+
+    return (cr & mask) != 0 && (USARTx->SR & status) != 0 ? SET : RESET;
+}
+
+void USART_ClearITPendingBit(USART_TypeDef* USARTx, uint16_t USART_IT)
+{
+    sim_lock();
+    USARTx->SR &= (uint16_t)~(1u << (USART_IT >> 8));
+    sim_unlock();
+}
+
+FlagStatus USART_GetFlagStatus(USART_TypeDef* USARTx, uint16_t USART_FLAG)
+{
+    return (USARTx->SR & USART_FLAG) != 0 ? SET : RESET;
+}
+
+void USART_ClearFlag(USART_TypeDef* USARTx, uint16_t USART_FLAG)
+{
+    sim_lock();
+    USARTx->SR &= (uint16_t)~USART_FLAG;
+    sim_unlock();
+}
+
+uint16_t USART_ReceiveData(USART_TypeDef* USARTx)
+{
+    sim_lock();
+    uint16_t data = USARTx->DR & 0x01FF;
+    USARTx->SR &= (uint16_t)~(USART_SR_RXNE | USART_SR_ORE);
+    sim_unlock();
+
+    return data;
+}
+
+void USART_SendData(USART_TypeDef* USARTx, uint16_t Data)
+{
+    uint8_t byte = (uint8_t)Data;
+
+    USARTx->DR = Data & 0x01FF;
+    sim_usart_write(USARTx, &byte, 1);
+}
@@ -0,0 +1,351 @@
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <signal.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "console.h"
+#include "sim.h"
+
+// Host build of the firmware: app/ and driver/ unchanged on the FreeRTOS
+// POSIX port, with the peripherals they touch simulated in sim/periph and
+// the parts on the board in sim/device. The console is stdin / stdout,
+// the simulator's own messages go to stderr.
+
+#define SIM_STDIN_SIZE      4096
+// the shell is up well before this
+#define SIM_BENCH_START_NS  (1000ull * 1000000)
+#define SIM_LINE_SIZE       128
+
+// firmware main.c, renamed by the Makefile
+int firmware_main(void);
+
+sim_options_t sim_options;
+
+static struct timespec start_time;
+static volatile sig_atomic_t stop_requested;
+static int exit_code;
+static bool bench_started;
+
+// console output, split into lines for -b
+static char console_line[SIM_LINE_SIZE];
+static uint32_t console_line_len;
+
+// single producer (reader thread), single consumer (sim_poll)
+static uint8_t stdin_buf[SIM_STDIN_SIZE];
+static volatile uint32_t stdin_head;
+static volatile uint32_t stdin_tail;
+
+uint64_t sim_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)(now.tv_sec - start_time.tv_sec) * 1000000000u +
+           (uint64_t)now.tv_nsec - (uint64_t)start_time.tv_nsec;
+}
+
+// no stdio: a task may be switched out anywhere, and a lock it holds
+// would stop every other one
+void sim_log(const char *fmt, ...)
+{
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len > (int)sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    if (len > 0 && write(STDERR_FILENO, buf, len) < 0)
+        return;
+}
+
+void sim_write_stdout(const void *data, uint32_t length)
+{
+    const uint8_t *p = data;
+    while (length > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, p, length);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return;
+        }
+        p += n;
+        length -= n;
+    }
+}
+
+static void sim_console_line(const char *line)
+{
+    if (strncmp(line, "bench: pass", 11) == 0)
+        stop_requested = 1;
+    else if (strncmp(line, "bench: FAIL", 11) == 0)
+    {
+        exit_code = 1;
+        stop_requested = 1;
+    }
+}
+
+// what the firmware writes to USART1
+void sim_console_output(const uint8_t *data, uint32_t length)
+{
+    sim_write_stdout(data, length);
+    if (!sim_options.bench)
+        return;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (data[i] == '\n')
+        {
+            console_line[console_line_len] = '\0';
+            sim_console_line(console_line);
+            console_line_len = 0;
+        }
+        else if (console_line_len < sizeof(console_line) - 1)
+        {
+            console_line[console_line_len++] = (char)data[i];
+        }
+    }
+}
+
+// LOG is plain printf in this build (LOG_TOKENIZED=0) and the Makefile
+// points printf here, so the output takes the console path of the target
+int sim_printf(const char *fmt, ...)
+{
+    char buf[1024];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+
+    if (len > (int)sizeof(buf) - 1)
+        len = sizeof(buf) - 1;
+    if (len > 0)
+        console_write_data(buf, len);
+    return len;
+}
+
+void sim_exit(int code)
+{
+    sim_lcd_exit();
+    sim_log("[SIM] exit after %u ms\n", (unsigned)(sim_time_ns() / 1000000));
+    exit(code);
+}
+
+// from a task: the interrupt task exits at its next poll
+void sim_stop(int code)
+{
+    exit_code = code;
+    stop_requested = 1;
+}
+
+static void sim_stop_signal(int sig)
+{
+    stop_requested = 1;
+}
+
+// the port's tick is SIGALRM: this thread must never take it
+static void *sim_stdin_func(void *param)
+{
+    sigset_t signals;
+    sigfillset(&signals);
+    sigdelset(&signals, SIGINT);
+    sigdelset(&signals, SIGTERM);
+    pthread_sigmask(SIG_SETMASK, &signals, NULL);
+
+    while (1)
+    {
+        uint8_t data[64];
+        ssize_t n = read(STDIN_FILENO, data, sizeof(data));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+
+        for (ssize_t i = 0; i < n; i++)
+        {
+            while (stdin_head - stdin_tail >= SIM_STDIN_SIZE)
+                usleep(1000);
+            stdin_buf[stdin_head % SIM_STDIN_SIZE] = data[i];
+            __sync_synchronize();
+            stdin_head++;
+        }
+    }
+
+    return NULL;
+}
+
+static void sim_stdin_poll(void)
+{
+    uint8_t data[64];
+    uint32_t count = 0;
+
+    while (count < sizeof(data) && stdin_tail != stdin_head)
+    {
+        data[count++] = stdin_buf[stdin_tail % SIM_STDIN_SIZE];
+        __sync_synchronize();
+        stdin_tail++;
+    }
+
+    if (count > 0)
+        sim_usart_receive(USART1, data, count);
+}
+
+// from the interrupt task, once per tick or when a request was raised
+void sim_poll(void)
+{
+    if (stop_requested)
+        sim_exit(exit_code);
+    if (sim_options.run_seconds != 0 &&
+        sim_time_ns() >= (uint64_t)sim_options.run_seconds * 1000000000u)
+    {
+        // -b and -c stop on their verdict, running out of time means a hang
+        if (sim_options.bench || sim_options.check)
+        {
+            sim_log("[SIM] no verdict after %u s\n", (unsigned)sim_options.run_seconds);
+            sim_exit(1);
+        }
+        sim_exit(exit_code);
+    }
+
+    if (sim_options.bench && !bench_started && sim_time_ns() >= SIM_BENCH_START_NS)
+    {
+        bench_started = true;
+        sim_usart_receive(USART1, (const uint8_t *)"bench\r", 6);
+    }
+
+    sim_tim_poll();
+    sim_rtc_poll();
+    sim_esp_poll();
+    sim_stdin_poll();
+    sim_usart_poll();
+    sim_lcd_poll();
+}
+
+void vApplicationIdleHook(void)
+{
+    // nothing to run until the next tick
+    usleep(1000);
+}
+
+void sim_wfi(void)
+{
+    usleep(1000);
+}
+
+// tickless idle is off here (see FreeRTOSConfig.h), so the kernel leaves
+// these out; lowpower and clkscale still link against them but are never
+// called from the idle task
+void vTaskStepTick(const TickType_t xTicksToJump)
+{
+}
+
+eSleepModeStatus eTaskConfirmSleepModeStatus(void)
+{
+    return eAbortSleep;
+}
+
+static void sim_usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-t seconds] [-r] [-w] [-d seconds] [-s file] [-f dir] [-v] [-b] [-c] [-e file] [-h]\n"
+            "  -t seconds  stop after this long (default: until interrupted)\n"
+            "  -r          start the RTC at 2000-01-01 00:00:00 instead of now\n"
+            "  -w          the access point never answers\n"
+            "  -d seconds  the access point drops the link after this long\n"
+            "  -s file     write the LCD frame memory on exit (.ppm, else PNG)\n"
+            "  -f dir      write every LCD frame to dir/frame-NNNNN.png\n"
+            "  -v          log the SPI traffic of every LCD frame\n"
+            "  -b          run the console's bench command, exit with its result\n"
+            "  -c          run the host checks (check.c), exit with their result\n"
+            "  -e file     keep the EEPROM contents in file between runs\n"
+            "  -h          this help\n",
+            name);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:rwd:s:f:vbce:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            sim_options.run_seconds = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            sim_options.rtc_reset = true;
+            break;
+        case 'w':
+            sim_options.no_wifi = true;
+            break;
+        case 'd':
+            sim_options.wifi_drop_seconds = (uint32_t)strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            sim_options.lcd_snapshot = optarg;
+            break;
+        case 'f':
+            sim_options.lcd_frame_dir = optarg;
+            break;
+        case 'v':
+            sim_options.lcd_frame_log = true;
+            break;
+        case 'b':
+            sim_options.bench = true;
+            break;
+        case 'c':
+            sim_options.check = true;
+            break;
+        case 'e':
+            sim_options.eeprom_file = optarg;
+            break;
+        case 'h':
+            sim_usage(argv[0]);
+            return 0;
+        default:
+            sim_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = sim_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    sim_gpio_init();
+    sim_dma_init();
+    sim_usart_init();
+    sim_spi_init();
+    sim_tim_init();
+    sim_i2c_init();
+    sim_rtc_init();
+    sim_lcd_init();
+    sim_esp_init();
+    sim_aht20_init();
+    sim_eeprom_init();
+    sim_irq_init();
+
+    if (sim_options.check)
+        sim_check_init();
+
+    pthread_t stdin_thread;
+    pthread_create(&stdin_thread, NULL, sim_stdin_func, NULL);
+
+    return firmware_main();
+}
@@ -0,0 +1,129 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+typedef struct
+{
+    // 0 runs until interrupted
+    uint32_t run_seconds;
+    // calendar starts at 2000-01-01 00:00:00 instead of the host clock
+    bool rtc_reset;
+    // the access point never answers
+    bool no_wifi;
+    // the access point drops the link after this long and is away for a
+    // while, 0 never
+    uint32_t wifi_drop_seconds;
+    // LCD frame memory written here on exit, PNG or .ppm
+    const char *lcd_snapshot;
+    // every LCD frame written here as a PNG when it is done
+    const char *lcd_frame_dir;
+    // traffic of every LCD frame on stderr
+    bool lcd_frame_log;
+    // type "bench" on the console and exit with its verdict
+    bool bench;
+    // EEPROM contents kept here between runs
+    const char *eeprom_file;
+    // run the host checks (check.c) next to the firmware, exit with the result
+    bool check;
+} sim_options_t;
+
+typedef struct
+{
+    uint32_t frames;
+    uint32_t commands;
+    uint64_t pixel_bytes;
+    uint64_t pixels;
+    uint64_t overdrawn;
+    uint64_t unchanged;
+} sim_lcd_stats_t;
+
+extern sim_options_t sim_options;
+
+// sim.c
+uint64_t sim_time_ns(void);
+void sim_log(const char *fmt, ...);
+void sim_exit(int code);
+void sim_stop(int code);
+void sim_poll(void);
+void sim_write_stdout(const void *data, uint32_t length);
+void sim_console_output(const uint8_t *data, uint32_t length);
+int sim_printf(const char *fmt, ...);
+
+// check.c
+void sim_check_init(void);
+
+// irq.c
+void sim_irq_init(void);
+void sim_irq_enable(IRQn_Type irq, bool enable);
+void sim_irq_update(void);
+void sim_irq_run(void);
+bool sim_in_isr(void);
+void sim_lock(void);
+void sim_unlock(void);
+
+// periph
+typedef void (*sim_gpio_watch_t)(GPIO_TypeDef *port, uint16_t odr);
+void sim_gpio_init(void);
+void sim_gpio_watch(GPIO_TypeDef *port, sim_gpio_watch_t func);
+
+void sim_exti_edge(uint32_t line);
+bool sim_exti_level(uint32_t lines);
+
+void sim_dma_init(void);
+void sim_dma_request(DMA_Stream_TypeDef *stream, uint32_t count);
+bool sim_dma_level(DMA_Stream_TypeDef *stream);
+
+typedef void (*sim_usart_sink_t)(const uint8_t *data, uint32_t length);
+void sim_usart_init(void);
+void sim_usart_sink(USART_TypeDef *usart, sim_usart_sink_t func);
+void sim_usart_write(USART_TypeDef *usart, const uint8_t *data, uint32_t length);
+void sim_usart_receive(USART_TypeDef *usart, const uint8_t *data, uint32_t length);
+void sim_usart_poll(void);
+bool sim_usart_level(USART_TypeDef *usart);
+
+// frames are bytes, or half words when dff16; with minc false the same
+// frame is repeated count times
+typedef void (*sim_spi_sink_t)(const void *frames, uint32_t count, bool dff16, bool minc);
+void sim_spi_init(void);
+void sim_spi_sink(sim_spi_sink_t func);
+void sim_spi_write(const void *frames, uint32_t count, bool dff16, bool minc);
+
+void sim_tim_init(void);
+void sim_tim_poll(void);
+uint32_t sim_run_time_counter(void);
+bool sim_tim5_level(void);
+
+typedef struct
+{
+    uint8_t addr;
+    // false: no ACK for the address
+    bool (*start)(bool read);
+    bool (*write)(uint8_t data);
+    uint8_t (*read)(void);
+    void (*stop)(void);
+} sim_i2c_device_t;
+
+void sim_i2c_init(void);
+bool sim_i2c_attach(const sim_i2c_device_t *device);
+
+void sim_rtc_init(void);
+void sim_rtc_poll(void);
+bool sim_rtc_alarm_level(void);
+bool sim_rtc_wakeup_level(void);
+
+// device
+void sim_lcd_init(void);
+void sim_lcd_poll(void);
+void sim_lcd_exit(void);
+bool sim_lcd_snapshot(const char *path);
+void sim_lcd_get_stats(sim_lcd_stats_t *stats);
+uint32_t sim_lcd_get_pixel(uint16_t x, uint16_t y);
+void sim_esp_init(void);
+void sim_esp_poll(void);
+void sim_aht20_init(void);
+void sim_eeprom_init(void);
+
+#endif /* __SIM_H__ */
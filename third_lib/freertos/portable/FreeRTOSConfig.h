@@ -8,9 +8,14 @@ extern uint32_t SystemCoreClock;
 
 #define configUSE_PREEMPTION                                        1
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION                     1
-#define configUSE_TICKLESS_IDLE                                     0
+/* 2: portSUPPRESS_TICKS_AND_SLEEP is lowpower_idle() (STOP mode with the
+   RTC wakeup timer), see lowpower.h */
+#define configUSE_TICKLESS_IDLE                                     2
 #define configCPU_CLOCK_HZ                                          SystemCoreClock
 #define configTICK_RATE_HZ                                          1000
+/* the kernel's pdMS_TO_TICKS multiplies in TickType_t and wraps past
+   4294967 ms (71 min); the RTC discipline waits up to 24 h */
+#define pdMS_TO_TICKS( xTimeInMs )    ( ( TickType_t ) ( ( ( uint64_t ) ( xTimeInMs ) * configTICK_RATE_HZ ) / 1000U ) )
 #define configMAX_PRIORITIES                                        10
 #define configMINIMAL_STACK_SIZE                                    128
 #define configMAX_TASK_NAME_LEN                                     16
@@ -30,10 +35,11 @@ extern uint32_t SystemCoreClock;
 #define configNUM_THREAD_LOCAL_STORAGE_POINTERS                     5
 #define configUSE_MINI_LIST_ITEM                                    1
 #define configSTACK_DEPTH_TYPE                                      uint32_t
+#define configRECORD_STACK_HIGH_ADDRESS                             1
 #define configMESSAGE_BUFFER_LENGTH_TYPE                            size_t
 
 /* Memory allocation related definitions. */
-#define configSUPPORT_STATIC_ALLOCATION                             0
+#define configSUPPORT_STATIC_ALLOCATION                             1
 #define configSUPPORT_DYNAMIC_ALLOCATION                            1
 #define configTOTAL_HEAP_SIZE                                       (92 * 1024)
 #define configAPPLICATION_ALLOCATED_HEAP                            0
@@ -47,8 +53,12 @@ extern uint32_t SystemCoreClock;
 #define configUSE_SB_COMPLETED_CALLBACK                     0
 
 /* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS                       0
-#define configUSE_TRACE_FACILITY                            0
+#define configGENERATE_RUN_TIME_STATS                       1
+/* TIM5 is already a free-running 1 MHz counter (tim_delay), started in
+   board_init; it reads 0 until then. */
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()                    (TIM5->CNT)
+#define configUSE_TRACE_FACILITY                            1
 #define configUSE_STATS_FORMATTING_FUNCTIONS                0
 
 /* Co-routine related definitions. */
@@ -90,6 +100,10 @@ void vAssertCalled(const char *file, int line);
 #define INCLUDE_xTaskResumeFromISR              1
 
 /* A header file that defines trace macro can be included here. */
+#include "trace.h"
+#include "heapmon.h"
+#include "stackmon.h"
+#include "lowpower.h"
 
 #define xPortPendSVHandler PendSV_Handler
 #define xPortSysTickHandler SysTick_Handler
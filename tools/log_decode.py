@@ -0,0 +1,202 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Tokenized log decoder
+Turn the binary LOG() frames from the console back into text, looking the
+format strings up in the firmware image (.axf / .elf) they were built into.
+
+Usage:
+    python log_decode.py firmware.axf capture.bin
+    python log_decode.py firmware.axf < /dev/ttyUSB0
+"""
+
+import re
+import struct
+import sys
+
+LOG_FRAME_SYNC = 0x1E
+LOG_FRAME_MAX = 256
+LOG_STRING_BASE = 0x08000000
+
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?([hlLqjzt]*)([diouxXcspfFeEgGaAn%])')
+
+
+def load_sections(path):
+    """
+    Read the loadable sections of an ELF32 little endian image
+    Returns a list of (address, bytes)
+    """
+    with open(path, 'rb') as f:
+        elf = f.read()
+
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        raise ValueError('%s is not an ELF32 little endian image' % path)
+
+    e_shoff, = struct.unpack_from('<I', elf, 0x20)
+    e_shentsize, e_shnum = struct.unpack_from('<HH', elf, 0x2E)
+
+    sections = []
+    for i in range(e_shnum):
+        (sh_name, sh_type, sh_flags, sh_addr, sh_offset,
+         sh_size) = struct.unpack_from('<IIIIII', elf, e_shoff + i * e_shentsize)
+        if not (sh_flags & SHF_ALLOC) or sh_type == SHT_NOBITS or sh_size == 0:
+            continue
+        sections.append((sh_addr, elf[sh_offset:sh_offset + sh_size]))
+
+    return sections
+
+
+def lookup_string(sections, address):
+    """
+    Read the NUL terminated string at a target address
+    """
+    for base, data in sections:
+        if base <= address < base + len(data):
+            end = data.find(b'\0', address - base)
+            if end < 0:
+                end = len(data)
+            return data[address - base:end].decode('utf-8', errors='replace')
+    return None
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        if pos >= len(data):
+            raise ValueError('truncated varint')
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not (byte & 0x80):
+            return value, pos
+
+
+def read_signed(data, pos):
+    value, pos = read_varint(data, pos)
+    return (value >> 1) ^ -(value & 1), pos
+
+
+def format_frame(sections, payload):
+    """
+    Rebuild the text of one frame payload
+    """
+    offset, pos = read_varint(payload, 0)
+    fmt = lookup_string(sections, LOG_STRING_BASE + offset)
+    if fmt is None:
+        return '<unknown format 0x%08x>\n' % (LOG_STRING_BASE + offset)
+
+    out = []
+    last = 0
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, precision, _, conv = m.groups()
+
+        if conv == '%':
+            out.append('%')
+            continue
+        if width == '*':
+            width, pos = read_signed(payload, pos)
+            width = str(width)
+        if precision == '*':
+            precision, pos = read_signed(payload, pos)
+            precision = str(precision)
+
+        if conv in 'di':
+            value, pos = read_signed(payload, pos)
+        elif conv in 'ouxXc':
+            value, pos = read_varint(payload, pos)
+        elif conv == 'p':
+            value, pos = read_varint(payload, pos)
+            conv = 'x'
+            flags += '#'
+        elif conv in 'fFeEgGaA':
+            value, = struct.unpack_from('<f', payload, pos)
+            pos += 4
+            if conv in 'aA':
+                conv = 'e'
+        elif conv == 's':
+            length, pos = read_varint(payload, pos)
+            cut = length & 1
+            length >>= 1
+            value = payload[pos:pos + length].decode('utf-8', errors='replace')
+            if cut:
+                value += '<truncated>'
+            pos += length
+        else:
+            continue
+
+        spec = '%' + flags + (width or '') + ('.' + precision if precision is not None else '') + conv
+        out.append(spec % value)
+
+    out.append(fmt[last:])
+    return ''.join(out)
+
+
+def decode_stream(sections, data, output, final=True):
+    """
+    Plain text outside frames (early boot, panic messages) passes through
+    Returns the bytes of a frame that has not fully arrived yet, to be put
+    in front of the next chunk; with final set it is reported as bad instead
+    """
+    pos = 0
+    while pos < len(data):
+        sync = data.find(bytes([LOG_FRAME_SYNC]), pos)
+        if sync < 0:
+            output.write(data[pos:].decode('utf-8', errors='replace'))
+            break
+        output.write(data[pos:sync].decode('utf-8', errors='replace'))
+
+        try:
+            length, start = read_varint(data, sync + 1)
+        except ValueError:
+            if not final:
+                return data[sync:]
+            output.write('<bad frame>\n')
+            break
+
+        try:
+            if length > LOG_FRAME_MAX:
+                raise ValueError('frame too long')
+            if start + length > len(data):
+                if not final:
+                    return data[sync:]
+                raise ValueError('truncated frame')
+            output.write(format_frame(sections, data[start:start + length]))
+            pos = start + length
+        except (ValueError, struct.error, TypeError):
+            output.write('<bad frame>\n')
+            pos = sync + 1
+
+    return b''
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+
+    sections = load_sections(sys.argv[1])
+    if len(sys.argv) > 2:
+        with open(sys.argv[2], 'rb') as f:
+            decode_stream(sections, f.read(), sys.stdout)
+        return
+
+    # a serial port never ends: decode whatever has arrived, as it arrives
+    pending = b''
+    while True:
+        chunk = sys.stdin.buffer.read1(4096)
+        if not chunk:
+            break
+        pending = decode_stream(sections, pending + chunk, sys.stdout, final=False)
+        sys.stdout.flush()
+    decode_stream(sections, pending, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
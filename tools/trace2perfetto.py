@@ -0,0 +1,221 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+"""
+Scheduler trace converter
+Turn the output of the console "trace dump" command into Chrome trace
+JSON, which loads in https://ui.perfetto.dev or chrome://tracing.
+
+Usage:
+    python trace2perfetto.py capture.txt [trace.json]
+
+The capture may contain other console output around the dump; everything
+between "#trace" and "#end" is used.
+"""
+
+import json
+import sys
+
+EVT_TASK_CREATE = 0
+EVT_TASK_DELETE = 1
+EVT_TASK_SWITCH = 2
+EVT_TASK_READY = 3
+EVT_TASK_DELAY = 4
+EVT_NOTIFY_BLOCK = 5
+EVT_NOTIFY_FROM_ISR = 6
+EVT_QUEUE_CREATE = 7
+EVT_QUEUE_SEND = 8
+EVT_QUEUE_SEND_FAILED = 9
+EVT_QUEUE_SEND_FROM_ISR = 10
+EVT_QUEUE_RECEIVE = 11
+EVT_QUEUE_RECEIVE_FAILED = 12
+EVT_QUEUE_RECEIVE_FROM_ISR = 13
+EVT_QUEUE_BLOCK_SEND = 14
+EVT_QUEUE_BLOCK_RECEIVE = 15
+EVT_ISR_ENTER = 16
+EVT_ISR_EXIT = 17
+EVT_USER_MARK = 18
+EVT_USER_BEGIN = 19
+EVT_USER_END = 20
+
+QUEUE_EVENTS = {
+    EVT_QUEUE_SEND: 'send',
+    EVT_QUEUE_SEND_FAILED: 'send failed',
+    EVT_QUEUE_SEND_FROM_ISR: 'send from isr',
+    EVT_QUEUE_RECEIVE: 'receive',
+    EVT_QUEUE_RECEIVE_FAILED: 'receive failed',
+    EVT_QUEUE_RECEIVE_FROM_ISR: 'receive from isr',
+    EVT_QUEUE_BLOCK_SEND: 'block on send',
+    EVT_QUEUE_BLOCK_RECEIVE: 'block on receive',
+}
+
+QUEUE_TYPES = ['queue', 'mutex', 'counting semaphore', 'binary semaphore', 'recursive mutex']
+
+# STM32F40x IRQ numbers of the handlers that are instrumented
+IRQ_NAMES = {
+    15: 'DMA1_Stream4 (lcd)',
+    17: 'DMA1_Stream6 (esp)',
+    37: 'USART1 (console)',
+    38: 'USART2 (esp)',
+    41: 'RTC_Alarm',
+    50: 'TIM5',
+    68: 'DMA2_Stream5 (backlight)',
+    70: 'DMA2_Stream7 (console)',
+}
+
+PID_TASKS = 1
+PID_ISR = 2
+PID_USER = 3
+
+
+def parse_dump(lines):
+    """
+    Returns (tasks, queues, channels, events)
+    """
+    tasks, queues, channels, events = {}, {}, {}, []
+    inside = False
+
+    for line in lines:
+        line = line.strip()
+        if line.startswith('#trace'):
+            inside = True
+            tasks, queues, channels, events = {}, {}, {}, []
+            continue
+        if not inside:
+            continue
+        if line.startswith('#end'):
+            break
+
+        fields = line.split(None, 3)
+        if not fields:
+            continue
+        if fields[0] == '#task':
+            tasks[int(fields[1])] = line.split(None, 2)[2]
+        elif fields[0] == '#queue':
+            queues[int(fields[1])] = (int(fields[2]), line.split(None, 3)[3])
+        elif fields[0] == '#user':
+            channels[int(fields[1])] = line.split(None, 2)[2]
+        elif not fields[0].startswith('#') and len(fields) == 4:
+            events.append(tuple(int(f) for f in fields))
+
+    return tasks, queues, channels, events
+
+
+def unwrap(events):
+    """
+    Timestamps are a 32-bit microsecond counter: make them monotonic
+    """
+    offset = 0
+    last = None
+    for time, etype, task, arg in events:
+        if last is not None and time < last:
+            offset += 1 << 32
+        last = time
+        yield time + offset, etype, task, arg
+
+
+def convert(tasks, queues, channels, events):
+    out = []
+
+    def meta(pid, tid, name, kind='thread_name'):
+        out.append({'ph': 'M', 'pid': pid, 'tid': tid, 'name': kind, 'args': {'name': name}})
+
+    meta(PID_TASKS, 0, 'tasks', 'process_name')
+    meta(PID_ISR, 0, 'interrupts', 'process_name')
+    meta(PID_USER, 0, 'markers', 'process_name')
+    for number, name in tasks.items():
+        meta(PID_TASKS, number, '%s (#%d)' % (name, number))
+    for channel, name in channels.items():
+        meta(PID_USER, channel, name)
+
+    def queue_name(number):
+        if number in queues:
+            qtype, name = queues[number]
+            kind = QUEUE_TYPES[qtype] if qtype < len(QUEUE_TYPES) else 'queue'
+            return '%s %d' % (kind, number) if name == '-' else name
+        return 'queue %d' % number
+
+    running = None
+    isr_stack = []
+    last_time = 0
+
+    for time, etype, task, arg in unwrap(events):
+        last_time = time
+
+        if etype == EVT_TASK_SWITCH:
+            if running is not None:
+                out.append({'ph': 'E', 'pid': PID_TASKS, 'tid': running, 'ts': time})
+            running = arg
+            out.append({'ph': 'B', 'pid': PID_TASKS, 'tid': arg, 'ts': time,
+                        'name': tasks.get(arg, 'task %d' % arg)})
+        elif etype == EVT_ISR_ENTER:
+            isr_stack.append(arg)
+            out.append({'ph': 'B', 'pid': PID_ISR, 'tid': arg, 'ts': time,
+                        'name': IRQ_NAMES.get(arg, 'IRQ %d' % arg)})
+            meta(PID_ISR, arg, IRQ_NAMES.get(arg, 'IRQ %d' % arg))
+        elif etype == EVT_ISR_EXIT:
+            if arg in isr_stack:
+                isr_stack.remove(arg)
+                out.append({'ph': 'E', 'pid': PID_ISR, 'tid': arg, 'ts': time})
+        elif etype in QUEUE_EVENTS:
+            out.append({'ph': 'i', 's': 't', 'pid': PID_TASKS, 'tid': task, 'ts': time,
+                        'name': '%s %s' % (QUEUE_EVENTS[etype], queue_name(arg))})
+        elif etype == EVT_TASK_READY:
+            out.append({'ph': 'i', 's': 't', 'pid': PID_TASKS, 'tid': arg, 'ts': time,
+                        'name': 'ready', 'args': {'by': tasks.get(task, task)}})
+        elif etype == EVT_TASK_DELAY:
+            out.append({'ph': 'i', 's': 't', 'pid': PID_TASKS, 'tid': task, 'ts': time, 'name': 'delay'})
+        elif etype == EVT_NOTIFY_BLOCK:
+            out.append({'ph': 'i', 's': 't', 'pid': PID_TASKS, 'tid': task, 'ts': time,
+                        'name': 'wait notify %d' % arg})
+        elif etype == EVT_NOTIFY_FROM_ISR:
+            out.append({'ph': 'i', 's': 't', 'pid': PID_TASKS, 'tid': arg, 'ts': time,
+                        'name': 'notified from isr'})
+        elif etype in (EVT_TASK_CREATE, EVT_TASK_DELETE):
+            out.append({'ph': 'i', 's': 'p', 'pid': PID_TASKS, 'tid': arg, 'ts': time,
+                        'name': 'create' if etype == EVT_TASK_CREATE else 'delete'})
+        elif etype == EVT_QUEUE_CREATE:
+            out.append({'ph': 'i', 's': 'p', 'pid': PID_TASKS, 'tid': task, 'ts': time,
+                        'name': 'create %s' % queue_name(arg)})
+        elif etype == EVT_USER_BEGIN:
+            out.append({'ph': 'B', 'pid': PID_USER, 'tid': arg, 'ts': time,
+                        'name': channels.get(arg, 'channel %d' % arg),
+                        'args': {'task': tasks.get(task, task)}})
+        elif etype == EVT_USER_END:
+            out.append({'ph': 'E', 'pid': PID_USER, 'tid': arg, 'ts': time})
+        elif etype == EVT_USER_MARK:
+            channel, value = arg >> 12, arg & 0x0FFF
+            name = channels.get(channel, 'channel %d' % channel)
+            out.append({'ph': 'C', 'pid': PID_USER, 'tid': channel, 'ts': time,
+                        'name': name, 'args': {'value': value}})
+
+    # close whatever was still open when the dump was taken
+    if running is not None:
+        out.append({'ph': 'E', 'pid': PID_TASKS, 'tid': running, 'ts': last_time})
+    for irq in isr_stack:
+        out.append({'ph': 'E', 'pid': PID_ISR, 'tid': irq, 'ts': last_time})
+
+    return {'traceEvents': out, 'displayTimeUnit': 'ms'}
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+
+    with open(sys.argv[1], 'r', encoding='utf-8', errors='replace') as f:
+        tasks, queues, channels, events = parse_dump(f)
+
+    if not events:
+        print('no trace dump found in %s' % sys.argv[1])
+        sys.exit(1)
+
+    trace = convert(tasks, queues, channels, events)
+    output = sys.argv[2] if len(sys.argv) > 2 else 'trace.json'
+    with open(output, 'w') as f:
+        json.dump(trace, f)
+
+    print('%d events, %d tasks -> %s' % (len(events), len(tasks), output))
+
+
+if __name__ == '__main__':
+    main()